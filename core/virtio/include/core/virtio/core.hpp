@@ -285,6 +285,9 @@ async::result<void> scatterGather(DeviceToHostType, Chain &chain, Queue *queue,
 
 struct Request {
 	void (*complete)(Request *);
+	// Number of bytes that the device wrote to the descriptor chain.
+	// Only valid once complete() is called.
+	size_t written = 0;
 };
 
 // Represents a single virtq.
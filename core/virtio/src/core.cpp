@@ -1,5 +1,6 @@
 
 #include <assert.h>
+#include <algorithm>
 #include <iostream>
 #include <optional>
 
@@ -9,6 +10,12 @@
 
 namespace virtio_core {
 
+namespace {
+	// Upper bound for the number of MSI-X vectors that we use for virtqs.
+	// Virtqs are distributed round-robin over the vectors.
+	constexpr unsigned int maxQueueMsis = 16;
+}
+
 struct Mapping {
 	static constexpr size_t pageSize = 0x1000;
 
@@ -244,7 +251,8 @@ async::detached LegacyPciTransport::_processIrqs() {
 		}
 		if(isr & 1)
 			for(auto &queue : _queues)
-				queue->processInterrupt();
+				if(queue)
+					queue->processInterrupt();
 	}
 }
 
@@ -277,7 +285,7 @@ struct StandardPciTransport : Transport {
 			Mapping common_mapping, Mapping notify_mapping,
 			Mapping isr_mapping, Mapping device_mapping,
 			unsigned int notify_multiplier, helix::UniqueDescriptor irq,
-			helix::UniqueDescriptor queueMsi);
+			std::vector<helix::UniqueDescriptor> queueMsis);
 
 	protocols::hw::Device &hwDevice() override {
 		return _hwDevice;
@@ -303,7 +311,7 @@ private:
 	arch::mem_space _deviceSpace() { return arch::mem_space{_deviceMapping.get()}; }
 
 	async::detached _processIrqs();
-	async::detached _processQueueMsi();
+	async::detached _processQueueMsi(unsigned int vector);
 
 	protocols::hw::Device _hwDevice;
 	bool _useMsi;
@@ -313,7 +321,8 @@ private:
 	Mapping _deviceMapping;
 	unsigned int _notifyMultiplier;
 	helix::UniqueDescriptor _irq;
-	helix::UniqueDescriptor _queueMsi;
+	// Virtq i uses vector i % _queueMsis.size().
+	std::vector<helix::UniqueDescriptor> _queueMsis;
 
 
 	std::vector<std::unique_ptr<StandardPciQueue>> _queues;
@@ -338,13 +347,13 @@ StandardPciTransport::StandardPciTransport(protocols::hw::Device hw_device,
 		Mapping common_mapping, Mapping notify_mapping,
 		Mapping isr_mapping, Mapping device_mapping,
 		unsigned int notify_multiplier, helix::UniqueDescriptor irq,
-		helix::UniqueDescriptor queueMsi)
+		std::vector<helix::UniqueDescriptor> queueMsis)
 : _hwDevice{std::move(hw_device)},
 		_useMsi{useMsi},
 		_commonMapping{std::move(common_mapping)}, _notifyMapping{std::move(notify_mapping)},
 		_isrMapping{std::move(isr_mapping)}, _deviceMapping{std::move(device_mapping)},
 		_notifyMultiplier{notify_multiplier}, _irq{std::move(irq)},
-		_queueMsi{std::move(queueMsi)} { }
+		_queueMsis{std::move(queueMsis)} { }
 
 uint8_t StandardPciTransport::loadConfig8(size_t offset) {
 	return _deviceSpace().load(arch::scalar_register<uint8_t>(offset));
@@ -439,8 +448,9 @@ Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 
 	// Setup MSI-X.
 	if(_useMsi) {
-		_commonSpace().store(PCI_QUEUE_MSIX_VECTOR, 0);
-		if(_commonSpace().load(PCI_QUEUE_MSIX_VECTOR) != 0)
+		uint16_t vector = queue_index % _queueMsis.size();
+		_commonSpace().store(PCI_QUEUE_MSIX_VECTOR, vector);
+		if(_commonSpace().load(PCI_QUEUE_MSIX_VECTOR) != vector)
 			throw std::runtime_error("Device failed to allocate MSI-X interrupt");
 	}
 
@@ -454,7 +464,8 @@ void StandardPciTransport::runDevice() {
 	_commonSpace().store(PCI_DEVICE_STATUS, _commonSpace().load(PCI_DEVICE_STATUS) | DRIVER_OK);
 
 	if(_useMsi)
-		_processQueueMsi();
+		for(unsigned int i = 0; i < _queueMsis.size(); i++)
+			_processQueueMsi(i);
 	_processIrqs();
 }
 
@@ -525,7 +536,8 @@ async::detached StandardPciTransport::_processIrqs() {
 
 		if(await.bitset() & 1)
 			for(auto &queue : _queues)
-				queue->processInterrupt();
+				if(queue)
+					queue->processInterrupt();
 	}
 #else
 	co_await _hwDevice.enableBusIrq();
@@ -557,22 +569,25 @@ async::detached StandardPciTransport::_processIrqs() {
 
 		if(isr & 1)
 			for(auto &queue : _queues)
-				queue->processInterrupt();
+				if(queue)
+					queue->processInterrupt();
 	}
 #endif
 }
 
-async::detached StandardPciTransport::_processQueueMsi() {
+async::detached StandardPciTransport::_processQueueMsi(unsigned int vector) {
+	auto &msi = _queueMsis[vector];
 	uint64_t sequence = 0;
 	while(true) {
-		auto await = co_await helix_ng::awaitEvent(_queueMsi, sequence);
+		auto await = co_await helix_ng::awaitEvent(msi, sequence);
 		HEL_CHECK(await.error());
 		sequence = await.sequence();
 
-		HEL_CHECK(helAcknowledgeIrq(_queueMsi.getHandle(), kHelAckAcknowledge, sequence));
+		HEL_CHECK(helAcknowledgeIrq(msi.getHandle(), kHelAckAcknowledge, sequence));
 
-		for(auto &queue : _queues)
-			queue->processInterrupt();
+		for(size_t i = vector; i < _queues.size(); i += _queueMsis.size())
+			if(_queues[i])
+				_queues[i]->processInterrupt();
 	}
 }
 
@@ -642,12 +657,15 @@ discover(protocols::hw::Device hw_device, DiscoverMode mode) {
 			common_space.store(PCI_DEVICE_STATUS, 0);
 			assert(!common_space.load(PCI_DEVICE_STATUS));
 
-			helix::UniqueDescriptor queueMsi;
+			std::vector<helix::UniqueDescriptor> queueMsis;
 
-			// Enable MSI-X.
+			// Enable MSI-X. Devices with multiple virtqs (e.g., multi-queue NICs)
+			// get one vector per virtq, such that their IRQs can be handled independently.
 			if (info.numMsis) {
 				co_await hw_device.enableMsi();
-				queueMsi = co_await hw_device.installMsi(0);
+				auto numVectors = std::min(info.numMsis, maxQueueMsis);
+				for(unsigned int i = 0; i < numVectors; i++)
+					queueMsis.push_back(co_await hw_device.installMsi(i));
 			}
 
 			// Set the ACKNOWLEDGE and DRIVER bits.
@@ -662,7 +680,7 @@ discover(protocols::hw::Device hw_device, DiscoverMode mode) {
 					info.numMsis,
 					std::move(*common_mapping), std::move(*notify_mapping),
 					std::move(*isr_mapping), std::move(*device_mapping),
-					notify_multiplier, std::move(irq), std::move(queueMsi));
+					notify_multiplier, std::move(irq), std::move(queueMsis));
 		}
 	}
 
@@ -846,6 +864,7 @@ void Queue::processInterrupt() {
 		auto ring_index = _progressHead & (_queueSize - 1);
 		auto table_index = _usedRing->elements[ring_index].tableIndex.load();
 		assert(table_index < _queueSize);
+		auto written = _usedRing->elements[ring_index].written.load();
 
 		// Dequeue the Request object.
 		auto request = _activeRequests[table_index];
@@ -863,6 +882,7 @@ void Queue::processInterrupt() {
 		_descriptorDoorbell.raise();
 
 		// Call the completion handler.
+		request->written = written;
 		request->complete(request);
 
 		_progressHead++;
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <arch/bit.hpp>
 #include <helix/timer.hpp>
 
@@ -37,15 +39,19 @@ namespace flags {
 } // namespace flags
 
 Controller::Controller(int64_t parentId, protocols::hw::Device hwDevice, helix::Mapping hbaRegs,
-					   helix::UniqueDescriptor, helix::UniqueDescriptor irq)
+					   helix::UniqueDescriptor, std::vector<helix::UniqueDescriptor> irqs,
+					   bool useMsis)
 	: hwDevice_{std::move(hwDevice)}, regsMapping_{std::move(hbaRegs)},
-	  regs_{regsMapping_.get()}, irq_{std::move(irq)}, parentId_{parentId} {
+	  regs_{regsMapping_.get()}, irqs_{std::move(irqs)}, parentId_{parentId},
+	  useMsis_{useMsis} {
+	assert(!irqs_.empty());
 }
 
 async::detached Controller::run() {
 	co_await hwDevice_.enableBusIrq();
 
-	handleIrqs();
+	for (unsigned int i = 0; i < irqs_.size(); i++)
+		handleIrqs(i);
 
 	co_await reset();
 	co_await scanNamespaces();
@@ -54,23 +60,26 @@ async::detached Controller::run() {
 		ns->run();
 }
 
-async::detached Controller::handleIrqs() {
-	irqSequence_ = 0;
+async::detached Controller::handleIrqs(unsigned int vector) {
+	auto &irq = irqs_[vector];
+	uint64_t sequence = 0;
 
 	while (true) {
-		auto await = co_await helix_ng::awaitEvent(irq_, irqSequence_);
+		auto await = co_await helix_ng::awaitEvent(irq, sequence);
 		HEL_CHECK(await.error());
-		irqSequence_ = await.sequence();
+		sequence = await.sequence();
 
 		int found = 0;
 		for (auto &q : activeQueues_) {
-			found |= q->handleIrq();
+			if (irqVectorFor(q->getQueueId()) == vector)
+				found |= q->handleIrq();
 		}
 
-		if (found) {
-			HEL_CHECK(helAcknowledgeIrq(irq_.getHandle(), kHelAckAcknowledge, irqSequence_));
+		// MSIs are never shared, so we can always acknowledge them.
+		if (found || useMsis_) {
+			HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckAcknowledge, sequence));
 		} else {
-			HEL_CHECK(helAcknowledgeIrq(irq_.getHandle(), kHelAckNack, irqSequence_));
+			HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckNack, sequence));
 		}
 	}
 }
@@ -122,10 +131,18 @@ async::result<void> Controller::reset() {
 
 	co_await enable();
 
-	auto ioQ = std::make_unique<Queue>(1, queueDepth_, regs_.subspace(doorbellsOffset + 1 * 8 * dbStride_));
-	ioQ->init();
+	// Spread the I/O load over multiple queues. Each of them gets its own MSI-X vector
+	// as long as there are enough vectors; otherwise, vectors are shared.
+	auto numIoQueues = co_await setNumQueues(MAX_IO_QUEUES);
+
+	for (unsigned int qid = 1; qid <= numIoQueues; qid++) {
+		auto ioQ = std::make_unique<Queue>(qid, queueDepth_,
+				regs_.subspace(doorbellsOffset + qid * 8 * dbStride_));
+		ioQ->init();
+
+		if (!(co_await setupIoQueue(ioQ.get())))
+			break;
 
-	if (co_await setupIoQueue(ioQ.get())) {
 		ioQ->run();
 		activeQueues_.push_back(std::move(ioQ));
 	}
@@ -133,6 +150,30 @@ async::result<void> Controller::reset() {
 	assert(activeQueues_.size() >= 2 && "At least need one IO queue");
 }
 
+async::result<unsigned int> Controller::setNumQueues(unsigned int count) {
+	using arch::convert_endian;
+	using arch::endian;
+
+	auto &adminQ = activeQueues_.front();
+	auto cmd = std::make_unique<Command>();
+	auto &cmdBuf = cmd->getCommandBuffer().common;
+
+	// Both counts are zero-based.
+	cmdBuf.opcode = spec::kSetFeatures;
+	cmdBuf.cdw10 = convert_endian<endian::little, endian::native>((uint32_t)spec::kFeatureNumQueues);
+	cmdBuf.cdw11 = convert_endian<endian::little, endian::native>(((count - 1) << 16) | (count - 1));
+
+	auto res = co_await adminQ->submitCommand(std::move(cmd));
+	if (res.first != 0)
+		co_return 1;
+
+	// The controller may allocate a different number of queues than requested.
+	auto allocated = convert_endian<endian::little>(res.second.u32);
+	auto numSqs = (allocated & 0xFFFF) + 1;
+	auto numCqs = (allocated >> 16) + 1;
+	co_return std::min({count, numSqs, numCqs});
+}
+
 async::result<bool> Controller::setupIoQueue(Queue *q) {
 	auto cqRes = co_await createCQ(q);
 	if (cqRes.first != 0)
@@ -160,7 +201,7 @@ async::result<Command::Result> Controller::createCQ(Queue *q) {
 	cmdBuf.cqid = convert_endian<endian::little, endian::native>((uint16_t)q->getQueueId());
 	cmdBuf.qSize = convert_endian<endian::little, endian::native>((uint16_t)q->getQueueDepth() - 1);
 	cmdBuf.cqFlags = convert_endian<endian::little, endian::native>((uint16_t)flags);
-	cmdBuf.irqVector = 0; // TODO: set to MSI vector
+	cmdBuf.irqVector = convert_endian<endian::little, endian::native>((uint16_t)irqVectorFor(q->getQueueId()));
 
 	return adminQ->submitCommand(std::move(cmd));
 }
@@ -289,7 +330,12 @@ async::result<void> Controller::createNamespace(unsigned int nsid) {
 }
 
 async::result<Command::Result> Controller::submitIoCommand(std::unique_ptr<Command> cmd) {
-	auto &ioQ = activeQueues_.back();
+	// Submit to the I/O queue with the fewest outstanding commands.
+	auto ioQ = activeQueues_[1].get();
+	for (size_t i = 2; i < activeQueues_.size(); i++) {
+		if (activeQueues_[i]->numOutstanding() < ioQ->numOutstanding())
+			ioQ = activeQueues_[i].get();
+	}
 
 	return ioQ->submitCommand(std::move(cmd));
 }
@@ -9,8 +9,12 @@
 #include "namespace.hpp"
 
 struct Controller {
+	// Upper bound on the number of I/O queues (and thus MSI-X vectors) that we use.
+	static constexpr unsigned int MAX_IO_QUEUES = 8;
+
 	Controller(int64_t parentId, protocols::hw::Device hwDevice, helix::Mapping hbaRegs,
-			   helix::UniqueDescriptor ahciBar, helix::UniqueDescriptor irq);
+			   helix::UniqueDescriptor ahciBar, std::vector<helix::UniqueDescriptor> irqs,
+			   bool useMsis);
 
 	async::detached run();
 
@@ -25,8 +29,9 @@ private:
 	protocols::hw::Device hwDevice_;
 	helix::Mapping regsMapping_;
 	arch::mem_space regs_;
-	helix::UniqueDescriptor irq_;
+	std::vector<helix::UniqueDescriptor> irqs_;
 
+	// The admin queue is at index 0, followed by the I/O queues.
 	std::vector<std::unique_ptr<Queue>> activeQueues_;
 	std::vector<std::unique_ptr<Namespace>> activeNamespaces_;
 
@@ -34,8 +39,7 @@ private:
 	unsigned int queueDepth_;
 	uint32_t dbStride_;
 	uint32_t version_;
-
-	uint64_t irqSequence_;
+	bool useMsis_;
 
 	async::result<void> reset();
 	async::result<void> scanNamespaces();
@@ -44,6 +48,15 @@ private:
 	async::result<void> enable();
 	async::result<void> disable();
 
+	// The admin queue uses vector 0; I/O queues share the remaining vectors.
+	unsigned int irqVectorFor(unsigned int qid) const {
+		auto n = irqs_.size();
+		if (!qid || n == 1)
+			return 0;
+		return 1 + (qid - 1) % (n - 1);
+	}
+
+	async::result<unsigned int> setNumQueues(unsigned int count);
 	async::result<bool> setupIoQueue(Queue *q);
 	async::result<Command::Result> createCQ(Queue *q);
 	async::result<Command::Result> createSQ(Queue *q);
@@ -54,5 +67,5 @@ private:
 
 	async::result<void> createNamespace(unsigned int nsid);
 
-	async::detached handleIrqs();
+	async::detached handleIrqs(unsigned int vector);
 };
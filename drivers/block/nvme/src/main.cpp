@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 
 #include <protocols/mbus/client.hpp>
@@ -14,12 +15,22 @@ async::detached bindController(mbus::Entity entity) {
 	auto &barInfo = info.barInfo[0];
 	assert(barInfo.ioType == protocols::hw::IoType::kIoTypeMemory);
 	auto bar0 = co_await device.accessBar(0);
-	auto irq = co_await device.accessIrq();
+
+	std::vector<helix::UniqueDescriptor> irqs;
+	if (info.numMsis) {
+		// One vector for the admin queue and up to one vector per I/O queue.
+		auto numVectors = std::min(info.numMsis, Controller::MAX_IO_QUEUES + 1);
+		for (unsigned int i = 0; i < numVectors; i++)
+			irqs.push_back(co_await device.installMsi(i));
+		co_await device.enableMsi();
+	} else {
+		irqs.push_back(co_await device.accessIrq());
+	}
 
 	helix::Mapping mapping{bar0, barInfo.offset, barInfo.length};
 
 	auto controller = std::make_unique<Controller>(entity.getId(), std::move(device), std::move(mapping),
-			   std::move(bar0), std::move(irq));
+			   std::move(bar0), std::move(irqs), info.numMsis > 0);
 	controller->run();
 	globalControllers.push_back(std::move(controller));
 }
@@ -6,7 +6,8 @@
 #include "spec.hpp"
 
 Queue::Queue(unsigned int qid, unsigned int depth, arch::mem_space doorbells)
-	: qid_(qid), depth_(depth), doorbells_(doorbells), sqTail_(0), cqHead_(0), cqPhase_(1) {
+	: qid_(qid), depth_(depth), doorbells_(doorbells), sqTail_(0), cqHead_(0), cqPhase_(1),
+	  commandsInFlight_(0), outstanding_(0) {
 	queuedCmds_.resize(depth);
 }
 
@@ -119,6 +120,9 @@ async::result<void> Queue::submitCommandToDevice(std::unique_ptr<Command> cmd) {
 async::result<Command::Result> Queue::submitCommand(std::unique_ptr<Command> cmd) {
 	auto future = cmd->getFuture();
 
+	outstanding_++;
 	pendingCmdQueue_.put(std::move(cmd));
-	co_return *(co_await future.get());
+	auto result = *(co_await future.get());
+	outstanding_--;
+	co_return result;
 }
@@ -28,6 +28,11 @@ struct Queue {
 		return sqPhys_;
 	}
 
+	// Number of commands that were submitted but did not complete yet.
+	size_t numOutstanding() const {
+		return outstanding_;
+	}
+
 	async::result<Command::Result> submitCommand(std::unique_ptr<Command> cmd);
 
 	int handleIrq();
@@ -49,6 +54,7 @@ private:
 	std::vector<std::unique_ptr<Command>> queuedCmds_;
 	async::recurring_event freeSlotDoorbell_;
 	size_t commandsInFlight_;
+	size_t outstanding_;
 
 	async::result<size_t> findFreeSlot();
 	async::detached submitPendingLoop();
@@ -6,6 +6,7 @@
 
 #include <arch/mem_space.hpp>
 #include <async/result.hpp>
+#include <helix/clock.hpp>
 #include <protocols/hw/client.hpp>
 #include <protocols/mbus/client.hpp>
 
@@ -372,9 +373,9 @@ void Controller::programDpll(PllParams params, int multiplier) {
 	_ctrl.load(regs::pllControl);
 
 	uint64_t ticks, now;
-	HEL_CHECK(helGetClock(&ticks));
+	ticks = helix::currentNanos();
 	do {
-		HEL_CHECK(helGetClock(&now));
+		now = helix::currentNanos();
 	} while(now - ticks <= 150000);
 	
 	std::cout << "State: " << (_ctrl.load(regs::pllControl) & pll_control::enablePll)
@@ -391,9 +392,9 @@ void Controller::programDpll(PllParams params, int multiplier) {
 		_ctrl.load(regs::pllControl);
 
 		uint64_t ticks, now;
-		HEL_CHECK(helGetClock(&ticks));
+		ticks = helix::currentNanos();
 		do {
-			HEL_CHECK(helGetClock(&now));
+			now = helix::currentNanos();
 		} while(now - ticks <= 150000);
 	
 		std::cout << "State: " << (_ctrl.load(regs::pllControl) & pll_control::enablePll)
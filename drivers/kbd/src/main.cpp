@@ -12,6 +12,7 @@
 #include <arch/io_space.hpp>
 #include <async/result.hpp>
 #include <boost/intrusive/list.hpp>
+#include <helix/clock.hpp>
 #include <helix/ipc.hpp>
 #include <libevbackend.hpp>
 #include <protocols/mbus/client.hpp>
@@ -131,13 +132,13 @@ std::optional<uint8_t> Controller::recvResponseByte(uint64_t timeout) {
 	if (timeout) {
 		uint64_t start, end, current;
 
-		HEL_CHECK(helGetClock(&start));
+		start = helix::currentNanos();
 		end = start + timeout;
 		current = start;
 
 		while (!(_space.load(kbd_register::status) 
 				& status_bits::outBufferStatus) && current < end)
-			HEL_CHECK(helGetClock(&current));
+			current = helix::currentNanos();
 
 		bool cancelled = current >= end;
 
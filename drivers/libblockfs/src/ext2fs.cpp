@@ -4,6 +4,7 @@
 #include <string.h>
 #include <algorithm>
 #include <iostream>
+#include <limits>
 #include <sys/stat.h>
 
 #include <async/result.hpp>
@@ -22,6 +23,236 @@ namespace {
 
 	constexpr int pageShift = 12;
 	constexpr size_t pageSize = size_t{1} << pageShift;
+
+	FileType fileTypeFromDisk(uint8_t diskType) {
+		switch(diskType) {
+		case EXT2_FT_REG_FILE:
+			return kTypeRegular;
+		case EXT2_FT_DIR:
+			return kTypeDirectory;
+		case EXT2_FT_SYMLINK:
+			return kTypeSymlink;
+		default:
+			return kTypeNone;
+		}
+	}
+
+	// Locks the pages that back a byte range of a memory object.
+	async::result<helix::UniqueDescriptor> lockRange(HelHandle memory,
+			size_t offset, size_t length) {
+		auto misalign = offset & (pageSize - 1);
+		helix::LockMemoryView lockMemory;
+		auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(memory),
+				&lockMemory, offset - misalign,
+				(misalign + length + pageSize - 1) & ~(pageSize - 1),
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(lockMemory.error());
+		co_return lockMemory.descriptor();
+	}
+
+	// --------------------------------------------------------
+	// Directory hashes (compatible with Linux' fs/ext4/hash.c).
+	// --------------------------------------------------------
+
+	uint32_t rol32(uint32_t x, int s) {
+		return (x << s) | (x >> (32 - s));
+	}
+
+	template<typename Char>
+	uint32_t dxHackHash(const char *name, size_t length) {
+		uint32_t hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+		for(size_t i = 0; i < length; i++) {
+			uint32_t hash = hash1 + (hash0 ^ (static_cast<int>(static_cast<Char>(name[i]))
+					* 7152373));
+			if(hash & 0x80000000)
+				hash -= 0x7fffffff;
+			hash1 = hash0;
+			hash0 = hash;
+		}
+		return hash0 << 1;
+	}
+
+	template<typename Char>
+	void strToHashBuf(const char *msg, size_t length, uint32_t *buf, int num) {
+		uint32_t pad = static_cast<uint32_t>(length) | (static_cast<uint32_t>(length) << 8);
+		pad |= pad << 16;
+
+		uint32_t val = pad;
+		if(length > static_cast<size_t>(num) * 4)
+			length = num * 4;
+		for(size_t i = 0; i < length; i++) {
+			val = static_cast<int>(static_cast<Char>(msg[i])) + (val << 8);
+			if((i % 4) == 3) {
+				*buf++ = val;
+				val = pad;
+				num--;
+			}
+		}
+		if(--num >= 0)
+			*buf++ = val;
+		while(--num >= 0)
+			*buf++ = pad;
+	}
+
+	void halfMd4Transform(uint32_t buf[4], const uint32_t in[8]) {
+		auto f = [] (uint32_t x, uint32_t y, uint32_t z) { return z ^ (x & (y ^ z)); };
+		auto g = [] (uint32_t x, uint32_t y, uint32_t z) { return (x & y) + ((x ^ y) & z); };
+		auto h = [] (uint32_t x, uint32_t y, uint32_t z) { return x ^ y ^ z; };
+		constexpr uint32_t k2 = 013240474631UL;
+		constexpr uint32_t k3 = 015666365641UL;
+
+		uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+		auto round = [] (auto fn, uint32_t &a, uint32_t b, uint32_t c, uint32_t d,
+				uint32_t x, int s) {
+			a += fn(b, c, d) + x;
+			a = rol32(a, s);
+		};
+
+		round(f, a, b, c, d, in[0], 3);
+		round(f, d, a, b, c, in[1], 7);
+		round(f, c, d, a, b, in[2], 11);
+		round(f, b, c, d, a, in[3], 19);
+		round(f, a, b, c, d, in[4], 3);
+		round(f, d, a, b, c, in[5], 7);
+		round(f, c, d, a, b, in[6], 11);
+		round(f, b, c, d, a, in[7], 19);
+
+		round(g, a, b, c, d, in[1] + k2, 3);
+		round(g, d, a, b, c, in[3] + k2, 5);
+		round(g, c, d, a, b, in[5] + k2, 9);
+		round(g, b, c, d, a, in[7] + k2, 13);
+		round(g, a, b, c, d, in[0] + k2, 3);
+		round(g, d, a, b, c, in[2] + k2, 5);
+		round(g, c, d, a, b, in[4] + k2, 9);
+		round(g, b, c, d, a, in[6] + k2, 13);
+
+		round(h, a, b, c, d, in[3] + k3, 3);
+		round(h, d, a, b, c, in[7] + k3, 9);
+		round(h, c, d, a, b, in[2] + k3, 11);
+		round(h, b, c, d, a, in[6] + k3, 15);
+		round(h, a, b, c, d, in[1] + k3, 3);
+		round(h, d, a, b, c, in[5] + k3, 9);
+		round(h, c, d, a, b, in[0] + k3, 11);
+		round(h, b, c, d, a, in[4] + k3, 15);
+
+		buf[0] += a;
+		buf[1] += b;
+		buf[2] += c;
+		buf[3] += d;
+	}
+
+	void teaTransform(uint32_t buf[4], const uint32_t in[4]) {
+		uint32_t sum = 0;
+		uint32_t b0 = buf[0], b1 = buf[1];
+		uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+		for(int n = 0; n < 16; n++) {
+			sum += 0x9E3779B9;
+			b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+			b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+		}
+		buf[0] += b0;
+		buf[1] += b1;
+	}
+
+	// Returns std::nullopt if the hash version is not supported.
+	std::optional<uint32_t> dirHash(const std::string &name, int version, const uint32_t seed[4]) {
+		uint32_t buf[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+		if(seed[0] || seed[1] || seed[2] || seed[3])
+			memcpy(buf, seed, sizeof(buf));
+
+		uint32_t in[8];
+		uint32_t hash;
+		switch(version) {
+		case DX_HASH_LEGACY:
+			hash = dxHackHash<signed char>(name.data(), name.size());
+			break;
+		case DX_HASH_LEGACY_UNSIGNED:
+			hash = dxHackHash<unsigned char>(name.data(), name.size());
+			break;
+		case DX_HASH_HALF_MD4:
+		case DX_HASH_HALF_MD4_UNSIGNED:
+			for(size_t progress = 0; progress < name.size() || !progress; progress += 32) {
+				if(version == DX_HASH_HALF_MD4)
+					strToHashBuf<signed char>(name.data() + progress, name.size() - progress, in, 8);
+				else
+					strToHashBuf<unsigned char>(name.data() + progress, name.size() - progress, in, 8);
+				halfMd4Transform(buf, in);
+			}
+			hash = buf[1];
+			break;
+		case DX_HASH_TEA:
+		case DX_HASH_TEA_UNSIGNED:
+			for(size_t progress = 0; progress < name.size() || !progress; progress += 16) {
+				if(version == DX_HASH_TEA)
+					strToHashBuf<signed char>(name.data() + progress, name.size() - progress, in, 4);
+				else
+					strToHashBuf<unsigned char>(name.data() + progress, name.size() - progress, in, 4);
+				teaTransform(buf, in);
+			}
+			hash = buf[0];
+			break;
+		default:
+			return std::nullopt;
+		}
+
+		hash &= ~uint32_t{1};
+		// 0x7FFFFFFF << 1 is reserved as an end-of-directory marker.
+		if(hash == (0x7FFFFFFFu << 1))
+			hash = (0x7FFFFFFFu - 1) << 1;
+		return hash;
+	}
+
+	// --------------------------------------------------------
+	// Extent trees.
+	// --------------------------------------------------------
+
+	DiskExtentHeader *extentRoot(DiskInode *disk_inode) {
+		return reinterpret_cast<DiskExtentHeader *>(disk_inode->data.embedded);
+	}
+
+	DiskExtentIndex *extentIndices(DiskExtentHeader *header) {
+		return reinterpret_cast<DiskExtentIndex *>(header + 1);
+	}
+
+	DiskExtent *extentLeaves(DiskExtentHeader *header) {
+		return reinterpret_cast<DiskExtent *>(header + 1);
+	}
+
+	uint64_t indexChild(const DiskExtentIndex &entry) {
+		return entry.leafLo | (uint64_t(entry.leafHi) << 32);
+	}
+
+	uint64_t extentStart(const DiskExtent &extent) {
+		return extent.startLo | (uint64_t(extent.startHi) << 32);
+	}
+
+	size_t extentLength(const DiskExtent &extent) {
+		if(extent.length > EXT4_EXTENT_MAX_INIT_LENGTH)
+			return extent.length - EXT4_EXTENT_MAX_INIT_LENGTH;
+		return extent.length;
+	}
+
+	void initExtentRoot(DiskInode *disk_inode) {
+		disk_inode->flags |= EXT4_EXTENTS_FL;
+		auto header = extentRoot(disk_inode);
+		header->magic = EXT4_EXTENT_MAGIC;
+		header->entries = 0;
+		header->max = (sizeof(FileData) - sizeof(DiskExtentHeader)) / sizeof(DiskExtent);
+		header->depth = 0;
+		header->generation = 0;
+	}
+
+	// Returns the last entry that starts at or before index (or zero if there is none).
+	template<typename E>
+	size_t searchExtentNode(E *entries, size_t count, uint64_t index) {
+		auto it = std::upper_bound(entries, entries + count, index,
+				[] (uint64_t i, const E &entry) { return i < entry.block; });
+		if(it == entries)
+			return 0;
+		return it - entries - 1;
+	}
 }
 
 // --------------------------------------------------------
@@ -31,9 +262,16 @@ namespace {
 Inode::Inode(FileSystem &fs, uint32_t number)
 : fs(fs), number(number), isReady(false) { }
 
-void Inode::setFileSize(size_t size) {
-	assert(!(size & ~uint64_t(0xFFFFFFFF)));
-	diskInode()->size = size;
+void Inode::setFileSize(uint64_t size) {
+	auto disk_inode = diskInode();
+	if((disk_inode->mode & EXT2_S_IFMT) == EXT2_S_IFREG) {
+		// Files of 2 GiB or larger require the large_file feature.
+		assert(size < (uint64_t(1) << 31) || fs.haveLargeFiles);
+		disk_inode->sizeHigh = size >> 32;
+	}else{
+		assert(!(size & ~uint64_t(0xFFFFFFFF)));
+	}
+	disk_inode->size = size;
 }
 
 async::result<frg::expected<protocols::fs::Error, std::optional<DirEntry>>>
@@ -44,48 +282,196 @@ Inode::findEntry(std::string name) {
 		co_return protocols::fs::Error::notDirectory;
 	assert(fileMapping.size() == fileSize());
 
-	helix::LockMemoryView lock_memory;
-	auto map_size = (fileSize() + 0xFFF) & ~size_t(0xFFF);
-	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
-			&lock_memory,
-			0, map_size, helix::Dispatcher::global());
-	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
+	if(!entryIndex && fs.haveDirIndex && (diskInode()->flags & EXT2_INDEX_FL)) {
+		std::optional<DirEntry> entry;
+		if(co_await findHashedEntry(name, entry))
+			co_return entry;
+	}
 
-	// Read the directory structure.
-	uintptr_t offset = 0;
-	while(offset < fileSize()) {
-		assert(!(offset & 3));
-		assert(offset + sizeof(DiskDirEntry) <= fileSize());
-		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
-				reinterpret_cast<char *>(fileMapping.get()) + offset);
-		assert(disk_entry->recordLength);
+	if(!entryIndex) {
+		helix::LockMemoryView lock_memory;
+		auto map_size = (fileSize() + 0xFFF) & ~size_t(0xFFF);
+		auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
+				&lock_memory,
+				0, map_size, helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(lock_memory.error());
 
-		if(disk_entry->inode
-				&& name.length() == disk_entry->nameLength
-				&& !memcmp(disk_entry->name, name.data(), name.length())) {
-			DirEntry entry;
-			entry.inode = disk_entry->inode;
-
-			switch(disk_entry->fileType) {
-			case EXT2_FT_REG_FILE:
-				entry.fileType = kTypeRegular; break;
-			case EXT2_FT_DIR:
-				entry.fileType = kTypeDirectory; break;
-			case EXT2_FT_SYMLINK:
-				entry.fileType = kTypeSymlink; break;
-			default:
-				entry.fileType = kTypeNone;
+		// Read the directory structure and build the in-memory index.
+		std::unordered_map<std::string, DirEntry> index;
+		uintptr_t offset = 0;
+		while(offset < fileSize()) {
+			assert(!(offset & 3));
+			assert(offset + sizeof(DiskDirEntry) <= fileSize());
+			auto disk_entry = reinterpret_cast<DiskDirEntry *>(
+					reinterpret_cast<char *>(fileMapping.get()) + offset);
+			assert(disk_entry->recordLength);
+
+			if(disk_entry->inode) {
+				DirEntry entry;
+				entry.inode = disk_entry->inode;
+				entry.fileType = fileTypeFromDisk(disk_entry->fileType);
+				index.insert({std::string{disk_entry->name, disk_entry->nameLength}, entry});
 			}
 
-			co_return entry;
+			offset += disk_entry->recordLength;
 		}
+		assert(offset == fileSize());
 
-		offset += disk_entry->recordLength;
+		// Some other coroutine might have built the index while we were waiting.
+		if(!entryIndex)
+			entryIndex = std::move(index);
 	}
-	assert(offset == fileSize());
 
-	co_return std::nullopt;
+	auto it = entryIndex->find(name);
+	if(it == entryIndex->end())
+		co_return std::nullopt;
+	co_return it->second;
+}
+
+async::result<bool>
+Inode::findHashedEntry(const std::string &name, std::optional<DirEntry> &entry) {
+	auto dirBase = reinterpret_cast<char *>(fileMapping.get());
+	auto numBlocks = fileSize() >> fs.blockShift;
+	if(!numBlocks)
+		co_return false;
+
+	// Read the root of the tree.
+	auto rootLock = co_await lockRange(frontalMemory, 0, fs.blockSize);
+	// The root block contains "." (12 bytes) and ".." (spanning the rest of the block).
+	auto dotDotEntry = reinterpret_cast<DiskDirEntry *>(dirBase + 12);
+	if(dotDotEntry->recordLength != fs.blockSize - 12)
+		co_return false;
+	auto rootInfo = reinterpret_cast<DiskDxRootInfo *>(dirBase + 24);
+	if(rootInfo->reservedZero || rootInfo->infoLength != 8 || rootInfo->indirectLevels > 2)
+		co_return false;
+
+	int version = rootInfo->hashVersion;
+	if(fs.unsignedDirHash && version <= DX_HASH_TEA)
+		version += DX_HASH_LEGACY_UNSIGNED;
+	auto maybeHash = dirHash(name, version, fs.dirHashSeed);
+	if(!maybeHash)
+		co_return false;
+	auto hash = *maybeHash;
+
+	struct Level {
+		DiskDxEntry *entries;
+		unsigned int count;
+		unsigned int at;
+		helix::UniqueDescriptor lock;
+	};
+	std::vector<Level> path;
+
+	// Descends from the last node in path to the leaf level. In each new node,
+	// we binary search for the hash if search is true, otherwise we take the leftmost entry.
+	auto descend = [&] (bool search) -> async::result<bool> {
+		while(path.size() <= rootInfo->indirectLevels) {
+			char *node;
+			size_t offset;
+			helix::UniqueDescriptor lock;
+			if(path.empty()) {
+				node = dirBase;
+				offset = 24 + rootInfo->infoLength;
+			}else{
+				auto &parent = path.back();
+				uint32_t block = parent.entries[parent.at].block & 0x0FFFFFFF;
+				if(block >= numBlocks)
+					co_return false;
+				lock = co_await lockRange(frontalMemory, block << fs.blockShift, fs.blockSize);
+				node = dirBase + (block << fs.blockShift);
+				offset = sizeof(DiskDirEntry);
+			}
+
+			auto countLimit = reinterpret_cast<DiskDxCountLimit *>(node + offset);
+			auto entries = reinterpret_cast<DiskDxEntry *>(node + offset);
+			if(!countLimit->count || countLimit->count > countLimit->limit
+					|| offset + countLimit->limit * sizeof(DiskDxEntry) > fs.blockSize)
+				co_return false;
+
+			unsigned int at = 0;
+			if(search) {
+				// Find the last entry whose hash is <= the hash that we search for.
+				// Entry 0 has no hash; it covers all hashes below entry 1.
+				unsigned int lo = 1, hi = countLimit->count;
+				while(lo < hi) {
+					auto mid = lo + (hi - lo) / 2;
+					if(entries[mid].hash > hash) {
+						hi = mid;
+					}else{
+						lo = mid + 1;
+					}
+				}
+				at = lo - 1;
+			}
+			path.push_back({entries, countLimit->count, at, std::move(lock)});
+		}
+		co_return true;
+	};
+
+	if(!(co_await descend(true)))
+		co_return false;
+
+	while(true) {
+		// Scan the leaf block.
+		auto &leaf = path.back();
+		uint32_t block = leaf.entries[leaf.at].block & 0x0FFFFFFF;
+		if(block >= numBlocks)
+			co_return false;
+		auto leafLock = co_await lockRange(frontalMemory, block << fs.blockShift, fs.blockSize);
+
+		auto leafBase = dirBase + (block << fs.blockShift);
+		size_t offset = 0;
+		while(offset < fs.blockSize) {
+			auto diskEntry = reinterpret_cast<DiskDirEntry *>(leafBase + offset);
+			if(diskEntry->recordLength < sizeof(DiskDirEntry)
+					|| offset + diskEntry->recordLength > fs.blockSize)
+				co_return false;
+
+			if(diskEntry->inode
+					&& name.length() == diskEntry->nameLength
+					&& !memcmp(diskEntry->name, name.data(), name.length())) {
+				DirEntry result;
+				result.inode = diskEntry->inode;
+				result.fileType = fileTypeFromDisk(diskEntry->fileType);
+				entry = result;
+				co_return true;
+			}
+
+			offset += diskEntry->recordLength;
+		}
+
+		// Entries with colliding hashes may continue in the next leaf.
+		// In that case, the low bit of the next index entry's hash is set.
+		size_t depth = path.size();
+		while(depth && path[depth - 1].at + 1 >= path[depth - 1].count)
+			depth--;
+		if(!depth)
+			break;
+		auto &level = path[depth - 1];
+		level.at++;
+		if((level.entries[level.at].hash & ~uint32_t{1}) != hash)
+			break;
+
+		path.resize(depth);
+		if(!(co_await descend(false)))
+			co_return false;
+	}
+
+	entry = std::nullopt;
+	co_return true;
+}
+
+async::result<void> Inode::dropHashedIndex() {
+	if(!(diskInode()->flags & EXT2_INDEX_FL))
+		co_return;
+
+	// Interior nodes of the tree look like empty blocks to linear scans,
+	// hence the directory remains valid without the index.
+	diskInode()->flags &= ~EXT2_INDEX_FL;
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			diskMapping.get(), fs.inodeSize);
+	HEL_CHECK(syncInode.error());
 }
 
 async::result<std::optional<DirEntry>>
@@ -98,6 +484,8 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 	assert(fileType == kTypeDirectory);
 	assert(fileMapping.size() == fileSize());
 
+	co_await dropHashedIndex();
+
 	// Lock the mapping into memory before calling this function.
 	auto appendDirEntry = [&](size_t offset, size_t length)
 			-> async::result<std::optional<DirEntry>> {
@@ -142,6 +530,8 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 		DirEntry entry;
 		entry.inode = ino;
 		entry.fileType = type;
+		if(entryIndex)
+			(*entryIndex)[name] = entry;
 		co_return entry;
 	};
 
@@ -186,8 +576,9 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 	// If we made it this far, we ran out of space in the directory. Resize it.
 	auto blockOffset = (offset & ~(fs.blockSize - 1)) >> fs.blockShift;
 	auto newSize = (offset + fs.blockSize + 0xFFF) & ~size_t(0xFFF);
+	if(!(co_await fs.assignDataBlocks(this, blockOffset, 1)))
+		co_return std::nullopt;
 	setFileSize(newSize);
-	co_await fs.assignDataBlocks(this, blockOffset, 1);
 	HEL_CHECK(helResizeMemory(backingMemory, newSize));
 	fileMapping = helix::Mapping{helix::BorrowedDescriptor{frontalMemory},
 			0, newSize,
@@ -223,6 +614,8 @@ async::result<frg::expected<protocols::fs::Error>> Inode::unlink(std::string nam
 	co_await submit.async_wait();
 	HEL_CHECK(lock_memory.error());
 
+	co_await dropHashedIndex();
+
 	// Read the directory structure.
 	DiskDirEntry *previous_entry = nullptr;
 	uintptr_t offset = 0;
@@ -236,10 +629,16 @@ async::result<frg::expected<protocols::fs::Error>> Inode::unlink(std::string nam
 		if(disk_entry->inode
 				&& name.length() == disk_entry->nameLength
 				&& !memcmp(disk_entry->name, name.data(), name.length())) {
-			// The directory should start with "." and "..". As those entries are never deleted,
-			// we can assume that a previous entry exists.
-			assert(previous_entry);
-			previous_entry->recordLength += disk_entry->recordLength;
+			auto targetIno = disk_entry->inode;
+
+			// Entries cannot span blocks; hence we can only merge the entry into the
+			// previous one if both are in the same block. Otherwise, mark it as unused.
+			if(offset & (fs.blockSize - 1)) {
+				assert(previous_entry);
+				previous_entry->recordLength += disk_entry->recordLength;
+			}else{
+				disk_entry->inode = 0;
+			}
 
 			// Flush the data to disk.
 			// TODO: It would be enough to flush only one or two pages here.
@@ -248,7 +647,7 @@ async::result<frg::expected<protocols::fs::Error>> Inode::unlink(std::string nam
 			HEL_CHECK(syncDir.error());
 
 			// Decrement the inode's link count
-			auto target = fs.accessInode(disk_entry->inode);
+			auto target = fs.accessInode(targetIno);
 			co_await target->readyJump.wait();
 			target->diskInode()->linksCount--;
 			auto syncInode = co_await helix_ng::synchronizeSpace(
@@ -256,6 +655,8 @@ async::result<frg::expected<protocols::fs::Error>> Inode::unlink(std::string nam
 					target->diskMapping.get(), fs.inodeSize);
 			HEL_CHECK(syncInode.error());
 
+			if(entryIndex)
+				entryIndex->erase(name);
 			co_return {};
 		}
 
@@ -275,7 +676,9 @@ async::result<std::optional<DirEntry>> Inode::mkdir(std::string name) {
 	auto dirNode = co_await fs.createDirectory();
 	co_await dirNode->readyJump.wait();
 
-	co_await fs.assignDataBlocks(dirNode.get(), 0, 1);
+	// TODO: The new inode is leaked if this fails.
+	if(!(co_await fs.assignDataBlocks(dirNode.get(), 0, 1)))
+		co_return std::nullopt;
 
 	dirNode->setFileSize(fs.blockSize);
 	HEL_CHECK(helResizeMemory(dirNode->backingMemory,
@@ -420,6 +823,11 @@ async::result<void> FileSystem::init() {
 	blocksCount = sb.blocksCount;
 	inodesCount = sb.inodesCount;
 	numBlockGroups = (sb.blocksCount + (sb.blocksPerGroup - 1)) / sb.blocksPerGroup;
+	haveDirIndex = sb.featureCompat & EXT2_FEATURE_COMPAT_DIR_INDEX;
+	haveExtents = sb.featureIncompat & EXT4_FEATURE_INCOMPAT_EXTENTS;
+	haveLargeFiles = sb.featureRoCompat & EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+	unsignedDirHash = sb.flags & EXT2_FLAGS_UNSIGNED_HASH;
+	memcpy(dirHashSeed, sb.hashSeed, sizeof(dirHashSeed));
 
 	if(logSuperblock) {
 		std::cout << "ext2fs: Revision is: " << sb.revLevel << std::endl;
@@ -622,6 +1030,8 @@ async::result<std::shared_ptr<Inode>> FileSystem::createRegular() {
 	memset(disk_inode, 0, inodeSize);
 	disk_inode->mode = EXT2_S_IFREG;
 	disk_inode->generation = generation + 1;
+	if(haveExtents)
+		initExtentRoot(disk_inode);
 	struct timespec time;
 	// TODO: Move to CLOCK_REALTIME when supported
 	clock_gettime(CLOCK_MONOTONIC, &time);
@@ -656,6 +1066,8 @@ async::result<std::shared_ptr<Inode>> FileSystem::createDirectory() {
 	memset(disk_inode, 0, inodeSize);
 	disk_inode->mode = EXT2_S_IFDIR;
 	disk_inode->generation = generation + 1;
+	if(haveExtents)
+		initExtentRoot(disk_inode);
 	struct timespec time;
 	// TODO: Move to CLOCK_REALTIME when supported
 	clock_gettime(CLOCK_MONOTONIC, &time);
@@ -705,17 +1117,20 @@ async::result<std::shared_ptr<Inode>> FileSystem::createSymlink() {
 	co_return accessInode(ino);
 }
 
-async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
+async::result<frg::expected<protocols::fs::Error>> FileSystem::write(Inode *inode, uint64_t offset,
 		const void *buffer, size_t length) {
 	co_await inode->readyJump.wait();
 
 	// Make sure that data blocks are allocated.
 	auto blockOffset = (offset & ~(blockSize - 1)) >> blockShift;
 	auto blockCount = ((offset & (blockSize - 1)) + length + (blockSize - 1)) >> blockShift;
-	co_await assignDataBlocks(inode, blockOffset, blockCount);
+	auto assignResult = co_await assignDataBlocks(inode, blockOffset, blockCount);
+	if(!assignResult)
+		co_return assignResult;
 
 	// Resize the file if necessary.
 	if(offset + length > inode->fileSize()) {
+		co_await requireLargeFiles(inode, offset + length);
 		HEL_CHECK(helResizeMemory(inode->backingMemory,
 				(offset + length + 0xFFF) & ~size_t(0xFFF)));
 		inode->setFileSize(offset + length);
@@ -750,6 +1165,7 @@ async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
 			helix::BorrowedDescriptor(inode->frontalMemory),
 			offset, length, buffer);
 	HEL_CHECK(writeMemory.error());
+	co_return {};
 }
 
 async::detached FileSystem::initiateInode(std::shared_ptr<Inode> inode) {
@@ -969,6 +1385,43 @@ async::result<uint32_t> FileSystem::allocateBlock() {
 	co_return 0;
 }
 
+async::result<void> FileSystem::freeBlock(uint32_t block) {
+	assert(block && block < blocksCount);
+	auto bg_idx = block / blocksPerGroup;
+	auto bit = block % blocksPerGroup;
+
+	helix::LockMemoryView lock_bitmap;
+	auto &&submit_bitmap = helix::submitLockMemoryView(blockBitmap,
+			&lock_bitmap,
+			bg_idx << blockPagesShift, 1 << blockPagesShift,
+			helix::Dispatcher::global());
+	co_await submit_bitmap.async_wait();
+	HEL_CHECK(lock_bitmap.error());
+
+	helix::Mapping bitmap_map{blockBitmap,
+			bg_idx << blockPagesShift, size_t{1} << blockPagesShift,
+			kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+
+	auto words = reinterpret_cast<uint32_t *>(bitmap_map.get());
+	assert(words[bit / 32] & (static_cast<uint32_t>(1) << (bit % 32)));
+	words[bit / 32] &= ~(static_cast<uint32_t>(1) << (bit % 32));
+
+	bgdt[bg_idx].freeBlocksCount++;
+	co_await writebackBgdt();
+}
+
+async::result<void> FileSystem::zeroBlocks(uint64_t block, size_t count) {
+	constexpr size_t maxChunk = 64;
+	std::vector<std::byte> zeros(std::min(count, maxChunk) * blockSize);
+	size_t progress = 0;
+	while(progress < count) {
+		auto chunk = std::min(count - progress, maxChunk);
+		co_await device->writeSectors((block + progress) * sectorsPerBlock,
+				zeros.data(), chunk * sectorsPerBlock);
+		progress += chunk;
+	}
+}
+
 async::result<uint32_t> FileSystem::allocateInode() {
 	// TODO: Do not start at block group zero.
 	for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++) {
@@ -1012,7 +1465,331 @@ async::result<uint32_t> FileSystem::allocateInode() {
 	co_return 0;
 }
 
-async::result<void> FileSystem::assignDataBlocks(Inode *inode,
+async::result<FileSystem::ExtentRun> FileSystem::mapExtent(Inode *inode,
+		uint64_t index, size_t limit) {
+	// First logical block that is not covered by the subtree that we descend into.
+	uint64_t boundary = std::numeric_limits<uint64_t>::max();
+
+	std::vector<std::byte> buffer;
+	auto header = extentRoot(inode->diskInode());
+	while(true) {
+		assert(header->magic == EXT4_EXTENT_MAGIC);
+		if(!header->depth)
+			break;
+
+		auto indices = extentIndices(header);
+		assert(header->entries);
+		auto k = searchExtentNode(indices, header->entries, index);
+		if(k + 1 < header->entries)
+			boundary = std::min<uint64_t>(boundary, indices[k + 1].block);
+
+		auto child = indexChild(indices[k]);
+		buffer.resize(blockSize);
+		co_await device->readSectors(child * sectorsPerBlock, buffer.data(), sectorsPerBlock);
+		header = reinterpret_cast<DiskExtentHeader *>(buffer.data());
+	}
+
+	auto extents = extentLeaves(header);
+	if(header->entries) {
+		auto k = searchExtentNode(extents, header->entries, index);
+		auto &extent = extents[k];
+		auto length = extentLength(extent);
+		if(index >= extent.block && index < extent.block + length) {
+			auto skip = index - extent.block;
+			co_return ExtentRun{extentStart(extent) + skip,
+					std::min<size_t>(limit, length - skip),
+					extent.length > EXT4_EXTENT_MAX_INIT_LENGTH};
+		}
+
+		// The block is in a hole that ends at the next extent.
+		if(index < extent.block) {
+			boundary = std::min<uint64_t>(boundary, extent.block);
+		}else if(k + 1 < header->entries) {
+			boundary = std::min<uint64_t>(boundary, extents[k + 1].block);
+		}
+	}
+
+	co_return ExtentRun{0, static_cast<size_t>(std::min<uint64_t>(limit, boundary - index)), false};
+}
+
+async::result<frg::expected<protocols::fs::Error>> FileSystem::insertExtent(Inode *inode,
+		uint64_t index, uint64_t block, size_t count, bool uninitialized) {
+	auto disk_inode = inode->diskInode();
+	auto root = extentRoot(disk_inode);
+	assert(root->magic == EXT4_EXTENT_MAGIC);
+	if(uninitialized) {
+		assert(count && count < EXT4_EXTENT_MAX_INIT_LENGTH);
+	}else{
+		assert(count && count <= EXT4_EXTENT_MAX_INIT_LENGTH);
+	}
+
+	// Leaves and index nodes are split by the same code; this only works since
+	// both kinds of entries have the same size and start with the logical block.
+	static_assert(sizeof(DiskExtent) == sizeof(DiskExtentIndex));
+	constexpr size_t entrySize = sizeof(DiskExtent);
+	size_t maxPerBlock = (blockSize - sizeof(DiskExtentHeader)) / entrySize;
+
+	// Walk down to the leaf, remembering the nodes that we pass.
+	struct PathNode {
+		uint64_t block; // Zero for the root (which is stored in the inode).
+		std::vector<std::byte> buffer;
+		size_t slot; // Index entry that we followed.
+		bool dirty;
+	};
+
+	auto headerOf = [&] (PathNode &node) {
+		if(!node.block)
+			return root;
+		return reinterpret_cast<DiskExtentHeader *>(node.buffer.data());
+	};
+
+	auto entriesOf = [&] (PathNode &node) {
+		return reinterpret_cast<std::byte *>(headerOf(node) + 1);
+	};
+
+	std::vector<PathNode> path;
+	path.push_back({0, {}, 0, false});
+	while(headerOf(path.back())->depth) {
+		auto header = headerOf(path.back());
+		assert(header->entries);
+		auto indices = extentIndices(header);
+		auto slot = searchExtentNode(indices, header->entries, index);
+		path.back().slot = slot;
+
+		PathNode node{indexChild(indices[slot]), std::vector<std::byte>(blockSize), 0, false};
+		co_await device->readSectors(node.block * sectorsPerBlock,
+				node.buffer.data(), sectorsPerBlock);
+		assert(headerOf(node)->magic == EXT4_EXTENT_MAGIC);
+		path.push_back(std::move(node));
+	}
+
+	// Keeps the keys of the index entries above the given level up-to-date
+	// after key was inserted at the front of a node.
+	auto updateKeys = [&] (size_t level, uint64_t key) {
+		for(size_t i = level; i-- > 0; ) {
+			auto &entry = extentIndices(headerOf(path[i]))[path[i].slot];
+			if(entry.block <= key)
+				break;
+			entry.block = key;
+			path[i].dirty = true;
+		}
+	};
+
+	auto writeBack = [&] () -> async::result<void> {
+		// The root is written back together with the inode.
+		for(auto &node : path) {
+			if(!node.block || !node.dirty)
+				continue;
+			co_await device->writeSectors(node.block * sectorsPerBlock,
+					node.buffer.data(), sectorsPerBlock);
+		}
+	};
+
+	auto &leaf = path.back();
+	auto leafHeader = headerOf(leaf);
+	auto extents = extentLeaves(leafHeader);
+	size_t pos = 0;
+	if(leafHeader->entries) {
+		auto k = searchExtentNode(extents, leafHeader->entries, index);
+		auto &extent = extents[k];
+		if(extent.block <= index)
+			pos = k + 1;
+
+		// Grow the preceding extent if the new blocks directly follow it.
+		if(!uninitialized
+				&& extent.block <= index
+				&& extent.length + count <= EXT4_EXTENT_MAX_INIT_LENGTH
+				&& extent.block + extent.length == index
+				&& extentStart(extent) + extent.length == block) {
+			extent.length += count;
+			leaf.dirty = true;
+			co_await writeBack();
+			co_return {};
+		}
+	}
+
+	// Each full node on the way up to the root is split (or, for the root, moved)
+	// into a new block. Allocate all of them before the tree is modified.
+	std::vector<uint64_t> newBlocks;
+	for(size_t i = path.size(); i-- > 0; ) {
+		auto header = headerOf(path[i]);
+		if(header->entries < header->max)
+			break;
+		auto newBlock = co_await allocateBlock();
+		if(!newBlock) {
+			for(auto block : newBlocks)
+				co_await freeBlock(block);
+			co_return protocols::fs::Error::noSpaceLeft;
+		}
+		newBlocks.push_back(newBlock);
+	}
+
+	// Entry (with the given key) that we insert at position pos of the node at path[level].
+	std::byte pending[entrySize];
+	uint64_t key = index;
+	{
+		DiskExtent extent{};
+		extent.block = index;
+		extent.length = count + (uninitialized ? EXT4_EXTENT_MAX_INIT_LENGTH : 0);
+		extent.startHi = block >> 32;
+		extent.startLo = block;
+		memcpy(pending, &extent, entrySize);
+	}
+
+	size_t level = path.size() - 1;
+	while(true) {
+		auto header = headerOf(path[level]);
+		auto entries = entriesOf(path[level]);
+		size_t n = header->entries;
+
+		if(n < header->max) {
+			memmove(entries + (pos + 1) * entrySize, entries + pos * entrySize,
+					(n - pos) * entrySize);
+			memcpy(entries + pos * entrySize, pending, entrySize);
+			header->entries++;
+			path[level].dirty = true;
+			if(!pos)
+				updateKeys(level, key);
+			break;
+		}
+
+		assert(!newBlocks.empty());
+		uint64_t newBlock = newBlocks.back();
+		newBlocks.pop_back();
+		disk_inode->blocks += (blockSize / 512);
+
+		PathNode node{newBlock, std::vector<std::byte>(blockSize), 0, true};
+		auto newHeader = reinterpret_cast<DiskExtentHeader *>(node.buffer.data());
+		newHeader->magic = EXT4_EXTENT_MAGIC;
+		newHeader->max = maxPerBlock;
+		newHeader->depth = header->depth;
+		newHeader->generation = 0;
+
+		if(!level) {
+			// The root is full: move its entries into the new block and make that
+			// block the only child of the root. This increases the depth of the tree.
+			newHeader->entries = n;
+			memcpy(newHeader + 1, entries, n * entrySize);
+			node.slot = path[0].slot;
+
+			auto &entry = extentIndices(root)[0];
+			entry.block = reinterpret_cast<DiskExtentIndex *>(newHeader + 1)->block;
+			entry.leafLo = newBlock;
+			entry.leafHi = newBlock >> 32;
+			entry.unused = 0;
+			root->entries = 1;
+			root->depth++;
+			root->max = (sizeof(FileData) - sizeof(DiskExtentHeader)) / entrySize;
+			path[0].slot = 0;
+
+			// Retry the insertion in the new node.
+			path.insert(path.begin() + 1, std::move(node));
+			level = 1;
+			continue;
+		}
+
+		// Split the node: the upper half of the entries moves to the new sibling.
+		// If we append to the end of the node, only the new entry moves;
+		// this keeps the nodes full if a file is written sequentially.
+		std::vector<std::byte> merged((n + 1) * entrySize);
+		memcpy(merged.data(), entries, pos * entrySize);
+		memcpy(merged.data() + pos * entrySize, pending, entrySize);
+		memcpy(merged.data() + (pos + 1) * entrySize, entries + pos * entrySize,
+				(n - pos) * entrySize);
+
+		size_t keep = (pos == n) ? n : (n + 1) / 2;
+		memcpy(entries, merged.data(), keep * entrySize);
+		header->entries = keep;
+		memcpy(newHeader + 1, merged.data() + keep * entrySize, (n + 1 - keep) * entrySize);
+		newHeader->entries = n + 1 - keep;
+		path[level].dirty = true;
+		if(!pos)
+			updateKeys(level, key);
+
+		co_await device->writeSectors(newBlock * sectorsPerBlock,
+				node.buffer.data(), sectorsPerBlock);
+
+		// Insert an index entry for the sibling into the parent.
+		DiskExtentIndex entry{};
+		entry.block = reinterpret_cast<DiskExtentIndex *>(newHeader + 1)->block;
+		entry.leafLo = newBlock;
+		entry.leafHi = newBlock >> 32;
+		memcpy(pending, &entry, entrySize);
+		key = entry.block;
+		level--;
+		pos = path[level].slot + 1;
+	}
+	assert(newBlocks.empty());
+
+	co_await writeBack();
+	co_return {};
+}
+
+async::result<void> FileSystem::convertExtent(Inode *inode, uint64_t index, size_t count) {
+	// Find the leaf that contains the extent.
+	uint64_t leafBlock = 0; // Zero if the root is a leaf.
+	std::vector<std::byte> buffer;
+	auto header = extentRoot(inode->diskInode());
+	while(header->depth) {
+		auto indices = extentIndices(header);
+		assert(header->entries);
+		auto k = searchExtentNode(indices, header->entries, index);
+
+		leafBlock = indexChild(indices[k]);
+		buffer.resize(blockSize);
+		co_await device->readSectors(leafBlock * sectorsPerBlock, buffer.data(), sectorsPerBlock);
+		header = reinterpret_cast<DiskExtentHeader *>(buffer.data());
+		assert(header->magic == EXT4_EXTENT_MAGIC);
+	}
+
+	auto extents = extentLeaves(header);
+	assert(header->entries);
+	auto &extent = extents[searchExtentNode(extents, header->entries, index)];
+	auto first = extent.block;
+	auto start = extentStart(extent);
+	auto length = extentLength(extent);
+	assert(extent.length > EXT4_EXTENT_MAX_INIT_LENGTH);
+	assert(index >= first && index + count <= first + length);
+
+	// The extent is split into (up to) three parts: the uninitialized head,
+	// the initialized middle and the uninitialized tail. The head remains in place.
+	size_t head = index - first;
+	size_t tail = first + length - (index + count);
+	if(head) {
+		extent.length = head + EXT4_EXTENT_MAX_INIT_LENGTH;
+	}else{
+		extent.length = count;
+	}
+	// The root is written back together with the inode.
+	if(leafBlock)
+		co_await device->writeSectors(leafBlock * sectorsPerBlock, buffer.data(), sectorsPerBlock);
+
+	// If we run out of blocks to split the tree, we zero the uninitialized blocks instead
+	// and merge them into the initialized extent (which does not require new blocks).
+	if(head) {
+		auto result = co_await insertExtent(inode, index, start + head, count);
+		if(!result) {
+			// The tree is unchanged, i.e., extent still refers to the head.
+			co_await zeroBlocks(start, head);
+			extent.length = head;
+			if(leafBlock)
+				co_await device->writeSectors(leafBlock * sectorsPerBlock,
+						buffer.data(), sectorsPerBlock);
+			result = co_await insertExtent(inode, index, start + head, count);
+			assert(result);
+		}
+	}
+	if(tail) {
+		auto result = co_await insertExtent(inode, index + count, start + head + count, tail, true);
+		if(!result) {
+			co_await zeroBlocks(start + head + count, tail);
+			result = co_await insertExtent(inode, index + count, start + head + count, tail);
+			assert(result);
+		}
+	}
+}
+
+async::result<frg::expected<protocols::fs::Error>> FileSystem::assignDataBlocks(Inode *inode,
 		uint64_t block_offset, size_t num_blocks) {
 	size_t per_indirect = blockSize / 4;
 	size_t per_single = per_indirect;
@@ -1025,7 +1802,76 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 
 	auto disk_inode = inode->diskInode();
 
+	// Blocks that were assigned before we ran out of space remain assigned.
+	auto syncInode = [&] () -> async::result<void> {
+		auto sync = co_await helix_ng::synchronizeSpace(
+				helix::BorrowedDescriptor{kHelNullHandle},
+				inode->diskMapping.get(), inodeSize);
+		HEL_CHECK(sync.error());
+	};
+
+	// Maps n blocks starting at first to the given index; frees the blocks on failure.
+	auto insertOrFree = [&] (uint64_t index, uint64_t first, size_t n) -> async::result<bool> {
+		if(co_await insertExtent(inode, index, first, n))
+			co_return true;
+		for(size_t i = 0; i < n; i++)
+			co_await freeBlock(first + i);
+		disk_inode->blocks -= n * (blockSize / 512);
+		co_return false;
+	};
+
 	size_t prg = 0;
+	if(inode->usesExtents()) {
+		while(prg < num_blocks) {
+			auto run = co_await mapExtent(inode, block_offset + prg, num_blocks - prg);
+			if(run.block) {
+				prg += run.count;
+				continue;
+			}
+
+			// Fill the hole, inserting physically contiguous blocks as a single extent.
+			size_t filled = 0;
+			while(filled < run.count) {
+				auto first = co_await allocateBlock();
+				if(!first) {
+					co_await syncInode();
+					co_return protocols::fs::Error::noSpaceLeft;
+				}
+				disk_inode->blocks += (blockSize / 512);
+
+				size_t n = 1;
+				bool exhausted = false;
+				while(filled + n < run.count && n < EXT4_EXTENT_MAX_INIT_LENGTH) {
+					auto block = co_await allocateBlock();
+					if(!block) {
+						exhausted = true;
+						break;
+					}
+					disk_inode->blocks += (blockSize / 512);
+					if(block != first + n) {
+						if(!(co_await insertOrFree(block_offset + prg + filled, first, n))) {
+							co_await freeBlock(block);
+							disk_inode->blocks -= (blockSize / 512);
+							co_await syncInode();
+							co_return protocols::fs::Error::noSpaceLeft;
+						}
+						filled += n;
+						first = block;
+						n = 1;
+						continue;
+					}
+					n++;
+				}
+				if(!(co_await insertOrFree(block_offset + prg + filled, first, n)) || exhausted) {
+					co_await syncInode();
+					co_return protocols::fs::Error::noSpaceLeft;
+				}
+				filled += n;
+			}
+			prg += run.count;
+		}
+	}
+
 	while(prg < num_blocks) {
 		if(block_offset + prg < i_range) {
 			while(prg < num_blocks
@@ -1036,7 +1882,10 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 					continue;
 				}
 				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
+				if(!block) {
+					co_await syncInode();
+					co_return protocols::fs::Error::noSpaceLeft;
+				}
 				disk_inode->blocks += (blockSize / 512);
 				disk_inode->data.blocks.direct[idx] = block;
 				prg++;
@@ -1047,7 +1896,10 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 			// Allocate the single-indirect block itself.
 			if(!disk_inode->data.blocks.singleIndirect) {
 				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
+				if(!block) {
+					co_await syncInode();
+					co_return protocols::fs::Error::noSpaceLeft;
+				}
 				disk_inode->blocks += (blockSize / 512);
 				disk_inode->data.blocks.singleIndirect = block;
 				needsReset = true;
@@ -1076,7 +1928,10 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 					continue;
 				}
 				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
+				if(!block) {
+					co_await syncInode();
+					co_return protocols::fs::Error::noSpaceLeft;
+				}
 				disk_inode->blocks += (blockSize / 512);
 				window[idx] = block;
 				prg++;
@@ -1088,10 +1943,8 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 		}
 	}
 
-	auto syncInode = co_await helix_ng::synchronizeSpace(
-			helix::BorrowedDescriptor{kHelNullHandle},
-			inode->diskMapping.get(), inodeSize);
-	HEL_CHECK(syncInode.error());
+	co_await syncInode();
+	co_return {};
 }
 
 async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
@@ -1120,6 +1973,22 @@ async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 	co_await inode->readyJump.wait();
 	// TODO: Assert that we do not read past the EOF.
 
+	if(inode->usesExtents()) {
+		size_t progress = 0;
+		while(progress < num_blocks) {
+			auto run = co_await mapExtent(inode.get(), offset + progress, num_blocks - progress);
+			auto chunk = (uint8_t *)buffer + progress * blockSize;
+			if(run.block && !run.uninitialized) {
+				co_await device->readSectors(run.block * sectorsPerBlock,
+						chunk, run.count * sectorsPerBlock);
+			}else{
+				memset(chunk, 0, run.count * blockSize);
+			}
+			progress += run.count;
+		}
+		co_return;
+	}
+
 	constexpr size_t indirectBufferSize = 8;
 
 	std::array<uint32_t, indirectBufferSize> indirectBuffer;
@@ -1241,6 +2110,22 @@ async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
 	co_await inode->readyJump.wait();
 	// TODO: Assert that we do not write past the EOF.
 
+	if(inode->usesExtents()) {
+		size_t progress = 0;
+		while(progress < num_blocks) {
+			auto run = co_await mapExtent(inode.get(), offset + progress, num_blocks - progress);
+			assert(run.block);
+			co_await device->writeSectors(run.block * sectorsPerBlock,
+					(const uint8_t *)buffer + progress * blockSize,
+					run.count * sectorsPerBlock);
+			// Only mark the blocks as initialized once the data is on disk.
+			if(run.uninitialized)
+				co_await convertExtent(inode.get(), offset + progress, run.count);
+			progress += run.count;
+		}
+		co_return;
+	}
+
 	size_t progress = 0;
 	while(progress < num_blocks) {
 		// Block number and block count of the writeSectors() command that we will issue here.
@@ -1304,6 +2189,7 @@ async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
 
 
 async::result<void> FileSystem::truncate(Inode *inode, size_t size) {
+	co_await requireLargeFiles(inode, size);
 	HEL_CHECK(helResizeMemory(inode->backingMemory,
 			(size + 0xFFF) & ~size_t(0xFFF)));
 	inode->setFileSize(size);
@@ -1314,6 +2200,25 @@ async::result<void> FileSystem::truncate(Inode *inode, size_t size) {
 	co_return;
 }
 
+async::result<void> FileSystem::requireLargeFiles(Inode *inode, uint64_t size) {
+	if(haveLargeFiles || size < (uint64_t(1) << 31)
+			|| (inode->diskInode()->mode & EXT2_S_IFMT) != EXT2_S_IFREG)
+		co_return;
+
+	// Like Linux, we only update the primary superblock; e2fsck updates the backups.
+	std::vector<uint8_t> buffer(1024);
+	co_await device->readSectors(2, buffer.data(), 2);
+
+	DiskSuperblock sb;
+	memcpy(&sb, buffer.data(), sizeof(DiskSuperblock));
+	assert(sb.magic == 0xEF53);
+	sb.featureRoCompat |= EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+	memcpy(buffer.data(), &sb, sizeof(DiskSuperblock));
+
+	co_await device->writeSectors(2, buffer.data(), 2);
+	haveLargeFiles = true;
+}
+
 async::result<void> FileSystem::writebackBgdt() {
 	auto bgdt_offset = (2048 + blockSize - 1) & ~size_t(blockSize - 1);
 	co_await device->writeSectors((bgdt_offset >> blockShift) * sectorsPerBlock,
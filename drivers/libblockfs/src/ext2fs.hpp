@@ -93,7 +93,16 @@ struct DiskSuperblock {
 	//-- Other options --
 	uint32_t defaultMountOptions;
 	uint32_t firstMetaBg;
-	uint8_t unused[760];
+	uint32_t mkfsTime;
+	uint32_t jnlBlocks[17];
+	//-- 64bit Support --
+	uint32_t blocksCountHi;
+	uint32_t rBlocksCountHi;
+	uint32_t freeBlocksCountHi;
+	uint16_t minExtraIsize;
+	uint16_t wantExtraIsize;
+	uint32_t flags;
+	uint8_t unused[668];
 };
 static_assert(sizeof(DiskSuperblock) == 1024, "Bad DiskSuperblock struct size");
 
@@ -125,7 +134,7 @@ struct DiskInode {
 	FileData data;
 	uint32_t generation;
 	uint32_t fileAcl;
-	uint32_t dirAcl;
+	uint32_t sizeHigh; // Called dirAcl in revision 0 file systems.
 	uint32_t faddr;
 	uint8_t osd2[12];
 };
@@ -135,6 +144,28 @@ enum {
 	EXT2_ROOT_INO = 2
 };
 
+enum {
+	EXT2_FEATURE_COMPAT_DIR_INDEX = 0x20
+};
+
+// Superblock flags.
+enum {
+	EXT2_FLAGS_SIGNED_HASH = 0x1,
+	EXT2_FLAGS_UNSIGNED_HASH = 0x2
+};
+
+// Feature flags.
+enum {
+	EXT2_FEATURE_RO_COMPAT_LARGE_FILE = 0x2,
+	EXT4_FEATURE_INCOMPAT_EXTENTS = 0x40
+};
+
+// Inode flags.
+enum {
+	EXT2_INDEX_FL = 0x1000,
+	EXT4_EXTENTS_FL = 0x80000
+};
+
 enum {
 	EXT2_S_IFMT = 0xF000,
 	EXT2_S_IFLNK = 0xA000,
@@ -156,6 +187,76 @@ enum {
 	EXT2_FT_SYMLINK = 7
 };
 
+// Structures of hashed (htree) directories.
+// The root block starts with the "." and ".." entries, followed by DiskDxRootInfo.
+// Interior nodes start with a fake DiskDirEntry that spans the whole block.
+// Both are followed by an array of DiskDxEntry; the first entry overlaps DiskDxCountLimit.
+
+struct DiskDxRootInfo {
+	uint32_t reservedZero;
+	uint8_t hashVersion;
+	uint8_t infoLength;
+	uint8_t indirectLevels;
+	uint8_t unusedFlags;
+};
+static_assert(sizeof(DiskDxRootInfo) == 8, "Bad DiskDxRootInfo struct size");
+
+struct DiskDxCountLimit {
+	uint16_t limit;
+	uint16_t count;
+};
+
+struct DiskDxEntry {
+	uint32_t hash;
+	uint32_t block;
+};
+static_assert(sizeof(DiskDxEntry) == 8, "Bad DiskDxEntry struct size");
+
+enum {
+	DX_HASH_LEGACY = 0,
+	DX_HASH_HALF_MD4 = 1,
+	DX_HASH_TEA = 2,
+	DX_HASH_LEGACY_UNSIGNED = 3,
+	DX_HASH_HALF_MD4_UNSIGNED = 4,
+	DX_HASH_TEA_UNSIGNED = 5
+};
+
+// Structures of extent trees (ext4).
+// Each node consists of a DiskExtentHeader followed by an array of either
+// DiskExtentIndex (interior nodes) or DiskExtent (leaves), sorted by logical block.
+// The root node is stored in FileData; other nodes occupy a full block.
+
+struct DiskExtentHeader {
+	uint16_t magic;
+	uint16_t entries;
+	uint16_t max;
+	uint16_t depth;
+	uint32_t generation;
+};
+static_assert(sizeof(DiskExtentHeader) == 12, "Bad DiskExtentHeader struct size");
+
+struct DiskExtentIndex {
+	uint32_t block;
+	uint32_t leafLo;
+	uint16_t leafHi;
+	uint16_t unused;
+};
+static_assert(sizeof(DiskExtentIndex) == 12, "Bad DiskExtentIndex struct size");
+
+struct DiskExtent {
+	uint32_t block;
+	uint16_t length;
+	uint16_t startHi;
+	uint32_t startLo;
+};
+static_assert(sizeof(DiskExtent) == 12, "Bad DiskExtent struct size");
+
+enum {
+	EXT4_EXTENT_MAGIC = 0xF30A,
+	// Extents longer than this are uninitialized (i.e., they read as zeros).
+	EXT4_EXTENT_MAX_INIT_LENGTH = 32768
+};
+
 // --------------------------------------------------------
 // DirEntry
 // --------------------------------------------------------
@@ -180,7 +281,14 @@ struct Inode : std::enable_shared_from_this<Inode> {
 
 	// Returns the size of the file in bytes.
 	uint64_t fileSize() {
-		return diskInode()->size;
+		auto disk_inode = diskInode();
+		if((disk_inode->mode & EXT2_S_IFMT) == EXT2_S_IFREG)
+			return disk_inode->size | (uint64_t(disk_inode->sizeHigh) << 32);
+		return disk_inode->size;
+	}
+
+	bool usesExtents() {
+		return diskInode()->flags & EXT4_EXTENTS_FL;
 	}
 
 	void setFileSize(uint64_t size);
@@ -188,6 +296,13 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	async::result<frg::expected<protocols::fs::Error, std::optional<DirEntry>>>
 	findEntry(std::string name);
 
+	// Looks up an entry using the on-disk htree index.
+	// Returns false if the index cannot be used (e.g., unsupported hash or corruption).
+	async::result<bool> findHashedEntry(const std::string &name, std::optional<DirEntry> &entry);
+
+	// Clears the htree flag (as we do not maintain the index on modifications).
+	async::result<void> dropHashedIndex();
+
 	async::result<std::optional<DirEntry>> link(std::string name, int64_t ino, blockfs::FileType type);
 	async::result<frg::expected<protocols::fs::Error>> unlink(std::string name);
 	async::result<std::optional<DirEntry>> mkdir(std::string name);
@@ -235,6 +350,10 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	FlockManager flockManager;
 
 	std::unordered_set<std::string> obstructedLinks;
+
+	// In-memory index of directory entries (directories only).
+	// Built lazily by findEntry() and maintained by link() and unlink().
+	std::optional<std::unordered_map<std::string, DirEntry>> entryIndex;
 };
 
 // --------------------------------------------------------
@@ -256,7 +375,7 @@ struct FileSystem {
 	async::result<std::shared_ptr<Inode>> createDirectory();
 	async::result<std::shared_ptr<Inode>> createSymlink();
 
-	async::result<void> write(Inode *inode, uint64_t offset,
+	async::result<frg::expected<protocols::fs::Error>> write(Inode *inode, uint64_t offset,
 			const void *buffer, size_t length);
 
 	async::detached initiateInode(std::shared_ptr<Inode> inode);
@@ -265,11 +384,36 @@ struct FileSystem {
 			helix::UniqueDescriptor memory);
 
 	async::result<uint32_t> allocateBlock();
+	async::result<void> freeBlock(uint32_t block);
 	async::result<uint32_t> allocateInode();
 
-	async::result<void> assignDataBlocks(Inode *inode,
+	// Writes zeros to count consecutive blocks on disk.
+	async::result<void> zeroBlocks(uint64_t block, size_t count);
+
+	// Fails with noSpaceLeft if not all blocks could be allocated.
+	async::result<frg::expected<protocols::fs::Error>> assignDataBlocks(Inode *inode,
 			uint64_t block_offset, size_t num_blocks);
 
+	// A run of logically consecutive blocks that are also physically consecutive.
+	struct ExtentRun {
+		uint64_t block; // Zero for holes.
+		size_t count;
+		bool uninitialized;
+	};
+
+	// Looks up the extent that maps the given logical block (for inodes with EXT4_EXTENTS_FL).
+	// The returned run is clipped to at most limit blocks.
+	async::result<ExtentRun> mapExtent(Inode *inode, uint64_t index, size_t limit);
+
+	// Maps count logical blocks (that are currently unmapped) to consecutive physical blocks.
+	// Grows the preceding extent if possible. Splits full nodes of the extent tree.
+	// Fails with noSpaceLeft (without modifying the tree) if a split runs out of blocks.
+	async::result<frg::expected<protocols::fs::Error>> insertExtent(Inode *inode, uint64_t index, uint64_t block, size_t count,
+			bool uninitialized = false);
+
+	// Marks count blocks of an uninitialized extent as initialized (after they were written).
+	async::result<void> convertExtent(Inode *inode, uint64_t index, size_t count);
+
 	async::result<void> readDataBlocks(std::shared_ptr<Inode> inode, uint64_t block_offset,
 			size_t num_blocks, void *buffer);
 	async::result<void> writeDataBlocks(std::shared_ptr<Inode> inode, uint64_t block_offset,
@@ -277,6 +421,9 @@ struct FileSystem {
 
 	async::result<void> truncate(Inode *inode, size_t size);
 
+	// Sets the large_file feature in the superblock before a regular file reaches 2 GiB.
+	async::result<void> requireLargeFiles(Inode *inode, uint64_t size);
+
 	async::result<void> writebackBgdt();
 
 	BlockDevice *device;
@@ -290,6 +437,11 @@ struct FileSystem {
 	uint32_t inodesPerGroup;
 	uint32_t blocksCount;
 	uint32_t inodesCount;
+	bool haveDirIndex;
+	bool haveExtents;
+	bool haveLargeFiles;
+	bool unsignedDirHash;
+	uint32_t dirHashSeed[4];
 	std::vector<std::byte> blockGroupDescriptorBuffer;
 	DiskGroupDesc *bgdt;
 
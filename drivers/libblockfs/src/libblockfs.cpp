@@ -15,6 +15,7 @@
 #include "gpt.hpp"
 #include "ext2fs.hpp"
 #include "raw.hpp"
+#include "scheduler.hpp"
 #include "fs.bragi.hpp"
 #include <bragi/helpers-std.hpp>
 
@@ -164,7 +165,9 @@ async::result<frg::expected<protocols::fs::Error, size_t>> write(void *object, c
 	}
 
 	auto self = static_cast<ext2fs::OpenFile *>(object);
-	co_await self->inode->fs.write(self->inode.get(), self->offset, buffer, length);
+	auto result = co_await self->inode->fs.write(self->inode.get(), self->offset, buffer, length);
+	if(!result)
+		co_return result.error();
 	self->offset += length;
 	co_return length;
 }
@@ -176,7 +179,9 @@ async::result<frg::expected<protocols::fs::Error, size_t>> pwrite(void *object,
 	}
 
 	auto self = static_cast<ext2fs::OpenFile *>(object);
-	co_await self->inode->fs.write(self->inode.get(), offset, buffer, length);
+	auto result = co_await self->inode->fs.write(self->inode.get(), offset, buffer, length);
+	if(!result)
+		co_return result.error();
 	co_return length;
 }
 
@@ -757,7 +762,10 @@ async::detached runDevice(BlockDevice *device) {
 	ostByteCounter = co_await ostContext.announceItem("numBytes");
 	ostTimeCounter = co_await ostContext.announceItem("time");
 
-	table = new gpt::Table(device);
+	// All file systems on the device share one scheduler in front of the driver.
+	auto scheduler = new IoScheduler(device);
+
+	table = new gpt::Table(scheduler);
 	co_await table->parse();
 
 	int64_t diskId = 0;
@@ -0,0 +1,182 @@
+#include <string.h>
+#include <iostream>
+#include <memory>
+#include <new>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "scheduler.hpp"
+
+namespace blockfs {
+
+namespace {
+	constexpr bool logIoScheduler = false;
+
+	// Number of commands between two statistics dumps.
+	constexpr uint64_t statsInterval = 4096;
+
+	// Alignment of bounce buffers for non-contiguous merged requests.
+	constexpr size_t bounceAlignment = 4096;
+}
+
+// --------------------------------------------------------
+// IoScheduler
+// --------------------------------------------------------
+
+IoScheduler::IoScheduler(BlockDevice *device)
+: BlockDevice(device->sectorSize, device->parentId), _device(device) { }
+
+async::result<void> IoScheduler::readSectors(uint64_t sector, void *buffer,
+		size_t num_sectors) {
+	return _submit(false, sector, buffer, num_sectors);
+}
+
+async::result<void> IoScheduler::writeSectors(uint64_t sector, const void *buffer,
+		size_t num_sectors) {
+	return _submit(true, sector, const_cast<void *>(buffer), num_sectors);
+}
+
+async::result<size_t> IoScheduler::getSize() {
+	return _device->getSize();
+}
+
+void IoScheduler::dumpStats() {
+	std::cout << "libblockfs: " << _numRequests << " requests in "
+			<< _numCommands << " commands (merge ratio: "
+			<< (_numCommands ? static_cast<double>(_numRequests) / _numCommands : 0.0)
+			<< ")" << std::endl;
+	std::cout << "libblockfs: Queue latency histogram (us):";
+	for(size_t i = 0; i < numLatencyBuckets; i++) {
+		if(!_queueLatencies[i])
+			continue;
+		std::cout << " <" << (uint64_t{1} << i) << ": " << _queueLatencies[i];
+	}
+	std::cout << std::endl;
+}
+
+async::result<void> IoScheduler::_submit(bool write, uint64_t sector, void *buffer,
+		size_t num_sectors) {
+	Request req;
+	req.write = write;
+	req.sector = sector;
+	req.numSectors = num_sectors;
+	req.buffer = buffer;
+	HEL_CHECK(helGetClock(&req.enqueueTime));
+
+	_pending.emplace(sector, &req);
+	_numRequests++;
+	_dispatch();
+
+	co_await req.done.wait();
+	if(req.error)
+		std::rethrow_exception(req.error);
+}
+
+void IoScheduler::_dispatch() {
+	while(_inFlight < maxInFlight && !_pending.empty()) {
+		// Serve requests in ascending LBA order, wrapping around at the end (C-SCAN).
+		auto it = _pending.lower_bound(_headSector);
+		if(it == _pending.end())
+			it = _pending.begin();
+
+		std::vector<Request *> batch{it->second};
+		auto write = it->second->write;
+		auto end = it->second->sector + it->second->numSectors;
+		auto bytes = it->second->numSectors * sectorSize;
+		it = _pending.erase(it);
+
+		// Merge requests that directly follow the batch.
+		while(it != _pending.end()) {
+			auto req = it->second;
+			if(req->sector != end || req->write != write
+					|| bytes + req->numSectors * sectorSize > maxMergeBytes)
+				break;
+			batch.push_back(req);
+			end += req->numSectors;
+			bytes += req->numSectors * sectorSize;
+			it = _pending.erase(it);
+		}
+
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		for(auto req : batch) {
+			auto us = (now - req->enqueueTime) / 1000;
+			size_t bucket = 0;
+			while(us && bucket + 1 < numLatencyBuckets) {
+				us >>= 1;
+				bucket++;
+			}
+			_queueLatencies[bucket]++;
+		}
+
+		_headSector = end;
+		_inFlight++;
+		_numCommands++;
+		if(logIoScheduler && !(_numCommands % statsInterval))
+			dumpStats();
+
+		_issue(std::move(batch));
+	}
+}
+
+async::detached IoScheduler::_issue(std::vector<Request *> batch) {
+	auto first = batch.front();
+
+	// Merged requests can be issued directly if their buffers are also contiguous.
+	size_t numSectors = 0;
+	bool contiguous = true;
+	for(auto req : batch) {
+		if(static_cast<char *>(req->buffer)
+				!= static_cast<char *>(first->buffer) + numSectors * sectorSize)
+			contiguous = false;
+		numSectors += req->numSectors;
+	}
+
+	std::exception_ptr error;
+	try {
+		if(contiguous) {
+			if(first->write) {
+				co_await _device->writeSectors(first->sector, first->buffer, numSectors);
+			}else{
+				co_await _device->readSectors(first->sector, first->buffer, numSectors);
+			}
+		}else{
+			// Drivers require (at least) sector aligned DMA buffers.
+			auto freeBounce = [] (char *p) {
+				operator delete(p, std::align_val_t{bounceAlignment});
+			};
+			std::unique_ptr<char, decltype(freeBounce)> bounce{static_cast<char *>(
+					operator new(numSectors * sectorSize, std::align_val_t{bounceAlignment})),
+					freeBounce};
+			if(first->write) {
+				size_t offset = 0;
+				for(auto req : batch) {
+					memcpy(bounce.get() + offset, req->buffer, req->numSectors * sectorSize);
+					offset += req->numSectors * sectorSize;
+				}
+				co_await _device->writeSectors(first->sector, bounce.get(), numSectors);
+			}else{
+				co_await _device->readSectors(first->sector, bounce.get(), numSectors);
+				size_t offset = 0;
+				for(auto req : batch) {
+					memcpy(req->buffer, bounce.get() + offset, req->numSectors * sectorSize);
+					offset += req->numSectors * sectorSize;
+				}
+			}
+		}
+	}catch(...) {
+		error = std::current_exception();
+	}
+
+	// Keep the driver busy before we resume the submitters.
+	_inFlight--;
+	_dispatch();
+
+	for(auto req : batch) {
+		req->error = error;
+		req->done.raise();
+	}
+}
+
+} // namespace blockfs
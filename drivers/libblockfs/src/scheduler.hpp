@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <exception>
+#include <map>
+#include <vector>
+
+#include <async/oneshot-event.hpp>
+#include <async/result.hpp>
+#include <blockfs.hpp>
+
+namespace blockfs {
+
+// --------------------------------------------------------
+// IoScheduler
+// --------------------------------------------------------
+
+// Sits between the file systems and a block device driver.
+// Bounds the number of commands that are in flight at the driver. Requests that arrive
+// while the driver is saturated are queued, sorted by LBA and adjacent requests
+// of the same direction are merged into a single driver command.
+struct IoScheduler : BlockDevice {
+	// Maximal number of driver commands that are in flight at the same time.
+	static constexpr size_t maxInFlight = 16;
+	// Requests are not merged beyond this size.
+	static constexpr size_t maxMergeBytes = 512 * 1024;
+	// Bucket i of the latency histogram counts latencies in [2^(i-1), 2^i) microseconds.
+	static constexpr size_t numLatencyBuckets = 20;
+
+	IoScheduler(BlockDevice *device);
+
+	async::result<void> readSectors(uint64_t sector, void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> writeSectors(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+	async::result<size_t> getSize() override;
+
+	// Number of requests submitted to the scheduler.
+	uint64_t numRequests() {
+		return _numRequests;
+	}
+
+	// Number of commands issued to the driver.
+	uint64_t numCommands() {
+		return _numCommands;
+	}
+
+	// Histogram of the time that requests spend in the queue before they are issued.
+	const std::array<uint64_t, numLatencyBuckets> &queueLatencies() {
+		return _queueLatencies;
+	}
+
+	void dumpStats();
+
+private:
+	struct Request {
+		bool write;
+		uint64_t sector;
+		size_t numSectors;
+		void *buffer;
+		uint64_t enqueueTime;
+		std::exception_ptr error;
+		async::oneshot_event done;
+	};
+
+	async::result<void> _submit(bool write, uint64_t sector, void *buffer,
+			size_t num_sectors);
+
+	void _dispatch();
+
+	async::detached _issue(std::vector<Request *> batch);
+
+	BlockDevice *_device;
+
+	// Pending requests, ordered by their first sector.
+	std::multimap<uint64_t, Request *> _pending;
+	// Sector following the last command that we issued.
+	uint64_t _headSector = 0;
+	size_t _inFlight = 0;
+
+	uint64_t _numRequests = 0;
+	uint64_t _numCommands = 0;
+	std::array<uint64_t, numLatencyBuckets> _queueLatencies{};
+};
+
+} // namespace blockfs
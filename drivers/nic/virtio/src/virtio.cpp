@@ -1,18 +1,58 @@
 #include <nic/virtio/virtio.hpp>
 
+#include <algorithm>
+#include <deque>
+#include <optional>
+
 #include <arch/dma_pool.hpp>
+#include <async/recurring-event.hpp>
 #include <core/virtio/core.hpp>
 
 namespace {
+constexpr bool logFrames = false;
+
 // Device feature bits.
 constexpr size_t legacyHeaderSize = 10;
+
+// Each receive buffer holds the virtio header followed by a maximally sized frame.
+constexpr size_t rxBufferSize = legacyHeaderSize + 1514;
+// Upper bound for the number of receive buffers that are posted to each receive virtq.
+constexpr size_t maxRxBuffers = 128;
+// Upper bound for the number of queue pairs that we use on multi-queue devices.
+constexpr size_t maxQueuePairs = 4;
+
+enum {
+	VIRTIO_NET_F_CSUM = 0,
+	VIRTIO_NET_F_GUEST_CSUM = 1,
+	VIRTIO_NET_F_MAC = 5,
+	VIRTIO_NET_F_HOST_TSO4 = 11,
+	VIRTIO_NET_F_CTRL_VQ = 17,
+	VIRTIO_NET_F_MQ = 22
+};
+
+// Offset of max_virtqueue_pairs in the device configuration space.
+constexpr size_t configMaxQueuePairs = 8;
+
+// Commands on the control virtq.
+enum {
+	VIRTIO_NET_CTRL_MQ = 4,
+	VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET = 0
+};
+
 enum {
-	VIRTIO_NET_F_MAC = 5
+	VIRTIO_NET_OK = 0,
+	VIRTIO_NET_ERR = 1
+};
+
+struct CtrlHeader {
+	uint8_t cls;
+	uint8_t command;
 };
 
 // Bits for VirtHeader::flags.
 enum {
-	VIRTIO_NET_HDR_F_NEEDS_CSUM = 1
+	VIRTIO_NET_HDR_F_NEEDS_CSUM = 1,
+	VIRTIO_NET_HDR_F_DATA_VALID = 2
 };
 
 // Values for VirtHeader::gsoType.
@@ -37,19 +77,56 @@ struct VirtHeader {
 struct VirtioNic : nic::Link {
 	VirtioNic(std::unique_ptr<virtio_core::Transport> transport);
 
-	virtual async::result<void> receive(arch::dma_buffer_view) override;
-	virtual async::result<void> send(const arch::dma_buffer_view) override;
+	virtual async::result<ReceivedFrame> receive(size_t queue) override;
+	virtual async::result<void> send(const arch::dma_buffer_view,
+			std::optional<ChecksumOffload> checksum) override;
+	virtual async::result<void> sendSegmented(const arch::dma_buffer_view,
+			ChecksumOffload checksum, SegmentationOffload segmentation) override;
 
 	virtual ~VirtioNic() override = default;
 private:
+	struct QueuePair;
+
+	// A receive buffer that is owned by the device until it completes.
+	struct RxRequest : virtio_core::Request {
+		QueuePair *pair;
+		arch::dma_buffer buffer;
+	};
+
+	// Receive virtq i is paired with transmit virtq i. The device steers received
+	// frames to the pair that the flow was last transmitted on.
+	struct QueuePair {
+		virtio_core::Queue *receiveVq;
+		virtio_core::Queue *transmitVq;
+
+		std::vector<std::unique_ptr<RxRequest>> rxRequests;
+		// Completed receive buffers that were not consumed by receive() yet.
+		std::deque<RxRequest *> rxCompleted;
+		async::recurring_event rxDoorbell;
+	};
+
+	async::result<void> postRxBuffer_(RxRequest *request);
+	async::detached fillRxRing_(QueuePair *pair);
+	async::detached enableMultiqueue_();
+	async::result<void> transmit_(const VirtHeader &header,
+			const arch::dma_buffer_view payload);
+
 	std::unique_ptr<virtio_core::Transport> transport_;
 	arch::contiguous_pool dmaPool_;
-	virtio_core::Queue *receiveVq_;
-	virtio_core::Queue *transmitVq_;
+	nic::BufferPool rxPool_;
+	// Whether the device validates the checksums of received packets.
+	bool guestChecksum_ = false;
+
+	std::vector<std::unique_ptr<QueuePair>> pairs_;
+	// Only the first pair may be used for transmission until the device
+	// acknowledged the number of pairs.
+	size_t activePairs_ = 1;
+	virtio_core::Queue *controlVq_ = nullptr;
 };
 
 VirtioNic::VirtioNic(std::unique_ptr<virtio_core::Transport> transport)
-	: nic::Link(1500, &dmaPool_), transport_ { std::move(transport) }
+	: nic::Link(1500, &dmaPool_), transport_ { std::move(transport) },
+	rxPool_ { &dmaPool_, rxBufferSize }
 {
 	if(transport_->checkDeviceFeature(VIRTIO_NET_F_MAC)) {
 		for (int i = 0; i < 6; i++) {
@@ -64,47 +141,198 @@ VirtioNic::VirtioNic(std::unique_ptr<virtio_core::Transport> transport)
 		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_MAC);
 	}
 
+	if(transport_->checkDeviceFeature(VIRTIO_NET_F_CSUM)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_CSUM);
+		txChecksumOffload = true;
+
+		// TSO requires checksum offload.
+		if(transport_->checkDeviceFeature(VIRTIO_NET_F_HOST_TSO4)) {
+			transport_->acknowledgeDriverFeature(VIRTIO_NET_F_HOST_TSO4);
+			txSegmentationOffload = true;
+		}
+	}
+	if(transport_->checkDeviceFeature(VIRTIO_NET_F_GUEST_CSUM)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_GUEST_CSUM);
+		guestChecksum_ = true;
+	}
+
+	// Multi-queue operation is configured through the control virtq.
+	size_t maxPairs = 1;
+	if(transport_->checkDeviceFeature(VIRTIO_NET_F_CTRL_VQ)
+			&& transport_->checkDeviceFeature(VIRTIO_NET_F_MQ)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_CTRL_VQ);
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_MQ);
+		maxPairs = std::max(transport_->loadConfig16(configMaxQueuePairs), uint16_t{1});
+	}
+	auto numPairs = std::min(maxPairs, maxQueuePairs);
+
 	transport_->finalizeFeatures();
-	transport_->claimQueues(2);
-	receiveVq_ = transport_->setupQueue(0);
-	transmitVq_ = transport_->setupQueue(1);
+	if(maxPairs > 1) {
+		// The control virtq follows the last possible queue pair.
+		transport_->claimQueues(2 * maxPairs + 1);
+	}else{
+		transport_->claimQueues(2);
+	}
+	for(size_t i = 0; i < numPairs; i++) {
+		auto pair = std::make_unique<QueuePair>();
+		pair->receiveVq = transport_->setupQueue(2 * i);
+		pair->transmitVq = transport_->setupQueue(2 * i + 1);
+		pairs_.push_back(std::move(pair));
+	}
+	if(maxPairs > 1)
+		controlVq_ = transport_->setupQueue(2 * maxPairs);
+	numQueues = numPairs;
 
 	transport_->runDevice();
+
+	for(auto &pair : pairs_)
+		fillRxRing_(pair.get());
+	if(numPairs > 1)
+		enableMultiqueue_();
 }
 
-async::result<void> VirtioNic::receive(arch::dma_buffer_view frame) {
-	arch::dma_object<VirtHeader> header { &dmaPool_ };
+async::result<void> VirtioNic::postRxBuffer_(RxRequest *request) {
+	request->buffer = arch::dma_buffer { &rxPool_, rxBufferSize };
 
+	// The header and the frame share a buffer but legacy devices
+	// require them to be in separate descriptors.
+	auto receiveVq = request->pair->receiveVq;
 	virtio_core::Chain chain;
-	chain.append(co_await receiveVq_->obtainDescriptor());
+	chain.append(co_await receiveVq->obtainDescriptor());
 	chain.setupBuffer(virtio_core::deviceToHost,
-			header.view_buffer().subview(0, legacyHeaderSize));
-	chain.append(co_await receiveVq_->obtainDescriptor());
-	chain.setupBuffer(virtio_core::deviceToHost, frame);
+			request->buffer.subview(0, legacyHeaderSize));
+	chain.append(co_await receiveVq->obtainDescriptor());
+	chain.setupBuffer(virtio_core::deviceToHost,
+			request->buffer.subview(legacyHeaderSize));
+
+	receiveVq->postDescriptor(chain.front(), request,
+			[] (virtio_core::Request *base) {
+		auto request = static_cast<RxRequest *>(base);
+		request->pair->rxCompleted.push_back(request);
+		request->pair->rxDoorbell.raise();
+	});
+}
+
+async::detached VirtioNic::fillRxRing_(QueuePair *pair) {
+	// Each buffer takes up two descriptors.
+	auto numBuffers = std::min(pair->receiveVq->numDescriptors() / 2, maxRxBuffers);
+	for (size_t i = 0; i < numBuffers; i++) {
+		auto request = std::make_unique<RxRequest>();
+		request->pair = pair;
+		co_await postRxBuffer_(request.get());
+		pair->rxRequests.push_back(std::move(request));
+	}
+	pair->receiveVq->notify();
+}
+
+async::detached VirtioNic::enableMultiqueue_() {
+	arch::dma_object<CtrlHeader> header { &dmaPool_ };
+	header.data()->cls = VIRTIO_NET_CTRL_MQ;
+	header.data()->command = VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET;
+	arch::dma_object<uint16_t> numPairs { &dmaPool_ };
+	*numPairs.data() = pairs_.size();
+	arch::dma_object<uint8_t> ack { &dmaPool_ };
+	*ack.data() = VIRTIO_NET_ERR;
+
+	virtio_core::Chain chain;
+	chain.append(co_await controlVq_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::hostToDevice, header.view_buffer());
+	chain.append(co_await controlVq_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::hostToDevice, numPairs.view_buffer());
+	chain.append(co_await controlVq_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::deviceToHost, ack.view_buffer());
+	co_await controlVq_->submitDescriptor(chain.front());
+
+	if(*ack.data() != VIRTIO_NET_OK) {
+		std::cout << "virtio-driver: Device refused to use " << pairs_.size()
+				<< " queue pairs" << std::endl;
+		co_return;
+	}
+	std::cout << "virtio-driver: Using " << pairs_.size() << " queue pairs" << std::endl;
+	activePairs_ = pairs_.size();
+}
+
+async::result<nic::Link::ReceivedFrame> VirtioNic::receive(size_t queue) {
+	auto pair = pairs_[queue].get();
+	while (pair->rxCompleted.empty())
+		co_await pair->rxDoorbell.async_wait();
+	auto request = pair->rxCompleted.front();
+	pair->rxCompleted.pop_front();
 
-	co_await receiveVq_->submitDescriptor(chain.front());
+	ReceivedFrame received;
+	received.buffer = std::move(request->buffer);
+	auto written = std::max(request->written, legacyHeaderSize);
+	received.frame = received.buffer.subview(legacyHeaderSize,
+			std::min(written, rxBufferSize) - legacyHeaderSize);
+
+	// NEEDS_CSUM is only set for packets from the same host, their
+	// checksum is never checked on the wire; we can trust them as well.
+	if (guestChecksum_) {
+		auto flags = static_cast<uint8_t *>(received.buffer.data())[0];
+		if (flags & (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM))
+			received.checksumVerified = true;
+	}
 
-	co_return;
+	// Hand a fresh buffer to the device before we return this one to the stack.
+	co_await postRxBuffer_(request);
+	pair->receiveVq->notify();
+
+	co_return received;
 }
 
-async::result<void> VirtioNic::send(const arch::dma_buffer_view payload) {
+async::result<void> VirtioNic::send(const arch::dma_buffer_view payload,
+		std::optional<ChecksumOffload> checksum) {
 	if (payload.size() > 1514) {
 		throw std::runtime_error("data exceeds mtu");
 	}
 
-	arch::dma_object<VirtHeader> header { &dmaPool_ };
-	memset(header.data(), 0, sizeof(VirtHeader));
+	VirtHeader header{};
+	if (checksum) {
+		header.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+		header.csumStart = checksum->start;
+		header.csumOffset = checksum->offset;
+	}
+	co_await transmit_(header, payload);
+}
+
+async::result<void> VirtioNic::sendSegmented(const arch::dma_buffer_view payload,
+		ChecksumOffload checksum, SegmentationOffload segmentation) {
+	if (!txSegmentationOffload) {
+		co_await nic::Link::sendSegmented(payload, checksum, segmentation);
+		co_return;
+	}
+
+	VirtHeader header{};
+	header.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+	header.gsoType = VIRTIO_NET_HDR_GSO_TCPV4;
+	header.hdrLen = segmentation.headerSize;
+	header.gsoSize = segmentation.segmentSize;
+	header.csumStart = checksum.start;
+	header.csumOffset = checksum.offset;
+	co_await transmit_(header, payload);
+}
+
+async::result<void> VirtioNic::transmit_(const VirtHeader &header,
+		const arch::dma_buffer_view payload) {
+	arch::dma_object<VirtHeader> headerObject { &dmaPool_ };
+	memcpy(headerObject.data(), &header, sizeof(VirtHeader));
+
+	// Keep each flow on a single queue pair; this also determines
+	// the receive virtq that the device steers the flow to.
+	auto transmitVq = pairs_[nic::flowHash(payload) % activePairs_]->transmitVq;
 
 	virtio_core::Chain chain;
-	chain.append(co_await transmitVq_->obtainDescriptor());
+	chain.append(co_await transmitVq->obtainDescriptor());
 	chain.setupBuffer(virtio_core::hostToDevice,
-			header.view_buffer().subview(0, legacyHeaderSize));
-	chain.append(co_await transmitVq_->obtainDescriptor());
-	chain.setupBuffer(virtio_core::hostToDevice, payload);
+			headerObject.view_buffer().subview(0, legacyHeaderSize));
+	// Super-segments span multiple pages.
+	co_await virtio_core::scatterGather(virtio_core::hostToDevice, chain,
+			transmitVq, payload);
 
-	std::cout << "virtio-driver: sending frame" << std::endl;
-	co_await transmitVq_->submitDescriptor(chain.front());
-	std::cout << "virtio-driver: sent frame" << std::endl;
+	if (logFrames)
+		std::cout << "virtio-driver: sending frame (" << payload.size()
+				<< " bytes)" << std::endl;
+	co_await transmitVq->submitDescriptor(chain.front());
 }
 } // namespace
 
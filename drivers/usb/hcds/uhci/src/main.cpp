@@ -16,6 +16,7 @@
 #include <async/result.hpp>
 #include <boost/intrusive/list.hpp>
 #include <fafnir/dsl.hpp>
+#include <helix/clock.hpp>
 #include <helix/ipc.hpp>
 #include <protocols/hw/client.hpp>
 #include <protocols/kernlet/compiler.hpp>
@@ -670,15 +671,13 @@ Controller::RootHub::issueReset(int port, bool *low_speed) {
 	// Enable the port and wait until it is available.
 	port_space.store(port_regs::statusCtrl, port_status_ctrl::enableStatus(true));
 
-	uint64_t start;
-	HEL_CHECK(helGetClock(&start));
+	auto start = helix::currentNanos();
 	while(true) {
 		auto sc = port_space.load(port_regs::statusCtrl);
 		if((sc & port_status_ctrl::enableStatus))
 			break;
 	
-		uint64_t now;
-		HEL_CHECK(helGetClock(&now));
+		auto now = helix::currentNanos();
 		if(now - start > 1000'000'000) {
 			std::cout << "\e[31muhci: Could not enable device after reset\e[39m" << std::endl;
 			co_return false;
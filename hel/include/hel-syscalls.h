@@ -268,6 +268,11 @@ extern inline __attribute__ (( always_inline )) HelError helLoadahead(HelHandle
 	return helSyscall3(kHelCallLoadahead, (HelWord)handle, (HelWord)offset, (HelWord)length);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helQueryMemoryStats(
+		struct HelMemoryStats *stats) {
+	return helSyscall1(kHelCallQueryMemoryStats, (HelWord)stats);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCreateThread(HelHandle universe,
 		HelHandle address_space, HelAbi abi, void *ip, void *sp, uint32_t flags,
 		HelHandle *handle) {
@@ -331,6 +336,13 @@ extern inline __attribute__ (( always_inline )) HelError helGetClock(uint64_t *c
 	return error;
 };
 
+extern inline __attribute__ (( always_inline )) HelError helAccessClockPage(HelHandle *handle) {
+	HelWord handle_word;
+	HelError error = helSyscall0_1(kHelCallAccessClockPage, &handle_word);
+	*handle = (HelHandle)handle_word;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitAwaitClock(uint64_t counter,
 		HelHandle queue, uintptr_t context, uint64_t *async_id) {
 	HelWord async_word;
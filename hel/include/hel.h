@@ -16,7 +16,7 @@
 
 enum {
 	// largest system call number plus 1
-	kHelNumCalls = 103,
+	kHelNumCalls = 105,
 
 	kHelCallLog = 1,
 	kHelCallPanic = 10,
@@ -55,6 +55,7 @@ enum {
 	kHelCallUpdateMemory = 47,
 	kHelCallSubmitLockMemoryView = 48,
 	kHelCallLoadahead = 49,
+	kHelCallQueryMemoryStats = 104,
 	kHelCallCreateVirtualizedSpace = 50,
 
 	kHelCallCreateThread = 67,
@@ -70,6 +71,7 @@ enum {
 	kHelCallQueryRegisterInfo = 102,
 	kHelCallWriteFsBase = 41,
 	kHelCallGetClock = 42,
+	kHelCallAccessClockPage = 103,
 	kHelCallSubmitAwaitClock = 80,
 	kHelCallCreateVirtualizedCpu = 37,
 	kHelCallRunVirtualizedCpu = 38,
@@ -242,6 +244,9 @@ struct HelDescriptorInfo {
 enum HelAllocFlags {
 	kHelAllocContinuous = 4,
 	kHelAllocOnDemand = 1,
+	//! Allocate physical memory in 2 MiB chunks such that mappings can use huge pages.
+	//! The size (also when resizing) needs to be a multiple of 2 MiB.
+	kHelAllocHugePages = 8,
 };
 
 struct HelAllocRestrictions {
@@ -265,6 +270,28 @@ enum HelMapFlags {
 	kHelMapDontRequireBacking = 128
 };
 
+enum HelClockSource {
+	//! The clock cannot be read from user space; use ::helGetClock instead.
+	kHelClockSourceNone = 0,
+	//! The clock is derived from the x86 TSC.
+	kHelClockSourceTsc = 1
+};
+
+//! Layout of the clock page (see ::helAccessClockPage).
+//!
+//! The clock is computed as refNanos + (((counter - refCounter) * multiplier) >> shift)
+//! where the product is evaluated with 128-bit precision.
+//! seqlock is odd while the kernel updates the page; readers need to retry
+//! if seqlock is odd or if it changes while they read the page.
+struct HelClockPage {
+	uint64_t seqlock;
+	uint32_t source;
+	uint32_t shift;
+	uint64_t multiplier;
+	uint64_t refCounter;
+	uint64_t refNanos;
+};
+
 enum HelThreadFlags {
 	kHelThreadStopped = 1
 };
@@ -530,6 +557,25 @@ struct HelThreadStats {
 	uint64_t userTime;
 };
 
+struct HelMemoryStats {
+	//! Total amount of physical memory (in bytes).
+	uint64_t totalMemory;
+	//! Amount of physical memory that is not in use (in bytes).
+	uint64_t freeMemory;
+	//! Amount of managed memory that was modified but not yet written back (in bytes).
+	uint64_t dirtyMemory;
+	//! Amount of managed memory that is currently being written back (in bytes).
+	uint64_t writebackMemory;
+	//! Number of writeback requests that were sent to pagers.
+	uint64_t numWritebackRequests;
+	//! Number of writes that were throttled since too much memory was dirty.
+	uint64_t numThrottledWrites;
+	//! Number of 4 KiB pages that were mapped into address spaces.
+	uint64_t numSmallPageMappings;
+	//! Number of 2 MiB pages that were mapped into address spaces.
+	uint64_t numHugePageMappings;
+};
+
 enum {
   khelVmexitHlt = 0,
   khelVmexitTranslationFault = 1,
@@ -841,6 +887,11 @@ HEL_C_LINKAGE HelError helSubmitLockMemoryView(HelHandle handle, uintptr_t offse
 //!     Length of the memory range that is preloaded.
 HEL_C_LINKAGE HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length);
 
+//! Query system-wide statistics about physical and managed memory.
+//! @param[out] stats
+//!     Statistics related to memory usage and writeback.
+HEL_C_LINKAGE HelError helQueryMemoryStats(struct HelMemoryStats *stats);
+
 HEL_C_LINKAGE HelError helCreateVirtualizedSpace(HelHandle *handle);
 
 //! @}
@@ -947,6 +998,14 @@ HEL_C_LINKAGE HelError helWriteFsBase(void *pointer);
 //!     Current value of the system-wide clock in nanoseconds since boot.
 HEL_C_LINKAGE HelError helGetClock(uint64_t *counter);
 
+//! Obtain a memory object that contains the clock page (see ::HelClockPage).
+//!
+//! The clock page allows user space to read the system-wide monotone clock
+//! without entering the kernel. It must only be mapped read-only.
+//! @param[out] handle
+//!     Handle to the memory object (one page in size).
+HEL_C_LINKAGE HelError helAccessClockPage(HelHandle *handle);
+
 //! Wait until time passes.
 //!
 //! This is an asynchronous operation.
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace helix {
+
+// Reads the system-wide monotone clock (in nanoseconds, see helGetClock()).
+// Reads the kernel's clock page if possible and only falls back to a syscall
+// if the clock cannot be computed in user space.
+uint64_t currentNanos();
+
+} // namespace helix
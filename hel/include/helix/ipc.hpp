@@ -211,7 +211,10 @@ public:
 		return _handle;
 	}
 
+	// Blocks until at least one element is available, then completes all elements
+	// that are already available without blocking again.
 	void wait() {
+		bool anyCompleted = false;
 		while(true) {
 			// TODO: Initialize all chunks when setting up the queue.
 			if(_retrieveIndex == _nextIndex) {
@@ -243,7 +246,12 @@ public:
 			}
 
 			bool done;
-			_waitProgressFutex(&done);
+			if(anyCompleted) {
+				if(!_pollProgressFutex(&done))
+					return;
+			}else{
+				_waitProgressFutex(&done);
+			}
 			if(done) {
 				_surrender(_numberOf(_retrieveIndex));
 
@@ -261,7 +269,7 @@ public:
 			_refCounts[_numberOf(_retrieveIndex)]++;
 			context->complete(ElementHandle{this, _numberOf(_retrieveIndex),
 					ptr + sizeof(HelElement)});
-			return;
+			anyCompleted = true;
 		}
 	}
 
@@ -303,6 +311,20 @@ private:
 		}
 	}
 
+	// Like _waitProgressFutex() but returns false instead of blocking.
+	bool _pollProgressFutex(bool *done) {
+		auto futex = __atomic_load_n(&_retrieveChunk()->progressFutex, __ATOMIC_ACQUIRE);
+		assert(!(futex & ~(kHelProgressMask | kHelProgressWaiters | kHelProgressDone)));
+		if(_lastProgress != (futex & kHelProgressMask)) {
+			*done = false;
+			return true;
+		}else if(futex & kHelProgressDone) {
+			*done = true;
+			return true;
+		}
+		return false;
+	}
+
 	void _waitProgressFutex(bool *done) {
 		while(true) {
 			auto futex = __atomic_load_n(&_retrieveChunk()->progressFutex, __ATOMIC_ACQUIRE);
@@ -0,0 +1,68 @@
+#include <hel.h>
+#include <hel-syscalls.h>
+#include <helix/clock.hpp>
+
+namespace helix {
+
+namespace {
+
+const HelClockPage *clockPage() {
+	static const HelClockPage *page = [] {
+		HelHandle handle;
+		void *window;
+		HEL_CHECK(helAccessClockPage(&handle));
+		HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr,
+				0, 0x1000, kHelMapProtRead, &window));
+		HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+		return reinterpret_cast<const HelClockPage *>(window);
+	}();
+	return page;
+}
+
+bool readCounter(uint32_t source, uint64_t &counter) {
+#if defined(__x86_64__)
+	if(source == kHelClockSourceTsc) {
+		uint32_t lsw, msw;
+		asm volatile ("rdtsc" : "=a"(lsw), "=d"(msw));
+		counter = (static_cast<uint64_t>(msw) << 32) | lsw;
+		return true;
+	}
+#endif
+	(void)source;
+	(void)counter;
+	return false;
+}
+
+} // anonymous namespace
+
+uint64_t currentNanos() {
+	auto page = clockPage();
+
+	uint32_t source, shift;
+	uint64_t multiplier, refCounter, refNanos;
+	while(true) {
+		auto seq = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
+		if(seq & 1)
+			continue;
+		source = __atomic_load_n(&page->source, __ATOMIC_RELAXED);
+		shift = __atomic_load_n(&page->shift, __ATOMIC_RELAXED);
+		multiplier = __atomic_load_n(&page->multiplier, __ATOMIC_RELAXED);
+		refCounter = __atomic_load_n(&page->refCounter, __ATOMIC_RELAXED);
+		refNanos = __atomic_load_n(&page->refNanos, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+
+	uint64_t counter;
+	if(!readCounter(source, counter)) {
+		uint64_t nanos;
+		HEL_CHECK(helGetClock(&nanos));
+		return nanos;
+	}
+
+	return refNanos + static_cast<uint64_t>((static_cast<unsigned __int128>(
+			counter - refCounter) * multiplier) >> shift);
+}
+
+} // namespace helix
@@ -935,6 +935,15 @@ bool ClientPageSpace::isMapped(VirtualAddr pointer) {
 	return tbl3[index3].load() & kPageValid;
 }
 
+// TODO: Use level 2 block descriptors. For now, callers fall back to 4 KiB pages.
+bool ClientPageSpace::mapSingle2m(VirtualAddr, PhysicalAddr, bool, uint32_t, CachingMode) {
+	return false;
+}
+
+frg::optional<PageStatus> ClientPageSpace::unmapSingle2m(VirtualAddr) {
+	return frg::null_opt;
+}
+
 bool ClientPageSpace::updatePageAccess(VirtualAddr pointer) {
 	assert(!(pointer & (kPageSize - 1)));
 
@@ -4,6 +4,7 @@
 
 #include <assert.h>
 #include <frg/list.hpp>
+#include <frg/optional.hpp>
 #include <smarter.hpp>
 #include <thor-internal/mm-rc.hpp>
 #include <thor-internal/types.hpp>
@@ -13,7 +14,10 @@ namespace thor {
 
 enum {
 	kPageSize = 0x1000,
-	kPageShift = 12
+	kPageShift = 12,
+	// Size of a level 2 block with a 4 KiB granule.
+	kHugePageSize = 0x200000,
+	kHugePageShift = 21
 };
 
 constexpr Word kPfAccess = 1;
@@ -415,6 +419,10 @@ public:
 	bool isMapped(VirtualAddr pointer);
 	bool updatePageAccess(VirtualAddr pointer);
 
+	bool mapSingle2m(VirtualAddr pointer, PhysicalAddr physical, bool user_access,
+			uint32_t flags, CachingMode caching_mode);
+	frg::optional<PageStatus> unmapSingle2m(VirtualAddr pointer);
+
 private:
 	frg::ticket_spinlock _mutex;
 };
@@ -3,6 +3,7 @@
 #include <thor-internal/profile.hpp>
 #include <thor-internal/thread.hpp>
 #include <thor-internal/arch/cpu.hpp>
+#include <thor-internal/arch/paging.hpp>
 #include <thor-internal/arch/pmc-amd.hpp>
 #include <thor-internal/arch/pmc-intel.hpp>
 
@@ -497,6 +498,110 @@ extern "C" void onPlatformWork() {
 	disableInts();
 }
 
+namespace {
+	// Reads a word from the current address space without risking a page fault.
+	// This walks the page tables by hand since we cannot handle faults inside the NMI handler.
+	bool peekProfiledWord(uintptr_t address, bool user, uint64_t &value) {
+		constexpr uint64_t kPagePresent = 1;
+		constexpr uint64_t kPageUser = 4;
+		constexpr uint64_t kPageHuge = 0x80;
+		constexpr uint64_t kAddressMask = 0x000F'FFFF'FFFF'F000;
+
+		if(address & (sizeof(uint64_t) - 1))
+			return false;
+		if(user != (address < 0x8000'0000'0000))
+			return false;
+		if(!user && address < 0xFFFF'8000'0000'0000)
+			return false;
+
+		PhysicalAddr table;
+		asm volatile ("mov %%cr3, %0" : "=r"(table));
+		table &= kAddressMask;
+
+		for(int level = 3; level >= 0; level--) {
+			auto shift = 12 + 9 * level;
+			auto index = (address >> shift) & 0x1FF;
+			PageAccessor accessor{table};
+			auto entry = reinterpret_cast<uint64_t *>(accessor.get())[index];
+			if(!(entry & kPagePresent))
+				return false;
+			if(user && !(entry & kPageUser))
+				return false;
+
+			auto physical = entry & kAddressMask;
+			if(level && (level == 3 || !(entry & kPageHuge))) {
+				table = physical;
+				continue;
+			}
+
+			// Resolve the address within the (possibly huge) page.
+			auto pageMask = (uintptr_t{1} << shift) - 1;
+			physical = (physical & ~pageMask) + (address & pageMask);
+			if(physical >= 0x4000'0000'0000)
+				return false;
+			PageAccessor pageAccessor{physical & ~(kPageSize - 1)};
+			value = *reinterpret_cast<uint64_t *>(
+					reinterpret_cast<char *>(pageAccessor.get()) + (physical & (kPageSize - 1)));
+			return true;
+		}
+		return false;
+	}
+
+	// Follows a chain of frame pointers, starting at frame.
+	// Frames must be strictly increasing, which bounds the walk to the current stack.
+	size_t walkProfiledStack(uintptr_t frame, bool user, uint64_t *ips, size_t maxFrames) {
+		size_t n = 0;
+		while(n < maxFrames && frame) {
+			uint64_t next, ip;
+			if(!peekProfiledWord(frame, user, next)
+					|| !peekProfiledWord(frame + sizeof(uint64_t), user, ip))
+				break;
+			if(!ip)
+				break;
+			ips[n++] = ip;
+			if(next <= frame)
+				break;
+			frame = next;
+		}
+		return n;
+	}
+
+	void recordProfileSample(CpuData *cpuData, NmiImageAccessor image) {
+		struct {
+			ProfileSampleHeader header;
+			uint64_t frames[maxProfileKernelFrames + maxProfileUserFrames];
+		} sample;
+
+		sample.header.cpu = cpuData->cpuIndex;
+		sample.header.threadId = 0;
+		if(auto thread = cpuData->activeExecutor.get(); thread)
+			sample.header.threadId = thread->id();
+
+		if(*image.cs() == kSelClientUserCode) {
+			sample.header.numKernelFrames = 0;
+			sample.frames[0] = *image.ip();
+			sample.header.numUserFrames = 1 + walkProfiledStack(*image.rbp(), true,
+					sample.frames + 1, maxProfileUserFrames - 1);
+		}else{
+			sample.frames[0] = *image.ip();
+			sample.header.numKernelFrames = 1;
+#ifdef THOR_HAS_FRAME_POINTERS
+			// Only trust the kernel frame pointer if it points into the interrupted stack.
+			auto sp = *image.sp();
+			auto rbp = *image.rbp();
+			if(rbp >= sp && rbp < sp + UniqueKernelStack::kSize)
+				sample.header.numKernelFrames += walkProfiledStack(rbp, false,
+						sample.frames + 1, maxProfileKernelFrames - 1);
+#endif
+			sample.header.numUserFrames = 0;
+		}
+
+		auto numFrames = sample.header.numKernelFrames + sample.header.numUserFrames;
+		cpuData->localProfileRing->enqueue(&sample,
+				sizeof(ProfileSampleHeader) + numFrames * sizeof(uint64_t));
+	}
+} // anonymous namespace
+
 extern "C" void onPlatformNmi(NmiImageAccessor image) {
 	// If we interrupted user space or a kernel stub, we might need to update GS.
 	auto gs = common::x86::rdmsr(common::x86::kMsrIndexGsBase);
@@ -508,13 +613,11 @@ extern "C" void onPlatformNmi(NmiImageAccessor image) {
 	bool explained = false;
 	auto pmcMechanism = cpuData->profileMechanism.load(std::memory_order_acquire);
 	if(pmcMechanism == ProfileMechanism::intelPmc && checkIntelPmcOverflow()) {
-		uintptr_t ip = *image.ip();
-		cpuData->localProfileRing->enqueue(&ip, sizeof(uintptr_t));
+		recordProfileSample(cpuData, image);
 		setIntelPmc();
 		explained = true;
 	}else if(pmcMechanism == ProfileMechanism::amdPmc && checkAmdPmcOverflow()) {
-		uintptr_t ip = *image.ip();
-		cpuData->localProfileRing->enqueue(&ip, sizeof(uintptr_t));
+		recordProfileSample(cpuData, image);
 		setAmdPmc();
 		explained = true;
 	}
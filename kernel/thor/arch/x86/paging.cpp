@@ -74,9 +74,12 @@ enum {
 	kPagePcd = 0x10,
 	kPageDirty = 0x40,
 	kPagePat = 0x80,
+	kPageHuge = 0x80, // Only valid in PDEs (and PDPTEs).
 	kPageGlobal = 0x100,
+	kPageHugePat = 0x1000,
 	kPageXd = 0x8000000000000000,
-	kPageAddress = 0x000FFFFFFFFFF000
+	kPageAddress = 0x000FFFFFFFFFF000,
+	kPageHugeAddress = 0x000FFFFFFFE00000
 };
 
 namespace thor {
@@ -674,6 +677,36 @@ PhysicalAddr KernelPageSpace::unmapSingle4k(VirtualAddr pointer) {
 // ClientPageSpace
 // --------------------------------------------------------
 
+namespace {
+
+// Replaces a huge PDE by a PT that maps the same memory using 4 KiB pages.
+// The translation does not change, hence no TLB shootdown is required.
+// Stale 2 MiB TLB entries are removed by the next invalidation of any page within them.
+PageAccessor splitHugePage(arch::scalar_variable<uint64_t> *entry) {
+	auto huge = entry->load();
+	assert((huge & kPagePresent) && (huge & kPageHuge));
+
+	// Keep all flags (including the A/D bits) but move the PAT bit to its PTE position.
+	uint64_t bits = huge & ~(kPageAddress | kPageHuge);
+	if(huge & kPageHugePat)
+		bits |= kPagePat;
+
+	auto tbl_address = physicalAllocator->allocate(kPageSize);
+	assert(tbl_address != PhysicalAddr(-1) && "OOM");
+	PageAccessor accessor{tbl_address};
+	auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor.get());
+	for(size_t i = 0; i < 512; i++)
+		tbl[i].store(((huge & kPageHugeAddress) + i * kPageSize) | bits);
+
+	uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
+	if(huge & kPageUser)
+		new_entry |= kPageUser;
+	entry->store(new_entry);
+	return accessor;
+}
+
+} // anonymous namespace
+
 ClientPageSpace::ClientPageSpace()
 : PageSpace{physicalAllocator->allocate(kPageSize)} {
 	assert(rootTable() != PhysicalAddr(-1) && "OOM");
@@ -701,7 +734,8 @@ ClientPageSpace::~ClientPageSpace() {
 		PageAccessor accessor{ps};
 		auto tbl = reinterpret_cast<uint64_t *>(accessor.get());
 		for(int i = 0; i < 512; i++) {
-			if(tbl[i] & kPagePresent)
+			// Huge pages do not own their memory (unlike PTs).
+			if((tbl[i] & kPagePresent) && !(tbl[i] & kPageHuge))
 				physicalAllocator->free(tbl[i] & kPageAddress, kPageSize);
 		}
 	};
@@ -794,7 +828,9 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 
 	// Make sure there is a PT.
 	tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
-	if(tbl2[index2].load() & kPagePresent) {
+	if((tbl2[index2].load() & kPagePresent) && (tbl2[index2].load() & kPageHuge)) {
+		accessor1 = splitHugePage(&tbl2[index2]);
+	}else if(tbl2[index2].load() & kPagePresent) {
 		accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	}else{
 		auto tbl_address = physicalAllocator->allocate(kPageSize);
@@ -832,6 +868,88 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 	tbl1[index1].store(new_entry);
 }
 
+bool ClientPageSpace::mapSingle2m(VirtualAddr pointer, PhysicalAddr physical,
+		bool user_page, uint32_t flags, CachingMode caching_mode) {
+	assert(!(pointer & (kHugePageSize - 1)));
+	assert(!(physical & (kHugePageSize - 1)));
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	PageAccessor accessor4;
+	PageAccessor accessor3;
+	PageAccessor accessor2;
+
+	auto index4 = (int)((pointer >> 39) & 0x1FF);
+	auto index3 = (int)((pointer >> 30) & 0x1FF);
+	auto index2 = (int)((pointer >> 21) & 0x1FF);
+
+	// The PML4 does always exist.
+	accessor4 = PageAccessor{rootTable()};
+
+	// Make sure there is a PDPT.
+	auto tbl4 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor4.get());
+	if(tbl4[index4].load() & kPagePresent) {
+		accessor3 = PageAccessor{tbl4[index4].load() & 0x000FFFFFFFFFF000};
+	}else{
+		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		accessor3 = PageAccessor{tbl_address};
+		memset(accessor3.get(), 0, kPageSize);
+
+		uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
+		if(user_page)
+			new_entry |= kPageUser;
+		tbl4[index4].store(new_entry);
+	}
+	assert(user_page ? ((tbl4[index4].load() & kPageUser) != 0)
+			: ((tbl4[index4].load() & kPageUser) == 0));
+
+	// Make sure there is a PD.
+	auto tbl3 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor3.get());
+	if(tbl3[index3].load() & kPagePresent) {
+		accessor2 = PageAccessor{tbl3[index3].load() & 0x000FFFFFFFFFF000};
+	}else{
+		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		accessor2 = PageAccessor{tbl_address};
+		memset(accessor2.get(), 0, kPageSize);
+
+		uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
+		if(user_page)
+			new_entry |= kPageUser;
+		tbl3[index3].store(new_entry);
+	}
+	assert(user_page ? ((tbl3[index3].load() & kPageUser) != 0)
+			: ((tbl3[index3].load() & kPageUser) == 0));
+
+	// We do not free PTs here (that would require a shootdown of paging-structure caches),
+	// hence we can only use a huge page if no PT was installed before.
+	auto tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
+	if(tbl2[index2].load() & kPagePresent)
+		return false;
+
+	// Setup the new PDE.
+	uint64_t new_entry = physical | kPagePresent | kPageHuge;
+	if(user_page)
+		new_entry |= kPageUser;
+	if(flags & page_access::write)
+		new_entry |= kPageWrite;
+	if(!(flags & page_access::execute))
+		new_entry |= kPageXd;
+	if(caching_mode == CachingMode::writeThrough) {
+		new_entry |= kPagePwt;
+	}else if(caching_mode == CachingMode::writeCombine) {
+		new_entry |= kPageHugePat | kPagePwt;
+	}else if(caching_mode == CachingMode::uncached) {
+		new_entry |= kPagePwt | kPagePcd | kPageHugePat;
+	}else{
+		assert(caching_mode == CachingMode::null || caching_mode == CachingMode::writeBack);
+	}
+	tbl2[index2].store(new_entry);
+	return true;
+}
+
 PageStatus ClientPageSpace::unmapSingle4k(VirtualAddr pointer) {
 	assert(!(pointer & (kPageSize - 1)));
 
@@ -870,7 +988,11 @@ PageStatus ClientPageSpace::unmapSingle4k(VirtualAddr pointer) {
 	if(!(tbl2[index2].load() & kPagePresent))
 		return 0;
 	assert(tbl2[index2].load() & kPagePresent);
-	accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
+	if(tbl2[index2].load() & kPageHuge) {
+		accessor1 = splitHugePage(&tbl2[index2]);
+	}else{
+		accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
+	}
 	auto tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
 
 	// TODO: Do we want to preserve some bits?
@@ -884,6 +1006,48 @@ PageStatus ClientPageSpace::unmapSingle4k(VirtualAddr pointer) {
 	return status;
 }
 
+frg::optional<PageStatus> ClientPageSpace::unmapSingle2m(VirtualAddr pointer) {
+	assert(!(pointer & (kHugePageSize - 1)));
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	PageAccessor accessor4;
+	PageAccessor accessor3;
+	PageAccessor accessor2;
+
+	auto index4 = (int)((pointer >> 39) & 0x1FF);
+	auto index3 = (int)((pointer >> 30) & 0x1FF);
+	auto index2 = (int)((pointer >> 21) & 0x1FF);
+
+	// The PML4 is always present.
+	accessor4 = PageAccessor{rootTable()};
+	auto tbl4 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor4.get());
+
+	// Find the PDPT.
+	if(!(tbl4[index4].load() & kPagePresent))
+		return frg::null_opt;
+	accessor3 = PageAccessor{tbl4[index4].load() & 0x000FFFFFFFFFF000};
+	auto tbl3 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor3.get());
+
+	// Find the PD.
+	if(!(tbl3[index3].load() & kPagePresent))
+		return frg::null_opt;
+	accessor2 = PageAccessor{tbl3[index3].load() & 0x000FFFFFFFFFF000};
+	auto tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
+
+	// Only unmap the PDE if it is a huge page. Otherwise, the caller falls back to 4 KiB pages.
+	auto ent = tbl2[index2].load();
+	if(!(ent & kPagePresent) || !(ent & kPageHuge))
+		return frg::null_opt;
+	auto bits = tbl2[index2].atomic_exchange(0);
+
+	PageStatus status = page_status::present;
+	if(bits & kPageDirty)
+		status |= page_status::dirty;
+	return status;
+}
+
 PageStatus ClientPageSpace::cleanSingle4k(VirtualAddr pointer) {
 	assert(!(pointer & (kPageSize - 1)));
 
@@ -922,7 +1086,11 @@ PageStatus ClientPageSpace::cleanSingle4k(VirtualAddr pointer) {
 	if(!(tbl2[index2].load() & kPagePresent))
 		return 0;
 	assert(tbl2[index2].load() & kPagePresent);
-	accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
+	if(tbl2[index2].load() & kPageHuge) {
+		accessor1 = splitHugePage(&tbl2[index2]);
+	}else{
+		accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
+	}
 	auto tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
 
 	auto bits = tbl1[index1].load();
@@ -976,6 +1144,8 @@ bool ClientPageSpace::isMapped(VirtualAddr pointer) {
 	// Find the PT.
 	if(!(tbl2[index2].load() & kPagePresent))
 		return false;
+	if(tbl2[index2].load() & kPageHuge)
+		return true;
 	accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
 
@@ -1053,10 +1223,14 @@ void ClientPageSpace::Walk::_update() {
 		return;
 	_accessor2 = PageAccessor{tbl3[index3].load() & 0x000FFFFFFFFFF000};
 
-	// Make sure there is a PT.
+	// Make sure there is a PT. Walks operate on 4 KiB pages, hence we split huge pages.
 	auto tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor2.get());
 	if(!(tbl2[index2].load() & kPagePresent))
 		return;
+	if(tbl2[index2].load() & kPageHuge) {
+		_accessor1 = splitHugePage(&tbl2[index2]);
+		return;
+	}
 	_accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 }
 
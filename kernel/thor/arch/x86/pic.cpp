@@ -2,6 +2,7 @@
 #include <arch/io_space.hpp>
 #include <arch/mem_space.hpp>
 #include <arch/register.hpp>
+#include <hel.h>
 #include <thor-internal/arch/hpet.hpp>
 #include <thor-internal/debug.hpp>
 #include <thor-internal/fiber.hpp>
@@ -338,9 +339,15 @@ uint64_t localTicks() {
 }
 
 namespace {
+	// Fixed-point factor to convert TSC ticks to nanoseconds (with 32 fractional bits).
+	// The same factor is published to user space through the clock page.
+	constexpr uint32_t tscShift = 32;
+	uint64_t tscMultiplier;
+
 	struct TscClockSource final : ClockSource {
 		uint64_t currentNanos() override {
-			auto r = getRawTimestampCounter() * 1'000'000 / localApicContext()->tscTicksPerMilli;
+			auto r = static_cast<uint64_t>((static_cast<unsigned __int128>(
+					getRawTimestampCounter()) * tscMultiplier) >> tscShift);
 	//		infoLogger() << r << frg::endlog;
 			return r;
 		}
@@ -380,6 +387,13 @@ void calibrateApicTimer() {
 	infoLogger() << "thor: TSC ticks/ms: " << localApicContext()->tscTicksPerMilli
 				<< " on CPU #" << getCpuData()->cpuIndex << frg::endlog;
 
+	// All CPUs use the boot CPU's calibration such that the clock is consistent among CPUs.
+	if(!getCpuData()->cpuIndex) {
+		tscMultiplier = (uint64_t{1'000'000} << tscShift) / localApicContext()->tscTicksPerMilli;
+		if(getGlobalCpuFeatures()->haveInvariantTsc)
+			publishClockPage(kHelClockSourceTsc, tscMultiplier, tscShift);
+	}
+
 	localApicContext()->timersAreCalibrated = true;
 }
 
@@ -283,6 +283,8 @@ struct NmiImageAccessor {
 	Word *ip() { return &_frame()->rip; }
 	Word *cs() { return &_frame()->cs; }
 	Word *rflags() { return &_frame()->rflags; }
+	Word *sp() { return &_frame()->rsp; }
+	Word *rbp() { return &_frame()->rbp; }
 
 private:
 	// note: this struct is accessed from assembly.
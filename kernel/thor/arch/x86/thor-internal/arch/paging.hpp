@@ -3,6 +3,7 @@
 #include <atomic>
 
 #include <frg/list.hpp>
+#include <frg/optional.hpp>
 #include <assert.h>
 #include <smarter.hpp>
 #include <thor-internal/mm-rc.hpp>
@@ -13,7 +14,9 @@ namespace thor {
 
 enum {
 	kPageSize = 0x1000,
-	kPageShift = 12
+	kPageShift = 12,
+	kHugePageSize = 0x200000,
+	kHugePageShift = 21
 };
 
 constexpr Word kPfAccess = 1;
@@ -354,6 +357,15 @@ public:
 	PageStatus unmapSingle4k(VirtualAddr pointer);
 	PageStatus cleanSingle4k(VirtualAddr pointer);
 	bool isMapped(VirtualAddr pointer);
+
+	// Maps a 2 MiB page. Fails if the range is already covered by a page table.
+	// 4 KiB operations on a huge page split it into a page table first.
+	bool mapSingle2m(VirtualAddr pointer, PhysicalAddr physical, bool user_access,
+			uint32_t flags, CachingMode caching_mode);
+	// Unmaps a 2 MiB page. Returns null (and does nothing) if the range
+	// is not mapped by a single huge page.
+	frg::optional<PageStatus> unmapSingle2m(VirtualAddr pointer);
+
 	bool updatePageAccess(VirtualAddr pointer);
 
 private:
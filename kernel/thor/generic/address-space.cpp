@@ -1,9 +1,11 @@
+#include <atomic>
 #include <cstddef>
 #include <type_traits>
 #include <thor-internal/address-space.hpp>
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/physical.hpp>
 #include <thor-internal/fiber.hpp>
+#include <thor-internal/thread.hpp>
 #include <frg/container_of.hpp>
 #include <thor-internal/types.hpp>
 
@@ -32,7 +34,38 @@ namespace {
 		infoLogger() << "thor:     Physical usage: "
 				<< (physicalAllocator->numUsedPages() * 4) << " KiB, kernel usage: "
 				<< (kernelMemoryUsage / 1024) << " KiB" << frg::endlog;
+		infoLogger() << "thor:     Physical cache hits: "
+				<< physicalAllocator->numCacheHits() << ", misses: "
+				<< physicalAllocator->numCacheMisses() << ", refills: "
+				<< physicalAllocator->numCacheRefills() << ", drains: "
+				<< physicalAllocator->numCacheDrains() << frg::endlog;
 	}
+
+	std::atomic<uint64_t> numSmallPageMappings{0};
+	std::atomic<uint64_t> numHugePageMappings{0};
+
+	// Returns the physical huge page that backs [offset, offset + kHugePageSize) of the view.
+	// Returns PhysicalAddr(-1) if the range is not (completely) present, not physically
+	// contiguous or not suitably aligned.
+	frg::tuple<PhysicalAddr, CachingMode> peekHugeRange(MemoryView *view, uintptr_t offset) {
+		auto first = view->peekRange(offset);
+		if(first.get<0>() == PhysicalAddr(-1) || (first.get<0>() & (kHugePageSize - 1)))
+			return frg::tuple<PhysicalAddr, CachingMode>{PhysicalAddr(-1), CachingMode::null};
+
+		for(size_t progress = kPageSize; progress < kHugePageSize; progress += kPageSize) {
+			auto range = view->peekRange(offset + progress);
+			if(range.get<0>() != first.get<0>() + progress || range.get<1>() != first.get<1>())
+				return frg::tuple<PhysicalAddr, CachingMode>{PhysicalAddr(-1), CachingMode::null};
+		}
+		return first;
+	}
+}
+
+PageMappingStats getPageMappingStats() {
+	return PageMappingStats{
+		.numSmallPageMappings = numSmallPageMappings.load(std::memory_order_relaxed),
+		.numHugePageMappings = numHugePageMappings.load(std::memory_order_relaxed)
+	};
 }
 
 // --------------------------------------------------------
@@ -48,16 +81,30 @@ frg::expected<Error> VirtualOperations::mapPresentPages(VirtualAddr va, MemoryVi
 	if (!flags)
 		return {};
 
-	for(size_t progress = 0; progress < size; progress += kPageSize) {
+	size_t progress = 0;
+	while(progress < size) {
+		if(!((va + progress) & (kHugePageSize - 1)) && size - progress >= kHugePageSize) {
+			auto hugeRange = peekHugeRange(view, offset + progress);
+			if(hugeRange.get<0>() != PhysicalAddr(-1)
+					&& mapSingle2m(va + progress, hugeRange.get<0>(),
+						flags, hugeRange.get<1>())) {
+				numHugePageMappings.fetch_add(1, std::memory_order_relaxed);
+				progress += kHugePageSize;
+				continue;
+			}
+		}
+
 		auto physicalRange = view->peekRange(offset + progress);
 
 		assert(!isMapped(va + progress));
-		if(physicalRange.get<0>() == PhysicalAddr(-1))
-			continue;
-		assert(!(physicalRange.get<0>() & (kPageSize - 1)));
+		if(physicalRange.get<0>() != PhysicalAddr(-1)) {
+			assert(!(physicalRange.get<0>() & (kPageSize - 1)));
 
-		mapSingle4k(va + progress, physicalRange.get<0>(),
-				flags, physicalRange.get<1>());
+			mapSingle4k(va + progress, physicalRange.get<0>(),
+					flags, physicalRange.get<1>());
+			numSmallPageMappings.fetch_add(1, std::memory_order_relaxed);
+		}
+		progress += kPageSize;
 	}
 	return {};
 }
@@ -71,7 +118,25 @@ frg::expected<Error> VirtualOperations::remapPresentPages(VirtualAddr va, Memory
 	if (!flags)
 		return {};
 
-	for(size_t progress = 0; progress < size; progress += kPageSize) {
+	size_t progress = 0;
+	while(progress < size) {
+		// Huge pages that are completely covered by the range stay huge pages.
+		if(!((va + progress) & (kHugePageSize - 1)) && size - progress >= kHugePageSize) {
+			if(auto status = unmapSingle2m(va + progress); status) {
+				if(*status & page_status::dirty)
+					view->markDirty(offset + progress, kHugePageSize);
+
+				auto hugeRange = peekHugeRange(view, offset + progress);
+				if(hugeRange.get<0>() != PhysicalAddr(-1)
+						&& mapSingle2m(va + progress, hugeRange.get<0>(),
+							flags, hugeRange.get<1>())) {
+					numHugePageMappings.fetch_add(1, std::memory_order_relaxed);
+					progress += kHugePageSize;
+					continue;
+				}
+			}
+		}
+
 		auto physicalRange = view->peekRange(offset + progress);
 
 		auto status = unmapSingle4k(va + progress);
@@ -79,12 +144,14 @@ frg::expected<Error> VirtualOperations::remapPresentPages(VirtualAddr va, Memory
 			assert(!(physicalRange.get<0>() & (kPageSize - 1)));
 			mapSingle4k(va + progress, physicalRange.get<0>(),
 					flags, physicalRange.get<1>());
+			numSmallPageMappings.fetch_add(1, std::memory_order_relaxed);
 		}
 
 		if(status & page_status::present) {
 			if(status & page_status::dirty)
 				view->markDirty(offset + progress, kPageSize);
 		}
+		progress += kPageSize;
 	}
 	return {};
 }
@@ -99,6 +166,7 @@ frg::expected<Error> VirtualOperations::faultPage(VirtualAddr va,
 	PageStatus status = unmapSingle4k(va & ~(kPageSize - 1));
 	mapSingle4k(va & ~(kPageSize - 1), physicalRange.get<0>() & ~(kPageSize - 1),
 			flags, physicalRange.get<1>());
+	numSmallPageMappings.fetch_add(1, std::memory_order_relaxed);
 
 	if(status & page_status::present) {
 		if(status & page_status::dirty)
@@ -107,6 +175,22 @@ frg::expected<Error> VirtualOperations::faultPage(VirtualAddr va,
 	return {};
 }
 
+bool VirtualOperations::faultHugePage(VirtualAddr va,
+		MemoryView *view, uintptr_t offset, PageFlags flags) {
+	assert(!(va & (kHugePageSize - 1)));
+	assert(!(offset & (kPageSize - 1)));
+
+	auto hugeRange = peekHugeRange(view, offset);
+	if(hugeRange.get<0>() == PhysicalAddr(-1))
+		return false;
+
+	// This fails if parts of the range are already mapped by 4 KiB pages.
+	if(!mapSingle2m(va, hugeRange.get<0>(), flags, hugeRange.get<1>()))
+		return false;
+	numHugePageMappings.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
 frg::expected<Error> VirtualOperations::cleanPages(VirtualAddr va, MemoryView *view,
 		uintptr_t offset, size_t size) {
 	assert(!(va & (kPageSize - 1)));
@@ -130,17 +214,34 @@ frg::expected<Error> VirtualOperations::unmapPages(VirtualAddr va,
 	assert(!(offset & (kPageSize - 1)));
 	assert(!(size & (kPageSize - 1)));
 
-	for(size_t progress = 0; progress < size; progress += kPageSize) {
-		auto status = unmapSingle4k(va + progress);
-		if(!(status & page_status::present))
-			continue;
+	size_t progress = 0;
+	while(progress < size) {
+		if(!((va + progress) & (kHugePageSize - 1)) && size - progress >= kHugePageSize) {
+			if(auto status = unmapSingle2m(va + progress); status) {
+				if(*status & page_status::dirty)
+					view->markDirty(offset + progress, kHugePageSize);
+				progress += kHugePageSize;
+				continue;
+			}
+		}
 
-		if(status & page_status::dirty)
+		// Note that this splits huge pages that are only partially unmapped.
+		auto status = unmapSingle4k(va + progress);
+		if((status & page_status::present) && (status & page_status::dirty))
 			view->markDirty(offset + progress, kPageSize);
+		progress += kPageSize;
 	}
 	return {};
 }
 
+bool VirtualOperations::mapSingle2m(VirtualAddr, PhysicalAddr, uint32_t, CachingMode) {
+	return false;
+}
+
+frg::optional<PageStatus> VirtualOperations::unmapSingle2m(VirtualAddr) {
+	return frg::null_opt;
+}
+
 size_t VirtualOperations::getRss() {
 	// Derived classes should track RSS; the generic implementaton does not.
 	// TODO: As soon as all derived classes implement this, we should make it pure virtual.
@@ -538,6 +639,15 @@ VirtualSpace::protect(VirtualAddr address, size_t length, uint32_t flags) {
 
 	auto [start, end] = co_await _splitMappings(address, length);
 	assert(start || (!start && !end));
+
+	// Check all mappings before we change any of them.
+	if(mappingFlags & (MappingFlags::protWrite | MappingFlags::protExecute)) {
+		for (auto it = start; it != end; it = MappingTree::successor(it)) {
+			if(it->view->isReadOnly())
+				co_return Error::illegalArgs;
+		}
+	}
+
 	for (auto it = start; it != end;) {
 		auto mapping = it->selfPtr.lock();
 		it = MappingTree::successor(it);
@@ -622,6 +732,9 @@ VirtualSpace::synchronize(VirtualAddr address, size_t size) {
 coroutine<frg::expected<Error>>
 VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 		smarter::shared_ptr<WorkQueue> wq) {
+	// The fault handler starts this coroutine inline, on the faulting thread.
+	auto faultingThread = getCurrentThread();
+
 	co_await _consistencyMutex.async_lock_shared();
 	frg::shared_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
 
@@ -643,6 +756,11 @@ VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 			&& !((mapping->flags & MappingFlags::protExecute)))
 		co_return Error::fault;
 
+	// Pages that are written through mappings only become dirty (in terms of writeback)
+	// once their dirty bits are harvested, thus we throttle writers when they fault.
+	if(faultFlags & VirtualSpace::kFaultWrite)
+		co_await mapping->view->throttleWrites(faultingThread.get());
+
 	// TODO: Aligning should not be necessary here.
 	auto offset = (address - mapping->address) & ~(kPageSize - 1);
 
@@ -651,12 +769,23 @@ VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 		if(mapping->flags & MappingFlags::dontRequireBacking)
 			fetchFlags |= fetchDisallowBacking;
 
-		FRG_CO_TRY(co_await mapping->view->fetchRange(
+		auto range = FRG_CO_TRY(co_await mapping->view->fetchRange(
 				mapping->viewOffset + offset, fetchFlags, wq));
 
 		co_await mapping->evictionMutex.async_lock();
 		frg::unique_lock evictionLock{frg::adopt_lock, mapping->evictionMutex};
 
+		// Map the surrounding huge page if it is part of the mapping and if
+		// the view is backed by a large enough physical range.
+		auto hugeAddress = address & ~(kHugePageSize - 1);
+		if(hugeAddress >= mapping->address
+				&& hugeAddress + kHugePageSize <= mapping->address + mapping->length
+				&& range.get<1>() >= hugeAddress + kHugePageSize - (address & ~(kPageSize - 1))
+				&& _ops->faultHugePage(hugeAddress, mapping->view.get(),
+					mapping->viewOffset + (hugeAddress - mapping->address),
+					mapping->compilePageFlags()))
+			co_return {};
+
 		auto remapOutcome = _ops->faultPage(address & ~(kPageSize - 1),
 				mapping->view.get(), mapping->viewOffset + offset,
 				mapping->compilePageFlags());
@@ -736,7 +865,15 @@ VirtualAddr VirtualSpace::_allocate(size_t length, MapFlags flags) {
 //	infoLogger() << "Allocate virtual memory area"
 //			<< ", size: 0x" << frg::hex_fmt(length) << frg::endlog;
 
-	if(_holes.get_root()->largestHole < length)
+	// Align large areas to huge pages (if possible) such that they can be mapped using huge pages.
+	// To do that, we search for holes that fit the area at any alignment.
+	size_t align = kPageSize;
+	if(length >= kHugePageSize
+			&& _holes.get_root()->largestHole >= length + kHugePageSize - kPageSize)
+		align = kHugePageSize;
+	auto searchLength = length + align - kPageSize;
+
+	if(_holes.get_root()->largestHole < searchLength)
 		return 0; // TODO: Return something else here?
 
 	auto current = _holes.get_root();
@@ -744,41 +881,40 @@ VirtualAddr VirtualSpace::_allocate(size_t length, MapFlags flags) {
 		if(flags & kMapPreferBottom) {
 			// Try to allocate memory at the bottom of the range.
 			if(HoleTree::get_left(current)
-					&& HoleTree::get_left(current)->largestHole >= length) {
+					&& HoleTree::get_left(current)->largestHole >= searchLength) {
 				current = HoleTree::get_left(current);
 				continue;
 			}
 
-			if(current->length() >= length) {
+			if(current->length() >= searchLength) {
 				// Note that _splitHole can deallocate the hole!
-				auto address = current->address();
-				_splitHole(current, 0, length);
+				auto address = (current->address() + align - 1) & ~(align - 1);
+				_splitHole(current, address - current->address(), length);
 				return address;
 			}
 
 			assert(HoleTree::get_right(current));
-			assert(HoleTree::get_right(current)->largestHole >= length);
+			assert(HoleTree::get_right(current)->largestHole >= searchLength);
 			current = HoleTree::get_right(current);
 		}else{
 			// Try to allocate memory at the top of the range.
 			assert(flags & kMapPreferTop);
 
 			if(HoleTree::get_right(current)
-					&& HoleTree::get_right(current)->largestHole >= length) {
+					&& HoleTree::get_right(current)->largestHole >= searchLength) {
 				current = HoleTree::get_right(current);
 				continue;
 			}
 
-			if(current->length() >= length) {
+			if(current->length() >= searchLength) {
 				// Note that _splitHole can deallocate the hole!
-				auto offset = current->length() - length;
-				auto address = current->address() + offset;
-				_splitHole(current, offset, length);
+				auto address = (current->address() + current->length() - length) & ~(align - 1);
+				_splitHole(current, address - current->address(), length);
 				return address;
 			}
 
 			assert(HoleTree::get_left(current));
-			assert(HoleTree::get_left(current)->largestHole >= length);
+			assert(HoleTree::get_left(current)->largestHole >= searchLength);
 			current = HoleTree::get_left(current);
 		}
 	}
@@ -1192,6 +1328,55 @@ coroutine<size_t> VirtualSpace::writePartialSpace(uintptr_t address,
 	co_return progress;
 }
 
+coroutine<frg::expected<Error, PinnedVirtualRange>> VirtualSpace::pinRange(uintptr_t address,
+		size_t size, smarter::shared_ptr<WorkQueue> wq) {
+	// We do not take _consistencyMutex here since we are only interested in a snapshot.
+	assert(size);
+
+	smarter::shared_ptr<Mapping> mapping;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto spaceGuard = frg::guard(&_snapshotMutex);
+
+		mapping = _findMapping(address);
+	}
+	if(!mapping)
+		co_return Error::fault;
+	// Pinned ranges are only read by the kernel; do not give access to unreadable memory.
+	if(!(mapping->flags & MappingFlags::protRead))
+		co_return Error::fault;
+
+	auto startInMapping = address - mapping->address;
+	auto limitInMapping = frg::min(size, mapping->length - startInMapping);
+	// Otherwise, _findMapping() would have returned garbage.
+	assert(limitInMapping);
+
+	auto lockOutcome = co_await mapping->lockVirtualRange(startInMapping, limitInMapping, wq);
+	if(!lockOutcome)
+		co_return lockOutcome.error();
+	PinnedVirtualRange pin{mapping, startInMapping, limitInMapping};
+
+	FetchFlags fetchFlags = 0;
+	if(mapping->flags & MappingFlags::dontRequireBacking)
+		fetchFlags |= fetchDisallowBacking;
+
+	// Ensure that all pages are available.
+	for(auto offsetInMapping = startInMapping & ~(kPageSize - 1);
+			offsetInMapping < startInMapping + limitInMapping;
+			offsetInMapping += kPageSize) {
+		auto range = FRG_CO_TRY(co_await mapping->view->fetchRange(
+				mapping->viewOffset + offsetInMapping, fetchFlags, wq));
+
+		// Only cacheable RAM can be accessed through the direct physical mapping.
+		auto cacheMode = range.get<2>();
+		if(!physicalAllocator->isManaged(range.get<0>())
+				|| (cacheMode != CachingMode::null && cacheMode != CachingMode::writeBack))
+			co_return Error::illegalObject;
+	}
+
+	co_return std::move(pin);
+}
+
 // --------------------------------------------------------
 // AddressSpace
 // --------------------------------------------------------
@@ -1219,6 +1404,26 @@ MemoryViewLockHandle::~MemoryViewLockHandle() {
 		_view->unlockRange(_offset, _size);
 }
 
+// --------------------------------------------------------
+// PinnedVirtualRange.
+// --------------------------------------------------------
+
+PinnedVirtualRange::~PinnedVirtualRange() {
+	if(_mapping)
+		_mapping->unlockVirtualRange(_offset, _size);
+}
+
+PhysicalAddr PinnedVirtualRange::resolve(size_t progress) {
+	assert(progress < _size);
+	auto offsetInMapping = _offset + progress;
+	auto [physical, cacheMode] = _mapping->resolveRange(offsetInMapping & ~(kPageSize - 1));
+	// Since we have locked the MemoryView, the physical address remains valid here.
+	assert(physical != PhysicalAddr(-1));
+	// pinRange() rejects memory that is not cacheable.
+	assert(cacheMode == CachingMode::null || cacheMode == CachingMode::writeBack);
+	return physical + (offsetInMapping & (kPageSize - 1));
+}
+
 // --------------------------------------------------------
 // NamedMemoryViewLock.
 // --------------------------------------------------------
@@ -27,6 +27,9 @@
 using namespace thor;
 
 namespace {
+	// Maximal number of bytes of a flow transfer that are pinned (and in flight) at a time.
+	constexpr size_t maxPinnedFlowWindow = 64 * 1024;
+
 	// TODO: Replace this by a function that returns the type of special descriptor.
 	bool isSpecialMemoryView(HelHandle handle) {
 		return handle == kHelZeroMemory;
@@ -373,6 +376,13 @@ HelError helAllocateMemory(size_t size, uint32_t flags,
 	if(flags & kHelAllocContinuous) {
 		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
 				size, kPageSize);
+	}else if(flags & kHelAllocHugePages) {
+		if(size & (kHugePageSize - 1))
+			return kHelErrIllegalArgs;
+		// The physical allocator does not guarantee 2 MiB alignment, hence we only require
+		// page alignment here; misaligned chunks are simply mapped using 4 KiB pages.
+		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
+				kHugePageSize, kPageSize);
 	}else if(flags & kHelAllocOnDemand) {
 		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits);
 	}else{
@@ -409,6 +419,12 @@ HelError helResizeMemory(HelHandle handle, size_t newSize) {
 		memory = wrapper->get<MemoryViewDescriptor>().memory;
 	}
 
+	// Memory with huge page chunks can only be resized in multiples of the chunk size.
+	if(auto error = memory->checkResize(newSize); error != Error::success) {
+		assert(error == Error::illegalArgs);
+		return kHelErrIllegalArgs;
+	}
+
 	Thread::asyncBlockCurrent([] (smarter::shared_ptr<MemoryView> memory, size_t newSize)
 			-> coroutine<void> {
 		co_await memory->resize(newSize);
@@ -549,6 +565,9 @@ HelError helAlterMemoryIndirection(HelHandle indirectHandle, size_t slot,
 			return kHelErrBadDescriptor;
 		memoryView = memoryWrapper->get<MemoryViewDescriptor>().memory;
 	}
+	// Otherwise, read-only views could be mapped writable through the indirection.
+	if(memoryView->isReadOnly())
+		return kHelErrIllegalArgs;
 
 	if(auto e = indirectView->setIndirection(slot, std::move(memoryView), offset, size);
 			e != Error::success) {
@@ -788,6 +807,9 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 		}else{
 			return kHelErrBadDescriptor;
 		}
+		if(slice->getView()->isReadOnly()
+				&& (flags & (kHelMapProtWrite | kHelMapProtExecute)))
+			return kHelErrIllegalArgs;
 
 		if(space_handle == kHelNullHandle) {
 			space = this_thread->getAddressSpace().lock();
@@ -874,10 +896,14 @@ HelError helSubmitProtectMemory(HelHandle space_handle,
 			uint32_t protectFlags, uintptr_t context,
 			enable_detached_coroutine = {}) -> void {
 		auto outcome = co_await space->protect(pointer, length, protectFlags);
-		// TODO: handle errors after propagating them through VirtualSpace::protect.
-		assert(outcome);
+		HelError error = kHelErrNone;
+		if(!outcome) {
+			// Read-only views cannot become writable or executable.
+			assert(outcome.error() == Error::illegalArgs);
+			error = kHelErrIllegalArgs;
+		}
 
-		HelSimpleResult helResult{.error = kHelErrNone};
+		HelSimpleResult helResult{.error = error};
 		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
 		co_await queue->submit(&ipcSource, context);
 	}(std::move(space), std::move(queue), reinterpret_cast<VirtualAddr>(pointer),
@@ -1274,6 +1300,8 @@ HelError helSubmitWriteMemory(HelHandle handle, uintptr_t address,
 
 	if(descriptor.is<MemoryViewDescriptor>()) {
 		auto view = descriptor.get<MemoryViewDescriptor>().memory;
+		if(view->isReadOnly())
+			return kHelErrIllegalArgs;
 		writeMemoryView(thisThread.lock(),
 				std::move(view), address, length, buffer, std::move(queue), context);
 	}else if(descriptor.is<AddressSpaceDescriptor>()) {
@@ -1345,6 +1373,8 @@ HelError helSubmitManageMemory(HelHandle handle, HelHandle queue_handle, uintptr
 	if(!queue->validSize(ipcSourceSize(sizeof(HelManageResult))))
 		return kHelErrQueueTooSmall;
 
+	memory->notePager(this_thread.get());
+
 	[](smarter::shared_ptr<IpcQueue> queue,
 			smarter::shared_ptr<MemoryView> memory,
 			uintptr_t context,
@@ -1513,6 +1543,27 @@ HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length) {
 	return kHelErrNone;
 }
 
+HelError helQueryMemoryStats(HelMemoryStats *user_stats) {
+	auto writeback = getWritebackStats();
+	auto mappings = getPageMappingStats();
+
+	HelMemoryStats stats;
+	memset(&stats, 0, sizeof(HelMemoryStats));
+	stats.totalMemory = physicalAllocator->numTotalPages() * kPageSize;
+	stats.freeMemory = physicalAllocator->numFreePages() * kPageSize;
+	stats.dirtyMemory = writeback.dirtyPages * kPageSize;
+	stats.writebackMemory = writeback.writebackPages * kPageSize;
+	stats.numWritebackRequests = writeback.numWritebackRequests;
+	stats.numThrottledWrites = writeback.numThrottledWrites;
+	stats.numSmallPageMappings = mappings.numSmallPageMappings;
+	stats.numHugePageMappings = mappings.numHugePageMappings;
+
+	if(!writeUserObject(user_stats, stats))
+		return kHelErrFault;
+
+	return kHelErrNone;
+}
+
 std::atomic<unsigned int> globalNextCpu = 0;
 
 HelError helCreateThread(HelHandle universe_handle, HelHandle space_handle,
@@ -2012,6 +2063,25 @@ HelError helGetClock(uint64_t *counter) {
 	return kHelErrNone;
 }
 
+HelError helAccessClockPage(HelHandle *handle) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	auto memory = smarter::allocate_shared<HardwareMemory>(*kernelAlloc,
+			getClockPagePhysical(), kPageSize, CachingMode::null);
+	// The clock page is shared by all processes.
+	memory->makeReadOnly();
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		*handle = this_universe->attachDescriptor(universe_guard,
+				MemoryViewDescriptor(std::move(memory)));
+	}
+
+	return kHelErrNone;
+}
+
 HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t context,
 		uint64_t *async_id) {
 	struct Closure final : CancelNode, PrecisionTimerNode, IpcNode {
@@ -2451,9 +2521,6 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 		// Below, we need to ensure that we always complete our own nodes
 		// before completing peer nodes.
 
-		// The size of this array must be a power of two.
-		frg::array<frg::unique_memory<KernelAlloc>, 2> xferBuffers;
-
 		size_t i = 0;
 		size_t seenFlows = 0; // Iterates through flows.
 		while(seenFlows < numFlows) {
@@ -2502,24 +2569,82 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				// Empty packets are handled by the generic stream code.
 				assert(recipe->length);
 
+				// Instead of copying the data into a kernel buffer first, we pin the sender's
+				// pages and let the receiver copy directly out of them.
+				auto space = thread->getAddressSpace().lock();
+				assert(space);
+
 				size_t progress = 0;
-				size_t numSent = 0;
-				size_t numAcked = 0;
-				bool lastTransferSent = false;
-				// Each iteration of this loop sends one transfer packet (or terminates).
+				// Each iteration of this loop pins one window and sends all of its pages.
 				while(true) {
+					auto windowSize = frg::min(recipe->length - progress, maxPinnedFlowWindow);
+					auto pinOutcome = co_await space->pinRange(
+							reinterpret_cast<uintptr_t>(recipe->buffer) + progress,
+							windowSize, thread->mainWorkQueue());
+
+					// Memory that is not cacheable RAM (e.g., MMIO) is not covered by
+					// the direct physical mapping. Copy it into a bounce buffer instead.
+					frg::unique_memory<KernelAlloc> bounceBuffer;
+					bool faulted = !pinOutcome && pinOutcome.error() != Error::illegalObject;
+					if(!pinOutcome && !faulted) {
+						bounceBuffer = frg::unique_memory<KernelAlloc>{*kernelAlloc, windowSize};
+
+						co_await thread->mainWorkQueue()->enter();
+						auto outcome = readUserMemory(bounceBuffer.data(),
+								reinterpret_cast<std::byte *>(recipe->buffer) + progress,
+								windowSize);
+						if(!outcome)
+							faulted = true;
+					}
+					if(faulted) {
+						// Send the packet (may deallocate the peer!).
+						peer->flowQueue.put({ .terminate = true, .fault = true });
+						auto ackPacket = co_await node->flowQueue.async_get();
+						assert(ackPacket);
+
+						node->_error = Error::fault;
+						break;
+					}
+					auto windowLength = pinOutcome ? pinOutcome.value().size() : windowSize;
+
+					size_t numSent = 0;
+					size_t windowProgress = 0;
+					bool lastTransferSent = false;
+					while(windowProgress < windowLength) {
+						std::byte *data;
+						size_t chunkSize;
+						if(pinOutcome) {
+							auto physical = pinOutcome.value().resolve(windowProgress);
+							auto misalign = physical & (kPageSize - 1);
+							chunkSize = frg::min(windowLength - windowProgress, kPageSize - misalign);
+							PageAccessor accessor{physical - misalign};
+							data = reinterpret_cast<std::byte *>(accessor.get()) + misalign;
+						}else{
+							chunkSize = frg::min(windowLength - windowProgress, kPageSize);
+							data = reinterpret_cast<std::byte *>(bounceBuffer.data()) + windowProgress;
+						}
+
+						lastTransferSent = (progress + windowProgress + chunkSize == recipe->length);
+						// Send the packet (may deallocate the peer!).
+						peer->flowQueue.put({
+							.data = data,
+							.size = chunkSize,
+							.terminate = lastTransferSent
+						});
+						++numSent;
+						windowProgress += chunkSize;
+					}
+
+					// The pages need to stay pinned until the receiver acked all packets.
 					bool anyRemoteFault = false;
-					while(numSent != numAcked) {
-						// If there is anything more to send, we only need to wait until
-						// at least one buffer is not in-flight (otherwise, we wait for all).
-						if(!lastTransferSent && numSent - numAcked < xferBuffers.size())
-							break;
+					while(numSent) {
 						auto ackPacket = co_await node->flowQueue.async_get();
 						assert(ackPacket);
 						if(ackPacket->fault)
 							anyRemoteFault = true;
-						++numAcked;
+						--numSent;
 					}
+					progress += windowLength;
 
 					if(lastTransferSent) {
 						if(anyRemoteFault) {
@@ -2534,58 +2659,12 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 					if(anyRemoteFault) {
 						// Send the packet (may deallocate the peer!).
 						peer->flowQueue.put({ .terminate = true });
-						++numSent;
-
-						// Retrieve but ignore all acks.
-						assert(numSent > numAcked);
-						while(numSent != numAcked) {
-							auto ackPacket = co_await node->flowQueue.async_get();
-							assert(ackPacket);
-							++numAcked;
-						}
+						auto ackPacket = co_await node->flowQueue.async_get();
+						assert(ackPacket);
 
 						node->_error = Error::remoteFault;
 						break;
 					}
-
-					// Prepare a buffer an send it.
-					assert(numSent - numAcked < xferBuffers.size());
-					auto &xb = xferBuffers[numSent & (xferBuffers.size() - 1)];
-					if(!xb.size())
-						xb = frg::unique_memory<KernelAlloc>{*kernelAlloc, 4096};
-
-					auto chunkSize = frg::min(recipe->length - progress, xb.size());
-					assert(chunkSize);
-
-					co_await thread->mainWorkQueue()->enter();
-					auto outcome = readUserMemory(xb.data(),
-							reinterpret_cast<std::byte *>(recipe->buffer) + progress, chunkSize);
-					if(!outcome) {
-						// Send the packet (may deallocate the peer!).
-						peer->flowQueue.put({ .terminate = true, .fault = true });
-						++numSent;
-
-						// Retrieve but ignore all acks.
-						assert(numSent > numAcked);
-						while(numSent != numAcked) {
-							auto ackPacket = co_await node->flowQueue.async_get();
-							assert(ackPacket);
-							++numAcked;
-						}
-
-						node->_error = Error::fault;
-						break;
-					}
-
-					lastTransferSent = (progress + chunkSize == recipe->length);
-					// Send the packet (may deallocate the peer!).
-					peer->flowQueue.put({
-						.data = xb.data(),
-						.size = chunkSize,
-						.terminate = lastTransferSent
-					});
-					++numSent;
-					progress += chunkSize;
 				}
 
 				node->complete();
@@ -102,29 +102,46 @@ coroutine<void> IpcQueue::_runQueue() {
 			if(!_anyNodes.load(std::memory_order_relaxed))
 				continue;
 
-			// Check if there is enough space in the current chunk.
-			IpcNode *node;
+			// Emit as many elements as possible before updating the progress futex.
+			// This coalesces completions that arrive in bursts, such that user-space
+			// is woken up (and needs to run its dispatch loop) only once per batch.
+			NodeList batch;
+			size_t batchSize = 0;
 			uintptr_t progress;
 			{
 				auto irqLock = frg::guard(&irqMutex());
 				auto lock = frg::guard(&_mutex);
 
 				assert(!_nodeQueue.empty());
-				node = _nodeQueue.front();
 				progress = _currentProgress;
 			}
 
-			// Compute the overall length of the element.
-			size_t length = 0;
-			for(auto sgSource = _nodeQueue.front()->_source; sgSource; sgSource = sgSource->link)
-				length += (sgSource->size + 7) & ~size_t(7);
-			assert(length <= _chunkSize);
+			bool retireChunk = false;
+			while(true) {
+				IpcNode *node;
+				{
+					auto irqLock = frg::guard(&irqMutex());
+					auto lock = frg::guard(&_mutex);
+
+					if(_nodeQueue.empty() || batchSize >= maxBatchSize)
+						break;
+					node = _nodeQueue.front();
+				}
+
+				// Compute the overall length of the element.
+				size_t length = 0;
+				for(auto sgSource = node->_source; sgSource; sgSource = sgSource->link)
+					length += (sgSource->size + 7) & ~size_t(7);
+				assert(length <= _chunkSize);
+
+				// Check if we need to retire the current chunk.
+				if(progress + length > _chunkSize) {
+					retireChunk = true;
+					break;
+				}
 
-			// Check if we need to retire the current chunk.
-			bool emitElement = true;
-			if(progress + length <= _chunkSize) {
 				// Emit the next element to the current chunk.
-				auto elementOffset = offsetof(ChunkStruct, buffer) + _currentProgress;
+				auto elementOffset = offsetof(ChunkStruct, buffer) + progress;
 				assert(!(elementOffset & 0x7));
 
 				ElementStruct element;
@@ -140,17 +157,30 @@ coroutine<void> IpcQueue::_runQueue() {
 							sgSource->pointer, sgSource->size);
 					sgOffset += (sgSource->size + 7) & ~size_t(7);
 				}
-			}else{
-				emitElement = false;
-			}
 
-			// Update the progress futex.
-			unsigned int newProgressWord;
-			if(emitElement) {
-				newProgressWord = progress + sizeof(ElementStruct) + length;
-			}else{
-				newProgressWord = progress | kProgressDone;
+				progress += sizeof(ElementStruct) + length;
+
+				// Retire the node (it is completed once the progress futex is updated).
+				{
+					auto irqLock = frg::guard(&irqMutex());
+					auto lock = frg::guard(&_mutex);
+
+					_currentProgress = progress;
+					_nodeQueue.pop_front();
+
+					assert(_anyNodes.load(std::memory_order_relaxed));
+					if(_nodeQueue.empty())
+						_anyNodes.store(false, std::memory_order_relaxed);
+				}
+				batch.push_back(node);
+				batchSize++;
 			}
+			assert(!batch.empty() || retireChunk);
+
+			// Update the progress futex (once per batch).
+			unsigned int newProgressWord = progress;
+			if(retireChunk && batch.empty())
+				newProgressWord |= kProgressDone;
 
 			auto progressFutexWord = __atomic_exchange_n(&chunkHead->progressFutex,
 					newProgressWord, __ATOMIC_RELEASE);
@@ -161,8 +191,11 @@ coroutine<void> IpcQueue::_runQueue() {
 				getGlobalFutexRealm()->wake(_memory->resolveImmediateFutex(pfOffset));
 			}
 
+			while(!batch.empty())
+				batch.pop_front()->complete();
+
 			// Update our internal state and retire the chunk.
-			if(!emitElement) {
+			if(newProgressWord & kProgressDone) {
 				auto irqLock = frg::guard(&irqMutex());
 				auto lock = frg::guard(&_mutex);
 
@@ -170,21 +203,6 @@ coroutine<void> IpcQueue::_runQueue() {
 				_currentProgress = 0;
 				break;
 			}
-
-			// Update our internal state and retire the node.
-			{
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&_mutex);
-
-				_currentProgress += sizeof(ElementStruct) + length;
-				_nodeQueue.pop_front();
-
-				assert(_anyNodes.load(std::memory_order_relaxed));
-				if(_nodeQueue.empty())
-					_anyNodes.store(false, std::memory_order_relaxed);
-			}
-
-			node->complete();
 		}
 	}
 }
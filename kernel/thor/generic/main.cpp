@@ -713,6 +713,9 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallLoadahead: {
 		*image.error() = helLoadahead((HelHandle)arg0, (uintptr_t)arg1, (size_t)arg2);
 	} break;
+	case kHelCallQueryMemoryStats: {
+		*image.error() = helQueryMemoryStats((HelMemoryStats *)arg0);
+	} break;
 	case kHelCallCreateVirtualizedSpace: {
 		HelHandle handle;
 		*image.error() = helCreateVirtualizedSpace(&handle);
@@ -778,6 +781,11 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.error() = helGetClock(&counter);
 		*image.out0() = counter;
 	} break;
+	case kHelCallAccessClockPage: {
+		HelHandle handle;
+		*image.error() = helAccessClockPage(&handle);
+		*image.out0() = handle;
+	} break;
 	case kHelCallSubmitAwaitClock: {
 		uint64_t async_id;
 		*image.error() = helSubmitAwaitClock((uint64_t)arg0,
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <atomic>
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/main.hpp>
@@ -10,6 +12,8 @@ namespace thor {
 namespace {
 	constexpr bool logUsage = false;
 	constexpr bool logUncaching = false;
+	constexpr bool logReadahead = false;
+	constexpr bool logWriteback = false;
 
 	// The following flags are debugging options to debug the correctness of various components.
 	constexpr bool tortureUncaching = false;
@@ -188,10 +192,206 @@ static initgraph::Task initReclaim{&globalInitEngine, "generic.init-reclaim",
 	}
 };
 
+// --------------------------------------------------------
+// Writeback implementation.
+// --------------------------------------------------------
+
+// Dirty pages are not handed to the pager immediately. Instead, they are collected
+// per ManagedSpace and written back in large, contiguous requests once they expire or
+// once too much memory is dirty. Writers are throttled if the amount of dirty memory
+// exceeds a hard limit, i.e., if they produce dirty pages faster than the pagers write them.
+struct DirtyFlusher {
+	// Interval between two runs of the flusher fiber.
+	static constexpr uint64_t flushInterval = 500'000'000;
+	// Dirty pages are written back once they are older than this.
+	static constexpr uint64_t dirtyExpiry = 3'000'000'000;
+
+	// Above this number of dirty pages, dirty pages are written back immediately.
+	size_t backgroundLimit() {
+		return physicalAllocator->numTotalPages() / 10;
+	}
+
+	// Above this number of dirty pages, writers are blocked.
+	size_t hardLimit() {
+		return physicalAllocator->numTotalPages() / 5;
+	}
+
+	// Called with the ManagedSpace's mutex held.
+	void registerSpace(ManagedSpace *space) {
+		assert(!space->_flushRegistered);
+		space->_flushRegistered = true;
+		space->selfPtr.ctr()->increment();
+
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		_spaces.push_back(space);
+	}
+
+	// The following are called with the ManagedSpace's mutex held.
+
+	void pageDirtied() {
+		_dirtyPages.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void writebackStarted(size_t count) {
+		_writebackPages.fetch_add(count, std::memory_order_relaxed);
+		_numWritebackRequests.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void writebackDone(bool clean) {
+		_writebackPages.fetch_sub(1, std::memory_order_relaxed);
+		if(clean)
+			_dirtyPages.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// Called after writeback completed (without locks held).
+	void wakeWriters() {
+		if(_dirtyPages.load(std::memory_order_relaxed) < hardLimit())
+			_cleanEvent.raise();
+	}
+
+	// Hands dirty pages to the pagers. Unless force is true, only spaces whose
+	// dirty pages expired are considered.
+	void flush(bool force) {
+		auto now = systemClockSource()->currentNanos();
+
+		frg::intrusive_list<
+			ManagedSpace,
+			frg::locate_member<
+				ManagedSpace,
+				frg::default_list_hook<ManagedSpace>,
+				&ManagedSpace::flushHook
+			>
+		> spaces;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			while(!_spaces.empty())
+				spaces.push_back(_spaces.pop_front());
+		}
+
+		while(!spaces.empty()) {
+			auto space = spaces.pop_front();
+
+			ManageList pending;
+			bool flushed = false;
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&space->mutex);
+				assert(space->_flushRegistered);
+
+				if(force || now - space->_dirtySince >= dirtyExpiry) {
+					space->_flushDirty();
+					space->_progressManagement(pending);
+					space->_flushRegistered = false;
+					flushed = true;
+				}else{
+					auto flusherLock = frg::guard(&_mutex);
+					_spaces.push_back(space);
+				}
+			}
+
+			while(!pending.empty()) {
+				auto node = pending.pop_front();
+				node->complete();
+			}
+
+			if(flushed)
+				space->selfPtr.ctr()->decrement();
+		}
+	}
+
+	// Called before data is written to a ManagedSpace, either through copyTo()
+	// or through a mapping (on write faults).
+	coroutine<void> throttle() {
+		if(_dirtyPages.load(std::memory_order_relaxed) < backgroundLimit())
+			co_return;
+		flush(true);
+
+		if(_dirtyPages.load(std::memory_order_relaxed) < hardLimit())
+			co_return;
+		_numThrottledWrites.fetch_add(1, std::memory_order_relaxed);
+		if(logWriteback)
+			infoLogger() << "thor: Throttling writer, "
+					<< _dirtyPages.load(std::memory_order_relaxed) << " pages are dirty"
+					<< " (limit: " << hardLimit() << ")" << frg::endlog;
+
+		co_await _cleanEvent.async_wait_if([&] () -> bool {
+			return _dirtyPages.load(std::memory_order_relaxed) >= hardLimit();
+		});
+	}
+
+	WritebackStats getStats() {
+		return {
+			.dirtyPages = _dirtyPages.load(std::memory_order_relaxed),
+			.writebackPages = _writebackPages.load(std::memory_order_relaxed),
+			.numWritebackRequests = _numWritebackRequests.load(std::memory_order_relaxed),
+			.numThrottledWrites = _numThrottledWrites.load(std::memory_order_relaxed)
+		};
+	}
+
+	void runFlushFiber() {
+		KernelFiber::run([=] {
+			while(true) {
+				auto dirtyPages = _dirtyPages.load(std::memory_order_relaxed);
+				if(logWriteback && dirtyPages)
+					infoLogger() << "thor: " << dirtyPages << " dirty pages, "
+							<< _writebackPages.load(std::memory_order_relaxed)
+							<< " pages under writeback" << frg::endlog;
+
+				flush(dirtyPages >= backgroundLimit());
+				KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(flushInterval));
+			}
+		});
+	}
+
+private:
+	frg::ticket_spinlock _mutex;
+
+	// ManagedSpaces that have dirty pages (protected by _mutex).
+	frg::intrusive_list<
+		ManagedSpace,
+		frg::locate_member<
+			ManagedSpace,
+			frg::default_list_hook<ManagedSpace>,
+			&ManagedSpace::flushHook
+		>
+	> _spaces;
+
+	std::atomic<size_t> _dirtyPages{0};
+	std::atomic<size_t> _writebackPages{0};
+	std::atomic<uint64_t> _numWritebackRequests{0};
+	std::atomic<uint64_t> _numThrottledWrites{0};
+
+	// Raised when writeback completes.
+	async::recurring_event _cleanEvent;
+};
+
+static frg::manual_box<DirtyFlusher> globalFlusher;
+
+static initgraph::Task initFlusher{&globalInitEngine, "generic.init-flusher",
+	initgraph::Requires{getFibersAvailableStage()},
+	[] {
+		globalFlusher.initialize();
+		globalFlusher->runFlushFiber();
+	}
+};
+
+WritebackStats getWritebackStats() {
+	return globalFlusher->getStats();
+}
+
 // --------------------------------------------------------
 // MemoryView.
 // --------------------------------------------------------
 
+Error MemoryView::checkResize(size_t newSize) {
+	(void)newSize;
+	return Error::success;
+}
+
 void MemoryView::resize(size_t newSize, async::any_receiver<void> receiver) {
 	(void)newSize;
 	(void)receiver;
@@ -341,6 +541,10 @@ MemoryView::touchRange(uintptr_t offset, size_t size,
 	co_return {};
 }
 
+coroutine<void> MemoryView::throttleWrites(Thread *) {
+	co_return;
+}
+
 Error MemoryView::updateRange(ManageRequest, size_t, size_t) {
 	return Error::illegalObject;
 }
@@ -349,6 +553,10 @@ void MemoryView::submitManage(ManageNode *) {
 	panicLogger() << "MemoryView does not support management!" << frg::endlog;
 }
 
+void MemoryView::notePager(Thread *) {
+	// Only managed memory has a pager.
+}
+
 Error MemoryView::setIndirection(size_t, smarter::shared_ptr<MemoryView>,
 		uintptr_t, size_t) {
 	return Error::illegalObject;
@@ -631,6 +839,13 @@ AllocatedMemory::~AllocatedMemory() {
 				<< (physicalAllocator->numUsedPages() * 4) << " KiB in use)" << frg::endlog;
 }
 
+Error AllocatedMemory::checkResize(size_t newSize) {
+	// _chunkSize is constant so we do not need to lock.
+	if(newSize % _chunkSize)
+		return Error::illegalArgs;
+	return Error::success;
+}
+
 void AllocatedMemory::resize(size_t newSize, async::any_receiver<void> receiver) {
 	{
 		auto irq_lock = frg::guard(&irqMutex());
@@ -769,6 +984,13 @@ ManagedSpace::ManagedSpace(size_t length, bool readahead)
 
 				pit->loadState = kStateMissing;
 				pit->physical = PhysicalAddr(-1);
+
+				if(pit->readahead) {
+					// Nobody accessed the page; back off.
+					pit->readahead = false;
+					self->numReadaheadWaste++;
+					self->_raSize /= 2;
+				}
 			}
 
 			if(logUncaching)
@@ -880,7 +1102,7 @@ void ManagedSpace::_progressManagement(ManageList &pending) {
 
 		// Fuse the request with adjacent pages in the list.
 		ptrdiff_t count = 0;
-		while(!_writebackList.empty()) {
+		while(!_writebackList.empty() && count < static_cast<ptrdiff_t>(maxWritebackPages)) {
 			auto fuse_cache_page = _writebackList.front();
 			auto fuse_index = fuse_cache_page->identity;
 			auto fuse_managed_page = frg::container_of(fuse_cache_page, &ManagedPage::cachePage);
@@ -892,6 +1114,7 @@ void ManagedSpace::_progressManagement(ManageList &pending) {
 			_writebackList.pop_front();
 		}
 		assert(count);
+		globalFlusher->writebackStarted(count);
 
 		auto node = _managementQueue.pop_front();
 		node->setup(Error::success, ManageRequest::writeback,
@@ -925,6 +1148,96 @@ void ManagedSpace::_progressManagement(ManageList &pending) {
 	}
 }
 
+void ManagedSpace::_updateReadahead(size_t index, ManagedPage *pit, bool miss) {
+	if(!readahead)
+		return;
+
+	if(pit->readahead) {
+		pit->readahead = false;
+		numReadaheadHits++;
+	}
+
+	if(index == _raMarker) {
+		// The access stream reached the marker; request the next window
+		// such that it is present by the time that the stream gets there.
+		_raStart += _raSize;
+		_raSize = frg::min(2 * _raSize, maxReadaheadPages);
+		_raMarker = _raStart;
+		_issueReadahead();
+		return;
+	}
+
+	if(!miss)
+		return;
+	auto lastMiss = _lastMiss;
+	_lastMiss = index;
+
+	// Pages inside the current window are already being loaded.
+	if(index >= _raStart && index < _raStart + _raSize)
+		return;
+
+	if(!index || index == lastMiss + 1 || index == _raStart + _raSize) {
+		_raSize = frg::max(frg::min(2 * _raSize, maxReadaheadPages), minReadaheadPages);
+	}else if(_raSize > minReadaheadPages) {
+		// Random access after a sequential stream; fall back to a small window.
+		_raSize = minReadaheadPages;
+	}else{
+		// Repeated random access; disable readahead until the access becomes sequential.
+		_raSize = 0;
+	}
+	_raStart = index;
+	_raMarker = _raSize ? index + _raSize / 2 : size_t(-1);
+	_issueReadahead();
+}
+
+void ManagedSpace::_issueReadahead() {
+	auto end = frg::min(_raStart + _raSize, numPages);
+	for(size_t i = _raStart; i < end; i++) {
+		auto [pit, wasInserted] = pages.find_or_insert(i, this, i);
+		assert(pit);
+		if(pit->loadState != kStateMissing)
+			continue;
+		pit->loadState = kStateWantInitialization;
+		pit->readahead = true;
+		_initializationList.push_back(&pit->cachePage);
+		numReadaheadPages++;
+	}
+
+	if(logReadahead)
+		infoLogger() << "thor: Readahead of pages " << _raStart << " to " << end
+				<< " in " << this << " (" << numReadaheadPages << " pages read ahead, "
+				<< numReadaheadHits << " hits, " << numReadaheadWaste << " wasted)"
+				<< frg::endlog;
+}
+
+void ManagedSpace::_addDirtyPage(ManagedPage *pit) {
+	assert(pit->loadState == kStateWantWriteback);
+	if(_dirtyList.empty())
+		_dirtySince = systemClockSource()->currentNanos();
+	_dirtyList.push_back(&pit->cachePage);
+
+	if(!_flushRegistered)
+		globalFlusher->registerSpace(this);
+}
+
+void ManagedSpace::_flushDirty() {
+	// Pages are usually dirtied in ascending order, but concurrent writers and
+	// rewrites of pages that were under writeback scramble the list.
+	frg::vector<CachePage *, KernelAlloc> dirty{*kernelAlloc};
+	while(!_dirtyList.empty())
+		dirty.push_back(_dirtyList.pop_front());
+	std::sort(dirty.begin(), dirty.end(), [] (CachePage *a, CachePage *b) {
+		return a->identity < b->identity;
+	});
+
+	for(auto page : dirty)
+		_writebackList.push_back(page);
+
+	if(logWriteback && !dirty.empty())
+		infoLogger() << "thor: Flushing " << dirty.size() << " dirty pages of "
+				<< this << frg::endlog;
+}
+
 void ManagedSpace::_progressMonitors(MonitorList &pending) {
 	// TODO: Accelerate this by storing the monitors in a RB tree ordered by their progress.
 	auto progressNode = [&] (MonitorNode *node) -> bool {
@@ -963,6 +1276,12 @@ void ManagedSpace::_progressMonitors(MonitorList &pending) {
 // BackingMemory
 // --------------------------------------------------------
 
+Error BackingMemory::checkResize(size_t newSize) {
+	if(newSize & (kPageSize - 1))
+		return Error::illegalArgs;
+	return Error::success;
+}
+
 void BackingMemory::resize(size_t newSize, async::any_receiver<void> receiver) {
 	assert(!(newSize & (kPageSize - 1)));
 	auto newPages = newSize >> kPageShift;
@@ -1054,6 +1373,10 @@ void BackingMemory::submitManage(ManageNode *node) {
 	_managed->submitManagement(node);
 }
 
+void BackingMemory::notePager(Thread *pager) {
+	_managed->pagerThread.store(pager, std::memory_order_relaxed);
+}
+
 Error BackingMemory::updateRange(ManageRequest type, size_t offset, size_t length) {
 	assert((offset % kPageSize) == 0);
 	assert((length % kPageSize) == 0);
@@ -1095,10 +1418,13 @@ Error BackingMemory::updateRange(ManageRequest type, size_t offset, size_t lengt
 					pit->loadState = ManagedSpace::kStatePresent;
 					if(!pit->lockCount)
 						globalReclaimer->addPage(&pit->cachePage);
+					globalFlusher->writebackDone(true);
 				}else{
+					// The page was dirtied again while it was written back.
 					assert(pit->loadState == ManagedSpace::kStateAnotherWriteback);
 					pit->loadState = ManagedSpace::kStateWantWriteback;
-					_managed->_writebackList.push_back(&pit->cachePage);
+					_managed->_addDirtyPage(pit);
+					globalFlusher->writebackDone(false);
 				}
 			}
 		}
@@ -1111,6 +1437,9 @@ Error BackingMemory::updateRange(ManageRequest type, size_t offset, size_t lengt
 		node->event.raise();
 	}
 
+	if(type == ManageRequest::writeback)
+		globalFlusher->wakeWriters();
+
 	return Error::success;
 }
 
@@ -1158,6 +1487,12 @@ frg::tuple<PhysicalAddr, CachingMode> FrontalMemory::peekRange(uintptr_t offset)
 			globalReclaimer->addPage(&pit->cachePage);
 		}
 
+		// The page is about to be mapped, this counts as a use of readahead.
+		if(pit->readahead) {
+			pit->readahead = false;
+			_managed->numReadaheadHits++;
+		}
+
 		return frg::tuple<PhysicalAddr, CachingMode>{physical, CachingMode::null};
 	}else{
 		assert(pit->loadState == ManagedSpace::kStateMissing
@@ -1175,6 +1510,7 @@ FrontalMemory::fetchRange(uintptr_t offset, FetchFlags flags, smarter::shared_pt
 	ManageList pendingManagement;
 	MonitorList pendingMonitors;
 	MonitorNode fetchMonitor;
+	PhysicalAddr presentPhysical = PhysicalAddr(-1);
 	{
 		auto irq_lock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&_managed->mutex);
@@ -1189,8 +1525,8 @@ FrontalMemory::fetchRange(uintptr_t offset, FetchFlags flags, smarter::shared_pt
 				|| pit->loadState == ManagedSpace::kStateWriteback
 				|| pit->loadState == ManagedSpace::kStateAnotherWriteback
 				|| pit->loadState == ManagedSpace::kStateEvicting) {
-			auto physical = pit->physical;
-			assert(physical != PhysicalAddr(-1));
+			presentPhysical = pit->physical;
+			assert(presentPhysical != PhysicalAddr(-1));
 
 			if(pit->loadState == ManagedSpace::kStatePresent) {
 				if(!pit->lockCount)
@@ -1201,51 +1537,44 @@ FrontalMemory::fetchRange(uintptr_t offset, FetchFlags flags, smarter::shared_pt
 				globalReclaimer->addPage(&pit->cachePage);
 			}
 
-			co_return PhysicalRange{physical + misalign, kPageSize - misalign, CachingMode::null};
+			// Hitting the readahead marker requests the next window.
+			_managed->_updateReadahead(index, pit, false);
+			_managed->_progressManagement(pendingManagement);
 		}else{
 			assert(pit->loadState == ManagedSpace::kStateMissing
 					|| pit->loadState == ManagedSpace::kStateWantInitialization
 					|| pit->loadState == ManagedSpace::kStateInitialization);
-		}
-
-		if(flags & fetchDisallowBacking) {
-			infoLogger() << "\e[31m" "thor: Backing of page is disallowed" "\e[39m"
-					<< frg::endlog;
-			co_return Error::fault;
-		}
 
-		// We have to take the slow-path, i.e., perform the fetch asynchronously.
-		if(pit->loadState == ManagedSpace::kStateMissing) {
-			pit->loadState = ManagedSpace::kStateWantInitialization;
-			_managed->_initializationList.push_back(&pit->cachePage);
-		}
+			if(flags & fetchDisallowBacking) {
+				infoLogger() << "\e[31m" "thor: Backing of page is disallowed" "\e[39m"
+						<< frg::endlog;
+				co_return Error::fault;
+			}
 
-		// Perform readahead.
-		if(_managed->readahead)
-			for(size_t i = 1; i < 4; ++i) {
-				if(!(index + i < _managed->numPages))
-					break;
-				auto [pit, wasInserted] = _managed->pages.find_or_insert(
-						index + i, _managed.get(), index + i);
-				assert(pit);
-				if(pit->loadState == ManagedSpace::kStateMissing) {
-					pit->loadState = ManagedSpace::kStateWantInitialization;
-					_managed->_initializationList.push_back(&pit->cachePage);
-				}
+			// We have to take the slow-path, i.e., perform the fetch asynchronously.
+			if(pit->loadState == ManagedSpace::kStateMissing) {
+				pit->loadState = ManagedSpace::kStateWantInitialization;
+				_managed->_initializationList.push_back(&pit->cachePage);
 			}
 
-		_managed->_progressManagement(pendingManagement);
+			_managed->_updateReadahead(index, pit, true);
+			_managed->_progressManagement(pendingManagement);
 
-		fetchMonitor.setup(ManageRequest::initialize, offset, kPageSize);
-		fetchMonitor.progress = 0;
-		_managed->_monitorQueue.push_back(&fetchMonitor);
-		_managed->_progressMonitors(pendingMonitors);
+			fetchMonitor.setup(ManageRequest::initialize, offset, kPageSize);
+			fetchMonitor.progress = 0;
+			_managed->_monitorQueue.push_back(&fetchMonitor);
+			_managed->_progressMonitors(pendingMonitors);
+		}
 	}
 
 	while(!pendingManagement.empty()) {
 		auto node = pendingManagement.pop_front();
 		node->complete();
 	}
+	if(presentPhysical != PhysicalAddr(-1))
+		co_return PhysicalRange{presentPhysical + misalign, kPageSize - misalign,
+				CachingMode::null};
+
 	while(!pendingMonitors.empty()) {
 		auto node = pendingMonitors.pop_front();
 		node->event.raise();
@@ -1286,11 +1615,13 @@ void FrontalMemory::markDirty(uintptr_t offset, size_t size) {
 				pit->loadState = ManagedSpace::kStateWantWriteback;
 				if(!pit->lockCount)
 					globalReclaimer->removePage(&pit->cachePage);
-				_managed->_writebackList.push_back(&pit->cachePage);
+				_managed->_addDirtyPage(pit);
+				globalFlusher->pageDirtied();
 			}else if(pit->loadState == ManagedSpace::kStateEvicting) {
 				pit->loadState = ManagedSpace::kStateWantWriteback;
 				assert(!pit->lockCount);
-				_managed->_writebackList.push_back(&pit->cachePage);
+				_managed->_addDirtyPage(pit);
+				globalFlusher->pageDirtied();
 			}else if(pit->loadState == ManagedSpace::kStateWriteback) {
 				pit->loadState = ManagedSpace::kStateAnotherWriteback;
 			}else{
@@ -1299,10 +1630,20 @@ void FrontalMemory::markDirty(uintptr_t offset, size_t size) {
 			}
 		}
 	}
+}
+
+coroutine<frg::expected<Error>> FrontalMemory::copyTo(uintptr_t offset,
+		const void *pointer, size_t size,
+		smarter::shared_ptr<WorkQueue> wq) {
+	co_await globalFlusher->throttle();
+	co_return co_await MemoryView::copyTo(offset, pointer, size, std::move(wq));
+}
 
-	// We cannot call management callbacks with locks held, but markDirty() may be called
-	// with external locks held; do it on a WorkQueue.
-	_managed->_deferredManagement.invoke();
+coroutine<void> FrontalMemory::throttleWrites(Thread *writer) {
+	// Blocking the pager would prevent the writeback that unblocks it.
+	if(writer == _managed->pagerThread.load(std::memory_order_relaxed))
+		co_return;
+	co_await globalFlusher->throttle();
 }
 
 size_t FrontalMemory::getLength() {
@@ -2,9 +2,11 @@
 #include <bragi/helpers-frigg.hpp>
 #include <frg/small_vector.hpp>
 #include <frg/span.hpp>
+#include <frg/vector.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/kernel-io.hpp>
 #include <thor-internal/main.hpp>
+#include <thor-internal/memory-view.hpp>
 #include <thor-internal/ostrace.hpp>
 #include <thor-internal/stream.hpp>
 #include <thor-internal/timer.hpp>
@@ -29,9 +31,37 @@ initgraph::Stage *getOsTraceAvailableStage() {
 
 namespace {
 
+// Interval at which the per-CPU and user space rings are drained into the global ring.
+constexpr uint64_t drainInterval = 1'000'000;
+
+// Records that exceed this size are not accepted from user space rings.
+constexpr size_t maxRecordSize = 1024;
+
+// Layout of the shared memory rings that user space emits events to.
+// This needs to be kept in sync with protocols/ostrace.
+// The first page contains the ring header, the remaining pages contain the records.
+// Each record is prefixed by its size (as uint64_t) and padded to a multiple of 8 bytes.
+constexpr size_t userRingSize = 0x10000;
+constexpr size_t userRingDataOffset = kPageSize;
+constexpr size_t userRingDataSize = userRingSize - userRingDataOffset;
+
+struct UserRingHeader {
+	uint64_t headPtr; // Written by user space.
+	alignas(64) uint64_t tailPtr; // Written by the kernel.
+};
+
+struct UserRing {
+	smarter::shared_ptr<AllocatedMemory> memory;
+	PhysicalAddr physical; // The ring is physically contiguous.
+	uint64_t tailPtr = 0;
+};
+
 std::atomic<uint64_t> nextId{1};
 frg::manual_box<LogRingBuffer> globalOsTraceRing;
 
+frg::ticket_spinlock userRingsMutex;
+frg::manual_box<frg::vector<UserRing *, KernelAlloc>> userRings;
+
 initgraph::Task initOsTraceCore{&globalInitEngine, "generic.init-ostrace-core",
 	initgraph::Entails{getOsTraceAvailableStage()},
 	[] {
@@ -40,16 +70,14 @@ initgraph::Task initOsTraceCore{&globalInitEngine, "generic.init-ostrace-core",
 
 		void *osTraceMemory = kernelAlloc->allocate(1 << 20);
 		globalOsTraceRing.initialize(reinterpret_cast<uintptr_t>(osTraceMemory), 1 << 20);
+		userRings.initialize(*kernelAlloc);
 
 		osTraceInUse.store(true);
 	}
 };
 
 template<typename R>
-void commitOsTrace(R record) {
-	if(!osTraceInUse.load(std::memory_order_relaxed))
-		return;
-
+frg::small_vector<char, 64, KernelAlloc> serializeOsTrace(R &record) {
 	auto ts = record.size_of_tail();
 	frg::small_vector<char, 64, KernelAlloc> ser(*kernelAlloc);
 	ser.resize(8 + ts);
@@ -57,12 +85,173 @@ void commitOsTrace(R record) {
 			frg::span<char>(ser.data(), 8),
 			frg::span<char>(ser.data() + 8, ts));
 	assert(encodeSuccess);
+	return ser;
+}
+
+// Commits a record directly to the global ring.
+// This is only used for records that are rare (such as announcements) and that need
+// to precede all events that refer to them.
+template<typename R>
+void commitOsTrace(R record) {
+	if(!osTraceInUse.load(std::memory_order_relaxed))
+		return;
+
+	auto ser = serializeOsTrace(record);
 
 	// We want to be able to call this function from any context, but we cannot wake the waiters
 	// in all contexts. For now, only wake waiters if IRQs are enabled.
 	globalOsTraceRing->enqueue(ser.data(), ser.size(), !intsAreEnabled());
 }
 
+void copyFromUserRing(UserRing *ring, uint64_t ptr, void *buffer, size_t size) {
+	auto p = reinterpret_cast<char *>(buffer);
+	size_t progress = 0;
+	while(progress < size) {
+		auto offset = userRingDataOffset + (ptr + progress) % userRingDataSize;
+		auto pageOffset = offset & (kPageSize - 1);
+		auto chunk = frg::min(size - progress,
+				frg::min(kPageSize - pageOffset, userRingSize - offset));
+
+		PageAccessor accessor{ring->physical + (offset & ~(kPageSize - 1))};
+		memcpy(p + progress, reinterpret_cast<char *>(accessor.get()) + pageOffset, chunk);
+		progress += chunk;
+	}
+}
+
+// Appends the records of a user ring (each prefixed by its size) to records.
+// The records are only validated by forwardUserRecords() since we do not want to parse
+// them while holding userRingsMutex. Called with userRingsMutex held.
+void drainUserRing(UserRing *ring, frg::vector<char, KernelAlloc> &records) {
+	PageAccessor headerAccessor{ring->physical};
+	auto header = reinterpret_cast<UserRingHeader *>(headerAccessor.get());
+
+	auto headPtr = __atomic_load_n(&header->headPtr, __ATOMIC_ACQUIRE);
+	if(headPtr < ring->tailPtr || headPtr - ring->tailPtr > userRingDataSize) {
+		ring->tailPtr = headPtr;
+		__atomic_store_n(&header->tailPtr, ring->tailPtr, __ATOMIC_RELEASE);
+		return;
+	}
+
+	while(ring->tailPtr < headPtr) {
+		uint64_t recordSize;
+		copyFromUserRing(ring, ring->tailPtr, &recordSize, sizeof(uint64_t));
+		if(recordSize > maxRecordSize
+				|| sizeof(uint64_t) + recordSize > headPtr - ring->tailPtr) {
+			ring->tailPtr = headPtr;
+			break;
+		}
+		auto offset = records.size();
+		records.resize(offset + sizeof(uint64_t) + recordSize);
+		memcpy(records.data() + offset, &recordSize, sizeof(uint64_t));
+		copyFromUserRing(ring, ring->tailPtr + sizeof(uint64_t),
+				records.data() + offset + sizeof(uint64_t), recordSize);
+		ring->tailPtr += (sizeof(uint64_t) + recordSize + 7) & ~uint64_t{7};
+	}
+
+	__atomic_store_n(&header->tailPtr, ring->tailPtr, __ATOMIC_RELEASE);
+}
+
+// User space is free to write garbage to its ring, hence we validate everything.
+// Only well-formed event records are forwarded to the global ring.
+// Called without locks and with IRQs enabled, such that enqueue() can wake the readers.
+void forwardUserRecords(frg::vector<char, KernelAlloc> &records) {
+	size_t offset = 0;
+	while(offset < records.size()) {
+		uint64_t recordSize;
+		memcpy(&recordSize, records.data() + offset, sizeof(uint64_t));
+		frg::span<const char> recordSpan{records.data() + offset + sizeof(uint64_t), recordSize};
+		offset += sizeof(uint64_t) + recordSize;
+
+		auto preamble = bragi::read_preamble(recordSpan);
+		if(preamble.error() || preamble.id() != bragi::message_id<managarm::ostrace::EventRecord>
+				|| 8 + preamble.tail_size() != recordSize)
+			continue;
+		auto maybeRecord = bragi::parse_head_tail<managarm::ostrace::EventRecord>(
+				recordSpan.subspan(0, 8), recordSpan.subspan(8), *kernelAlloc);
+		if(!maybeRecord)
+			continue;
+
+		globalOsTraceRing->enqueue(recordSpan.data(), recordSize);
+	}
+}
+
+coroutine<frg::expected<Error, UserRing *>> createUserRing() {
+	auto memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, userRingSize, 64,
+			userRingSize, kPageSize);
+	memory->selfPtr = memory;
+
+	auto range = FRG_CO_TRY(co_await memory->fetchRange(0, 0, getCpuData()->generalWorkQueue));
+
+	auto ring = frg::construct<UserRing>(*kernelAlloc);
+	ring->memory = std::move(memory);
+	ring->physical = range.get<0>();
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&userRingsMutex);
+
+	userRings->push_back(ring);
+	co_return ring;
+}
+
+void destroyUserRing(UserRing *ring) {
+	frg::vector<char, KernelAlloc> records{*kernelAlloc};
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&userRingsMutex);
+
+		// Do not lose the records that were emitted before the lane was closed.
+		drainUserRing(ring, records);
+
+		for(size_t i = 0; i < userRings->size(); ++i) {
+			if((*userRings)[i] != ring)
+				continue;
+			(*userRings)[i] = userRings->back();
+			userRings->pop();
+			break;
+		}
+	}
+
+	forwardUserRecords(records);
+	frg::destruct(*kernelAlloc, ring);
+}
+
+// Moves records from the per-CPU rings and from the user space rings to the global ring.
+// The reader is responsible for ordering the records by their timestamps.
+void drainOsTraceRings(frg::vector<uint64_t, KernelAlloc> &cpuPtrs) {
+	size_t numCpus = getCpuCount();
+	if(cpuPtrs.size() < numCpus)
+		cpuPtrs.resize(numCpus, 0);
+
+	for(size_t k = 0; k < numCpus; ++k) {
+		auto ring = getCpuData(k)->localOsTraceRing.load(std::memory_order_acquire);
+		if(!ring)
+			continue;
+
+		while(true) {
+			char buffer[maxRecordSize];
+			auto [success, recordPtr, newPtr, size] = ring->dequeueAt(
+					cpuPtrs[k], buffer, maxRecordSize);
+			cpuPtrs[k] = newPtr;
+			if(!success)
+				break;
+			assert(size < maxRecordSize);
+
+			globalOsTraceRing->enqueue(buffer, size);
+		}
+	}
+
+	frg::vector<char, KernelAlloc> records{*kernelAlloc};
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&userRingsMutex);
+
+		for(auto ring : *userRings)
+			drainUserRing(ring, records);
+	}
+
+	forwardUserRecords(records);
+}
+
 } // anonymous namespace
 
 OsTraceEventId announceOsTraceEvent(frg::string_view name) {
@@ -76,10 +265,25 @@ OsTraceEventId announceOsTraceEvent(frg::string_view name) {
 	return static_cast<OsTraceEventId>(id);
 }
 
+// Events are written to a per-CPU ring without taking any locks;
+// a fiber periodically moves them to the global ring.
 void emitOsTrace(managarm::ostrace::EventRecord<KernelAlloc> record) {
+	if(!osTraceInUse.load(std::memory_order_relaxed))
+		return;
+
 	record.set_ts(systemClockSource()->currentNanos());
+	auto ser = serializeOsTrace(record);
 
-	commitOsTrace(std::move(record));
+	// The ring must not be re-entered by IRQ handlers that emit events on the same CPU.
+	StatelessIrqLock irqLock;
+
+	auto cpuData = getCpuData();
+	auto ring = cpuData->localOsTraceRing.load(std::memory_order_relaxed);
+	if(!ring) {
+		ring = frg::construct<SingleContextRecordRing>(*kernelAlloc);
+		cpuData->localOsTraceRing.store(ring, std::memory_order_release);
+	}
+	ring->enqueue(ser.data(), ser.size());
 }
 
 LogRingBuffer *getGlobalOsTraceRing() {
@@ -93,7 +297,7 @@ LogRingBuffer *getGlobalOsTraceRing() {
 namespace {
 
 coroutine<void> handleBind(LaneHandle objectLane);
-coroutine<Error> handleReq(LaneHandle boundLane);
+coroutine<Error> handleReq(LaneHandle boundLane, frg::vector<UserRing *, KernelAlloc> &rings);
 
 coroutine<void> createObject(LaneHandle mbusLane) {
 	auto [offerError, lane] = co_await OfferSender{mbusLane};
@@ -156,8 +360,10 @@ coroutine<void> handleBind(LaneHandle objectLane) {
 	auto boundLane = stream.get<0>();
 
 	async::detach_with_allocator(*kernelAlloc, ([] (LaneHandle boundLane) -> coroutine<void> {
+		// Rings that were created through this lane; they are destroyed when the lane is closed.
+		frg::vector<UserRing *, KernelAlloc> rings{*kernelAlloc};
 		while(true) {
-			auto error = co_await handleReq(boundLane);
+			auto error = co_await handleReq(boundLane, rings);
 			if(error == Error::endOfLane)
 				break;
 			if(error == Error::protocolViolation) {
@@ -167,10 +373,13 @@ coroutine<void> handleBind(LaneHandle objectLane) {
 				assert(error == Error::success);
 			}
 		}
+
+		for(auto ring : rings)
+			destroyUserRing(ring);
 	})(boundLane));
 }
 
-coroutine<Error> handleReq(LaneHandle boundLane) {
+coroutine<Error> handleReq(LaneHandle boundLane, frg::vector<UserRing *, KernelAlloc> &rings) {
 	auto [acceptError, lane] = co_await AcceptSender{boundLane};
 	if(acceptError == Error::endOfLane)
 		co_return Error::endOfLane;
@@ -301,6 +510,46 @@ coroutine<Error> handleReq(LaneHandle boundLane) {
 			co_return Error::protocolViolation;
 		}
 	} break;
+	case bragi::message_id<managarm::ostrace::CreateRingReq>: {
+		auto maybeReq = bragi::parse_head_tail<managarm::ostrace::CreateRingReq>(
+				headSpan, tailSpan, *kernelAlloc);
+		if(!maybeReq)
+			co_return Error::protocolViolation;
+
+		UserRing *ring = nullptr;
+		managarm::ostrace::Response<KernelAlloc> resp(*kernelAlloc);
+		if(wantOsTrace) {
+			auto ringOutcome = co_await createUserRing();
+			if(ringOutcome) {
+				ring = ringOutcome.value();
+				rings.push_back(ring);
+				resp.set_error(managarm::ostrace::Error::SUCCESS);
+			}else{
+				resp.set_error(managarm::ostrace::Error::ILLEGAL_REQUEST);
+			}
+		}else{
+			resp.set_error(managarm::ostrace::Error::OSTRACE_GLOBALLY_DISABLED);
+		}
+
+		frg::string<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, ser.size()};
+		memcpy(respBuffer.data(), ser.data(), ser.size());
+		auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+		if(respError != Error::success) {
+			assert(isRemoteIpcError(respError));
+			co_return Error::protocolViolation;
+		}
+
+		if(ring) {
+			auto memoryError = co_await PushDescriptorSender{lane,
+					MemoryViewDescriptor{ring->memory}};
+			if(memoryError != Error::success) {
+				assert(isRemoteIpcError(memoryError));
+				co_return Error::protocolViolation;
+			}
+		}
+	} break;
 	default:
 		managarm::ostrace::Response<KernelAlloc> resp(*kernelAlloc);
 		resp.set_error(managarm::ostrace::Error::ILLEGAL_REQUEST);
@@ -324,6 +573,17 @@ initgraph::Task initOsTraceMbus{&globalInitEngine, "generic.init-ostrace-sinks",
 		getFibersAvailableStage(),
 		getIoChannelsDiscoveredStage()},
 	[] {
+		// Create a fiber that moves records to the global ring.
+		if(wantOsTrace) {
+			KernelFiber::run([=] {
+				frg::vector<uint64_t, KernelAlloc> cpuPtrs{*kernelAlloc};
+				while(true) {
+					drainOsTraceRings(cpuPtrs);
+					KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(drainInterval));
+				}
+			});
+		}
+
 		// Create a fiber to manage requests to the ostrace mbus object.
 		KernelFiber::run([=] {
 			// We unconditionally create the mbus object since userspace might use it.
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <string.h>
 #include <thor-internal/arch/paging.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
@@ -56,13 +57,6 @@ void PhysicalChunkAllocator::bootstrapRegion(PhysicalAddr address,
 
 PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int addressBits) {
 	auto irq_lock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&_mutex);
-
-	auto currentFree = _freePages.load(std::memory_order_relaxed);
-	auto currentUsed = _usedPages.load(std::memory_order_relaxed);
-	assert(currentFree > size / kPageSize);
-	_freePages.store(currentFree - size / kPageSize, std::memory_order_relaxed);
-	_usedPages.store(currentUsed + size / kPageSize, std::memory_order_relaxed);
 
 	// TODO: This could be solved better.
 	int target = 0;
@@ -73,41 +67,180 @@ PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int addressBits) {
 	if(logPhysicalAllocs)
 		infoLogger() << "thor: Allocating physical memory of order "
 					<< (target + kPageShift) << frg::endlog;
-	for(int i = 0; i < _numRegions; i++) {
-		if(target > _allRegions[i].buddyAccessor.tableOrder())
-			continue;
 
-		auto physical = _allRegions[i].buddyAccessor.allocate(target, addressBits);
+	// Cached chunks are not restricted in their address, hence we can only use
+	// the cache if the caller does not have any constraints.
+	if(target < PhysicalCpuCache::numOrders && addressBits >= 64) {
+		auto cache = &getCpuData()->physicalCache;
+		auto magazine = &cache->magazines[target];
+		auto cacheLock = frg::guard(&cache->mutex);
+
+		if(magazine->count) {
+			cache->hits.store(cache->hits.load(std::memory_order_relaxed) + 1,
+					std::memory_order_relaxed);
+		}else{
+			cache->misses.store(cache->misses.load(std::memory_order_relaxed) + 1,
+					std::memory_order_relaxed);
+
+			// Refill the magazine in a single batch.
+			auto lock = frg::guard(&_mutex);
+			while(magazine->count < PhysicalCpuCache::batchSize) {
+				auto physical = _allocateFromRegions(target, addressBits);
+				if(physical == BuddyAccessor::illegalAddress)
+					break;
+				magazine->chunks[magazine->count++] = physical;
+			}
+			cache->refills.store(cache->refills.load(std::memory_order_relaxed) + 1,
+					std::memory_order_relaxed);
+		}
+
+		if(magazine->count) {
+			auto physical = magazine->chunks[--magazine->count];
+			assert(!(physical % (size_t(kPageSize) << target)));
+
+			_freePages.fetch_sub(size / kPageSize, std::memory_order_relaxed);
+			_usedPages.fetch_add(size / kPageSize, std::memory_order_relaxed);
+			return physical;
+		}
+	}
+
+	PhysicalAddr physical;
+	{
+		auto lock = frg::guard(&_mutex);
+		physical = _allocateFromRegions(target, addressBits);
+	}
+	if(physical == BuddyAccessor::illegalAddress) {
+		// Free chunks might still be held by the caches of other CPUs.
+		_drainCaches();
+
+		auto lock = frg::guard(&_mutex);
+		physical = _allocateFromRegions(target, addressBits);
 		if(physical == BuddyAccessor::illegalAddress)
-			continue;
-	//	infoLogger() << "Allocate " << (void *)physical << frg::endlog;
-		assert(!(physical % (size_t(kPageSize) << target)));
-		return physical;
+			return static_cast<PhysicalAddr>(-1);
 	}
+	assert(!(physical % (size_t(kPageSize) << target)));
 
-	return static_cast<PhysicalAddr>(-1);
+	_freePages.fetch_sub(size / kPageSize, std::memory_order_relaxed);
+	_usedPages.fetch_add(size / kPageSize, std::memory_order_relaxed);
+	return physical;
 }
 
 void PhysicalChunkAllocator::free(PhysicalAddr address, size_t size) {
 	auto irq_lock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&_mutex);
-	
+
 	int target = 0;
 	while(size > (size_t(kPageSize) << target))
 		target++;
 
+	assert(_usedPages.load(std::memory_order_relaxed) >= size / kPageSize);
+	_freePages.fetch_add(size / kPageSize, std::memory_order_relaxed);
+	_usedPages.fetch_sub(size / kPageSize, std::memory_order_relaxed);
+
+	if(target < PhysicalCpuCache::numOrders) {
+		auto cache = &getCpuData()->physicalCache;
+		auto magazine = &cache->magazines[target];
+		auto cacheLock = frg::guard(&cache->mutex);
+
+		if(magazine->count == PhysicalCpuCache::capacity) {
+			// Return the oldest chunks to the buddy allocator in a single batch.
+			auto lock = frg::guard(&_mutex);
+			for(size_t i = 0; i < PhysicalCpuCache::batchSize; i++)
+				_freeToRegions(magazine->chunks[i], target);
+			memmove(magazine->chunks, magazine->chunks + PhysicalCpuCache::batchSize,
+					(magazine->count - PhysicalCpuCache::batchSize) * sizeof(PhysicalAddr));
+			magazine->count -= PhysicalCpuCache::batchSize;
+			cache->drains.store(cache->drains.load(std::memory_order_relaxed) + 1,
+					std::memory_order_relaxed);
+		}
+
+		magazine->chunks[magazine->count++] = address;
+		return;
+	}
+
+	auto lock = frg::guard(&_mutex);
+	_freeToRegions(address, target);
+}
+
+uint64_t PhysicalChunkAllocator::numCacheHits() {
+	uint64_t n = 0;
+	for(int i = 0; i < getCpuCount(); i++)
+		n += getCpuData(i)->physicalCache.hits.load(std::memory_order_relaxed);
+	return n;
+}
+
+uint64_t PhysicalChunkAllocator::numCacheMisses() {
+	uint64_t n = 0;
+	for(int i = 0; i < getCpuCount(); i++)
+		n += getCpuData(i)->physicalCache.misses.load(std::memory_order_relaxed);
+	return n;
+}
+
+uint64_t PhysicalChunkAllocator::numCacheRefills() {
+	uint64_t n = 0;
+	for(int i = 0; i < getCpuCount(); i++)
+		n += getCpuData(i)->physicalCache.refills.load(std::memory_order_relaxed);
+	return n;
+}
+
+uint64_t PhysicalChunkAllocator::numCacheDrains() {
+	uint64_t n = 0;
+	for(int i = 0; i < getCpuCount(); i++)
+		n += getCpuData(i)->physicalCache.drains.load(std::memory_order_relaxed);
+	return n;
+}
+
+void PhysicalChunkAllocator::_drainCaches() {
+	if(logPhysicalAllocs)
+		infoLogger() << "thor: Draining per-CPU physical caches" << frg::endlog;
+
+	for(int i = 0; i < getCpuCount(); i++) {
+		auto cache = &getCpuData(i)->physicalCache;
+		auto cacheLock = frg::guard(&cache->mutex);
+		auto lock = frg::guard(&_mutex);
+		for(int order = 0; order < PhysicalCpuCache::numOrders; order++) {
+			auto magazine = &cache->magazines[order];
+			for(size_t j = 0; j < magazine->count; j++)
+				_freeToRegions(magazine->chunks[j], order);
+			magazine->count = 0;
+		}
+	}
+}
+
+PhysicalAddr PhysicalChunkAllocator::_allocateFromRegions(int order, int addressBits) {
+	for(int i = 0; i < _numRegions; i++) {
+		if(order > _allRegions[i].buddyAccessor.tableOrder())
+			continue;
+
+		auto physical = _allRegions[i].buddyAccessor.allocate(order, addressBits);
+		if(physical == BuddyAccessor::illegalAddress)
+			continue;
+		return physical;
+	}
+
+	return BuddyAccessor::illegalAddress;
+}
+
+bool PhysicalChunkAllocator::isManaged(PhysicalAddr address) {
+	// Regions are only added during boot, hence we do not need to lock.
+	for(int i = 0; i < _numRegions; i++) {
+		if(address < _allRegions[i].physicalBase)
+			continue;
+		if(address - _allRegions[i].physicalBase >= _allRegions[i].regionSize)
+			continue;
+		return true;
+	}
+	return false;
+}
+
+void PhysicalChunkAllocator::_freeToRegions(PhysicalAddr address, int order) {
+	size_t size = size_t(kPageSize) << order;
 	for(int i = 0; i < _numRegions; i++) {
 		if(address < _allRegions[i].physicalBase)
 			continue;
 		if(address + size - _allRegions[i].physicalBase > _allRegions[i].regionSize)
 			continue;
 
-		_allRegions[i].buddyAccessor.free(address, target);
-		auto currentFree = _freePages.load(std::memory_order_relaxed);
-		auto currentUsed = _usedPages.load(std::memory_order_relaxed);
-		assert(currentUsed > size / kPageSize);
-		_freePages.store(currentFree + size / kPageSize, std::memory_order_relaxed);
-		_usedPages.store(currentUsed - size / kPageSize, std::memory_order_relaxed);
+		_allRegions[i].buddyAccessor.free(address, order);
 		return;
 	}
 
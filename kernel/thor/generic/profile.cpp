@@ -66,16 +66,16 @@ void initializeProfile() {
 
 		uint64_t deqPtr = 0;
 		while(true) {
-			char buffer[128];
+			char buffer[maxProfileSampleSize];
 			auto [success, recordPtr, newPtr, size] = getCpuData()->localProfileRing->dequeueAt(
-					deqPtr, buffer, 128);
+					deqPtr, buffer, maxProfileSampleSize);
 			deqPtr = newPtr;
 			if(!success) {
 				KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(1'000'000));
 				continue;
 			}
 			assert(size);
-			assert(size < 128);
+			assert(size <= maxProfileSampleSize);
 
 			globalProfileRing->enqueue(buffer, size);
 		}
@@ -14,12 +14,20 @@ namespace {
 	constexpr bool logNextBest = false;
 	constexpr bool logUpdates = false;
 	constexpr bool logIdle = false;
+	constexpr bool logBalancing = false;
 
 	constexpr bool disablePreemption = false;
 
 	// Minimum length of a preemption time slice in ns.
 	constexpr int64_t sliceGranularity = 10'000'000;
 
+	// Interval (in ns) between periodic load balancing passes.
+	constexpr uint64_t balanceInterval = 100'000'000;
+	// Minimum interval (in ns) between two work requests of an idle CPU.
+	constexpr uint64_t workRequestInterval = 1'000'000;
+	// Maximal number of entities that are inspected when looking for an entity to migrate.
+	constexpr int maxMigrationCandidates = 4;
+
 	struct IdleTask final : ScheduleEntity {
 		IdleTask()
 		: ScheduleEntity{ScheduleType::idle} { }
@@ -75,6 +83,9 @@ void Scheduler::associate(ScheduleEntity *entity, Scheduler *scheduler) {
 	assert(entity->type() == ScheduleType::regular);
 
 //	infoLogger() << "associate " << entity << frg::endlog;
+	auto irqLock = frg::guard(&irqMutex());
+	auto associationLock = frg::guard(&entity->_associationMutex);
+
 	assert(entity->state == ScheduleState::null);
 	entity->_scheduler = scheduler;
 	entity->state = ScheduleState::attached;
@@ -85,6 +96,7 @@ void Scheduler::unassociate(ScheduleEntity *entity) {
 
 	// TODO: This is only really need to assert against _current.
 	auto irqLock = frg::guard(&irqMutex());
+	auto associationLock = frg::guard(&entity->_associationMutex);
 
 	auto self = entity->_scheduler;
 	assert(self);
@@ -115,12 +127,15 @@ void Scheduler::resume(ScheduleEntity *entity) {
 //	infoLogger() << "resume " << entity << frg::endlog;
 	assert(entity->state == ScheduleState::attached);
 
+	// The load balancer changes _scheduler while holding _associationMutex.
+	auto irqLock = frg::guard(&irqMutex());
+	auto associationLock = frg::guard(&entity->_associationMutex);
+
 	auto self = entity->_scheduler;
 	assert(self);
 	assert(entity != self->_current);
 	bool wasEmpty;
 	{
-		auto irqLock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&self->_mutex);
 
 		entity->state = ScheduleState::pending;
@@ -230,6 +245,17 @@ void Scheduler::update() {
 		_waitQueue.push(entity);
 		_numWaiting++;
 	}
+
+	// Serve requests of idle CPUs first, then check for imbalance periodically.
+	if(auto requester = _workRequest.exchange(nullptr, std::memory_order_acquire); requester)
+		_shedWork(requester);
+
+	if(_refClock - _balanceClock >= balanceInterval) {
+		_balanceClock = _refClock;
+		_balance();
+	}
+
+	_updateRunQueueLength();
 }
 
 bool Scheduler::maybeReschedule() {
@@ -323,6 +349,8 @@ void Scheduler::_schedule() {
 		if(logScheduling)
 			infoLogger() << "No entities to schedule" << frg::endlog;
 		_scheduled = &globalIdleTask.get();
+		_updateRunQueueLength();
+		_requestWork();
 		return;
 	}
 
@@ -350,6 +378,137 @@ void Scheduler::_schedule() {
 				<< " ms" << frg::endlog;
 
 	_scheduled = entity;
+	_updateRunQueueLength();
+}
+
+void Scheduler::_updateRunQueueLength() {
+	auto n = _numWaiting;
+	if((_current && _current->type() == ScheduleType::regular)
+			|| (_scheduled && _scheduled->type() == ScheduleType::regular))
+		n++;
+	_runQueueLength.store(n, std::memory_order_relaxed);
+}
+
+void Scheduler::_balance() {
+	auto ownLength = _runQueueLength.load(std::memory_order_relaxed);
+	if(!_numWaiting)
+		return;
+
+	Scheduler *target = nullptr;
+	size_t targetLength = ownLength;
+	for(int i = 0; i < getCpuCount(); i++) {
+		auto other = &getCpuData(i)->scheduler;
+		if(other == this)
+			continue;
+		auto length = other->runQueueLength();
+		if(length < targetLength) {
+			target = other;
+			targetLength = length;
+		}
+	}
+
+	// Only migrate if this reduces the imbalance.
+	if(!target || ownLength < targetLength + 2)
+		return;
+	_shedWork(target);
+}
+
+void Scheduler::_requestWork() {
+	if(_requestClock && _refClock - _requestClock < workRequestInterval)
+		return;
+	_requestClock = _refClock;
+
+	Scheduler *victim = nullptr;
+	size_t victimLength = 1; // Only steal if there is at least one waiting entity.
+	for(int i = 0; i < getCpuCount(); i++) {
+		auto other = &getCpuData(i)->scheduler;
+		if(other == this)
+			continue;
+		auto length = other->runQueueLength();
+		if(length > victimLength) {
+			victim = other;
+			victimLength = length;
+		}
+	}
+
+	if(!victim)
+		return;
+
+	// If there already is a pending request, we do not need to do anything.
+	Scheduler *expected = nullptr;
+	if(!victim->_workRequest.compare_exchange_strong(expected, this,
+			std::memory_order_release, std::memory_order_relaxed))
+		return;
+	if(logBalancing)
+		infoLogger() << "thor: CPU " << _cpuContext->cpuIndex
+				<< " requests work from CPU " << victim->_cpuContext->cpuIndex
+				<< frg::endlog;
+	sendPingIpi(victim->_cpuContext->cpuIndex);
+}
+
+void Scheduler::_shedWork(Scheduler *target) {
+	assert(!intsAreEnabled());
+	assert(target != this);
+
+	// Do not shed the entity that would run next if we are idle.
+	auto length = _numWaiting;
+	if(_current && _current->type() == ScheduleType::regular)
+		length++;
+	if(!_numWaiting || length < 2)
+		return;
+
+	auto targetIndex = target->_cpuContext->cpuIndex;
+
+	// Find a suitable entity. The pairing heap does not support iteration,
+	// hence we pop a few candidates and push back the ones that we do not take.
+	// The top of the heap is the entity that runs next on this CPU; we prefer to keep it
+	// here and only take it if it is the only waiting entity (i.e., it waits for _current).
+	ScheduleEntity *candidates[maxMigrationCandidates];
+	int numCandidates = 0;
+	ScheduleEntity *entity = nullptr;
+	while(numCandidates < maxMigrationCandidates && !_waitQueue.empty()) {
+		auto candidate = _waitQueue.top();
+		_waitQueue.pop();
+		if((numCandidates || _numWaiting == 1) && candidate->mayBalanceTo(targetIndex)) {
+			entity = candidate;
+			break;
+		}
+		candidates[numCandidates++] = candidate;
+	}
+	for(int i = 0; i < numCandidates; i++)
+		_waitQueue.push(candidates[i]);
+
+	if(!entity)
+		return;
+	assert(entity->state == ScheduleState::active);
+	_numWaiting--;
+
+	// Fold the accumulated progress into the entity's unfairness;
+	// the target scheduler resets the reference progress when the entity becomes active.
+	_updateWaitingEntity(entity);
+	_updateEntityStats(entity);
+
+	if(logBalancing)
+		infoLogger() << "thor: Migrating entity from CPU " << _cpuContext->cpuIndex
+				<< " to CPU " << targetIndex << frg::endlog;
+
+	bool wasEmpty;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto associationLock = frg::guard(&entity->_associationMutex);
+		auto lock = frg::guard(&target->_mutex);
+
+		entity->_scheduler = target;
+		entity->state = ScheduleState::pending;
+
+		wasEmpty = target->_pendingList.empty();
+		target->_pendingList.push_back(entity);
+	}
+
+	_updateRunQueueLength();
+
+	if(wasEmpty)
+		sendPingIpi(targetIndex);
 }
 
 // Returns true if preemption should be done immediately.
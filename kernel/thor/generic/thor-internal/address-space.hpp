@@ -5,6 +5,7 @@
 #include <async/oneshot-event.hpp>
 #include <frg/container_of.hpp>
 #include <frg/expected.hpp>
+#include <frg/optional.hpp>
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/memory-view.hpp>
 
@@ -12,6 +13,14 @@ namespace thor {
 
 struct VirtualSpace;
 
+struct PageMappingStats {
+	// Number of 4 KiB pages and 2 MiB pages that were mapped into virtual spaces.
+	uint64_t numSmallPageMappings;
+	uint64_t numHugePageMappings;
+};
+
+PageMappingStats getPageMappingStats();
+
 struct VirtualOperations {
 	virtual void retire(RetireNode *node) = 0;
 
@@ -23,6 +32,13 @@ struct VirtualOperations {
 	virtual PageStatus cleanSingle4k(VirtualAddr pointer) = 0;
 	virtual bool isMapped(VirtualAddr pointer) = 0;
 
+	// Huge pages (of size kHugePageSize) are optional. The default implementations fail,
+	// in which case the callers fall back to 4 KiB pages.
+	// 4 KiB operations on huge pages need to be supported (e.g. by splitting the huge page).
+	virtual bool mapSingle2m(VirtualAddr pointer, PhysicalAddr physical,
+			uint32_t flags, CachingMode cachingMode);
+	virtual frg::optional<PageStatus> unmapSingle2m(VirtualAddr pointer);
+
 	// ----------------------------------------------------------------------------------
 
 	// The following API is based on MemoryView and will replace the legacy API above.
@@ -37,6 +53,11 @@ struct VirtualOperations {
 	virtual frg::expected<Error> faultPage(VirtualAddr va, MemoryView *view, uintptr_t offset,
 			PageFlags flags);
 
+	// Maps the huge page at va if the view is backed by a suitable physical range.
+	// Returns false if the caller needs to fall back to faultPage().
+	virtual bool faultHugePage(VirtualAddr va, MemoryView *view, uintptr_t offset,
+			PageFlags flags);
+
 	virtual frg::expected<Error> cleanPages(VirtualAddr va, MemoryView *view,
 			uintptr_t offset, size_t size);
 
@@ -316,6 +337,50 @@ public:
 	frg::ticket_spinlock pagingMutex;
 };
 
+// Keeps a range of a Mapping locked (i.e., its pages stay present and cannot be evicted).
+// Returned by VirtualSpace::pinRange().
+struct PinnedVirtualRange {
+	friend void swap(PinnedVirtualRange &a, PinnedVirtualRange &b) {
+		using std::swap;
+		swap(a._mapping, b._mapping);
+		swap(a._offset, b._offset);
+		swap(a._size, b._size);
+	}
+
+	PinnedVirtualRange() = default;
+
+	PinnedVirtualRange(smarter::shared_ptr<Mapping> mapping, uintptr_t offset, size_t size)
+	: _mapping{std::move(mapping)}, _offset{offset}, _size{size} { }
+
+	PinnedVirtualRange(const PinnedVirtualRange &) = delete;
+
+	PinnedVirtualRange(PinnedVirtualRange &&other)
+	: PinnedVirtualRange{} {
+		swap(*this, other);
+	}
+
+	~PinnedVirtualRange();
+
+	PinnedVirtualRange &operator= (PinnedVirtualRange other) {
+		swap(*this, other);
+		return *this;
+	}
+
+	// Number of bytes that are pinned. This can be less than the size passed to pinRange().
+	size_t size() {
+		return _size;
+	}
+
+	// Returns the physical address of the given byte of the range.
+	// The address remains valid (up to the next page boundary) while the range is pinned.
+	PhysicalAddr resolve(size_t progress);
+
+private:
+	smarter::shared_ptr<Mapping> _mapping = nullptr;
+	uintptr_t _offset = 0;
+	size_t _size = 0;
+};
+
 struct HoleLess {
 	bool operator() (const Hole &a, const Hole &b) {
 		return a.address() < b.address();
@@ -411,6 +476,13 @@ public:
 	coroutine<size_t> writePartialSpace(uintptr_t address, const void *buffer, size_t size,
 			smarter::shared_ptr<WorkQueue> wq);
 
+	// Locks (a prefix of) the given range and ensures that all of its pages are present.
+	// The range is truncated at the end of the mapping that contains address.
+	// This allows the kernel to access user memory without copying it first.
+	// Fails with Error::illegalObject if the range is not backed by cacheable RAM (e.g., MMIO).
+	coroutine<frg::expected<Error, PinnedVirtualRange>> pinRange(uintptr_t address, size_t size,
+			smarter::shared_ptr<WorkQueue> wq);
+
 	auto readSpace(uintptr_t address, void *buffer, size_t size,
 			smarter::shared_ptr<WorkQueue> wq) {
 		return async::transform(
@@ -556,6 +628,15 @@ struct AddressSpace final : VirtualSpace, smarter::crtp_counter<AddressSpace, Bi
 			return space_->pageSpace_.isMapped(pointer);
 		}
 
+		bool mapSingle2m(VirtualAddr pointer, PhysicalAddr physical,
+				uint32_t flags, CachingMode cachingMode) override {
+			return space_->pageSpace_.mapSingle2m(pointer, physical, true, flags, cachingMode);
+		}
+
+		frg::optional<PageStatus> unmapSingle2m(VirtualAddr pointer) override {
+			return space_->pageSpace_.unmapSingle2m(pointer);
+		}
+
 	private:
 		AddressSpace *space_;
 	};
@@ -3,6 +3,7 @@
 #include <thor-internal/arch/cpu.hpp>
 #include <thor-internal/executor-context.hpp>
 #include <thor-internal/kernel-locks.hpp>
+#include <thor-internal/physical.hpp>
 #include <thor-internal/schedule.hpp>
 
 namespace thor {
@@ -43,6 +44,10 @@ struct CpuData : public PlatformCpuData {
 	std::atomic<ProfileMechanism> profileMechanism{};
 	// TODO: This should be a unique_ptr instead.
 	SingleContextRecordRing *localProfileRing = nullptr;
+	// Allocated on the first ostrace event on this CPU; drained by ostrace.cpp.
+	std::atomic<SingleContextRecordRing *> localOsTraceRing{nullptr};
+
+	PhysicalCpuCache physicalCache;
 };
 
 CpuData *getCpuData(size_t k);
@@ -92,6 +92,9 @@ private:
 
 	using Mutex = frg::ticket_spinlock;
 
+	// Maximal number of elements that are emitted before the progress futex is updated.
+	static constexpr size_t maxBatchSize = 64;
+
 public:
 	IpcQueue(unsigned int ringShift, unsigned int numChunks, size_t chunkSize);
 
@@ -30,6 +30,7 @@ struct FaultNode;
 struct MemoryReclaimer;
 
 struct CacheBundle;
+struct Thread;
 
 struct CachePage {
 	// Page is registered with the reclaim mechanism.
@@ -273,6 +274,8 @@ public:
 
 	virtual size_t getLength() = 0;
 
+	// Checks whether newLength is a valid argument to resize(), e.g., w.r.t. alignment.
+	virtual Error checkResize(size_t newLength);
 	virtual void resize(size_t newLength, async::any_receiver<void> receiver);
 
 	// Returns a unique identity for each memory address.
@@ -290,6 +293,10 @@ public:
 			void *pointer, size_t size,
 			smarter::shared_ptr<WorkQueue> wq);
 
+	// Called before a write fault of the given thread makes a page of this view writable.
+	// Views that are subject to writeback block the writer while too much memory is dirty.
+	virtual coroutine<void> throttleWrites(Thread *writer);
+
 	// Acquire/release a lock on a memory range.
 	// While a lock is active, results of peekRange() and fetchRange() stay consistent.
 	// Locks do *not* force all pages to be available, but once a page is available
@@ -318,12 +325,27 @@ public:
 
 	virtual void submitManage(ManageNode *handle);
 
+	// Remembers the thread that submits manage requests.
+	// Write faults of the pager are not throttled since it has to clean the pages.
+	virtual void notePager(Thread *pager);
+
 	// Called (e.g. by user space) to update a range after loading or writeback.
 	virtual Error updateRange(ManageRequest type, size_t offset, size_t length);
 
 	virtual Error setIndirection(size_t slot, smarter::shared_ptr<MemoryView> view,
 			uintptr_t offset, size_t size);
 
+	// Read-only views (e.g., the clock page) cannot be mapped writable or executable
+	// and cannot be written to by user space.
+	bool isReadOnly() {
+		return readOnly_;
+	}
+
+	// Contract: called before the view is handed out to user space.
+	void makeReadOnly() {
+		readOnly_ = true;
+	}
+
 	// ----------------------------------------------------------------------------------
 	// Memory eviction.
 	// ----------------------------------------------------------------------------------
@@ -542,6 +564,7 @@ public:
 
 private:
 	EvictionQueue *associatedEvictionQueue_;
+	bool readOnly_ = false;
 };
 
 struct SliceRange {
@@ -694,6 +717,20 @@ private:
 
 smarter::shared_ptr<MemoryView> getZeroMemory();
 
+struct WritebackStats {
+	// Pages that were modified but are not yet written back (including pages
+	// that are currently being written back).
+	size_t dirtyPages;
+	// Pages that are currently being written back.
+	size_t writebackPages;
+	// Number of writeback requests that were handed to pagers.
+	uint64_t numWritebackRequests;
+	// Number of writes that had to wait for writeback to complete.
+	uint64_t numThrottledWrites;
+};
+
+WritebackStats getWritebackStats();
+
 // Memory that is allocated by the kernel and never swapped out.
 // In contrast to most other memory objects, it can be accessed synchronously.
 struct ImmediateMemory final : MemoryView, GlobalFutexSpace {
@@ -799,6 +836,7 @@ struct AllocatedMemory final : MemoryView, GlobalFutexSpace {
 	AllocatedMemory &operator= (const AllocatedMemory &) = delete;
 
 	size_t getLength() override;
+	Error checkResize(size_t newLength) override;
 	void resize(size_t newLength, async::any_receiver<void> receiver) override;
 	frg::expected<Error, frg::tuple<smarter::shared_ptr<GlobalFutexSpace>, uintptr_t>>
 			resolveGlobalFutex(uintptr_t offset) override;
@@ -850,34 +888,17 @@ struct ManagedSpace : CacheBundle {
 		PhysicalAddr physical = PhysicalAddr(-1);
 		LoadState loadState = kStateMissing;
 		unsigned int lockCount = 0;
+		// Page was requested by readahead and has not been accessed since.
+		bool readahead = false;
 		CachePage cachePage;
 	};
 
-	// Calls management callbacks from a WQ; required to implement markDirty().
-	struct DeferredManagement {
-		void setUp() {
-			self->selfPtr.ctr()->increment();
-		}
-
-		void execute() {
-			ManageList pending;
-			{
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&self->mutex);
-
-				self->_progressManagement(pending);
-			}
-
-			while(!pending.empty()) {
-				auto node = pending.pop_front();
-				node->complete();
-			}
-
-			self->selfPtr.ctr()->decrement();
-		}
+	// Bounds for the size of the readahead window (in pages).
+	static constexpr size_t minReadaheadPages = 4;
+	static constexpr size_t maxReadaheadPages = 64;
 
-		ManagedSpace *self;
-	};
+	// Writeback requests are not fused beyond this size (in pages).
+	static constexpr size_t maxWritebackPages = 256;
 
 	ManagedSpace(size_t length, bool readahead);
 	~ManagedSpace();
@@ -890,6 +911,20 @@ struct ManagedSpace : CacheBundle {
 	void _progressManagement(ManageList &pending);
 	void _progressMonitors(MonitorList &pending);
 
+	// Updates the readahead window when fetchRange() accesses a page.
+	// Called with the mutex held; the caller needs to run _progressManagement() afterwards.
+	void _updateReadahead(size_t index, ManagedPage *pit, bool miss);
+	// Requests initialization of all missing pages of the current window.
+	void _issueReadahead();
+
+	// Puts a page that entered kStateWantWriteback onto the dirty list.
+	// Called with the mutex held.
+	void _addDirtyPage(ManagedPage *pit);
+	// Moves all dirty pages to the writeback list, sorted by their index such that
+	// _progressManagement() can fuse them into large requests.
+	// Called with the mutex held; the caller needs to run _progressManagement() afterwards.
+	void _flushDirty();
+
 	smarter::borrowed_ptr<ManagedSpace> selfPtr;
 
 	frg::ticket_spinlock mutex;
@@ -899,6 +934,22 @@ struct ManagedSpace : CacheBundle {
 	size_t numPages;
 	bool readahead;
 
+	// Adaptive readahead (protected by mutex).
+	// Sequential faults grow the window, random faults and wasted pages shrink it.
+	// Pages [_raStart, _raStart + _raSize) belong to the current window. Once the page
+	// _raMarker is accessed, the next window is requested before it is needed.
+	size_t _raStart = 0;
+	size_t _raSize = 0;
+	size_t _raMarker = size_t(-1);
+	size_t _lastMiss = size_t(-1);
+
+	// Readahead statistics (protected by mutex).
+	// Pages requested by readahead, pages that were accessed afterwards and pages that
+	// were evicted without being accessed.
+	uint64_t numReadaheadPages = 0;
+	uint64_t numReadaheadHits = 0;
+	uint64_t numReadaheadWaste = 0;
+
 	EvictionQueue _evictQueue;
 
 	frg::intrusive_list<
@@ -919,10 +970,29 @@ struct ManagedSpace : CacheBundle {
 		>
 	> _writebackList;
 
+	// Pages in kStateWantWriteback that are not yet handed to the pager.
+	// The DirtyFlusher moves them to _writebackList.
+	frg::intrusive_list<
+		CachePage,
+		frg::locate_member<
+			CachePage,
+			frg::default_list_hook<CachePage>,
+			&CachePage::listHook
+		>
+	> _dirtyList;
+
+	// Time at which the oldest page on _dirtyList became dirty (protected by mutex).
+	uint64_t _dirtySince = 0;
+	// Whether this space is queued in the DirtyFlusher (protected by mutex).
+	bool _flushRegistered = false;
+	// Hook for the DirtyFlusher's list (protected by the DirtyFlusher's mutex).
+	frg::default_list_hook<ManagedSpace> flushHook;
+
+	// Thread of the pager (see notePager()). Only compared against, never dereferenced.
+	std::atomic<Thread *> pagerThread{nullptr};
+
 	ManageList _managementQueue;
 	MonitorList _monitorQueue;
-
-	DeferredWork<DeferredManagement> _deferredManagement{{this}};
 };
 
 struct BackingMemory final : MemoryView {
@@ -935,6 +1005,7 @@ public:
 	BackingMemory &operator= (const BackingMemory &) = delete;
 
 	size_t getLength() override;
+	Error checkResize(size_t newLength) override;
 	void resize(size_t newLength, async::any_receiver<void> receiver) override;
 	frg::expected<Error, frg::tuple<smarter::shared_ptr<GlobalFutexSpace>, uintptr_t>>
 			resolveGlobalFutex(uintptr_t offset) override;
@@ -946,6 +1017,7 @@ public:
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
 	void submitManage(ManageNode *handle) override;
+	void notePager(Thread *pager) override;
 	Error updateRange(ManageRequest type, size_t offset, size_t length) override;
 
 private:
@@ -971,6 +1043,10 @@ public:
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	coroutine<frg::expected<Error>> copyTo(uintptr_t offset,
+			const void *pointer, size_t size,
+			smarter::shared_ptr<WorkQueue> wq) override;
+	coroutine<void> throttleWrites(Thread *writer) override;
 
 	coroutine<frg::expected<Error, PhysicalAddr>> takeGlobalFutex(uintptr_t offset,
 			smarter::shared_ptr<WorkQueue> wq) override;
@@ -25,6 +25,34 @@ public:
 	void *access(PhysicalAddr physical);
 };
 
+// Per-CPU cache of small physical chunks. This avoids taking the global
+// PhysicalChunkAllocator lock for most allocations and frees.
+// The owning CPU accesses it with its irqMutex() held; other CPUs only
+// access the magazines to drain them when memory runs out.
+struct PhysicalCpuCache {
+	// Orders [0, numOrders) are cached.
+	static constexpr int numOrders = 3;
+	// Capacity of each per-order magazine.
+	static constexpr size_t capacity = 64;
+	// Number of chunks that are moved from/to the buddy allocator at once.
+	static constexpr size_t batchSize = 16;
+
+	struct Magazine {
+		PhysicalAddr chunks[capacity];
+		size_t count = 0;
+	};
+
+	// Protects the magazines. Must be taken before PhysicalChunkAllocator::_mutex.
+	frg::ticket_spinlock mutex;
+	Magazine magazines[numOrders];
+
+	// Statistics. Only written by the owning CPU.
+	std::atomic<uint64_t> hits{0};
+	std::atomic<uint64_t> misses{0};
+	std::atomic<uint64_t> refills{0};
+	std::atomic<uint64_t> drains{0};
+};
+
 class PhysicalChunkAllocator {
 	typedef frg::ticket_spinlock Mutex;
 public:
@@ -36,6 +64,10 @@ public:
 	PhysicalAddr allocate(size_t size, int addressBits = 64);
 	void free(PhysicalAddr address, size_t size);
 
+	// Whether the page at address is RAM that is managed by this allocator.
+	// In contrast to MMIO, such pages are covered by the direct physical mapping.
+	bool isManaged(PhysicalAddr address);
+
 	size_t numTotalPages() {
 		return _totalPages.load(std::memory_order_relaxed);
 	}
@@ -46,7 +78,21 @@ public:
 		return _freePages.load(std::memory_order_relaxed);
 	}
 
+	// Sums of the per-CPU cache statistics.
+	uint64_t numCacheHits();
+	uint64_t numCacheMisses();
+	uint64_t numCacheRefills();
+	uint64_t numCacheDrains();
+
 private:
+	// Returns the chunks in the caches of all CPUs to the buddy allocator.
+	// Requires that _mutex is not held.
+	void _drainCaches();
+
+	// The following functions require _mutex to be held.
+	PhysicalAddr _allocateFromRegions(int order, int addressBits);
+	void _freeToRegions(PhysicalAddr address, int order);
+
 	Mutex _mutex;
 
 	struct Region {
@@ -1,11 +1,32 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <thor-internal/ring-buffer.hpp>
 
 namespace thor {
 
 extern bool wantKernelProfile;
 
+// Maximal number of kernel and user frames that are recorded per sample.
+inline constexpr size_t maxProfileKernelFrames = 16;
+inline constexpr size_t maxProfileUserFrames = 16;
+
+// Each sample is a ProfileSampleHeader, followed by numKernelFrames kernel IPs
+// and then by numUserFrames user IPs (innermost frames first).
+// The IP at which the sample was taken is always the first frame.
+struct ProfileSampleHeader {
+	uint16_t numKernelFrames;
+	uint16_t numUserFrames;
+	uint32_t cpu;
+	uint64_t threadId;
+};
+static_assert(sizeof(ProfileSampleHeader) == 16);
+
+inline constexpr size_t maxProfileSampleSize = sizeof(ProfileSampleHeader)
+		+ (maxProfileKernelFrames + maxProfileUserFrames) * sizeof(uint64_t);
+
 void initializeProfile();
 LogRingBuffer *getGlobalProfileRing();
 
@@ -3,6 +3,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <atomic>
+
 #include <frg/list.hpp>
 #include <frg/pairing_heap.hpp>
 #include <frg/spinlock.hpp>
@@ -57,6 +59,19 @@ public:
 		return _runTime;
 	}
 
+	// Set of CPUs that the load balancer may move this entity to
+	// (bit i corresponds to CPU i). Entities with an empty mask are never
+	// moved by the load balancer; this is the default.
+	void setBalancingMask(uint64_t mask) {
+		_balancingMask.store(mask, std::memory_order_relaxed);
+	}
+
+	bool mayBalanceTo(int cpuIndex) {
+		if(cpuIndex >= 64)
+			return false;
+		return _balancingMask.load(std::memory_order_relaxed) & (uint64_t{1} << cpuIndex);
+	}
+
 private:
 	const ScheduleType type_;
 
@@ -78,6 +93,8 @@ private:
 
 	// Unfairness value at slice T.
 	Progress baseUnfairness;
+
+	std::atomic<uint64_t> _balancingMask{0};
 };
 
 struct ScheduleGreater {
@@ -122,10 +139,29 @@ public:
 
 	ScheduleEntity *currentRunnable();
 
+	// Number of runnable (i.e., waiting or running) entities on this CPU.
+	// This value is updated lazily and is only meant for statistics and load balancing.
+	size_t runQueueLength() {
+		return _runQueueLength.load(std::memory_order_relaxed);
+	}
+
 private:
 	void _unschedule();
 	void _schedule();
 
+	// ----------------------------------------------------------------------------------
+	// Load balancing.
+	// ----------------------------------------------------------------------------------
+
+	void _updateRunQueueLength();
+
+	// Called periodically to push work to the least loaded CPU.
+	void _balance();
+	// Called when this CPU is about to become idle to pull work from the busiest CPU.
+	void _requestWork();
+	// Moves a waiting entity to the given scheduler (if there is a suitable one).
+	void _shedWork(Scheduler *target);
+
 private:
 	void _updatePreemption();
 
@@ -162,6 +198,16 @@ private:
 	// This allows us to easily track u_p(T) for all waiting processes.
 	Progress _systemProgress = 0;
 
+	// Only written by the local CPU, but read by all CPUs.
+	std::atomic<size_t> _runQueueLength{0};
+
+	// Set by idle CPUs that want this scheduler to shed work to them.
+	std::atomic<Scheduler *> _workRequest{nullptr};
+
+	// Time of the last periodic balancing pass / the last work request.
+	uint64_t _balanceClock = 0;
+	uint64_t _requestClock = 0;
+
 	// ----------------------------------------------------------------------------------
 	// Management of pending entities.
 	// ----------------------------------------------------------------------------------
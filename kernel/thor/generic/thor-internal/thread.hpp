@@ -205,6 +205,11 @@ public:
 		return _credentials;
 	}
 
+	// Numeric ID of the thread; also embedded in its credentials.
+	uint64_t id() {
+		return _id;
+	}
+
 	WorkQueue *mainWorkQueue() {
 		return &_mainWorkQueue;
 	}
@@ -281,6 +286,12 @@ public:
 	void setAffinityMask(frg::vector<uint8_t, KernelAlloc> &&mask) {
 		auto lock = frg::guard(&_mutex);
 		_affinityMask = std::move(mask);
+
+		// Tell the load balancer about the new mask (it only supports 64 CPUs).
+		uint64_t balancingMask = 0;
+		for(size_t i = 0; i < _affinityMask.size() && i < 8; i++)
+			balancingMask |= static_cast<uint64_t>(_affinityMask[i]) << (i * 8);
+		setBalancingMask(balancingMask);
 	}
 
 	// TODO: Tidy this up.
@@ -316,6 +327,7 @@ private:
 		kRunTerminated
 	};
 
+	uint64_t _id;
 	char _credentials[16];
 
 	AssociatedWorkQueue _mainWorkQueue;
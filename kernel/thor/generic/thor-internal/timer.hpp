@@ -9,6 +9,7 @@
 #include <frg/pairing_heap.hpp>
 #include <frg/spinlock.hpp>
 #include <thor-internal/cancel.hpp>
+#include <thor-internal/types.hpp>
 #include <thor-internal/work-queue.hpp>
 
 namespace thor {
@@ -24,6 +25,14 @@ protected:
 
 ClockSource *systemClockSource();
 
+// Physical address of the clock page (see HelClockPage).
+PhysicalAddr getClockPagePhysical();
+
+// Publishes the parameters that user space needs to compute the system clock from
+// a hardware counter. The clock must be equal to
+// (counter * multiplier) >> shift (using 128-bit arithmetic).
+void publishClockPage(uint32_t source, uint64_t multiplier, uint32_t shift);
+
 struct AlarmSink {
 	virtual void firedAlarm() = 0;
 
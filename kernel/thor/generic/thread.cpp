@@ -384,9 +384,12 @@ Thread::Thread(smarter::shared_ptr<Universe> universe,
 		_universe{std::move(universe)}, _addressSpace{std::move(address_space)},
 		_affinityMask{*kernelAlloc} {
 	// TODO: Generate real UUIDs instead of ascending numbers.
-	uint64_t id = globalThreadId.fetch_add(1, std::memory_order_relaxed) + 1;
+	_id = globalThreadId.fetch_add(1, std::memory_order_relaxed) + 1;
 	memset(_credentials, 0, 16);
-	memcpy(_credentials + 8, &id, sizeof(uint64_t));
+	memcpy(_credentials + 8, &_id, sizeof(uint64_t));
+
+	// Threads without an affinity mask may be moved to any CPU.
+	setBalancingMask(~uint64_t{0});
 }
 
 Thread::~Thread() {
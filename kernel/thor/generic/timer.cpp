@@ -1,5 +1,10 @@
+#include <string.h>
+
+#include <hel.h>
+#include <thor-internal/arch/paging.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
+#include <thor-internal/physical.hpp>
 #include <thor-internal/timer.hpp>
 
 namespace thor {
@@ -111,6 +116,44 @@ ClockSource *systemClockSource() {
 	return globalClockSource;
 }
 
+namespace {
+	frg::ticket_spinlock clockPageMutex;
+	PhysicalAddr clockPagePhysical = PhysicalAddr(-1);
+}
+
+PhysicalAddr getClockPagePhysical() {
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&clockPageMutex);
+
+	if(clockPagePhysical == PhysicalAddr(-1)) {
+		clockPagePhysical = physicalAllocator->allocate(kPageSize);
+		assert(clockPagePhysical != PhysicalAddr(-1) && "OOM");
+
+		// Until a clock source is published, user space falls back to helGetClock().
+		PageAccessor accessor{clockPagePhysical};
+		memset(accessor.get(), 0, kPageSize);
+	}
+	return clockPagePhysical;
+}
+
+void publishClockPage(uint32_t source, uint64_t multiplier, uint32_t shift) {
+	PageAccessor accessor{getClockPagePhysical()};
+	auto page = reinterpret_cast<HelClockPage *>(accessor.get());
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&clockPageMutex);
+
+	auto seq = __atomic_load_n(&page->seqlock, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->seqlock, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	page->source = source;
+	page->shift = shift;
+	page->multiplier = multiplier;
+	page->refCounter = 0;
+	page->refNanos = 0;
+	__atomic_store_n(&page->seqlock, seq + 2, __ATOMIC_RELEASE);
+}
+
 PrecisionTimerEngine *generalTimerEngine() {
 	return globalTimerEngine;
 }
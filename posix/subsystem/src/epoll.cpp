@@ -2,6 +2,7 @@
 #include <string.h>
 #include <iostream>
 
+#include <async/oneshot-event.hpp>
 #include <async/recurring-event.hpp>
 #include <boost/intrusive/list.hpp>
 #include <frg/manual_box.hpp>
@@ -68,9 +69,49 @@ private:
 
 		std::optional<frg::expected<Error, PollWaitResult>> pollOutcome;
 
+		// Result of pollStatus() while the item is checked by waitForEvents().
+		std::optional<frg::expected<Error, PollStatusResult>> statusOutcome;
+
 		smarter::borrowed_ptr<Item> self;
 	};
 
+	// Starts watching the item for edges that happen after past_seq.
+	static void _startPolling(smarter::shared_ptr<Item> item, uint64_t past_seq) {
+		if(item->state & statePolling)
+			return;
+		item->state |= statePolling;
+
+		item->cancelPoll.reset();
+		item->pollOperation.construct_with([&] {
+			return async::execution::connect(
+				item->file->pollWait(item->process, past_seq,
+						item->eventMask | EPOLLERR | EPOLLHUP, item->cancelPoll),
+				Receiver{item}
+			);
+		});
+		if(async::execution::start_inline(*item->pollOperation))
+			_awaitPoll(item.get());
+	}
+
+	// Queries the status of all items concurrently, such that the latencies
+	// of pollStatus() calls to remote files do not add up.
+	static async::result<void> _pollStatusOf(std::vector<smarter::shared_ptr<Item>> &batch) {
+		if(batch.empty())
+			co_return;
+
+		size_t outstanding = batch.size();
+		async::oneshot_event done;
+		for(auto &item : batch) {
+			async::detach([] (Item *item, size_t *outstanding,
+					async::oneshot_event *done) -> async::result<void> {
+				item->statusOutcome.emplace(co_await item->file->pollStatus(item->process));
+				if(!--(*outstanding))
+					done->raise();
+			}(item.get(), &outstanding, &done));
+		}
+		co_await done.wait();
+	}
+
 	static void _awaitPoll(Item *item) {
 	reRunImmediately:
 		// First, destruct the operation so that we can re-use it later.
@@ -197,6 +238,10 @@ public:
 		return Error::success;
 	}
 
+	size_t numItems() {
+		return _fileMap.size();
+	}
+
 	Error deleteItem(File *file, int fd) {
 		if(logEpoll)
 			std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Deleting item \e[1;34m"
@@ -232,81 +277,92 @@ public:
 			// TODO: Stop waiting in this case.
 			assert(isOpen());
 
-			while(!_pendingQueue.empty()) {
-				auto item = _pendingQueue.front().self.lock();
-				_pendingQueue.pop_front();
-				item.ctr()->decrement();
-				assert(item->state & statePending);
+			while(!_pendingQueue.empty() && k < max_events) {
+				// Each item yields at most one event, hence we never check more items
+				// than we can report.
+				std::vector<smarter::shared_ptr<Item>> batch;
+				while(!_pendingQueue.empty() && k + batch.size() < max_events) {
+					auto item = _pendingQueue.front().self.lock();
+					_pendingQueue.pop_front();
+					item.ctr()->decrement();
+					assert(item->state & statePending);
+
+					// Discard non-alive items without returning them.
+					if(!(item->state & stateActive)) {
+						if(logEpoll)
+							std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Discarding"
+									" inactive item \e[1;34m" << item->file->structName() << "\e[0m"
+									<< std::endl;
+						item->state &= ~statePending;
+						continue;
+					}
 
-				// Discard non-alive items without returning them.
-				if(!(item->state & stateActive)) {
 					if(logEpoll)
-						std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Discarding"
-								" inactive item \e[1;34m" << item->file->structName() << "\e[0m"
-								<< std::endl;
-					item->state &= ~statePending;
-					continue;
+						std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Checking item "
+								<< "\e[1;34m" << item->file->structName() << "\e[0m" << std::endl;
+					batch.push_back(std::move(item));
 				}
 
-				if(logEpoll)
-					std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Checking item "
-							<< "\e[1;34m" << item->file->structName() << "\e[0m" << std::endl;
-				auto result_or_error = co_await item->file->pollStatus(item->process);
+				co_await _pollStatusOf(batch);
 
-				// Discard closed items.
-				if(!result_or_error) {
-					assert(result_or_error.error() == Error::fileClosed);
-					if(logEpoll)
-						std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Discarding"
-								" closed item \e[1;34m" << item->file->structName() << "\e[0m"
-								<< std::endl;
-					item->state &= ~statePending;
-					continue;
-				}
+				for(auto &item : batch) {
+					auto result_or_error = std::move(*item->statusOutcome);
+					item->statusOutcome.reset();
 
-				auto result = result_or_error.value();
-				if(logEpoll)
-					std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m:"
-							" Item \e[1;34m" << item->file->structName() << "\e[0m"
-							" mask is " << item->eventMask << ", while " << std::get<1>(result)
-							<< " is active" << std::endl;
+					// The item might have been deleted while we were waiting for its status.
+					if(!(item->state & stateActive)) {
+						item->state &= ~statePending;
+						continue;
+					}
 
-				// Abort early (i.e before requeuing) if the item is not pending.
-				auto status = std::get<1>(result) & (item->eventMask | EPOLLERR | EPOLLHUP);
-				if(!status) {
-					item->state &= ~statePending;
-					if(!(item->state & statePolling)) {
-						item->state |= statePolling;
+					// Discard closed items.
+					if(!result_or_error) {
+						assert(result_or_error.error() == Error::fileClosed);
+						if(logEpoll)
+							std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Discarding"
+									" closed item \e[1;34m" << item->file->structName() << "\e[0m"
+									<< std::endl;
+						item->state &= ~statePending;
+						continue;
+					}
 
+					auto result = result_or_error.value();
+					if(logEpoll)
+						std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m:"
+								" Item \e[1;34m" << item->file->structName() << "\e[0m"
+								" mask is " << item->eventMask << ", while " << std::get<1>(result)
+								<< " is active" << std::endl;
+
+					// Abort early (i.e before requeuing) if the item is not pending.
+					auto status = std::get<1>(result) & (item->eventMask | EPOLLERR | EPOLLHUP);
+					if(!status) {
 						// Once an item is not pending anymore, we continue watching it.
-						item->cancelPoll.reset();
-						item->pollOperation.construct_with([&] {
-							return async::execution::connect(
-								item->file->pollWait(item->process, std::get<0>(result),
-										item->eventMask | EPOLLERR | EPOLLHUP, item->cancelPoll),
-								Receiver{item}
-							);
-						});
-						if(async::execution::start_inline(*item->pollOperation))
-							_awaitPoll(item.get());
+						item->state &= ~statePending;
+						_startPolling(item, std::get<0>(result));
+						continue;
 					}
-					continue;
-				}
-
-				// We have to increment the sequence again as concurrent waiters
-				// might have seen an empty _pendingQueue.
-				// TODO: Edge-triggered watches should not be requeued here.
-				item.ctr()->increment();
-				repoll_queue.push_back(*item);
-
-				assert(k < max_events);
-				memset(events + k, 0, sizeof(struct epoll_event));
-				events[k].events = status;
-				events[k].data.u64 = item->cookie;
 
-				k++;
-				if(k == max_events)
-					break;
+					assert(k < max_events);
+					memset(events + k, 0, sizeof(struct epoll_event));
+					events[k].events = status;
+					events[k].data.u64 = item->cookie;
+					k++;
+
+					if(item->eventMask & EPOLLONESHOT) {
+						// The item stays disabled until it is modified again.
+						item->state &= ~statePending;
+					}else if(item->eventMask & EPOLLET) {
+						// Only report the item again once there is another edge.
+						item->state &= ~statePending;
+						_startPolling(item, std::get<0>(result));
+					}else{
+						// Level-triggered items are checked again on the next wait.
+						// We have to increment the sequence again as concurrent waiters
+						// might have seen an empty _pendingQueue.
+						item.ctr()->increment();
+						repoll_queue.push_back(*item);
+					}
+				}
 			}
 
 			if(k)
@@ -348,9 +404,11 @@ public:
 			if(item->state & statePolling)
 				item->cancelPoll.cancel();
 
-			if(item->state & statePending) {
+			// Items that are currently checked by waitForEvents() are not linked.
+			if((item->state & statePending) && item->is_linked()) {
 				auto qit = _pendingQueue.iterator_to(*item);
 				_pendingQueue.erase(qit);
+				item.ctr()->decrement();
 				item->state &= ~statePending;
 			}
 		}
@@ -446,6 +504,11 @@ Error deleteItem(File *epfile, File *file, int fd, int flags) {
 	return epoll->deleteItem(file, fd);
 }
 
+size_t numItems(File *epfile) {
+	auto epoll = static_cast<OpenFile *>(epfile);
+	return epoll->numItems();
+}
+
 async::result<size_t> wait(File *epfile, struct epoll_event *events,
 		size_t max_events, async::cancellation_token cancellation) {
 	auto epoll = static_cast<OpenFile *>(epfile);
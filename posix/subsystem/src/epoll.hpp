@@ -12,6 +12,8 @@ Error addItem(File *epfile, Process *process, smarter::shared_ptr<File> file, in
 		int flags, uint64_t cookie);
 Error modifyItem(File *epfile, File *file, int fd, int flags, uint64_t cookie);
 Error deleteItem(File *epfile, File *file, int fd, int flags);
+// Number of items that are registered with the epoll instance.
+size_t numItems(File *epfile);
 
 async::result<size_t> wait(File *epfile, struct epoll_event *events,
 		size_t max_events, async::cancellation_token cancellation = {});
@@ -350,6 +350,8 @@ public:
 
 	async::result<frg::expected<Error>> obstruct() override {
 		assert(_owner);
+		LinkCache::global().beginModification(_owner.get());
+
 		managarm::fs::CntRequest req;
 		req.set_req_type(managarm::fs::CntReqType::NODE_OBSTRUCT_LINK);
 		req.set_link_name(_name);
@@ -368,6 +370,8 @@ public:
 		HEL_CHECK(send_req.error());
 		HEL_CHECK(recv_resp.error());
 
+		LinkCache::global().invalidate(_owner.get(), _name);
+
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
@@ -448,6 +452,15 @@ private:
 		return true;
 	}
 
+	// All modifications of the directory go through the POSIX subsystem;
+	// hence it is safe to cache lookups as long as we invalidate them below.
+	// Modifications bump the cache generation before the request is sent and
+	// invalidate the entry after the server replied; lookups that race with
+	// them do not populate the cache (see LinkCache).
+	bool hasLinkCache() override {
+		return true;
+	}
+
 	async::result<frg::expected<Error, std::pair<std::shared_ptr<FsLink>, size_t>>>
 	traverseLinks(std::deque<std::string> path) override {
 		managarm::fs::CntRequest req;
@@ -517,6 +530,8 @@ private:
 
 	async::result<std::variant<Error, std::shared_ptr<FsLink>>>
 	mkdir(std::string name) override {
+		LinkCache::global().beginModification(this);
+
 		managarm::fs::CntRequest req;
 		req.set_req_type(managarm::fs::CntReqType::NODE_MKDIR);
 		req.set_path(name);
@@ -534,6 +549,8 @@ private:
 		HEL_CHECK(sendReq.error());
 		HEL_CHECK(recvResp.error());
 
+		LinkCache::global().invalidate(this, name);
+
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recvResp.data(), recvResp.length());
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
@@ -549,6 +566,8 @@ private:
 
 	async::result<std::variant<Error, std::shared_ptr<FsLink>>>
 	symlink(std::string name, std::string path) override {
+		LinkCache::global().beginModification(this);
+
 		managarm::fs::CntRequest req;
 		req.set_req_type(managarm::fs::CntReqType::NODE_SYMLINK);
 		req.set_name_length(name.size());
@@ -571,6 +590,8 @@ private:
 		HEL_CHECK(sendTarget.error());
 		HEL_CHECK(recvResp.error());
 
+		LinkCache::global().invalidate(this, name);
+
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recvResp.data(), recvResp.length());
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
@@ -643,6 +664,8 @@ private:
 		helix::RecvInline recv_resp;
 		helix::PullDescriptor pull_node;
 
+		LinkCache::global().beginModification(this);
+
 		managarm::fs::CntRequest req;
 		req.set_req_type(managarm::fs::CntReqType::NODE_LINK);
 		req.set_path(name);
@@ -659,6 +682,8 @@ private:
 		HEL_CHECK(send_req.error());
 		HEL_CHECK(recv_resp.error());
 
+		LinkCache::global().invalidate(this, name);
+
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
@@ -683,6 +708,8 @@ private:
 		helix::SendBuffer send_req;
 		helix::RecvInline recv_resp;
 
+		LinkCache::global().beginModification(this);
+
 		managarm::fs::CntRequest req;
 		req.set_req_type(managarm::fs::CntReqType::NODE_UNLINK);
 		req.set_path(name);
@@ -697,6 +724,8 @@ private:
 		HEL_CHECK(send_req.error());
 		HEL_CHECK(recv_resp.error());
 
+		LinkCache::global().invalidate(this, name);
+
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		if(resp.error() == managarm::fs::Errors::FILE_NOT_FOUND)
@@ -706,6 +735,8 @@ private:
 	}
 
 	async::result<frg::expected<Error>> rmdir(std::string name) override {
+		LinkCache::global().beginModification(this);
+
 		managarm::fs::CntRequest req;
 		req.set_req_type(managarm::fs::CntReqType::NODE_RMDIR);
 		req.set_path(name);
@@ -722,6 +753,8 @@ private:
 		HEL_CHECK(send_req.error());
 		HEL_CHECK(recv_resp.error());
 
+		LinkCache::global().invalidate(this, name);
+
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
@@ -846,6 +879,10 @@ async::result<frg::expected<Error, std::shared_ptr<FsLink>>>
 	req.set_old_name(source->getName());
 	req.set_new_name(name);
 
+	auto oldName = source->getName();
+	LinkCache::global().beginModification(source_node);
+	LinkCache::global().beginModification(target_node);
+
 	auto [offer, send_head, send_tail, recv_resp] = co_await helix_ng::exchangeMsgs(
 		_lane,
 		helix_ng::offer(
@@ -859,6 +896,9 @@ async::result<frg::expected<Error, std::shared_ptr<FsLink>>>
 	HEL_CHECK(send_tail.error());
 	HEL_CHECK(recv_resp.error());
 
+	LinkCache::global().invalidate(source_node, oldName);
+	LinkCache::global().invalidate(target_node, name);
+
 	managarm::fs::SvrResponse resp;
 	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 	if(resp.error() == managarm::fs::Errors::SUCCESS) {
@@ -1,9 +1,29 @@
 #include "extern_socket.hpp"
 
+#include <iostream>
+
 #include "fs.bragi.hpp"
 #include "protocols/fs/client.hpp"
 
 namespace {
+
+Error translateFsError(managarm::fs::Errors error) {
+	switch(error) {
+	case managarm::fs::Errors::WOULD_BLOCK: return Error::wouldBlock;
+	case managarm::fs::Errors::ILLEGAL_ARGUMENT: return Error::illegalArguments;
+	case managarm::fs::Errors::ILLEGAL_OPERATION_TARGET: return Error::illegalOperationTarget;
+	case managarm::fs::Errors::NOT_CONNECTED: return Error::notConnected;
+	case managarm::fs::Errors::BROKEN_PIPE: return Error::brokenPipe;
+	case managarm::fs::Errors::ACCESS_DENIED: return Error::accessDenied;
+	case managarm::fs::Errors::INSUFFICIENT_PERMISSIONS: return Error::insufficientPermissions;
+	case managarm::fs::Errors::NO_SPACE_LEFT: return Error::noSpaceLeft;
+	default:
+		std::cout << "posix: Unexpected error " << static_cast<int>(error)
+				<< " from extern socket" << std::endl;
+		return Error::illegalArguments;
+	}
+}
+
 struct Socket : File {
 	Socket(helix::UniqueLane sockLane)
 	: File{StructName::get("extern-socket")},
@@ -24,6 +44,41 @@ struct Socket : File {
 		co_return resultOrError.value();
 	}
 
+	async::result<frg::expected<Error, AcceptResult>> accept(Process *) override {
+		managarm::fs::CntRequest req;
+		req.set_req_type(managarm::fs::CntReqType::PT_ACCEPT);
+
+		auto req_data = req.SerializeAsString();
+		char buffer[128];
+
+		auto [offer, send_req, recv_resp] = co_await helix_ng::exchangeMsgs(
+			_file.getLane(),
+			helix_ng::offer(
+				helix_ng::sendBuffer(req_data.data(), req_data.size()),
+				helix_ng::recvBuffer(buffer, sizeof(buffer))
+			)
+		);
+		HEL_CHECK(offer.error());
+		HEL_CHECK(send_req.error());
+		HEL_CHECK(recv_resp.error());
+
+		managarm::fs::SvrResponse resp;
+		resp.ParseFromArray(buffer, recv_resp.actualLength());
+		if(resp.error() != managarm::fs::Errors::SUCCESS)
+			co_return translateFsError(resp.error());
+
+		// The lane of the new connection follows the response on the same conversation.
+		auto [recv_lane] = co_await helix_ng::exchangeMsgs(
+			offer.descriptor(),
+			helix_ng::pullDescriptor()
+		);
+		HEL_CHECK(recv_lane.error());
+
+		auto file = smarter::make_shared<Socket>(recv_lane.descriptor());
+		file->setupWeakFile(file);
+		co_return File::constructHandle(file);
+	}
+
 	helix::BorrowedDescriptor getPassthroughLane() override {
 		return _file.getLane();
 	}
@@ -109,6 +109,10 @@ async::result<frg::expected<Error, std::pair<std::shared_ptr<FsLink>, size_t>>>
 	throw std::runtime_error("traverseLinks() is not implemented for this FsNode");
 }
 
+bool FsNode::hasLinkCache() {
+	return false;
+}
+
 async::result<Error> FsNode::chmod(int mode) {
 	std::cout << "\e[31m" "posix: chmod() is not implemented for this FsNode" "\e[39m" << std::endl;
 	co_return Error::accessDenied;
@@ -132,3 +136,63 @@ void FsNode::notifyObservers(uint32_t events, const std::string &name, uint32_t
 	}
 }
 
+
+// --------------------------------------------------------
+// LinkCache implementation.
+// --------------------------------------------------------
+
+LinkCache &LinkCache::global() {
+	static LinkCache cache{4096};
+	return cache;
+}
+
+std::optional<std::shared_ptr<FsLink>> LinkCache::lookup(FsNode *directory,
+		const std::string &name) {
+	auto it = _map.find(Key{directory, name});
+	if(it == _map.end()) {
+		_numMisses++;
+		return std::nullopt;
+	}
+
+	_numHits++;
+	_lru.splice(_lru.begin(), _lru, it->second);
+	return it->second->link;
+}
+
+void LinkCache::insert(std::shared_ptr<FsNode> directory, std::string name,
+		std::shared_ptr<FsLink> link, uint64_t generation) {
+	// The lookup raced with a modification; its result may be stale.
+	if(directory->_linkCacheGeneration != generation)
+		return;
+
+	Key key{directory.get(), std::move(name)};
+	if(auto it = _map.find(key); it != _map.end()) {
+		it->second->link = std::move(link);
+		_lru.splice(_lru.begin(), _lru, it->second);
+		return;
+	}
+
+	_lru.push_front(Entry{key, std::move(directory), std::move(link)});
+	_map.insert({std::move(key), _lru.begin()});
+
+	while(_lru.size() > _capacity) {
+		_map.erase(_lru.back().key);
+		_lru.pop_back();
+	}
+}
+
+void LinkCache::beginModification(FsNode *directory) {
+	directory->_linkCacheGeneration++;
+	_globalGeneration++;
+}
+
+void LinkCache::invalidate(FsNode *directory, const std::string &name) {
+	directory->_linkCacheGeneration++;
+	_globalGeneration++;
+
+	auto it = _map.find(Key{directory, name});
+	if(it == _map.end())
+		return;
+	_lru.erase(it->second);
+	_map.erase(it);
+}
@@ -3,6 +3,8 @@
 #include <iostream>
 #include <set>
 #include <deque>
+#include <list>
+#include <optional>
 #include <unordered_map>
 
 #include <async/result.hpp>
@@ -174,6 +176,11 @@ public:
 	virtual bool hasTraverseLinks();
 	virtual async::result<frg::expected<Error, std::pair<std::shared_ptr<FsLink>, size_t>>> traverseLinks(std::deque<std::string> path);
 
+	// If this returns true, the VFS caches the results of name lookups in this directory
+	// (see LinkCache below). The file system must then invalidate cache entries
+	// whenever it changes the directory.
+	virtual bool hasLinkCache();
+
 protected:
 	void notifyObservers(uint32_t inotifyEvents, const std::string &name, uint32_t cookie);
 
@@ -183,6 +190,82 @@ private:
 
 	// Observers, for example for inotify.
 	std::unordered_map<FsObserver *, std::shared_ptr<FsObserver>> _observers;
+
+	// Incremented by LinkCache whenever the directory is modified.
+	friend struct LinkCache;
+	uint64_t _linkCacheGeneration = 0;
+};
+
+// ----------------------------------------------------------------------------
+// LinkCache class.
+// ----------------------------------------------------------------------------
+
+// Caches the results of name lookups keyed by (directory, name).
+// Negative results (i.e., the name does not exist) are cached as nullptr links.
+// Only directories that return true from hasLinkCache() are cached.
+//
+// Lookups can race with modifications of the directory. Hence, each directory has a
+// generation that is incremented before a modification is sent to the file system
+// and again once it completed. Callers take the generation before they start a lookup
+// and insert() drops the result if the generation changed in the meantime.
+struct LinkCache {
+	static LinkCache &global();
+
+	LinkCache(size_t capacity)
+	: _capacity{capacity} { }
+
+	// Returns std::nullopt on cache misses and nullptr for negative entries.
+	std::optional<std::shared_ptr<FsLink>> lookup(FsNode *directory, const std::string &name);
+
+	uint64_t generation(FsNode *directory) {
+		return directory->_linkCacheGeneration;
+	}
+
+	// Incremented whenever any directory is modified.
+	uint64_t globalGeneration() {
+		return _globalGeneration;
+	}
+
+	// Does nothing if the directory was modified since generation(directory) returned
+	// the given value.
+	void insert(std::shared_ptr<FsNode> directory, std::string name, std::shared_ptr<FsLink> link,
+			uint64_t generation);
+
+	// Must be called before the file system is asked to modify the directory.
+	void beginModification(FsNode *directory);
+
+	// Must be called once the modification completed.
+	void invalidate(FsNode *directory, const std::string &name);
+
+	uint64_t numHits() { return _numHits; }
+	uint64_t numMisses() { return _numMisses; }
+
+private:
+	using Key = std::pair<FsNode *, std::string>;
+
+	struct KeyHash {
+		size_t operator() (const Key &key) const {
+			return std::hash<FsNode *>{}(key.first) ^ std::hash<std::string>{}(key.second);
+		}
+	};
+
+	struct Entry {
+		Key key;
+		// Keeps the directory alive such that the key cannot be reused.
+		std::shared_ptr<FsNode> directory;
+		std::shared_ptr<FsLink> link;
+	};
+
+	size_t _capacity;
+
+	// Entries in LRU order (most recently used first).
+	std::list<Entry> _lru;
+	std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> _map;
+
+	uint64_t _globalGeneration = 0;
+
+	uint64_t _numHits = 0;
+	uint64_t _numMisses = 0;
 };
 
 // ----------------------------------------------------------------------------
@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -16,6 +17,7 @@
 
 #include <async/algorithm.hpp>
 #include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
 #include <protocols/mbus/client.hpp>
 #include <helix/timer.hpp>
 
@@ -67,6 +69,15 @@ namespace {
 	constexpr bool logCleanup = false;
 
 	constexpr bool debugFaults = false;
+
+	// Maximal number of requests per posix lane that are handled concurrently.
+	constexpr size_t maxRequestsInFlight = 16;
+
+	// Same limit as on Linux (INT_MAX / sizeof(struct epoll_event)).
+	constexpr uint32_t maxEpollEvents = INT_MAX / sizeof(struct epoll_event);
+
+	// Shared anonymous mappings that are a multiple of this size are backed by huge pages.
+	constexpr size_t hugePageSize = 0x200000;
 }
 
 std::map<
@@ -694,34 +705,10 @@ async::result<void> serveSignals(std::shared_ptr<Process> self,
 	generation->signalsDone.raise();
 }
 
-async::result<void> serveRequests(std::shared_ptr<Process> self,
-		std::shared_ptr<Generation> generation) {
-	async::cancellation_token cancellation = generation->cancelServe;
-
-	async::cancellation_callback cancel_callback{cancellation, [&] {
-		HEL_CHECK(helShutdownLane(self->posixLane().getHandle()));
-	}};
-
-	while(true) {
-		auto [accept, recv_head] = co_await helix_ng::exchangeMsgs(
-				self->posixLane(),
-				helix_ng::accept(
-					helix_ng::recvInline()
-				)
-			);
-
-		if(accept.error() == kHelErrLaneShutdown)
-			break;
-		HEL_CHECK(accept.error());
-
-		if(recv_head.error() == kHelErrBufferTooSmall) {
-			std::cout << "posix: Rejecting request due to RecvInline overflow" << std::endl;
-			continue;
-		}
-		HEL_CHECK(recv_head.error());
-
-		auto conversation = accept.descriptor();
-
+async::result<void> handleRequest(std::shared_ptr<Process> self,
+		helix::UniqueDescriptor conversation, std::vector<char> head) {
+	// The body keeps the indentation of the loop in serveRequests() that it was split from.
+	{
 		auto sendErrorResponse = [&conversation]<typename Message = managarm::posix::SvrResponse>(managarm::posix::Errors err) -> async::result<void> {
 			Message resp;
 			resp.set_error(err);
@@ -734,26 +721,25 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			HEL_CHECK(send_resp.error());
 		};
 
-		auto preamble = bragi::read_preamble(recv_head);
+		auto preamble = bragi::read_preamble(head);
 		assert(!preamble.error());
-		recv_head.reset();
 
 		managarm::posix::CntRequest req;
 		if (preamble.id() == managarm::posix::CntRequest::message_id) {
-			auto o = bragi::parse_head_only<managarm::posix::CntRequest>(recv_head);
+			auto o = bragi::parse_head_only<managarm::posix::CntRequest>(head);
 			if (!o) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			req = *o;
 		}
 
 		if(preamble.id() == bragi::message_id<managarm::posix::GetTidRequest>) {
-			auto req = bragi::parse_head_only<managarm::posix::GetTidRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::GetTidRequest>(head);
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 			if(logRequests)
 				std::cout << "posix: GET_TID" << std::endl;
@@ -783,11 +769,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			co_await transmit.async_wait();
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::GetPpidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetPpidRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::GetPpidRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -804,11 +790,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::GetUidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetUidRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::GetUidRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -825,11 +811,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::SetUidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SetUidRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::SetUidRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -844,11 +830,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
 			}
 		}else if(preamble.id() == managarm::posix::GetEuidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetEuidRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::GetEuidRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -865,11 +851,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::SetEuidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SetEuidRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::SetEuidRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -884,11 +870,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
 			}
 		}else if(preamble.id() == managarm::posix::GetGidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetGidRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::GetGidRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -905,11 +891,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::GetEgidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetEgidRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::GetEgidRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -926,11 +912,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::SetGidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SetGidRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::SetGidRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -945,11 +931,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
 			}
 		}else if(preamble.id() == managarm::posix::SetEgidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SetEgidRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::SetEgidRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -970,7 +956,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(req.flags() & ~(WNOHANG | WUNTRACED | WCONTINUED)) {
 				std::cout << "posix: WAIT invalid flags: " << req.flags() << std::endl;
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
+				co_return;
 			}
 
 			if(req.flags() & WUNTRACED)
@@ -1033,10 +1019,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			co_await transmit.async_wait();
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == bragi::message_id<managarm::posix::VmMapRequest>) {
-			auto req = bragi::parse_head_only<managarm::posix::VmMapRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::VmMapRequest>(head);
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 			if(logRequests)
 				std::cout << "posix: VM_MAP size: " << (void *)(size_t)req->size() << std::endl;
@@ -1045,7 +1031,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			if(req->mode() & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
+				co_return;
 			}
 
 			uint32_t nativeFlags = 0;
@@ -1080,8 +1066,12 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 							{}, nullptr,
 							0, req->size(), true, nativeFlags);
 				}else{
+					uint32_t allocFlags = 0;
+					if(!(req->size() & (hugePageSize - 1)))
+						allocFlags |= kHelAllocHugePages;
+
 					HelHandle handle;
-					HEL_CHECK(helAllocateMemory(req->size(), 0, nullptr, &handle));
+					HEL_CHECK(helAllocateMemory(req->size(), allocFlags, nullptr, &handle));
 
 					address = co_await self->vmContext()->mapFile(hint,
 							helix::UniqueDescriptor{handle}, nullptr,
@@ -1137,7 +1127,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
 				HEL_CHECK(send_resp.error());
-				continue;
+				co_return;
 			}
 
 			uint32_t native_flags = 0;
@@ -1182,11 +1172,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recv_tail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::MountRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::MountRequest>(head, tail);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -1198,10 +1188,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!resolveResult) {
 				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -1226,10 +1216,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				if(!sourceResult) {
 					if(sourceResult.error() == protocols::fs::Error::fileNotFound) {
 						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
+						co_return;
 					} else if(sourceResult.error() == protocols::fs::Error::notDirectory) {
 						co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-						continue;
+						co_return;
 					} else {
 						std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 						co_return;
@@ -1266,10 +1256,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!pathResult) {
 				if(pathResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(pathResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -1297,10 +1287,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!pathResult) {
 				if(pathResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(pathResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -1334,7 +1324,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
 				HEL_CHECK(send_resp.error());
-				continue;
+				co_return;
 			}
 
 			self->fsContext()->changeWorkingDirectory({file->associatedMount(),
@@ -1362,7 +1352,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				} else {
 					std::cout << "posix: ACCESSAT unknown flag is unimplemented: " << req.flags() << std::endl;
 					co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-					continue;
+					co_return;
 				}
 			}
 
@@ -1373,7 +1363,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				if(!file) {
 					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
+					co_return;
 				}
 
 				relative_to = {file->associatedMount(), file->associatedLink()};
@@ -1384,10 +1374,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!pathResult) {
 				if(pathResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(pathResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -1420,7 +1410,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
 				HEL_CHECK(send_resp.error());
-				continue;
+				co_return;
 			}
 
 			if(req.fd() == AT_FDCWD) {
@@ -1430,7 +1420,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				if (!file) {
 					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
+					co_return;
 				}
 
 				relative_to = {file->associatedMount(), file->associatedLink()};
@@ -1443,10 +1433,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!resolveResult) {
 				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -1455,7 +1445,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			if(!resolver.hasComponent()) {
 				co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-				continue;
+				co_return;
 			}
 
 			auto parent = resolver.currentLink()->getTarget();
@@ -1464,7 +1454,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			auto exists = existsResult.value();
 			if(exists) {
 				co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-				continue;
+				co_return;
 			}
 
 			auto result = co_await parent->mkdir(resolver.nextComponent());
@@ -1495,11 +1485,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recv_tail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::MkfifoAtRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::MkfifoAtRequest>(head, tail);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests || logPaths)
@@ -1507,7 +1497,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			if (!req->path().size()) {
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
+				co_return;
 			}
 
 			ViewPath relative_to;
@@ -1521,7 +1511,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				if (!file) {
 					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
+					co_return;
 				}
 
 				relative_to = {file->associatedMount(), file->associatedLink()};
@@ -1534,10 +1524,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!resolveResult) {
 				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -1547,7 +1537,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			auto parent = resolver.currentLink()->getTarget();
 			if(co_await parent->getLink(resolver.nextComponent())) {
 				co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-				continue;
+				co_return;
 			}
 
 			auto result = co_await parent->mkfifo(resolver.nextComponent(), req->mode());
@@ -1565,14 +1555,14 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recv_tail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::LinkAtRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::LinkAtRequest>(head, tail);
 
 			if(logRequests)
 				std::cout << "posix: LINKAT" << std::endl;
 
 			if(req->flags() & ~(AT_EMPTY_PATH | AT_SYMLINK_FOLLOW)) {
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
+				co_return;
 			}
 
 			if(req->flags() & AT_EMPTY_PATH) {
@@ -1593,7 +1583,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				if(!file) {
 					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
+					co_return;
 				}
 
 				relative_to = {file->associatedMount(), file->associatedLink()};
@@ -1606,10 +1596,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!resolveResult) {
 				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -1623,7 +1613,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				if(!file) {
 					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
+					co_return;
 				}
 
 				relative_to = {file->associatedMount(), file->associatedLink()};
@@ -1637,13 +1627,13 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!new_resolveResult) {
 				if(new_resolveResult.error() == protocols::fs::Error::illegalOperationTarget) {
 					co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_OPERATION_TARGET);
-					continue;
+					co_return;
 				} else if(new_resolveResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(new_resolveResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -1668,11 +1658,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recv_tail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::SymlinkAtRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::SymlinkAtRequest>(head, tail);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests || logPaths)
@@ -1683,7 +1673,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			if (!req->path().size()) {
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
+				co_return;
 			}
 
 			if(req->fd() == AT_FDCWD) {
@@ -1692,7 +1682,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				file = self->fileContext()->getFile(req->fd());
 				if (!file) {
 					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
+					co_return;
 				}
 
 				relativeTo = {file->associatedMount(), file->associatedLink()};
@@ -1706,10 +1696,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!resolveResult) {
 				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -1721,7 +1711,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(auto error = std::get_if<Error>(&result); error) {
 				assert(*error == Error::illegalOperationTarget);
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
+				co_return;
 			}
 
 			managarm::posix::SvrResponse resp;
@@ -1740,11 +1730,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recv_tail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::RenameAtRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::RenameAtRequest>(head, tail);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests || logPaths)
@@ -1761,7 +1751,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				if (!file) {
 					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
+					co_return;
 				}
 
 				relative_to = {file->associatedMount(), file->associatedLink()};
@@ -1774,13 +1764,13 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!resolveResult) {
 				if(resolveResult.error() == protocols::fs::Error::isDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
-					continue;
+					co_return;
 				} else if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -1794,7 +1784,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				if (!file) {
 					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
+					co_return;
 				}
 
 				relative_to = {file->associatedMount(), file->associatedLink()};
@@ -1808,13 +1798,13 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!new_resolveResult) {
 				if(new_resolveResult.error() == protocols::fs::Error::isDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
-					continue;
+					co_return;
 				} else if(new_resolveResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(new_resolveResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -1829,7 +1819,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!result) {
 				assert(result.error() == Error::alreadyExists);
 				co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-				continue;
+				co_return;
 			}
 
 			co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
@@ -1841,11 +1831,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recv_tail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::FstatAtRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::FstatAtRequest>(head, tail);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -1862,7 +1852,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				if (!file) {
 					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
+					co_return;
 				}
 
 				relative_to = {file->associatedMount(), file->associatedLink()};
@@ -1883,10 +1873,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				if(!resolveResult) {
 					if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
+						co_return;
 					} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 						co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-						continue;
+						co_return;
 					} else {
 						std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 						co_return;
@@ -1965,7 +1955,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recv_tail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::FchmodAtRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::FchmodAtRequest>(head, tail);
 
 			if(logRequests)
 				std::cout << "posix: FCHMODAT request" << std::endl;
@@ -1981,7 +1971,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				if (!file) {
 					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
+					co_return;
 				}
 
 				relative_to = {file->associatedMount(), file->associatedLink()};
@@ -1990,12 +1980,12 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(req->flags()) {
 				if(req->flags() & AT_SYMLINK_NOFOLLOW) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_SUPPORTED);
-					continue;
+					co_return;
 				} else if(req->flags() & AT_EMPTY_PATH) {
 					// Allowed, managarm extension
 				} else {
 					co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-					continue;
+					co_return;
 				}
 			}
 
@@ -2011,10 +2001,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				if(!resolveResult) {
 					if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
+						co_return;
 					} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 						co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-						continue;
+						co_return;
 					} else {
 						std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 						co_return;
@@ -2035,11 +2025,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recv_tail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::UtimensAtRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::UtimensAtRequest>(head, tail);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests || logPaths)
@@ -2054,7 +2044,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			} else {
 				if(req->flags() & ~AT_SYMLINK_NOFOLLOW) {
 					co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-					continue;
+					co_return;
 				}
 
 				if(req->flags() & AT_SYMLINK_NOFOLLOW) {
@@ -2067,7 +2057,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					file = self->fileContext()->getFile(req->fd());
 					if (!file) {
 						co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-						continue;
+						co_return;
 					}
 
 					relativeTo = {file->associatedMount(), file->associatedLink()};
@@ -2080,10 +2070,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				if(!resolveResult) {
 					if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
+						co_return;
 					} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 						co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-						continue;
+						co_return;
 					} else {
 						std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 						co_return;
@@ -2116,7 +2106,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 							helix::action(&send_data, nullptr, 0));
 					co_await transmit.async_wait();
 					HEL_CHECK(send_resp.error());
-					continue;
+					co_return;
 				} else if(pathResult.error() == protocols::fs::Error::notDirectory) {
 					managarm::posix::SvrResponse resp;
 					resp.set_error(managarm::posix::Errors::NOT_A_DIRECTORY);
@@ -2127,7 +2117,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 							helix::action(&send_data, nullptr, 0));
 					co_await transmit.async_wait();
 					HEL_CHECK(send_resp.error());
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -2169,10 +2159,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recvTail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::OpenAtRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::OpenAtRequest>(head, tail);
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 			if(logRequests || logPaths)
 				std::cout << "posix: OPENAT path: " << req->path() << std::endl;
@@ -2189,7 +2179,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					| managarm::posix::OpenFlags::OF_NOCTTY))) {
 				std::cout << "posix: OPENAT flags not recognized: " << req->flags() << std::endl;
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
+				co_return;
 			}
 
 			SemanticFlags semantic_flags = 0;
@@ -2214,7 +2204,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				if (!file) {
 					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
+					co_return;
 				}
 
 				relative_to = {file->associatedMount(), file->associatedLink()};
@@ -2230,13 +2220,13 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					if(resolveResult.error() == protocols::fs::Error::isDirectory) {
 						// TODO: Verify additional constraints for sending EISDIR.
 						co_await sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
-						continue;
+						co_return;
 					} else if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
+						co_return;
 					} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 						co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-						continue;
+						co_return;
 					} else {
 						std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 						co_return;
@@ -2253,7 +2243,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				if(tail) {
 					if(req->flags() & managarm::posix::OpenFlags::OF_EXCLUSIVE) {
 						co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-						continue;
+						co_return;
 					}else{
 						auto fileResult = co_await tail->getTarget()->open(
 											resolver.currentView(), std::move(tail),
@@ -2267,7 +2257,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					auto node = co_await directory->superblock()->createRegular();
 					if (!node) {
 						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
+						co_return;
 					}
 					// Due to races, link() can fail here.
 					// TODO: Implement a version of link() that eithers links the new node
@@ -2287,13 +2277,13 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					if(resolveResult.error() == protocols::fs::Error::isDirectory) {
 						// TODO: Verify additional constraints for sending EISDIR.
 						co_await sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
-						continue;
+						co_return;
 					} else if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
+						co_return;
 					} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 						co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-						continue;
+						co_return;
 					} else {
 						std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 						co_return;
@@ -2311,10 +2301,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					if(!fileResult) {
 						if(fileResult.error() == Error::noBackingDevice) {
 							co_await sendErrorResponse(managarm::posix::Errors::NO_BACKING_DEVICE);
-							continue;
+							co_return;
 						} else if(fileResult.error() == Error::illegalArguments) {
 							co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-							continue;
+							co_return;
 						} else {
 							std::cout << "posix: Unexpected failure from open()" << std::endl;
 							co_return;
@@ -2329,7 +2319,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				if(logRequests)
 					std::cout << "posix:     OPEN failed: file not found" << std::endl;
 				co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-				continue;
+				co_return;
 			}
 
 			if(file->isTerminal() &&
@@ -2362,10 +2352,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(sendResp.error());
 		}else if(preamble.id() == bragi::message_id<managarm::posix::CloseRequest>) {
-			auto req = bragi::parse_head_only<managarm::posix::CloseRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::CloseRequest>(head);
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 			if(logRequests)
 				std::cout << "posix: CLOSE file descriptor " << req->fd() << std::endl;
@@ -2397,7 +2387,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
 				HEL_CHECK(send_resp.error());
-				continue;
+				co_return;
 			}
 
 			if(req.flags() & ~(managarm::posix::OpenFlags::OF_CLOEXEC)) {
@@ -2411,7 +2401,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
 				HEL_CHECK(send_resp.error());
-				continue;
+				co_return;
 			}
 
 			int newfd = self->fileContext()->attachFile(file,
@@ -2434,7 +2424,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto file = self->fileContext()->getFile(req.fd());
 
-			if (!file || req.newfd() < 0) {
+			if (!file || req.newfd() < 0 || req.newfd() >= FileContext::maxFileDescriptors) {
 				helix::SendBuffer send_resp;
 
 				managarm::posix::SvrResponse resp;
@@ -2445,7 +2435,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
 				HEL_CHECK(send_resp.error());
-				continue;
+				co_return;
 			}
 
 			if(req.flags()) {
@@ -2459,7 +2449,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
 				HEL_CHECK(send_resp.error());
-				continue;
+				co_return;
 			}
 
 			self->fileContext()->attachFile(req.newfd(), file);
@@ -2475,10 +2465,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			co_await transmit.async_wait();
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == bragi::message_id<managarm::posix::IsTtyRequest>) {
-			auto req = bragi::parse_head_only<managarm::posix::IsTtyRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::IsTtyRequest>(head);
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 			if(logRequests)
 				std::cout << "posix: IS_TTY" << std::endl;
@@ -2486,7 +2476,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			auto file = self->fileContext()->getFile(req->fd());
 			if(!file) {
 				co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_FD);
-				continue;
+				co_return;
 			}
 
 			helix::SendBuffer send_resp;
@@ -2512,14 +2502,14 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			auto file = self->fileContext()->getFile(req.fd());
 			if(!file) {
 			    co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_FD);
-			    continue;
+			    co_return;
 			}
 			
 			auto ttynameResult = co_await file->ttyname();
 			if(!ttynameResult) {
 			    assert(ttynameResult.error() == Error::notTerminal);
 			    co_await sendErrorResponse(managarm::posix::Errors::NOT_A_TTY);
-			    continue;
+			    co_return;
 			}
 
 			resp.set_path(ttynameResult.value());
@@ -2560,11 +2550,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recv_tail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::UnlinkAtRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::UnlinkAtRequest>(head, tail);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests || logPaths)
@@ -2590,7 +2580,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				if (!file) {
 					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
+					co_return;
 				}
 
 				relative_to = {file->associatedMount(), file->associatedLink()};
@@ -2605,13 +2595,13 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				if(resolveResult.error() == protocols::fs::Error::isDirectory) {
 					// TODO: Only when AT_REMOVEDIR is not specified, fix this when flag handling is implemented.
 					co_await sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
-					continue;
+					co_return;
 				} else if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -2623,13 +2613,13 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			auto owner = target_link->getOwner();
 			if(!owner) {
 				co_await sendErrorResponse(managarm::posix::Errors::RESOURCE_IN_USE);
-				continue;
+				co_return;
 			}
 			auto result = co_await owner->unlink(target_link->getName());
 			if(!result) {
 				if(result.error() == Error::noSuchFile) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				}else{
 					std::cout << "posix: Unexpected failure from unlink()" << std::endl;
 					co_return;
@@ -2645,11 +2635,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recv_tail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::RmdirRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::RmdirRequest>(head, tail);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests || logPaths)
@@ -2666,10 +2656,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!resolveResult) {
 				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -2702,7 +2692,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
 				HEL_CHECK(send_resp.error());
-				continue;
+				co_return;
 			}
 
 			int flags = 0;
@@ -2725,12 +2715,12 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(req.flags() & ~FD_CLOEXEC) {
 				std::cout << "posix: FD_SET_FLAGS unknown flags: " << req.flags() << std::endl;
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
+				co_return;
 			}
 			int closeOnExec = req.flags() & FD_CLOEXEC;
 			if(self->fileContext()->setDescriptor(req.fd(), closeOnExec) != Error::success) {
 				co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_FD);
-				continue;
+				co_return;
 			}
 
 			managarm::posix::SvrResponse resp;
@@ -2741,10 +2731,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					helix_ng::sendBuffer(ser.data(), ser.size()));
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == bragi::message_id<managarm::posix::IoctlFioclexRequest>) {
-			auto req = bragi::parse_head_only<managarm::posix::IoctlFioclexRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::IoctlFioclexRequest>(head);
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -2752,7 +2742,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			if(self->fileContext()->setDescriptor(req->fd(), true) != Error::success) {
 				co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_FD);
-				continue;
+				co_return;
 			}
 
 			managarm::posix::SvrResponse resp;
@@ -2784,7 +2774,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 						helix::action(&send_resp, ser.data(), ser.size()));
 				co_await transmit.async_wait();
 				HEL_CHECK(send_resp.error());
-				continue;
+				co_return;
 			}
 
 			SignalHandler saved_handler;
@@ -2886,7 +2876,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			if(self->pgPointer()->getSession()->getSessionId() == self->pid()) {
 				co_await sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
-				continue;
+				co_return;
 			}
 
 			auto session = TerminalSession::initializeNewSession(self.get());
@@ -2899,11 +2889,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					helix_ng::sendBuffer(ser.data(), ser.size()));
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::SocketRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SocketRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::SocketRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -2946,11 +2936,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::SockpairRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SockpairRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::SockpairRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -2985,11 +2975,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::AcceptRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::AcceptRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::AcceptRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -2998,14 +2988,30 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			auto sockfile = self->fileContext()->getFile(req->fd());
 			if(!sockfile) {
 				co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-				continue;
+				co_return;
 			}
 
 			auto newfileResult = co_await sockfile->accept(self.get());
 			if(!newfileResult) {
-				assert(newfileResult.error() == Error::wouldBlock);
-				co_await sendErrorResponse(managarm::posix::Errors::WOULD_BLOCK);
-				continue;
+				switch(newfileResult.error()) {
+				case Error::wouldBlock:
+					co_await sendErrorResponse(managarm::posix::Errors::WOULD_BLOCK);
+					break;
+				case Error::illegalOperationTarget:
+					co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_OPERATION_TARGET);
+					break;
+				case Error::insufficientPermissions:
+					co_await sendErrorResponse(managarm::posix::Errors::INSUFFICIENT_PERMISSION);
+					break;
+				case Error::accessDenied:
+					co_await sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
+					break;
+				default:
+					// Like Linux, accept() on sockets that are not listening fails with EINVAL.
+					co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+					break;
+				}
+				co_return;
 			}
 			auto newfile = newfileResult.value();
 			auto fd = self->fileContext()->attachFile(std::move(newfile));
@@ -3072,22 +3078,23 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				assert(ret == Error::success);
 			}
 			if(errorOut)
-				continue;
+				co_return;
 
-			struct epoll_event events[16];
+			// Each FD yields at most one event.
+			std::vector<struct epoll_event> events(std::max(fdsToEvents.size(), size_t(1)));
 			size_t k;
 			if(req.timeout() < 0) {
-				k = co_await epoll::wait(epfile.get(), events, 16);
+				k = co_await epoll::wait(epfile.get(), events.data(), events.size());
 			}else if(!req.timeout()) {
 				// Do not bother to set up a timer for zero timeouts.
 				async::cancellation_event cancel_wait;
 				cancel_wait.cancel();
-				k = co_await epoll::wait(epfile.get(), events, 16, cancel_wait);
+				k = co_await epoll::wait(epfile.get(), events.data(), events.size(), cancel_wait);
 			}else{
 				assert(req.timeout() > 0);
 				async::cancellation_event cancel_wait;
 				helix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait};
-				k = co_await epoll::wait(epfile.get(), events, 16, cancel_wait);
+				k = co_await epoll::wait(epfile.get(), events.data(), events.size(), cancel_wait);
 				co_await timer.retire();
 			}
 
@@ -3151,7 +3158,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			auto file = self->fileContext()->getFile(req.newfd());
 			if(!file || !epfile) {
 				co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-				continue;
+				co_return;
 			}
 
 			auto locked = file->weakFile().lock();
@@ -3160,7 +3167,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					std::move(locked), req.newfd(), req.flags(), req.cookie());
 			if(ret == Error::alreadyExists) {
 				co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-				continue;
+				co_return;
 			}
 			assert(ret == Error::success);
 
@@ -3187,7 +3194,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					req.flags(), req.cookie());
 			if(ret == Error::noSuchFile) {
 				co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-				continue;
+				co_return;
 			}
 			assert(ret == Error::success);
 
@@ -3210,13 +3217,13 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!epfile || !file) {
 				std::cout << "posix: Illegal FD for EPOLL_DELETE" << std::endl;
 				co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-				continue;
+				co_return;
 			}
 
 			Error ret = epoll::deleteItem(epfile.get(), file.get(), req.newfd(), req.flags());
 			if(ret == Error::noSuchFile) {
 				co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-				continue;
+				co_return;
 			}
 			assert(ret == Error::success);
 
@@ -3239,28 +3246,34 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			auto epfile = self->fileContext()->getFile(req.fd());
 			if(!epfile) {
 				co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-				continue;
+				co_return;
+			}
+			if(!req.size() || req.size() > maxEpollEvents) {
+				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				co_return;
 			}
 			if(req.sigmask_needed()) {
 				self->setSignalMask(req.sigmask());
 			}
 
-			struct epoll_event events[16];
+			// Return as many events as fit into the caller's buffer. Each item yields
+			// at most one event, hence we do not allocate more than that (req.size() is
+			// controlled by the caller). Surplus events are reported by the next wait.
+			std::vector<struct epoll_event> events(std::max(std::min(epoll::numItems(epfile.get()),
+					static_cast<size_t>(req.size())), size_t(1)));
 			size_t k;
 			if(req.timeout() < 0) {
-				k = co_await epoll::wait(epfile.get(), events,
-						std::min(req.size(), uint32_t(16)));
+				k = co_await epoll::wait(epfile.get(), events.data(), events.size());
 			}else if(!req.timeout()) {
 				// Do not bother to set up a timer for zero timeouts.
 				async::cancellation_event cancel_wait;
 				cancel_wait.cancel();
-				k = co_await epoll::wait(epfile.get(), events,
-						std::min(req.size(), uint32_t(16)), cancel_wait);
+				k = co_await epoll::wait(epfile.get(), events.data(), events.size(), cancel_wait);
 			}else{
 				assert(req.timeout() > 0);
 				async::cancellation_event cancel_wait;
 				helix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait};
-				k = co_await epoll::wait(epfile.get(), events, 16, cancel_wait);
+				k = co_await epoll::wait(epfile.get(), events.data(), events.size(), cancel_wait);
 				co_await timer.retire();
 			}
 			if(req.sigmask_needed()) {
@@ -3273,7 +3286,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			auto ser = resp.SerializeAsString();
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
-					helix::action(&send_data, events, k * sizeof(struct epoll_event)));
+					helix::action(&send_data, events.data(), k * sizeof(struct epoll_event)));
 			co_await transmit.async_wait();
 			HEL_CHECK(send_resp.error());
 		}else if(req.request_type() == managarm::posix::CntReqType::TIMERFD_CREATE) {
@@ -3325,7 +3338,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(req.flags() & ~(managarm::posix::OpenFlags::OF_CLOEXEC
 					| managarm::posix::OpenFlags::OF_NONBLOCK)) {
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
+				co_return;
 			}
 
 			auto file = createSignalFile(req.sigset(),
@@ -3343,11 +3356,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			co_await transmit.async_wait();
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::InotifyCreateRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::InotifyCreateRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::InotifyCreateRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -3377,11 +3390,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recv_tail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::InotifyAddRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::InotifyAddRequest>(head, tail);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			managarm::posix::SvrResponse resp;
@@ -3392,7 +3405,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			auto ifile = self->fileContext()->getFile(req->fd());
 			if(!ifile) {
 				co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-				continue;
+				co_return;
 			}
 
 			PathResolver resolver;
@@ -3402,10 +3415,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!resolveResult) {
 				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -3425,11 +3438,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::EventfdCreateRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::EventfdCreateRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::EventfdCreateRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -3465,11 +3478,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recv_tail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::MknodAtRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::MknodAtRequest>(head, tail);
 
 			if(!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests || logPaths)
@@ -3482,7 +3495,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			if(!req->path().size()) {
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
+				co_return;
 			}
 
 			if(req->dirfd() == AT_FDCWD) {
@@ -3492,7 +3505,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				if(!file) {
 					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
+					co_return;
 				}
 
 				relative_to = {file->associatedMount(), file->associatedLink()};
@@ -3506,10 +3519,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(!resolveResult) {
 				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
 					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
+					co_return;
 				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
 					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
+					co_return;
 				} else {
 					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
 					co_return;
@@ -3522,7 +3535,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			auto exists = existsResult.value();
 			if(exists) {
 				co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-				continue;
+				co_return;
 			}
 
 			VfsType type;
@@ -3554,7 +3567,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				if(!result) {
 					if(result.error() == Error::illegalOperationTarget) {
 						co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-						continue;
+						co_return;
 					} else {
 						std::cout << "posix: Unexpected failure from mkdev()" << std::endl;
 						co_return;
@@ -3565,7 +3578,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				if(!result) {
 					if(result.error() == Error::illegalOperationTarget) {
 						co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-						continue;
+						co_return;
 					} else {
 						std::cout << "posix: Unexpected failure from mkfifo()" << std::endl;
 						co_return;
@@ -3576,7 +3589,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				if(!result) {
 					if(result.error() == Error::illegalOperationTarget) {
 						co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-						continue;
+						co_return;
 					} else {
 						std::cout << "posix: Unexpected failure from mksocket()" << std::endl;
 						co_return;
@@ -3586,7 +3599,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				// TODO: Handle regular files.
 				std::cout << "\e[31mposix: Creating regular files with mknod is not supported.\e[39m" << std::endl;
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
+				co_return;
 			}
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
@@ -3597,11 +3610,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::GetPgidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetPgidRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::GetPgidRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -3612,7 +3625,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				target = Process::findProcess(req->pid());
 				if(!target) {
 					co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_RESOURCE);
-					continue;
+					co_return;
 				}
 			} else {
 				target = self;
@@ -3629,11 +3642,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::SetPgidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SetPgidRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::SetPgidRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -3644,7 +3657,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				target = Process::findProcess(req->pid());
 				if(!target) {
 					co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_RESOURCE);
-					continue;
+					co_return;
 				}
 			} else {
 				target = self;
@@ -3652,19 +3665,19 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			if(target->pgPointer()->getSession() != self->pgPointer()->getSession()) {
 				co_await sendErrorResponse(managarm::posix::Errors::INSUFFICIENT_PERMISSION);
-				continue;
+				co_return;
 			}
 
 			// We can't change the process group ID of the session leader
 			if(target->pid() == target->pgPointer()->getSession()->getSessionId()) {
 				co_await sendErrorResponse(managarm::posix::Errors::INSUFFICIENT_PERMISSION);
-				continue;
+				co_return;
 			}
 
 			if(target->getParent()->pid() == self->pid()) {
 				if(target->didExecute()) {
 					co_await sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
-					continue;
+					co_return;
 				}
 			}
 
@@ -3686,7 +3699,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				} else {
 					// Doesn't exists, and not requesting a make?
 					co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_RESOURCE);
-					continue;
+					co_return;
 				}
 			}
 
@@ -3700,11 +3713,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			HEL_CHECK(send_resp.error());
 		}else if(preamble.id() == managarm::posix::GetSidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetSidRequest>(recv_head);
+			auto req = bragi::parse_head_only<managarm::posix::GetSidRequest>(head);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -3715,7 +3728,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				target = Process::findProcess(req->pid());
 				if(!target) {
 					co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_RESOURCE);
-					continue;
+					co_return;
 				}
 			} else {
 				target = self;
@@ -3739,11 +3752,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				);
 			HEL_CHECK(recv_tail.error());
 
-			auto req = bragi::parse_head_tail<managarm::posix::MemFdCreateRequest>(recv_head, tail);
+			auto req = bragi::parse_head_tail<managarm::posix::MemFdCreateRequest>(head, tail);
 
 			if (!req) {
 				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+				co_return;
 			}
 
 			if(logRequests)
@@ -3751,7 +3764,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			if(req->flags() & ~(MFD_CLOEXEC | MFD_ALLOW_SEALING)) {
 				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
+				co_return;
 			}
 
 			auto link = SpecialLink::makeSpecialLink(VfsType::regular, 0777);
@@ -3789,6 +3802,63 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			HEL_CHECK(send_resp.error());
 		}
 	}
+}
+
+async::result<void> serveRequests(std::shared_ptr<Process> self,
+		std::shared_ptr<Generation> generation) {
+	async::cancellation_token cancellation = generation->cancelServe;
+
+	async::cancellation_callback cancel_callback{cancellation, [&] {
+		HEL_CHECK(helShutdownLane(self->posixLane().getHandle()));
+	}};
+
+	size_t numInFlight = 0;
+	async::recurring_event inFlightChanged;
+
+	while(true) {
+		auto [accept, recv_head] = co_await helix_ng::exchangeMsgs(
+				self->posixLane(),
+				helix_ng::accept(
+					helix_ng::recvInline()
+				)
+			);
+
+		if(accept.error() == kHelErrLaneShutdown)
+			break;
+		HEL_CHECK(accept.error());
+
+		if(recv_head.error() == kHelErrBufferTooSmall) {
+			std::cout << "posix: Rejecting request due to RecvInline overflow" << std::endl;
+			continue;
+		}
+		HEL_CHECK(recv_head.error());
+
+		// Copy the head such that the queue element is recycled even if
+		// the request blocks for a long time.
+		auto data = static_cast<const char *>(recv_head.data());
+		std::vector<char> head{data, data + recv_head.length()};
+		recv_head.reset();
+
+		// Handle the request in its own coroutine such that a blocking request
+		// (e.g., if the thread was interrupted by a signal) does not stall the lane.
+		// Handlers start in the order in which requests arrive.
+		co_await inFlightChanged.async_wait_if([&] {
+			return numInFlight >= maxRequestsInFlight;
+		});
+		numInFlight++;
+		async::detach([] (std::shared_ptr<Process> self, helix::UniqueDescriptor conversation,
+				std::vector<char> head, size_t *numInFlight,
+				async::recurring_event *inFlightChanged) -> async::result<void> {
+			co_await handleRequest(std::move(self), std::move(conversation), std::move(head));
+			(*numInFlight)--;
+			inFlightChanged->raise();
+		}(self, accept.descriptor(), std::move(head), &numInFlight, &inFlightChanged));
+	}
+
+	// Handlers refer to the process; wait until all of them are done.
+	co_await inFlightChanged.async_wait_if([&] {
+		return numInFlight > 0;
+	});
 
 	if(logCleanup)
 		std::cout << "\e[33mposix: Exiting serveRequests()\e[39m" << std::endl;
@@ -3906,5 +3976,9 @@ int main() {
 
 	runInit();
 
+	// All processes are served from this thread. Request handlers share VFS nodes,
+	// open files, the mount tree and signal state across processes and modify them
+	// across co_await without locking; this state has to become thread-safe before
+	// processes can be distributed over multiple dispatcher threads.
 	async::run_forever(helix::currentDispatcher);
 }
@@ -308,6 +308,22 @@ static HelHandle posixMbusClient = [] {
 	return data.mbusLane;
 }();
 
+namespace {
+
+constexpr size_t maxFileTableSize = FileContext::maxFileDescriptors * sizeof(HelHandle);
+
+// Clients map this (never written) memory object to reserve address space for their file table.
+helix::BorrowedDescriptor fileTableReservation() {
+	static helix::UniqueDescriptor memory = [] {
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(maxFileTableSize, 0, nullptr, &handle));
+		return helix::UniqueDescriptor{handle};
+	}();
+	return memory;
+}
+
+} // anonymous namespace
+
 std::shared_ptr<FileContext> FileContext::create() {
 	auto context = std::make_shared<FileContext>();
 
@@ -321,7 +337,9 @@ std::shared_ptr<FileContext> FileContext::create() {
 	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
 			0, 0x1000, kHelMapProtRead | kHelMapProtWrite, &window));
 	context->_fileTableMemory = helix::UniqueDescriptor(memory);
+	context->_fileTableSize = 0x1000;
 	context->_fileTableWindow = reinterpret_cast<HelHandle *>(window);
+	context->_fileTable.resize(0x1000 / sizeof(HelHandle));
 
 	HEL_CHECK(helTransferDescriptor(posixMbusClient,
 			context->_universe.getHandle(), &context->_clientMbusLane));
@@ -342,11 +360,16 @@ std::shared_ptr<FileContext> FileContext::clone(std::shared_ptr<FileContext> ori
 	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
 			0, 0x1000, kHelMapProtRead | kHelMapProtWrite, &window));
 	context->_fileTableMemory = helix::UniqueDescriptor(memory);
+	context->_fileTableSize = 0x1000;
 	context->_fileTableWindow = reinterpret_cast<HelHandle *>(window);
+	context->_fileTable.resize(0x1000 / sizeof(HelHandle));
 
-	for(auto entry : original->_fileTable) {
-		//std::cout << "Clone FD " << entry.first << std::endl;
-		context->attachFile(entry.first, entry.second.file, entry.second.closeOnExec);
+	for(size_t fd = 0; fd < original->_fileTable.size(); fd++) {
+		auto &entry = original->_fileTable[fd];
+		if(!entry.file)
+			continue;
+		//std::cout << "Clone FD " << fd << std::endl;
+		context->attachFile(fd, entry.file, entry.closeOnExec);
 	}
 
 	HEL_CHECK(helTransferDescriptor(posixMbusClient,
@@ -358,29 +381,111 @@ std::shared_ptr<FileContext> FileContext::clone(std::shared_ptr<FileContext> ori
 FileContext::~FileContext() {
 	if(logCleanup)
 		std::cout << "\e[33mposix: FileContext is destructed\e[39m" << std::endl;
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, _fileTableWindow, _fileTableSize));
+}
+
+void *FileContext::mapFileTable(std::shared_ptr<VmContext> vmContext) {
+	void *address;
+	HEL_CHECK(helMapMemory(fileTableReservation().getHandle(),
+			vmContext->getSpace().getHandle(),
+			nullptr, 0, maxFileTableSize, kHelMapProtRead,
+			&address));
+	HEL_CHECK(helMapMemory(_fileTableMemory.getHandle(),
+			vmContext->getSpace().getHandle(),
+			address, 0, _fileTableSize, kHelMapProtRead,
+			&address));
+
+	std::erase_if(_clientMappings, [] (const ClientMapping &mapping) {
+		return mapping.vmContext.expired();
+	});
+	_clientMappings.push_back({vmContext, address});
+	return address;
+}
+
+void FileContext::_growFileTable(int fd) {
+	if(static_cast<size_t>(fd) < _fileTable.size())
+		return;
+	assert(fd < maxFileDescriptors);
+
+	auto newSize = _fileTableSize;
+	while(newSize <= fd * sizeof(HelHandle))
+		newSize *= 2;
+	newSize = std::min(newSize, maxFileTableSize);
+
+	if(logFileAttach)
+		std::cout << "posix: Growing file table to " << newSize << " bytes" << std::endl;
+
+	HEL_CHECK(helResizeMemory(_fileTableMemory.getHandle(), newSize));
+
+	// Move our own window. Clients map the table in place, covering their reservation.
+	void *window;
+	HEL_CHECK(helMapMemory(_fileTableMemory.getHandle(), kHelNullHandle, nullptr,
+			0, newSize, kHelMapProtRead | kHelMapProtWrite, &window));
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, _fileTableWindow, _fileTableSize));
+	_fileTableWindow = reinterpret_cast<HelHandle *>(window);
+
+	std::erase_if(_clientMappings, [] (const ClientMapping &mapping) {
+		return mapping.vmContext.expired();
+	});
+	for(auto &mapping : _clientMappings) {
+		auto vmContext = mapping.vmContext.lock();
+		void *address;
+		HEL_CHECK(helMapMemory(_fileTableMemory.getHandle(),
+				vmContext->getSpace().getHandle(),
+				mapping.address, 0, newSize, kHelMapProtRead,
+				&address));
+		assert(address == mapping.address);
+	}
+
+	_fileTableSize = newSize;
+	_fileTable.resize(newSize / sizeof(HelHandle));
+}
+
+void FileContext::_markUsed(int fd) {
+	size_t w = fd / 64;
+	if(w >= _usedFds.size()) {
+		_usedFds.resize(w + 1);
+		_fullWords.resize(w / 64 + 1);
+	}
+	_usedFds[w] |= uint64_t{1} << (fd % 64);
+	if(_usedFds[w] == ~uint64_t{0})
+		_fullWords[w / 64] |= uint64_t{1} << (w % 64);
+}
+
+void FileContext::_markFree(int fd) {
+	size_t w = fd / 64;
+	_usedFds[w] &= ~(uint64_t{1} << (fd % 64));
+	_fullWords[w / 64] &= ~(uint64_t{1} << (w % 64));
 }
 
 int FileContext::attachFile(smarter::shared_ptr<File, FileHandle> file,
 		bool close_on_exec) {
-	HelHandle handle;
-	HEL_CHECK(helTransferDescriptor(file->getPassthroughLane().getHandle(),
-			_universe.getHandle(), &handle));
-
-	for(int fd = 0; ; fd++) {
-		if(_fileTable.find(fd) != _fileTable.end())
+	// Find the lowest free FD: skip over groups of 64 full words at a time.
+	int fd = -1;
+	for(size_t v = 0; v < _fullWords.size(); v++) {
+		if(_fullWords[v] == ~uint64_t{0})
 			continue;
+		size_t w = v * 64 + __builtin_ctzll(~_fullWords[v]);
+		if(w >= _usedFds.size())
+			break;
+		fd = w * 64 + __builtin_ctzll(~_usedFds[w]);
+		break;
+	}
+	if(fd < 0)
+		fd = _usedFds.size() * 64;
+	if(fd >= maxFileDescriptors)
+		throw std::runtime_error("posix: Out of file descriptors");
 
-		if(logFileAttach)
-			std::cout << "posix: Attaching FD " << fd << std::endl;
+	if(logFileAttach)
+		std::cout << "posix: Attaching FD " << fd << std::endl;
 
-		_fileTable.insert({fd, {std::move(file), close_on_exec}});
-		_fileTableWindow[fd] = handle;
-		return fd;
-	}
+	attachFile(fd, std::move(file), close_on_exec);
+	return fd;
 }
 
 void FileContext::attachFile(int fd, smarter::shared_ptr<File, FileHandle> file,
 		bool close_on_exec) {
+	assert(fd >= 0 && fd < maxFileDescriptors);
 	HelHandle handle;
 	HEL_CHECK(helTransferDescriptor(file->getPassthroughLane().getHandle(),
 			_universe.getHandle(), &handle));
@@ -388,43 +493,38 @@ void FileContext::attachFile(int fd, smarter::shared_ptr<File, FileHandle> file,
 	if(logFileAttach)
 		std::cout << "posix: Attaching fixed FD " << fd << std::endl;
 
-	auto it = _fileTable.find(fd);
-	if(it != _fileTable.end()) {
-		it->second = {std::move(file), close_on_exec};
-	}else{
-		_fileTable.insert({fd, {std::move(file), close_on_exec}});
-	}
+	_growFileTable(fd);
+	auto &entry = _fileTable[fd];
+	if(entry.file)
+		HEL_CHECK(helCloseDescriptor(_universe.getHandle(), _fileTableWindow[fd]));
+	entry = {std::move(file), close_on_exec};
+	_markUsed(fd);
 	_fileTableWindow[fd] = handle;
 }
 
 std::optional<FileDescriptor> FileContext::getDescriptor(int fd) {
-	auto file = _fileTable.find(fd);
-	if(file == _fileTable.end())
+	if(fd < 0 || static_cast<size_t>(fd) >= _fileTable.size() || !_fileTable[fd].file)
 		return std::nullopt;
-	return file->second;
+	return _fileTable[fd];
 }
 
 Error FileContext::setDescriptor(int fd, bool close_on_exec) {
-	auto it = _fileTable.find(fd);
-	if(it == _fileTable.end()) {
+	if(fd < 0 || static_cast<size_t>(fd) >= _fileTable.size() || !_fileTable[fd].file)
 		return Error::noSuchFile;
-	}
-	it->second.closeOnExec = close_on_exec;
+	_fileTable[fd].closeOnExec = close_on_exec;
 	return Error::success;
 }
 
 smarter::shared_ptr<File, FileHandle> FileContext::getFile(int fd) {
-	auto file = _fileTable.find(fd);
-	if(file == _fileTable.end())
+	if(fd < 0 || static_cast<size_t>(fd) >= _fileTable.size())
 		return smarter::shared_ptr<File, FileHandle>{};
-	return file->second.file;
+	return _fileTable[fd].file;
 }
 
 void FileContext::closeFile(int fd) {
 	if(logFileAttach)
 		std::cout << "posix: Closing FD " << fd << std::endl;
-	auto it = _fileTable.find(fd);
-	if(it == _fileTable.end()) {
+	if(fd < 0 || static_cast<size_t>(fd) >= _fileTable.size() || !_fileTable[fd].file) {
 		std::cout << "\e[31m" "posix: Trying to close non-existant FD "
 				<< fd << "\e[39m" << std::endl;
 		return;
@@ -433,20 +533,20 @@ void FileContext::closeFile(int fd) {
 	HEL_CHECK(helCloseDescriptor(_universe.getHandle(), _fileTableWindow[fd]));
 
 	_fileTableWindow[fd] = 0;
-	_fileTable.erase(it);
+	_fileTable[fd] = {};
+	_markFree(fd);
 }
 
 void FileContext::closeOnExec() {
-	auto it = _fileTable.begin();
-	while(it != _fileTable.end()) {
-		if(it->second.closeOnExec) {
-			HEL_CHECK(helCloseDescriptor(_universe.getHandle(), _fileTableWindow[it->first]));
+	for(size_t fd = 0; fd < _fileTable.size(); fd++) {
+		auto &entry = _fileTable[fd];
+		if(!entry.file || !entry.closeOnExec)
+			continue;
+		HEL_CHECK(helCloseDescriptor(_universe.getHandle(), _fileTableWindow[fd]));
 
-			_fileTableWindow[it->first] = 0;
-			it = _fileTable.erase(it);
-		}else{
-			it++;
-		}
+		_fileTableWindow[fd] = 0;
+		entry = {};
+		_markFree(fd);
 	}
 }
 
@@ -862,10 +962,7 @@ async::result<std::shared_ptr<Process>> Process::init(std::string path) {
 			process->_vmContext->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead | kHelMapProtWrite,
 			&process->_clientThreadPage));
-	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
-			process->_vmContext->getSpace().getHandle(),
-			nullptr, 0, 0x1000, kHelMapProtRead,
-			&process->_clientFileTable));
+	process->_clientFileTable = process->_fileContext->mapFileTable(process->_vmContext);
 	HEL_CHECK(helMapMemory(clk::trackerPageMemory().getHandle(),
 			process->_vmContext->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead,
@@ -933,10 +1030,7 @@ std::shared_ptr<Process> Process::fork(std::shared_ptr<Process> original) {
 			process->_vmContext->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead | kHelMapProtWrite,
 			&process->_clientThreadPage));
-	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
-			process->_vmContext->getSpace().getHandle(),
-			nullptr, 0, 0x1000, kHelMapProtRead,
-			&process->_clientFileTable));
+	process->_clientFileTable = process->_fileContext->mapFileTable(process->_vmContext);
 	HEL_CHECK(helMapMemory(clk::trackerPageMemory().getHandle(),
 			process->_vmContext->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead,
@@ -1056,10 +1150,7 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 			exec_vm_context->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead,
 			&exec_clk_tracker_page));
-	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
-			exec_vm_context->getSpace().getHandle(),
-			nullptr, 0, 0x1000, kHelMapProtRead,
-			&exec_client_table));
+	exec_client_table = process->_fileContext->mapFileTable(exec_vm_context);
 
 	// Kill the old thread.
 	// After this is done, we cannot roll back the exec() operation.
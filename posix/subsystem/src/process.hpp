@@ -3,6 +3,7 @@
 #include <map>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include <async/result.hpp>
 #include <async/oneshot-event.hpp>
@@ -155,6 +156,9 @@ struct FileDescriptor {
 
 struct FileContext {
 public:
+	// Upper bound on the number of file descriptors per process.
+	static constexpr int maxFileDescriptors = 1 << 20;
+
 	static std::shared_ptr<FileContext> create();
 	static std::shared_ptr<FileContext> clone(std::shared_ptr<FileContext> original);
 
@@ -168,6 +172,11 @@ public:
 		return _fileTableMemory;
 	}
 
+	// Maps the file table into a client address space and returns its address.
+	// Clients reserve enough address space for the largest possible table,
+	// such that the table can grow without moving.
+	void *mapFileTable(std::shared_ptr<VmContext> vmContext);
+
 	int attachFile(smarter::shared_ptr<File, FileHandle> file, bool close_on_exec = false);
 
 	void attachFile(int fd, smarter::shared_ptr<File, FileHandle> file, bool close_on_exec = false);
@@ -187,15 +196,34 @@ public:
 	}
 
 private:
+	struct ClientMapping {
+		std::weak_ptr<VmContext> vmContext;
+		void *address;
+	};
+
+	// Makes sure that fd is covered by the file table.
+	void _growFileTable(int fd);
+
+	void _markUsed(int fd);
+	void _markFree(int fd);
+
 	helix::UniqueDescriptor _universe;
 
-	// TODO: replace this by a tree that remembers gaps between keys.
-	std::unordered_map<int, FileDescriptor> _fileTable;
+	// Indexed by FD. Unused entries have a null file.
+	std::vector<FileDescriptor> _fileTable;
+
+	// Two-level bitmap of used FDs: bit i of _usedFds[w] is set if FD 64 * w + i is used,
+	// bit j of _fullWords[v] is set if _usedFds[64 * v + j] has all bits set.
+	std::vector<uint64_t> _usedFds;
+	std::vector<uint64_t> _fullWords;
 
 	helix::UniqueDescriptor _fileTableMemory;
+	size_t _fileTableSize = 0;
 
 	HelHandle *_fileTableWindow;
 
+	std::vector<ClientMapping> _clientMappings;
+
 	HelHandle _clientMbusLane;
 };
 
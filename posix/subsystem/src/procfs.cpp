@@ -223,6 +223,7 @@ std::shared_ptr<Link> DirectoryNode::createRootDirectory() {
 
 	auto self_link = std::make_shared<Link>(the_node->shared_from_this(), "self", std::make_shared<SelfLink>());
 	the_node->_entries.insert(std::move(self_link));
+	the_node->directMkregular("meminfo", std::make_shared<MemInfoNode>());
 	return link;
 }
 
@@ -385,6 +386,28 @@ async::result<void> MapNode::store(std::string) {
 	throw std::runtime_error("Can't store to a /proc/maps file!");
 }
 
+async::result<std::string> MemInfoNode::show() {
+	HelMemoryStats stats;
+	HEL_CHECK(helQueryMemoryStats(&stats));
+
+	// Same format as on Linux; sizes are in KiB.
+	std::stringstream stream;
+	auto line = [&] (const char *name, uint64_t bytes) {
+		stream << std::left << std::setw(16) << (std::string{name} + ":")
+				<< std::right << std::setw(8) << (bytes / 1024) << " kB\n";
+	};
+	line("MemTotal", stats.totalMemory);
+	line("MemFree", stats.freeMemory);
+	line("Dirty", stats.dirtyMemory);
+	line("Writeback", stats.writebackMemory);
+	co_return stream.str();
+}
+
+async::result<void> MemInfoNode::store(std::string) {
+	// TODO: proper error reporting.
+	throw std::runtime_error("Can't store to a /proc/meminfo file!");
+}
+
 } // namespace procfs
 
 std::shared_ptr<FsLink> getProcfs() {
@@ -180,6 +180,11 @@ private:
 	Process *_process;
 };
 
+struct MemInfoNode final : RegularNode {
+	async::result<std::string> show() override;
+	async::result<void> store(std::string) override;
+};
+
 } // namespace procfs
 
 std::shared_ptr<FsLink> getProcfs();
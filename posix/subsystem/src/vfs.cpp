@@ -255,7 +255,27 @@ async::result<frg::expected<protocols::fs::Error, void>> PathResolver::resolve(R
 				_currentPath = ViewPath{_currentPath.first, owner->treeLink()};
 			}
 		}else{
-			if (_currentPath.second->getTarget()->hasTraverseLinks()) {
+			auto directory = _currentPath.second->getTarget();
+
+			// Consult the link cache first. This avoids round trips to external file systems.
+			std::shared_ptr<FsLink> cachedChild;
+			if(directory->hasLinkCache()) {
+				if(auto entry = LinkCache::global().lookup(directory.get(), name); entry) {
+					if(!*entry) {
+						_currentPath = ViewPath{_currentPath.first, nullptr};
+						co_return protocols::fs::Error::fileNotFound;
+					}
+					if(debugResolve)
+						std::cout << "posix " << sn << ":     Link is cached" << std::endl;
+					cachedChild = std::move(*entry);
+				}
+			}
+
+			// Snapshots of the cache generations; see LinkCache.
+			auto cacheGeneration = LinkCache::global().generation(directory.get());
+			auto globalCacheGeneration = LinkCache::global().globalGeneration();
+
+			if (!cachedChild && directory->hasTraverseLinks()) {
 				_components.push_front(name);
 				std::string end;
 
@@ -264,9 +284,13 @@ async::result<frg::expected<protocols::fs::Error, void>> PathResolver::resolve(R
 					_components.pop_back();
 				}
 
-				auto result = co_await _currentPath.second->getTarget()->traverseLinks(_components);
+				auto result = co_await directory->traverseLinks(_components);
 
 				if (!result) {
+					if(result.error() == Error::noSuchFile
+							&& _components.size() == 1 && directory->hasLinkCache())
+						LinkCache::global().insert(directory, name, nullptr, cacheGeneration);
+
 					assert(result.error() == Error::illegalOperationTarget
 							|| result.error() == Error::noSuchFile
 							|| result.error() == Error::notDirectory);
@@ -289,6 +313,28 @@ async::result<frg::expected<protocols::fs::Error, void>> PathResolver::resolve(R
 
 				assert(nLinks <= _components.size());
 
+				// Populate the link cache by walking up from the final link.
+				// We do not know the intermediate directories in advance, hence we
+				// only do this if no directory was modified during the traversal.
+				if(child && directory->hasLinkCache()
+						&& LinkCache::global().globalGeneration() == globalCacheGeneration) {
+					bool plain = true;
+					for(size_t i = 0; i < nLinks; i++) {
+						if(_components[i] == "." || _components[i] == "..")
+							plain = false;
+					}
+
+					auto link = child;
+					for(size_t i = nLinks; plain && i > 0; i--) {
+						auto owner = link->getOwner();
+						if(!owner)
+							break;
+						LinkCache::global().insert(owner, _components[i - 1], link,
+								LinkCache::global().generation(owner.get()));
+						link = owner->treeLink();
+					}
+				}
+
 				while (nLinks--)
 					_components.pop_front();
 
@@ -333,19 +379,25 @@ async::result<frg::expected<protocols::fs::Error, void>> PathResolver::resolve(R
 					_currentPath = std::move(next);
 				}
 			} else {
-				auto childResult = co_await _currentPath.second->getTarget()->getLink(std::move(name));
-				if(!childResult) {
-					assert(childResult.error() == Error::notDirectory
-							|| childResult.error() == Error::illegalOperationTarget);
-					_currentPath = ViewPath{_currentPath.first, nullptr};
-					if(childResult.error() == Error::notDirectory) {
-						co_return protocols::fs::Error::notDirectory;
-					} else if(childResult.error() == Error::illegalOperationTarget) {
-						std::cout << "\e[33mposix: Illegal operation target in PathResolver::resolve\e[39m" << std::endl;
-						co_return protocols::fs::Error::fileNotFound;
+				auto child = std::move(cachedChild);
+				if(!child) {
+					auto childResult = co_await directory->getLink(name);
+					if(!childResult) {
+						assert(childResult.error() == Error::notDirectory
+								|| childResult.error() == Error::illegalOperationTarget);
+						_currentPath = ViewPath{_currentPath.first, nullptr};
+						if(childResult.error() == Error::notDirectory) {
+							co_return protocols::fs::Error::notDirectory;
+						} else if(childResult.error() == Error::illegalOperationTarget) {
+							std::cout << "\e[33mposix: Illegal operation target in PathResolver::resolve\e[39m" << std::endl;
+							co_return protocols::fs::Error::fileNotFound;
+						}
 					}
+					child = childResult.value();
+
+					if(directory->hasLinkCache())
+						LinkCache::global().insert(directory, name, child, cacheGeneration);
 				}
-				auto child = childResult.value();
 
 				if(!child) {
 					_currentPath = ViewPath{_currentPath.first, nullptr};
@@ -138,6 +138,11 @@ struct FileOperations {
 		listen = f;
 		return *this;
 	}
+	constexpr FileOperations &withAccept(async::result<frg::expected<Error, helix::UniqueLane>>
+			(*f)(void *object)) {
+		accept = f;
+		return *this;
+	}
 
 	constexpr FileOperations &withPeername(async::result<frg::expected<Error, size_t>> (*f)(void *object,
 			void *addr_ptr, size_t max_addr_length)) {
@@ -173,6 +178,8 @@ struct FileOperations {
 	async::result<Error> (*bind)(void *object, const char *credentials,
 			const void *addr_ptr, size_t addr_length);
 	async::result<Error> (*listen)(void *object);
+	// Returns the passthrough lane of the accepted connection.
+	async::result<frg::expected<Error, helix::UniqueLane>> (*accept)(void *object);
 	async::result<Error> (*connect)(void *object, const char *credentials,
 			const void *addr_ptr, size_t addr_length);
 	async::result<size_t> (*sockname)(void *object, void *addr_ptr, size_t max_addr_length);
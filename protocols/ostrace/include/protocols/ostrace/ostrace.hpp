@@ -1,9 +1,11 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <async/result.hpp>
 #include <helix/ipc.hpp>
+#include <helix/memory.hpp>
 #include <ostrace.bragi.hpp>
 
 namespace protocols::ostrace {
@@ -11,9 +13,15 @@ namespace protocols::ostrace {
 enum class EventId : uint64_t { };
 enum class ItemId : uint64_t { };
 
+struct Event;
+
+// Events are written to a shared memory ring that the kernel drains periodically.
+// Since the ring has a single producer, each Context must only be used by one thread.
 struct Context {
+	friend struct Event;
+
 	Context();
-	Context(helix::UniqueLane lane, bool enabled);
+	Context(helix::UniqueLane lane, bool enabled, helix::Mapping ring = {});
 
 	inline helix::BorrowedLane getLane() {
 		return lane_;
@@ -28,8 +36,13 @@ struct Context {
 	async::result<ItemId> announceItem(std::string_view name);
 
 private:
+	// Returns false if the record has to be sent via IPC instead.
+	bool emitToRing_(managarm::ostrace::EventRecord &record);
+
 	helix::UniqueLane lane_;
 	bool enabled_;
+	helix::Mapping ring_;
+	std::vector<char> buffer_;
 };
 
 struct Event {
@@ -42,7 +55,7 @@ struct Event {
 private:
 	Context *ctx_;
 	bool live_; // Whether we emit an event at all.
-	managarm::ostrace::EmitEventReq req_;
+	managarm::ostrace::EventRecord record_;
 };
 
 async::result<Context> createContext();
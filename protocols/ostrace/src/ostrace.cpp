@@ -1,17 +1,73 @@
+#include <string.h>
+#include <algorithm>
+
 #include <async/oneshot-event.hpp>
 #include <bragi/helpers-std.hpp>
+#include <frg/span.hpp>
 #include <frg/std_compat.hpp>
+#include <helix/clock.hpp>
 #include <protocols/mbus/client.hpp>
 #include <protocols/ostrace/ostrace.hpp>
 #include <ostrace.bragi.hpp>
 
 namespace protocols::ostrace {
 
+namespace {
+
+// Layout of the shared memory ring. This needs to be kept in sync with thor.
+// The first page contains the ring header, the remaining pages contain the records.
+// Each record is prefixed by its size (as uint64_t) and padded to a multiple of 8 bytes.
+constexpr size_t ringSize = 0x10000;
+constexpr size_t ringDataOffset = 0x1000;
+constexpr size_t ringDataSize = ringSize - ringDataOffset;
+
+struct RingHeader {
+	uint64_t headPtr; // Written by user space.
+	alignas(64) uint64_t tailPtr; // Written by the kernel.
+};
+
+void copyToRing(char *data, uint64_t ptr, const void *buffer, size_t size) {
+	auto offset = ptr % ringDataSize;
+	auto preWrapSize = std::min(size, ringDataSize - offset);
+	memcpy(data + offset, buffer, preWrapSize);
+	memcpy(data, reinterpret_cast<const char *>(buffer) + preWrapSize, size - preWrapSize);
+}
+
+} // anonymous namespace
+
 Context::Context()
 : enabled_{false} { }
 
-Context::Context(helix::UniqueLane lane, bool enabled)
-: lane_{std::move(lane)}, enabled_{enabled} { }
+Context::Context(helix::UniqueLane lane, bool enabled, helix::Mapping ring)
+: lane_{std::move(lane)}, enabled_{enabled}, ring_{std::move(ring)} { }
+
+bool Context::emitToRing_(managarm::ostrace::EventRecord &record) {
+	if(!ring_)
+		return false;
+	auto header = reinterpret_cast<RingHeader *>(ring_.get());
+	auto data = reinterpret_cast<char *>(ring_.get()) + ringDataOffset;
+
+	auto tailSize = record.size_of_tail();
+	buffer_.resize(8 + tailSize);
+	bool encodeSuccess = bragi::write_head_tail(record,
+			frg::span<char>(buffer_.data(), 8),
+			frg::span<char>(buffer_.data() + 8, tailSize));
+	assert(encodeSuccess);
+
+	uint64_t recordSize = buffer_.size();
+	auto effectiveSize = (sizeof(uint64_t) + recordSize + 7) & ~uint64_t{7};
+
+	// We are the only producer, hence headPtr cannot change concurrently.
+	auto headPtr = __atomic_load_n(&header->headPtr, __ATOMIC_RELAXED);
+	auto tailPtr = __atomic_load_n(&header->tailPtr, __ATOMIC_ACQUIRE);
+	if(headPtr + effectiveSize - tailPtr > ringDataSize)
+		return true; // Drop the record if the kernel does not keep up.
+
+	copyToRing(data, headPtr, &recordSize, sizeof(uint64_t));
+	copyToRing(data, headPtr + sizeof(uint64_t), buffer_.data(), recordSize);
+	__atomic_store_n(&header->headPtr, headPtr + effectiveSize, __ATOMIC_RELEASE);
+	return true;
+}
 
 async::result<EventId> Context::announceEvent(std::string_view name) {
 	managarm::ostrace::AnnounceEventReq req;
@@ -68,7 +124,7 @@ async::result<ItemId> Context::announceItem(std::string_view name) {
 Event::Event(Context *ctx, EventId id)
 : ctx_{ctx} {
 	live_ = ctx->isActive();
-	req_.set_id(static_cast<uint64_t>(id));
+	record_.set_id(static_cast<uint64_t>(id));
 }
 
 void Event::withCounter(ItemId id, int64_t value) {
@@ -78,18 +134,28 @@ void Event::withCounter(ItemId id, int64_t value) {
 	managarm::ostrace::CounterItem item;
 	item.set_id(static_cast<uint64_t>(id));
 	item.set_value(value);
-	req_.add_ctrs(std::move(item));
+	record_.add_ctrs(std::move(item));
 }
 
 async::result<void> Event::emit() {
 	if(!live_)
 		co_return;
 
+	record_.set_ts(helix::currentNanos());
+	if(ctx_->emitToRing_(record_))
+		co_return;
+
+	// Fall back to IPC if the kernel did not provide a ring.
+	managarm::ostrace::EmitEventReq req;
+	req.set_id(record_.id());
+	for(size_t i = 0; i < record_.ctrs_size(); ++i)
+		req.add_ctrs(record_.ctrs(i));
+
 	auto [offer, sendReq, recvResp] =
 		co_await helix_ng::exchangeMsgs(
 			ctx_->getLane(),
 			helix_ng::offer(
-				helix_ng::sendBragiHeadOnly(req_, frg::stl_allocator{}),
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
 				helix_ng::recvInline()
 			)
 		);
@@ -155,7 +221,36 @@ async::result<Context> createContext() {
 		co_return Context{std::move(lane), false};
 
 	assert(resp.error() == managarm::ostrace::Error::SUCCESS);
-	co_return Context{std::move(lane), true};
+
+	// Ask for a ring such that events do not need an IPC round trip.
+
+	managarm::ostrace::CreateRingReq ringReq;
+
+	auto [ringOffer, sendRingReq, recvRingResp, pullMemory] =
+		co_await helix_ng::exchangeMsgs(
+			lane,
+			helix_ng::offer(
+				helix_ng::sendBragiHeadOnly(ringReq, frg::stl_allocator{}),
+				helix_ng::recvInline(),
+				helix_ng::pullDescriptor()
+			)
+		);
+
+	HEL_CHECK(ringOffer.error());
+	HEL_CHECK(sendRingReq.error());
+	HEL_CHECK(recvRingResp.error());
+
+	auto maybeRingResp = bragi::parse_head_only<managarm::ostrace::Response>(recvRingResp);
+	recvRingResp.reset();
+	assert(maybeRingResp);
+	auto &ringResp = maybeRingResp.value();
+
+	if(ringResp.error() != managarm::ostrace::Error::SUCCESS)
+		co_return Context{std::move(lane), true};
+
+	HEL_CHECK(pullMemory.error());
+	helix::Mapping ring{pullMemory.descriptor(), 0, ringSize};
+	co_return Context{std::move(lane), true, std::move(ring)};
 }
 
 } // namespace protocols::ostrace
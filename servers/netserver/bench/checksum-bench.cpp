@@ -0,0 +1,91 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "../src/ip/checksum.hpp"
+
+namespace {
+
+// Straightforward implementation that processes one 16-bit word per iteration.
+uint16_t referenceChecksum(const unsigned char *data, size_t size) {
+	uint32_t state = 0;
+	auto add = [&] (uint16_t word) {
+		state += word;
+		while (state >> 16)
+			state = (state >> 16) + (state & 0xffff);
+	};
+	if (size % 2 != 0) {
+		size--;
+		add(data[size] << 8);
+	}
+	for (size_t i = 0; i < size; i += 2)
+		add(data[i] << 8 | data[i + 1]);
+	return ~state;
+}
+
+template<typename F>
+void runBenchmark(const char *name, size_t size, F fn) {
+	constexpr size_t totalBytes = size_t{1} << 30;
+	auto iterations = totalBytes / size;
+
+	auto start = std::chrono::steady_clock::now();
+	uint64_t sink = 0;
+	for (size_t i = 0; i < iterations; i++) {
+		// Prevent the compiler from hoisting the computation out of the loop.
+		asm volatile ("" : : : "memory");
+		sink += fn(size);
+	}
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	auto seconds = std::chrono::duration<double>(elapsed).count();
+	std::cout << name << " (" << size << " bytes): "
+			<< (totalBytes / seconds / (1 << 20)) << " MiB/s"
+			<< " [" << (sink & 1) << "]" << std::endl;
+}
+
+} // namespace
+
+int main() {
+	std::vector<unsigned char> buffer(65536 + 1);
+	for (auto &c : buffer)
+		c = rand();
+
+	// Make sure that all variants agree with the reference, including odd sizes and offsets.
+	for (size_t offset = 0; offset < 4; offset++) {
+		for (size_t size : {0, 1, 2, 3, 20, 63, 64, 65, 1460, 1461, 65535}) {
+			Checksum csum;
+			csum.update(buffer.data() + offset, size);
+			if (csum.finalize() != referenceChecksum(buffer.data() + offset, size)) {
+				std::cout << "checksum-bench: Mismatch at offset " << offset
+						<< ", size " << size << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	for (size_t size : {20, 64, 1460, 65536}) {
+		auto data = buffer.data();
+		runBenchmark("reference", size, [&] (size_t n) {
+			return referenceChecksum(data, n);
+		});
+		runBenchmark("scalar", size, [&] (size_t n) {
+			return checksum::sumScalar(data, n);
+		});
+#if defined(__x86_64__)
+		runBenchmark("sse2", size, [&] (size_t n) {
+			return checksum::sumSse2(data, n);
+		});
+		if (checksum::haveAvx2()) {
+			runBenchmark("avx2", size, [&] (size_t n) {
+				return checksum::sumAvx2(data, n);
+			});
+		}
+#endif
+		runBenchmark("Checksum::update", size, [&] (size_t n) {
+			Checksum csum;
+			csum.update(data, n);
+			return csum.finalize();
+		});
+	}
+}
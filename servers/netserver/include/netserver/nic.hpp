@@ -3,6 +3,8 @@
 #include <arch/dma_pool.hpp>
 #include <async/result.hpp>
 #include <cstdint>
+#include <optional>
+#include <vector>
 
 namespace nic {
 struct MacAddress {
@@ -34,30 +36,94 @@ enum EtherType : uint16_t {
 	ETHER_TYPE_ARP = 0x0806,
 };
 
-// TODO(arsen): Expose interface for csum offloading, constructing frames, and
-// other features of NICs
+// Pool of fixed-size buffers on top of another DMA pool.
+// Freed buffers are kept for reuse, such that drivers can keep many receive buffers
+// in flight without allocating memory for each frame.
+struct BufferPool : arch::dma_pool {
+	BufferPool(arch::dma_pool *backing, size_t bufferSize);
+	BufferPool(const BufferPool &) = delete;
+	~BufferPool();
+
+	BufferPool &operator= (const BufferPool &) = delete;
+
+	size_t bufferSize() {
+		return bufferSize_;
+	}
+
+	void *allocate(size_t size, size_t count, size_t align) override;
+	void deallocate(void *pointer, size_t size, size_t count, size_t align) override;
+
+private:
+	arch::dma_pool *backing_;
+	size_t bufferSize_;
+	std::vector<void *> freeBuffers_;
+};
+
+// TODO(arsen): Expose interface for constructing frames, and other features of NICs
 struct Link {
 	struct AllocatedBuffer {
 		arch::dma_buffer frame;
 		arch::dma_buffer_view payload;
 	};
+	struct ReceivedFrame {
+		// Owns the memory of the frame; usually comes from a BufferPool.
+		arch::dma_buffer buffer;
+		// The part of the buffer that contains the Ethernet frame.
+		arch::dma_buffer_view frame;
+		// Whether the NIC already verified the L4 checksum.
+		bool checksumVerified = false;
+	};
+	// Asks the NIC to compute a L4 checksum.
+	// The checksum field must contain the (non-complemented) sum of the pseudo header.
+	struct ChecksumOffload {
+		// Offset into the frame at which the NIC starts summing.
+		uint16_t start;
+		// Offset of the checksum field, relative to start.
+		uint16_t offset;
+	};
+	// Asks the NIC to split a TCP/IPv4 frame into multiple segments (TSO).
+	struct SegmentationOffload {
+		// Size of the Ethernet, IPv4 and TCP headers that are replicated in each segment.
+		uint16_t headerSize;
+		// Maximal number of payload bytes per segment.
+		uint16_t segmentSize;
+	};
 	inline Link(unsigned int mtu, arch::dma_pool *dmaPool)
 		: mtu(mtu), dmaPool_(dmaPool) {}
 	virtual ~Link() = default;
-	//! Receives an entire frame from the network
-	virtual async::result<void> receive(arch::dma_buffer_view) = 0;
+	//! Receives an entire frame from the given receive queue (< numQueues).
+	//! The frame is not copied; the buffer is handed up the stack as-is.
+	virtual async::result<ReceivedFrame> receive(size_t queue) = 0;
 	//! Sends an entire ethernet frame
-	virtual async::result<void> send(const arch::dma_buffer_view) = 0;
+	virtual async::result<void> send(const arch::dma_buffer_view,
+		std::optional<ChecksumOffload> checksum) = 0;
+	//! Sends a TCP/IPv4 frame that is split into segments on the way out.
+	//! The TCP checksum field must contain the sum of the pseudo header.
+	//! The default implementation segments the frame in software (GSO).
+	virtual async::result<void> sendSegmented(const arch::dma_buffer_view,
+		ChecksumOffload checksum, SegmentationOffload segmentation);
 	arch::dma_pool *dmaPool();
 	AllocatedBuffer allocateFrame(MacAddress to, EtherType type,
 		size_t payloadSize);
 
 	MacAddress deviceMac();
 	unsigned int mtu;
+	// Number of receive queues. Multi-queue NICs steer each flow to one of them.
+	size_t numQueues = 1;
+	// Whether send() supports ChecksumOffload.
+	bool txChecksumOffload = false;
+	// Whether the NIC implements sendSegmented() in hardware.
+	bool txSegmentationOffload = false;
 protected:
 	arch::dma_pool *dmaPool_;
 	MacAddress mac_;
 };
 
-async::detached runDevice(std::shared_ptr<Link> dev);
+// Hash over the addresses and ports of an IPv4 TCP or UDP frame (zero for other frames).
+// Multi-queue drivers use this to pick a transmit queue, such that all frames of
+// a flow are sent (and steered back to us) through the same queue pair.
+uint32_t flowHash(arch::dma_buffer_view frame);
+
+// Starts one receive loop per receive queue of the device (on the current dispatcher).
+void runDevice(std::shared_ptr<Link> dev);
 } // namespace nic
@@ -65,7 +65,7 @@ async::result<void> sendArp(uint16_t op,
 
 	appendData(targetHw);
 	appendData(targetProto);
-	co_await link->send(std::move(buffer.frame));
+	co_await link->send(std::move(buffer.frame), std::nullopt);
 }
 }
 
@@ -1,7 +1,138 @@
 #include "checksum.hpp"
 
+#include <cstring>
 #include <arch/bit.hpp>
 
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace {
+
+uint64_t addWithCarry(uint64_t sum, uint64_t value) {
+	sum += value;
+	return sum + (sum < value);
+}
+
+uint16_t fold(uint64_t sum) {
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return sum;
+}
+
+using SumFunction = uint64_t (*)(const void *, size_t);
+
+SumFunction pickSumFunction() {
+#if defined(__x86_64__)
+	if (checksum::haveAvx2())
+		return checksum::sumAvx2;
+	return checksum::sumSse2;
+#else
+	return checksum::sumScalar;
+#endif
+}
+
+const SumFunction sumFunction = pickSumFunction();
+
+} // namespace
+
+namespace checksum {
+
+uint64_t sumScalar(const void *data, size_t size) {
+	auto iter = static_cast<const unsigned char *>(data);
+	uint64_t sum = 0;
+	for (; size >= 8; iter += 8, size -= 8) {
+		uint64_t word;
+		std::memcpy(&word, iter, sizeof(word));
+		sum = addWithCarry(sum, word);
+	}
+	for (; size >= 2; iter += 2, size -= 2) {
+		uint16_t word;
+		std::memcpy(&word, iter, sizeof(word));
+		sum = addWithCarry(sum, word);
+	}
+	return sum;
+}
+
+#if defined(__x86_64__)
+
+// Both SIMD variants zero-extend 32-bit words into 64-bit lanes.
+// Since 2^16 = 1 (mod 2^16 - 1), summing 32-bit words yields the same one's
+// complement sum as summing 16-bit words, and the lanes cannot overflow in practice.
+
+uint64_t sumSse2(const void *data, size_t size) {
+	if (size < 64)
+		return sumScalar(data, size);
+
+	auto iter = static_cast<const unsigned char *>(data);
+	auto zero = _mm_setzero_si128();
+	auto accLow = zero;
+	auto accHigh = zero;
+	for (; size >= 64; iter += 64, size -= 64) {
+		for (int i = 0; i < 4; i++) {
+			auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(iter + 16 * i));
+			accLow = _mm_add_epi64(accLow, _mm_unpacklo_epi32(v, zero));
+			accHigh = _mm_add_epi64(accHigh, _mm_unpackhi_epi32(v, zero));
+		}
+	}
+
+	uint64_t lanes[4];
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), accLow);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(lanes + 2), accHigh);
+	uint64_t sum = sumScalar(iter, size);
+	for (auto lane : lanes)
+		sum = addWithCarry(sum, lane);
+	return sum;
+}
+
+[[gnu::target("avx2")]]
+uint64_t sumAvx2(const void *data, size_t size) {
+	if (size < 64)
+		return sumScalar(data, size);
+
+	auto iter = static_cast<const unsigned char *>(data);
+	auto zero = _mm256_setzero_si256();
+	auto accLow = zero;
+	auto accHigh = zero;
+	for (; size >= 64; iter += 64, size -= 64) {
+		for (int i = 0; i < 2; i++) {
+			auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(iter + 32 * i));
+			accLow = _mm256_add_epi64(accLow, _mm256_unpacklo_epi32(v, zero));
+			accHigh = _mm256_add_epi64(accHigh, _mm256_unpackhi_epi32(v, zero));
+		}
+	}
+
+	uint64_t lanes[8];
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), accLow);
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes + 4), accHigh);
+	uint64_t sum = sumScalar(iter, size);
+	for (auto lane : lanes)
+		sum = addWithCarry(sum, lane);
+	return sum;
+}
+
+bool haveAvx2() {
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	// We need AVX and the OS needs to save the YMM registers (OSXSAVE + XCR0).
+	if (!(ecx & bit_AVX) || !(ecx & bit_OSXSAVE))
+		return false;
+	uint32_t xcrLow, xcrHigh;
+	asm volatile ("xgetbv" : "=a"(xcrLow), "=d"(xcrHigh) : "c"(0));
+	if ((xcrLow & 6) != 6)
+		return false;
+
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return false;
+	return ebx & bit_AVX2;
+}
+
+#endif // defined(__x86_64__)
+
+} // namespace checksum
+
 void Checksum::update(uint16_t word)  {
 	state_ += word;
 	while (state_ >> 16 != 0) {
@@ -16,10 +147,10 @@ void Checksum::update(const void *data, size_t size) {
 		size--;
 		update(iter[size] << 8);
 	}
-	auto end = iter + size;
-	for (; iter < end; iter += 2) {
-		update(iter[0] << 8 | iter[1]);
-	}
+	// The sum is computed over native-endian words; by RFC1071, swapping the folded
+	// result yields the sum over the big-endian words.
+	uint16_t sum = fold(sumFunction(iter, size));
+	update(convert_endian<endian::big, endian::native>(sum));
 }
 
 void Checksum::update(arch::dma_buffer_view view) {
@@ -30,3 +161,7 @@ uint16_t Checksum::finalize() {
 	auto state_ = this->state_;
 	return ~state_;
 }
+
+uint16_t Checksum::partial() {
+	return state_;
+}
@@ -9,6 +9,24 @@ struct Checksum {
 	void update(arch::dma_buffer_view area);
 	uint16_t finalize();
 
+	// Returns the folded sum without complementing it.
+	// This is what NICs expect in the checksum field when they complete the checksum.
+	uint16_t partial();
+
 private:
 	uint32_t state_ = 0;
 };
+
+namespace checksum {
+
+// Each of these returns a (not yet folded) one's complement sum of the 16-bit words
+// in [data, data + size), where the words are read in native byte order.
+// size must be even. Checksum::update() picks the fastest variant at runtime.
+uint64_t sumScalar(const void *data, size_t size);
+#if defined(__x86_64__)
+uint64_t sumSse2(const void *data, size_t size);
+uint64_t sumAvx2(const void *data, size_t size);
+bool haveAvx2();
+#endif
+
+} // namespace checksum
@@ -6,6 +6,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <algorithm>
+#include <cassert>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
@@ -244,7 +245,8 @@ bool Ip4::hasIp(uint32_t addr) {
 }
 
 async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
-		void *data, size_t len, uint16_t proto) {
+		void *data, size_t len, uint16_t proto,
+		Ip4TxOffload offload) {
 	using arch::convert_endian;
 	using arch::endian;
 
@@ -252,14 +254,23 @@ async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
 	// calculate header size
 	size_t header_size = sizeof(Ip4Packet::Header);
 	size_t packet_size = len + header_size;
+	if (packet_size > 0xFFFF)
+		co_return protocols::fs::Error::messageSize;
+	// Super-segments only need to fit into the MTU once they are split.
+	size_t wire_size = packet_size;
+	if (offload.segmentSize) {
+		assert(offload.checksumOffset);
+		wire_size = std::min(packet_size,
+				header_size + offload.l4HeaderSize + offload.segmentSize);
+	}
 	// TODO(arsen): options
-	if (ti.route.mtu != 0 && ti.route.mtu < packet_size) {
+	if (ti.route.mtu != 0 && ti.route.mtu < wire_size) {
 		std::cout << "netserver: cant fragment 1" << std::endl;
 		co_return protocols::fs::Error::messageSize;
 	}
 
 	auto &target = ti.link;
-	if (target->mtu < packet_size) {
+	if (target->mtu < wire_size) {
 		std::cout << "netserver: cant fragment 2" << std::endl;
 		co_return protocols::fs::Error::messageSize;
 	}
@@ -300,18 +311,37 @@ async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
 	std::memcpy(fb.payload.data(), &hdr, sizeof(hdr));
 	std::memcpy(fb.payload.subview(header_size).byte_data(), data, len);
 
-	co_await target->send(std::move(fb.frame));
+	std::optional<nic::Link::ChecksumOffload> checksum;
+	if (offload.checksumOffset) {
+		checksum = nic::Link::ChecksumOffload{
+			.start = static_cast<uint16_t>(14 + header_size),
+			.offset = *offload.checksumOffset
+		};
+	}
+
+	if (offload.segmentSize) {
+		nic::Link::SegmentationOffload segmentation{
+			.headerSize = static_cast<uint16_t>(14 + header_size + offload.l4HeaderSize),
+			.segmentSize = offload.segmentSize
+		};
+		co_await target->sendSegmented(std::move(fb.frame), *checksum, segmentation);
+	} else {
+		assert(!checksum || target->txChecksumOffload);
+		co_await target->send(std::move(fb.frame), checksum);
+	}
 	co_return protocols::fs::Error::none;
 }
 
 void Ip4::feedPacket(nic::MacAddress, nic::MacAddress,
-		arch::dma_buffer owner, arch::dma_buffer_view frame) {
+		arch::dma_buffer owner, arch::dma_buffer_view frame,
+		bool checksumVerified) {
 	Ip4Packet hdr;
 	if (!hdr.parse(std::move(owner), frame)) {
 		std::cout << "netserver: runt, or otherwise invalid, ip4 frame received"
 			<< std::endl;
 		return;
 	}
+	hdr.checksumVerified = checksumVerified;
 	auto proto = hdr.header.protocol;
 
 	auto begin = sockets.lower_bound(proto);
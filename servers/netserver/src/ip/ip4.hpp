@@ -96,6 +96,8 @@ public:
 	} header;
 	static_assert(sizeof(header) == 20, "bad header size");
 	arch::dma_buffer_view data;
+	// Set if the NIC already verified the L4 checksum.
+	bool checksumVerified = false;
 
 	inline arch::dma_buffer_view payload() const {
 		return data.subview(header.ihl * 4);
@@ -116,12 +118,27 @@ struct Ip4TargetInfo {
 	std::shared_ptr<nic::Link> link;
 };
 
+// Work that Ip4::sendFrame() hands to the link instead of doing it in software.
+struct Ip4TxOffload {
+	// If set, the link computes the L4 checksum at this offset (relative to the
+	// L4 header); the field must contain the pseudo header sum.
+	// Requires link->txChecksumOffload unless segmentSize is set.
+	std::optional<uint16_t> checksumOffset;
+	// If non-zero, the packet is a TCP super-segment that the link splits into
+	// segments carrying (at most) segmentSize bytes of payload each.
+	// Requires checksumOffset.
+	uint16_t segmentSize = 0;
+	// Size of the L4 header that is replicated in each segment.
+	uint16_t l4HeaderSize = 0;
+};
+
 struct Ip4Socket;
 struct Ip4 {
 	managarm::fs::Errors serveSocket(helix::UniqueLane lane, int type, int proto, int flags);
 	// frame is a view into the owner buffer, stripping away eth bits
 	void feedPacket(nic::MacAddress dest, nic::MacAddress src,
-		arch::dma_buffer owner, arch::dma_buffer_view frame);
+		arch::dma_buffer owner, arch::dma_buffer_view frame,
+		bool checksumVerified);
 
 	bool hasIp(uint32_t ip);
 	std::shared_ptr<nic::Link> getLink(uint32_t ip);
@@ -131,7 +148,7 @@ struct Ip4 {
 	async::result<std::optional<Ip4TargetInfo>> targetByRemote(uint32_t);
 	async::result<protocols::fs::Error> sendFrame(Ip4TargetInfo,
 		void*, size_t,
-		uint16_t);
+		uint16_t, Ip4TxOffload offload = {});
 private:
 	std::multimap<int, smarter::shared_ptr<Ip4Socket>> sockets;
 	std::map<CidrAddress, std::weak_ptr<nic::Link>> ips;
@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <limits>
+
+#include "tcp-congestion.hpp"
+
+TcpCongestionControl::TcpCongestionControl(size_t mss)
+: mss_{mss}, ssthresh_{std::numeric_limits<size_t>::max()} {
+	// Initial window as in RFC 5681.
+	if (mss > 2190)
+		cwnd_ = 2 * mss;
+	else if (mss > 1095)
+		cwnd_ = 3 * mss;
+	else
+		cwnd_ = 4 * mss;
+}
+
+NewRenoCongestionControl::NewRenoCongestionControl(size_t mss)
+: TcpCongestionControl{mss} { }
+
+void NewRenoCongestionControl::onAck(size_t ackedBytes) {
+	if (cwnd_ < ssthresh_) {
+		// Slow start.
+		cwnd_ += std::min(ackedBytes, mss_);
+		return;
+	}
+
+	// Congestion avoidance: grow by one segment per window of acknowledged data.
+	bytesAcked_ += ackedBytes;
+	if (bytesAcked_ >= cwnd_) {
+		bytesAcked_ -= cwnd_;
+		cwnd_ += mss_;
+	}
+}
+
+void NewRenoCongestionControl::onEnterRecovery(size_t flightSize) {
+	ssthresh_ = std::max(flightSize / 2, 2 * mss_);
+	cwnd_ = ssthresh_ + 3 * mss_;
+	bytesAcked_ = 0;
+}
+
+void NewRenoCongestionControl::onRecoveryDupAck() {
+	cwnd_ += mss_;
+}
+
+void NewRenoCongestionControl::onPartialAck(size_t ackedBytes) {
+	// Deflate by the amount of new data, then add back one segment.
+	cwnd_ -= std::min(cwnd_, ackedBytes);
+	if (ackedBytes >= mss_)
+		cwnd_ += mss_;
+	cwnd_ = std::max(cwnd_, mss_);
+}
+
+void NewRenoCongestionControl::onExitRecovery(size_t flightSize) {
+	cwnd_ = std::min(ssthresh_, std::max(flightSize, mss_) + mss_);
+}
+
+void NewRenoCongestionControl::onRetransmitTimeout(size_t flightSize) {
+	ssthresh_ = std::max(flightSize / 2, 2 * mss_);
+	cwnd_ = mss_;
+	bytesAcked_ = 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+
+// Decides how the congestion window of a TCP connection evolves.
+// Loss detection and recovery (retransmission timeouts, fast retransmit and
+// NewReno partial ACK handling) are implemented by the socket; it calls into
+// the controller whenever the window needs to be adjusted.
+struct TcpCongestionControl {
+	TcpCongestionControl(size_t mss);
+
+	virtual ~TcpCongestionControl() = default;
+
+	// New data was acknowledged outside of fast recovery.
+	virtual void onAck(size_t ackedBytes) = 0;
+
+	// Loss was detected by duplicate ACKs and fast recovery is entered.
+	virtual void onEnterRecovery(size_t flightSize) = 0;
+
+	// An additional duplicate ACK arrived during fast recovery.
+	virtual void onRecoveryDupAck() = 0;
+
+	// An ACK during fast recovery acknowledged some but not all outstanding data.
+	virtual void onPartialAck(size_t ackedBytes) = 0;
+
+	// All data that was outstanding when recovery started is acknowledged.
+	virtual void onExitRecovery(size_t flightSize) = 0;
+
+	virtual void onRetransmitTimeout(size_t flightSize) = 0;
+
+	size_t congestionWindow() const {
+		return cwnd_;
+	}
+
+	size_t slowStartThreshold() const {
+		return ssthresh_;
+	}
+
+protected:
+	size_t mss_;
+	size_t cwnd_;
+	size_t ssthresh_;
+};
+
+// RFC 5681 slow start and congestion avoidance with RFC 6582 fast recovery.
+struct NewRenoCongestionControl final : TcpCongestionControl {
+	NewRenoCongestionControl(size_t mss);
+
+	void onAck(size_t ackedBytes) override;
+	void onEnterRecovery(size_t flightSize) override;
+	void onRecoveryDupAck() override;
+	void onPartialAck(size_t ackedBytes) override;
+	void onExitRecovery(size_t flightSize) override;
+	void onRetransmitTimeout(size_t flightSize) override;
+
+private:
+	// Bytes acknowledged since the last increase in congestion avoidance.
+	size_t bytesAcked_ = 0;
+};
@@ -1,12 +1,18 @@
 #include <async/basic.hpp>
 #include <async/recurring-event.hpp>
 #include <async/result.hpp>
+#include <async/cancellation.hpp>
 #include <arch/bit.hpp>
 #include <arch/variable.hpp>
+#include <helix/timer.hpp>
 #include <protocols/fs/server.hpp>
+#include <algorithm>
+#include <cstddef>
 #include <cstring>
 #include <deque>
 #include <iomanip>
+#include <memory>
+#include <optional>
 #include <random>
 #include <fcntl.h>
 #include <sys/epoll.h>
@@ -16,11 +22,46 @@
 
 #include "checksum.hpp"
 #include "ip4.hpp"
+#include "tcp-congestion.hpp"
 #include "tcp4.hpp"
 
 namespace {
 
 constexpr bool debugTcp = false;
+constexpr bool logTcpStats = false;
+
+constexpr size_t maxSegmentSize = 1000; // TODO: Perform path MTU discovery.
+// Upper bound for the data that is handed to the link as a single super-segment.
+// The link splits it into maxSegmentSize segments (in hardware or in software).
+// Limited by the 16-bit total length field of the IPv4 header.
+constexpr size_t maxSuperSegmentSize = (0xFFFF - 20 - 20) / maxSegmentSize * maxSegmentSize;
+
+// Retransmission timeout bounds (in nanoseconds), see RFC 6298.
+// Like other stacks, we use a lower minimum than the 1s that the RFC suggests.
+constexpr uint64_t initialRto = 1'000'000'000;
+constexpr uint64_t minRto = 200'000'000;
+constexpr uint64_t maxRto = 60'000'000'000;
+constexpr uint64_t clockGranularity = 1'000'000;
+
+// Number of duplicate ACKs that trigger a fast retransmit.
+constexpr int dupAckThreshold = 3;
+
+// Maximal number of pending and established connections on a listening socket.
+// The fs protocol does not transport the backlog argument of listen().
+constexpr size_t listenBacklog = 128;
+// Half-open connections are dropped after this many retransmitted SYN-ACKs.
+constexpr int maxSynAckRetries = 5;
+// Other connections are dropped after this many consecutive retransmission timeouts.
+// Together with the exponential backoff, this corresponds to Linux' tcp_retries2 default.
+constexpr int maxRetransmitRetries = 15;
+// Time (in nanoseconds) that closed connections linger in TIME-WAIT (or FIN-WAIT-2)
+// before their 4-tuple is released. Like Linux, we use 60s instead of 2 * MSL.
+constexpr uint64_t timeWaitDuration = 60'000'000'000;
+
+// Compares TCP sequence numbers (modulo 2^32).
+bool seqBefore(uint32_t a, uint32_t b) {
+	return static_cast<int32_t>(a - b) < 0;
+}
 
 struct stl_allocator {
 	void *allocate(size_t size) {
@@ -107,6 +148,7 @@ static std::mt19937 globalPrng;
 struct TcpHeader {
 	static constexpr arch::field<uint16_t, bool> finFlag{0, 1};
 	static constexpr arch::field<uint16_t, bool> synFlag{1, 1};
+	static constexpr arch::field<uint16_t, bool> rstFlag{2, 1};
 	static constexpr arch::field<uint16_t, bool> ackFlag{4, 1};
 	static constexpr arch::field<uint16_t, unsigned int> headerWords{12, 4};
 
@@ -140,7 +182,7 @@ struct TcpPacket {
 		if (ipPayload.size() < words * 4)
 			return false;
 
-		if (header.checksum.load()) {
+		if (header.checksum.load() && !packet->checksumVerified) {
 			PseudoHeader pseudo {
 				.src = packet->header.source,
 				.dst = packet->header.destination,
@@ -179,23 +221,83 @@ protocols::fs::Error checkAddress(const void *addrPtr, size_t addrLength, TcpEnd
 	return protocols::fs::Error::none;
 }
 
+// Fills in the checksum of an outgoing segment (TcpHeader followed by the payload).
+// The checksum is left to the link if it supports offloading or if forceOffload is set.
+Ip4TxOffload fillChecksum(std::vector<char> &buf, const Ip4TargetInfo &targetInfo,
+		uint32_t remote, bool forceOffload) {
+	auto header = reinterpret_cast<TcpHeader *>(buf.data());
+	PseudoHeader pseudo {
+		.src = targetInfo.source,
+		.dst = remote,
+		.len = buf.size()
+	};
+	Checksum csum;
+	csum.update(&pseudo, sizeof(PseudoHeader));
+	Ip4TxOffload offload;
+	if(forceOffload || targetInfo.link->txChecksumOffload) {
+		// The link sums over the segment(s) and completes the checksum.
+		header->checksum = csum.partial();
+		offload.checksumOffset = offsetof(TcpHeader, checksum);
+	}else{
+		csum.update(buf.data(), buf.size());
+		header->checksum = csum.finalize();
+	}
+	return offload;
+}
+
 } // anonymous namespace
 
 struct Tcp4Socket {
+	// Per-socket statistics.
+	struct Stats {
+		uint64_t segmentsSent = 0;
+		uint64_t segmentsRetransmitted = 0;
+		uint64_t timeouts = 0;
+		uint64_t fastRetransmits = 0;
+		uint64_t dupAcks = 0;
+	};
+
 	Tcp4Socket(Tcp4 *parent, bool nonBlock)
-	: parent_(parent), nonBlock_{nonBlock}, recvRing_{14}, sendRing_{14} {}
+	: parent_(parent), nonBlock_{nonBlock}, recvRing_{14}, sendRing_{14},
+			cc_{std::make_unique<NewRenoCongestionControl>(maxSegmentSize)} {}
 
 	~Tcp4Socket() {
-		parent_->unbind(localEp_);
+		if(logTcpStats)
+			dumpStats();
+		// Passively opened connections share the port of their listener.
+		if(bound_)
+			parent_->unbind(localEp_);
+	}
+
+	// Serves the socket's file until the user closes it; then closes the connection.
+	static async::detached serve(helix::UniqueLane lane, smarter::shared_ptr<Tcp4Socket> socket) {
+		co_await protocols::fs::servePassthrough(std::move(lane), socket, &ops);
+		socket->close_();
 	}
 
 	static auto makeSocket(Tcp4 *parent, bool nonBlock) {
 		auto s = smarter::make_shared<Tcp4Socket>(parent, nonBlock);
 		s->holder_ = s;
 		async::detach(s->flushOutPackets_());
+		async::detach(s->retransmitTimer_());
 		return s;
 	}
 
+	const Stats &stats() {
+		return stats_;
+	}
+
+	void dumpStats() {
+		std::cout << "netserver: TCP socket " << localEp_.port << " -> " << remoteEp_.port
+				<< ": " << stats_.segmentsSent << " segments sent, "
+				<< stats_.segmentsRetransmitted << " retransmitted, "
+				<< stats_.timeouts << " timeouts, "
+				<< stats_.fastRetransmits << " fast retransmits, "
+				<< stats_.dupAcks << " duplicate ACKs; srtt: " << srtt_ / 1000
+				<< " us, rto: " << rto_ / 1000 << " us, cwnd: " << cc_->congestionWindow()
+				<< ", ssthresh: " << cc_->slowStartThreshold() << std::endl;
+	}
+
 	static async::result<protocols::fs::Error> bind(void *object,
 			const char *creds,
 			const void *addrPtr, size_t addrLength) {
@@ -230,6 +332,45 @@ struct Tcp4Socket {
 		co_return protocols::fs::Error::none;
 	}
 
+	static async::result<protocols::fs::Error> listen(void *object) {
+		auto self = static_cast<Tcp4Socket *>(object);
+
+		if (self->connectState_ == ConnectState::listening)
+			co_return protocols::fs::Error::none;
+		if (self->connectState_ != ConnectState::none)
+			co_return protocols::fs::Error::illegalArguments;
+
+		// Bind the socket if necessary.
+		if (!self->localEp_.port && !self->bindAvailable()) {
+			std::cout << "netserver: No source port" << std::endl;
+			co_return protocols::fs::Error::addressInUse;
+		}
+
+		self->connectState_ = ConnectState::listening;
+		co_return protocols::fs::Error::none;
+	}
+
+	static async::result<frg::expected<protocols::fs::Error, helix::UniqueLane>>
+	accept(void *object) {
+		auto self = static_cast<Tcp4Socket *>(object);
+
+		if (self->connectState_ != ConnectState::listening)
+			co_return protocols::fs::Error::illegalArguments;
+
+		while(self->acceptQueue_.empty()) {
+			if(self->nonBlock_)
+				co_return protocols::fs::Error::wouldBlock;
+			co_await self->inEvent_.async_wait();
+		}
+
+		auto sock = std::move(self->acceptQueue_.front());
+		self->acceptQueue_.pop_front();
+
+		auto [localLane, remoteLane] = helix::createStream();
+		serve(std::move(localLane), std::move(sock));
+		co_return std::move(remoteLane);
+	}
+
 	static async::result<protocols::fs::Error> connect(void *object,
 			const char *creds,
 			const void *addrPtr, size_t addrLength) {
@@ -264,6 +405,12 @@ struct Tcp4Socket {
 				break;
 			co_await self->settleEvent_.async_wait();
 		}
+		// The remote refused the connection or is unreachable.
+		if(self->connectState_ == ConnectState::closed) {
+			if(self->closeError_ != protocols::fs::Error::none)
+				co_return self->closeError_;
+			co_return protocols::fs::Error::notConnected;
+		}
 		co_return protocols::fs::Error::none;
 	}
 
@@ -295,7 +442,9 @@ struct Tcp4Socket {
 		while(progress < size) {
 			size_t available = self->recvRing_.availableToDequeue();
 			if(!available) {
-				if(progress)
+				// Return EOF once the remote closed the connection.
+				if(progress || self->remoteClosed_
+						|| self->connectState_ == ConnectState::closed)
 					break;
 				if(self->nonBlock_)
 					co_return protocols::fs::Error::wouldBlock;
@@ -330,6 +479,14 @@ struct Tcp4Socket {
 
 		size_t progress = 0;
 		while(progress < size) {
+			if(self->connectState_ == ConnectState::closed) {
+				if(progress)
+					break;
+				if(self->closeError_ != protocols::fs::Error::none)
+					co_return self->closeError_;
+				co_return protocols::fs::Error::brokenPipe;
+			}
+
 			size_t space = self->sendRing_.spaceForEnqueue();
 			if(!space) {
 				if(self->nonBlock_) {
@@ -379,11 +536,17 @@ struct Tcp4Socket {
 		auto self = static_cast<Tcp4Socket *>(object);
 
 		int active = 0;
+		if(self->connectState_ == ConnectState::listening) {
+			if(!self->acceptQueue_.empty())
+				active |= EPOLLIN;
+			co_return protocols::fs::PollStatusResult{self->currentSeq_, active};
+		}
+
 		if(self->recvRing_.availableToDequeue())
 			active |= EPOLLIN;
 		if(self->sendRing_.spaceForEnqueue())
 			active |= EPOLLOUT;
-		if(self->remoteClosed_)
+		if(self->remoteClosed_ || self->connectState_ == ConnectState::closed)
 			active |= EPOLLHUP;
 
 		co_return protocols::fs::PollStatusResult{self->currentSeq_, active};
@@ -416,6 +579,8 @@ struct Tcp4Socket {
 		.pollWait = &pollWait,
 		.pollStatus = &pollStatus,
 		.bind = &bind,
+		.listen = &listen,
+		.accept = &accept,
 		.connect = &connect,
 		.getFileFlags = &getFileFlags,
 		.setFileFlags = &setFileFlags,
@@ -440,17 +605,37 @@ struct Tcp4Socket {
 
 private:
 	async::result<void> flushOutPackets_();
+	async::result<void> retransmitTimer_();
 
 	void handleInPacket_(TcpPacket packet);
+	void handleSyn_(TcpPacket &packet);
+	void handleSynAckAck_(TcpPacket packet);
+	void completeHandshake_(smarter::shared_ptr<Tcp4Socket> child);
+	void abortHandshake_();
+	void handleRst_(TcpPacket &packet);
+	void handleAck_(TcpPacket &packet);
+	void handleRetransmitTimeout_();
+
+	void armRetransmitTimer_();
+	void updateRtt_(uint64_t sample);
+
+	// Called once the user closed the socket.
+	void close_();
+	void handleFinAcked_();
+	async::result<void> timeWait_();
+	// Releases the 4-tuple and port of the connection and stops our coroutines.
+	void enterClosed_();
 
 private:
 	friend struct Tcp4;
 
 	enum class ConnectState {
 		none,
+		listening, // Server-side only.
 		sendSyn, // Client-side only.
 		sendSynAck, // Server-side only.
 		connected,
+		closed,
 	};
 
 	Tcp4 *parent_;
@@ -458,14 +643,34 @@ private:
 	TcpEndpoint remoteEp_;
 	TcpEndpoint localEp_;
 	smarter::weak_ptr<Tcp4Socket> holder_;
+	// Whether this socket owns its entry in Tcp4::binds.
+	bool bound_ = false;
+	// Key in Tcp4::connections (only valid if registered_ is true).
+	bool registered_ = false;
+	TcpConnectionKey connectionKey_;
 
 	ConnectState connectState_ = ConnectState::none;
 	bool remoteClosed_ = false;
+	// Error that ended the connection (reported to connect() and writers).
+	protocols::fs::Error closeError_ = protocols::fs::Error::none;
+
+	// Set once the user closed the socket. Connected sockets then send a FIN
+	// after all data in sendRing_ was sent.
+	bool localClosed_ = false;
+	// Whether the user closed the socket before the remote sent its FIN.
+	// In this case, the connection enters TIME-WAIT once our FIN is acknowledged.
+	bool closedFirst_ = false;
+	// Out-SN of our FIN (only valid if localClosed_ is true).
+	uint32_t finSn_ = 0;
+	bool finAcked_ = false;
 
 	// Out-SN corresponding to the front of sendRing_.
 	uint32_t localSettledSn_ = 0;
 	// Out-SN that has already been flushed to the IP layer (>= localSettledSn_).
+	// Moves back to localSettledSn_ on retransmission timeouts.
 	uint32_t localFlushedSn_ = 0;
+	// Highest Out-SN that was ever flushed (>= localFlushedSn_).
+	uint32_t localHighestSn_ = 0;
 	// Out-SN of the end of the remote window (>= localSettledSn_).
 	uint32_t localWindowSn_ = 0;
 	// In-SN that we already acknowledged.
@@ -482,6 +687,44 @@ private:
 	async::recurring_event flushEvent_;
 	async::recurring_event settleEvent_;
 
+	// Passive open. Listening sockets count connections that are still in the
+	// handshake and queue connections that completed it.
+	size_t synQueueLength_ = 0;
+	std::deque<smarter::shared_ptr<Tcp4Socket>> acceptQueue_;
+	// Connections created from a SYN refer back to their listening socket.
+	smarter::weak_ptr<Tcp4Socket> listener_;
+	int synAckRetries_ = 0;
+	// Retransmission timeouts since the last ACK that made progress.
+	int retransmitRetries_ = 0;
+
+	// Whether the initial sequence number was already chosen.
+	bool haveIsn_ = false;
+
+	// RTT estimation (RFC 6298). All times are in nanoseconds.
+	bool haveRtt_ = false;
+	uint64_t srtt_ = 0;
+	uint64_t rttVar_ = 0;
+	uint64_t rto_ = initialRto;
+	// At most one segment is timed at a time; retransmitted segments are never timed.
+	bool rttSampling_ = false;
+	uint32_t rttSampleSn_ = 0;
+	uint64_t rttSampleTime_ = 0;
+
+	// Deadline of the retransmission timer (zero if the timer is not armed).
+	uint64_t rtoDeadline_ = 0;
+	async::recurring_event rtoEvent_;
+
+	// Loss recovery and congestion control.
+	std::unique_ptr<TcpCongestionControl> cc_;
+	int dupAcks_ = 0;
+	bool inRecovery_ = false;
+	// Out-SN that ends the current recovery phase.
+	uint32_t recoverSn_ = 0;
+	// Whether the first unacknowledged segment needs to be retransmitted.
+	bool retransmitFirst_ = false;
+
+	Stats stats_;
+
 	// The following sequence numbers are *not* TCP sequence numbers,
 	// they implement the poll() function.
 	uint64_t currentSeq_ = 1;
@@ -492,31 +735,56 @@ private:
 };
 
 async::result<void> Tcp4Socket::flushOutPackets_() {
+	// Keep the socket alive until it is closed.
+	auto self = holder_.lock();
+
 	while(true) {
-		if(connectState_ == ConnectState::none) {
+		if(connectState_ == ConnectState::closed)
+			co_return;
+
+		if(connectState_ == ConnectState::none
+				|| connectState_ == ConnectState::listening) {
 			co_await flushEvent_.async_wait();
 			continue;
 		}
 
-		if(connectState_ == ConnectState::sendSyn) {
+		if(connectState_ == ConnectState::sendSyn
+				|| connectState_ == ConnectState::sendSynAck) {
+			bool synAck = connectState_ == ConnectState::sendSynAck;
 			if(localSettledSn_ != localFlushedSn_) {
 				co_await flushEvent_.async_wait();
 				continue;
 			}
 
 			// Obtain a new random sequence number.
-			auto randomSn = globalPrng();
-			localSettledSn_ = randomSn;
-			localFlushedSn_ = randomSn;
+			// Retransmitted SYNs reuse the sequence number of the first SYN.
+			if(!haveIsn_) {
+				auto randomSn = globalPrng();
+				localSettledSn_ = randomSn;
+				localFlushedSn_ = randomSn;
+				recoverSn_ = randomSn;
+				haveIsn_ = true;
+			}
 
-			// Construct and transmit the initial SYN packet.
+			// Construct and transmit the initial SYN (or SYN-ACK) packet.
 			auto targetInfo = co_await ip4().targetByRemote(remoteEp_.ipAddress);
 			if (!targetInfo) {
-				// TODO: Return an error to users.
+				// Without a route, retransmissions cannot succeed either.
 				std::cout << "netserver: Destination unreachable" << std::endl;
+				closeError_ = protocols::fs::Error::netUnreachable;
+				abortHandshake_();
 				co_return;
 			}
 
+			// Once the source address is known, incoming segments can be
+			// matched by their 4-tuple.
+			if(!registered_) {
+				connectionKey_ = {targetInfo->source, localEp_.port,
+						remoteEp_.ipAddress, remoteEp_.port};
+				registered_ = true;
+				parent_->registerConnection(connectionKey_, holder_.lock());
+			}
+
 			std::vector<char> buf;
 			buf.resize(sizeof(TcpHeader));
 
@@ -524,51 +792,59 @@ async::result<void> Tcp4Socket::flushOutPackets_() {
 				.srcPort = localEp_.port,
 				.destPort = remoteEp_.port,
 				.seqNumber = localFlushedSn_,
-				.ackNumber = 0,
-				.window = 0,
+				.ackNumber = synAck ? remoteKnownSn_ : 0,
+				.window = synAck ? std::min(recvRing_.spaceForEnqueue(), size_t{0xFFFF}) : 0,
 				.checksum = 0,
 				.urgentPointer = 0
 			};
 			header->flags.store(TcpHeader::headerWords(sizeof(TcpHeader) / 4)
-					| TcpHeader::synFlag(true));
+					| TcpHeader::synFlag(true) | TcpHeader::ackFlag(synAck));
 
-			// Fill in the checksum.
-			PseudoHeader pseudo {
-				.src = targetInfo->source,
-				.dst = remoteEp_.ipAddress,
-				.len = buf.size()
-			};
-			Checksum csum;
-			csum.update(&pseudo, sizeof(PseudoHeader));
-			csum.update(buf.data(), buf.size());
-			header->checksum = csum.finalize();
+			auto offload = fillChecksum(buf, *targetInfo, remoteEp_.ipAddress, false);
 
 			++localFlushedSn_;
+			localHighestSn_ = localFlushedSn_;
+			stats_.segmentsSent++;
+			if(!rtoDeadline_)
+				armRetransmitTimer_();
+
+			if(synAck) {
+				remoteAckedSn_ = remoteKnownSn_;
+				announcedWindow_ = recvRing_.spaceForEnqueue();
+			}
 
 			if(debugTcp)
-				std::cout << "netserver: Sending TCP SYN" << std::endl;
+				std::cout << "netserver: Sending TCP " << (synAck ? "SYN-ACK" : "SYN")
+						<< std::endl;
 			auto error = co_await ip4().sendFrame(std::move(*targetInfo),
-				buf.data(), buf.size(), static_cast<uint16_t>(IpProto::tcp));
+				buf.data(), buf.size(), static_cast<uint16_t>(IpProto::tcp),
+				offload);
 			if (error != protocols::fs::Error::none) {
-				// TODO: Return an error to users.
+				// Treat the segment as lost; the retransmission timer resends it.
 				std::cout << "netserver: Could not send TCP packet" << std::endl;
-				co_return;
+				continue;
 			}
 		}else{
 			assert(connectState_ == ConnectState::connected);
 			size_t flushPointer = localFlushedSn_ - localSettledSn_;
 			size_t windowPointer = localWindowSn_ - localSettledSn_;
+			size_t sendLimit = std::min(windowPointer, cc_->congestionWindow());
 
 			size_t bytesAvailable = sendRing_.availableToDequeue();
-			assert(bytesAvailable >= flushPointer);
+			// The FIN occupies one Out-SN after the data.
+			size_t finPointer = finSn_ - localSettledSn_;
+			bool finFlushed = localClosed_ && flushPointer == finPointer + 1;
+			assert(bytesAvailable >= flushPointer
+					|| (finFlushed && bytesAvailable + 1 == flushPointer));
 
 			// Check whether we need to send a packet.
-			// TODO: Add retransmission here.
-			bool wantData = (bytesAvailable > flushPointer && windowPointer > flushPointer);
+			bool wantRetransmit = retransmitFirst_ && localHighestSn_ != localSettledSn_;
+			bool wantData = (bytesAvailable > flushPointer && sendLimit > flushPointer);
+			bool wantFin = localClosed_ && flushPointer == finPointer;
 			bool wantAck = (remoteAckedSn_ != remoteKnownSn_);
 			bool wantWindowUpdate = (announcedWindow_ < recvRing_.spaceForEnqueue());
 
-			if(!wantData && !wantAck && !wantWindowUpdate) {
+			if(!wantRetransmit && !wantData && !wantFin && !wantAck && !wantWindowUpdate) {
 				co_await flushEvent_.async_wait();
 				continue;
 			}
@@ -576,16 +852,35 @@ async::result<void> Tcp4Socket::flushOutPackets_() {
 			// Construct and transmit the TCP packet.
 			auto targetInfo = co_await ip4().targetByRemote(remoteEp_.ipAddress);
 			if (!targetInfo) {
-				// TODO: Return an error to users.
 				std::cout << "netserver: Destination unreachable" << std::endl;
+				closeError_ = protocols::fs::Error::netUnreachable;
+				enterClosed_();
 				co_return;
 			}
 
-			auto chunk = std::min({
-				bytesAvailable - flushPointer,
-				windowPointer - flushPointer,
-				size_t{1000} // TODO: Perform path MTU discovery.
-			});
+			// Fast retransmits resend the first unacknowledged segment.
+			size_t sendPointer = wantRetransmit ? 0 : flushPointer;
+			size_t chunk = 0;
+			if(wantRetransmit) {
+				chunk = std::min({size_t{localHighestSn_ - localSettledSn_}, maxSegmentSize,
+						bytesAvailable});
+			}else if(wantData) {
+				chunk = std::min({
+					bytesAvailable - flushPointer,
+					sendLimit - flushPointer,
+					maxSuperSegmentSize
+				});
+			}
+			// Number of segments that end up on the wire.
+			size_t numSegments = (chunk + maxSegmentSize - 1) / maxSegmentSize;
+			// Send the FIN once all data was sent; retransmissions repeat it.
+			bool fin = false;
+			if(wantRetransmit) {
+				fin = localClosed_ && sendPointer + chunk == finPointer
+						&& seqBefore(finSn_, localHighestSn_);
+			}else{
+				fin = wantFin;
+			}
 
 			std::vector<char> buf;
 			buf.resize(sizeof(TcpHeader) + chunk);
@@ -593,48 +888,87 @@ async::result<void> Tcp4Socket::flushOutPackets_() {
 			auto header = new (buf.data()) TcpHeader {
 				.srcPort = localEp_.port,
 				.destPort = remoteEp_.port,
-				.seqNumber = localFlushedSn_,
+				.seqNumber = localSettledSn_ + static_cast<uint32_t>(sendPointer),
 				.ackNumber = remoteKnownSn_,
 				.window = std::min(recvRing_.spaceForEnqueue(), size_t{0xFFFF}),
 				.checksum = 0,
 				.urgentPointer = 0
 			};
 			header->flags.store(TcpHeader::headerWords(sizeof(TcpHeader) / 4)
-					| TcpHeader::ackFlag(true));
+					| TcpHeader::finFlag(fin) | TcpHeader::ackFlag(true));
 
-			sendRing_.dequeueLookahead(flushPointer, buf.data() + sizeof(TcpHeader), chunk);
+			sendRing_.dequeueLookahead(sendPointer, buf.data() + sizeof(TcpHeader), chunk);
 
-			// Fill in the checksum.
-			PseudoHeader pseudo {
-				.src = targetInfo->source,
-				.dst = remoteEp_.ipAddress,
-				.len = buf.size()
-			};
-			Checksum csum;
-			csum.update(&pseudo, sizeof(PseudoHeader));
-			csum.update(buf.data(), buf.size());
-			header->checksum = csum.finalize();
+			// Super-segments are always checksummed by the link.
+			auto offload = fillChecksum(buf, *targetInfo, remoteEp_.ipAddress,
+					numSegments > 1);
+			if(numSegments > 1) {
+				offload.segmentSize = maxSegmentSize;
+				offload.l4HeaderSize = sizeof(TcpHeader);
+			}
 
-			localFlushedSn_ += chunk;
+			if(wantRetransmit) {
+				retransmitFirst_ = false;
+				stats_.segmentsRetransmitted++;
+			}else if(chunk) {
+				if(localFlushedSn_ == localHighestSn_) {
+					// Time this segment unless we are already timing another one.
+					if(!rttSampling_) {
+						rttSampling_ = true;
+						rttSampleSn_ = localFlushedSn_ + chunk;
+						HEL_CHECK(helGetClock(&rttSampleTime_));
+					}
+				}else{
+					// We are resending data after a retransmission timeout.
+					stats_.segmentsRetransmitted++;
+				}
+
+				localFlushedSn_ += chunk;
+				if(seqBefore(localHighestSn_, localFlushedSn_))
+					localHighestSn_ = localFlushedSn_;
+			}else if(fin) {
+				localFlushedSn_++;
+				if(seqBefore(localHighestSn_, localFlushedSn_))
+					localHighestSn_ = localFlushedSn_;
+			}
+			if(chunk || fin) {
+				stats_.segmentsSent += std::max(numSegments, size_t{1});
+				if(!rtoDeadline_)
+					armRetransmitTimer_();
+			}
 			remoteAckedSn_ = remoteKnownSn_;
 			announcedWindow_ = recvRing_.spaceForEnqueue();
 
 			if(debugTcp)
-				std::cout << "netserver: Sending TCP data (" << chunk << " bytes)" << std::endl;
+				std::cout << "netserver: Sending TCP data (" << chunk << " bytes"
+						<< (fin ? ", FIN" : "") << ")" << std::endl;
 			auto error = co_await ip4().sendFrame(std::move(*targetInfo),
 				buf.data(), buf.size(),
-				static_cast<uint16_t>(IpProto::tcp));
+				static_cast<uint16_t>(IpProto::tcp), offload);
 			if (error != protocols::fs::Error::none) {
-				// TODO: Return an error to users.
+				// Treat the segment as lost; the retransmission timer resends it.
 				std::cout << "netserver: Could not send TCP packet" << std::endl;
-				co_return;
+				continue;
 			}
 		}
 	}
 }
 
 void Tcp4Socket::handleInPacket_(TcpPacket packet) {
-	if(connectState_ == ConnectState::sendSyn) {
+	if(connectState_ == ConnectState::closed)
+		return;
+
+	if(connectState_ != ConnectState::listening
+			&& (packet.header.flags.load() & TcpHeader::rstFlag)) {
+		handleRst_(packet);
+		return;
+	}
+
+	if(connectState_ == ConnectState::listening) {
+		handleSyn_(packet);
+	}else if(connectState_ == ConnectState::sendSynAck) {
+		handleSynAckAck_(std::move(packet));
+	}else if(connectState_ == ConnectState::sendSyn) {
 		if(localSettledSn_ == localFlushedSn_) {
 			std::cout << "netserver: Rejecting packet before SYN is sent [sendSyn]"
 					<< std::endl;
@@ -659,6 +993,14 @@ void Tcp4Socket::handleInPacket_(TcpPacket packet) {
 
 		++localSettledSn_;
 		localWindowSn_ = localSettledSn_ + packet.header.window.load();
+		if(rttSampling_) {
+			uint64_t now;
+			HEL_CHECK(helGetClock(&now));
+			updateRtt_(now - rttSampleTime_);
+			rttSampling_ = false;
+		}
+		rtoDeadline_ = 0;
+		retransmitRetries_ = 0;
 		remoteAckedSn_ = packet.header.seqNumber.load();
 		remoteKnownSn_ = packet.header.seqNumber.load() + 1; // SYN counts as one byte.
 		connectState_ = ConnectState::connected;
@@ -698,21 +1040,383 @@ void Tcp4Socket::handleInPacket_(TcpPacket packet) {
 			}
 		}
 
-		if(packet.header.flags.load() & TcpHeader::ackFlag) {
-			size_t validWindow = localFlushedSn_ - localSettledSn_;
-			size_t ackPointer = packet.header.ackNumber.load() - localSettledSn_;
-			if(ackPointer <= validWindow) {
-				localSettledSn_ += ackPointer;
-				localWindowSn_ = localSettledSn_ + packet.header.window.load();
-				sendRing_.dequeueAdvance(ackPointer);
-				outSeq_ = ++currentSeq_;
-				settleEvent_.raise();
-				pollEvent_.raise();
-			}else{
-				std::cout << "netserver: Rejecting ack-number outside of valid window"
-						<< std::endl;
-			}
+		if(packet.header.flags.load() & TcpHeader::ackFlag)
+			handleAck_(packet);
+	}
+}
+
+void Tcp4Socket::handleSyn_(TcpPacket &packet) {
+	if(!(packet.header.flags.load() & TcpHeader::synFlag)) {
+		// TODO: Send a RST in this case.
+		if(debugTcp)
+			std::cout << "netserver: Rejecting packet without SYN [listening]" << std::endl;
+		return;
+	}else if(packet.header.flags.load() & TcpHeader::ackFlag) {
+		if(debugTcp)
+			std::cout << "netserver: Rejecting SYN packet with ACK [listening]" << std::endl;
+		return;
+	}
+
+	if(synQueueLength_ + acceptQueue_.size() >= listenBacklog) {
+		if(debugTcp)
+			std::cout << "netserver: Dropping SYN, listen backlog is full" << std::endl;
+		return;
+	}
+
+	// Create the connection. It starts in the SYN queue and moves to the accept
+	// queue once the remote acknowledges our SYN-ACK.
+	auto child = makeSocket(parent_, false);
+	child->listener_ = holder_;
+	child->localEp_ = {packet.packet->header.destination, localEp_.port};
+	child->remoteEp_ = {packet.packet->header.source, packet.header.srcPort.load()};
+	child->remoteAckedSn_ = packet.header.seqNumber.load();
+	child->remoteKnownSn_ = packet.header.seqNumber.load() + 1; // SYN counts as one byte.
+	child->connectionKey_ = {child->localEp_.ipAddress, child->localEp_.port,
+			child->remoteEp_.ipAddress, child->remoteEp_.port};
+	child->registered_ = true;
+	child->connectState_ = ConnectState::sendSynAck;
+	parent_->registerConnection(child->connectionKey_, child);
+	++synQueueLength_;
+	child->flushEvent_.raise();
+}
+
+void Tcp4Socket::handleSynAckAck_(TcpPacket packet) {
+	if(localSettledSn_ == localFlushedSn_) {
+		if(debugTcp)
+			std::cout << "netserver: Rejecting packet before SYN-ACK is sent [sendSynAck]"
+					<< std::endl;
+		return;
+	}
+
+	if(packet.header.flags.load() & TcpHeader::synFlag) {
+		// The remote retransmitted its SYN; our SYN-ACK was probably lost.
+		localFlushedSn_ = localSettledSn_;
+		flushEvent_.raise();
+		return;
+	}else if(!(packet.header.flags.load() & TcpHeader::ackFlag)) {
+		std::cout << "netserver: Rejecting packet without ACK [sendSynAck]"
+				<< std::endl;
+		return;
+	}
+
+	if(packet.header.ackNumber.load() != localSettledSn_ + 1) {
+		std::cout << "netserver: Rejecting packet with bad ack-number [sendSynAck]"
+				<< std::endl;
+		return;
+	}
+
+	++localSettledSn_;
+	localWindowSn_ = localSettledSn_ + packet.header.window.load();
+	if(rttSampling_) {
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		updateRtt_(now - rttSampleTime_);
+		rttSampling_ = false;
+	}
+	rtoDeadline_ = 0;
+	connectState_ = ConnectState::connected;
+
+	if(auto listener = listener_.lock(); listener) {
+		listener->completeHandshake_(holder_.lock());
+	}else{
+		abortHandshake_();
+		return;
+	}
+
+	// The final ACK of the handshake can already carry data.
+	if(packet.payload().size() || (packet.header.flags.load() & TcpHeader::finFlag))
+		handleInPacket_(std::move(packet));
+	flushEvent_.raise();
+	settleEvent_.raise();
+}
+
+void Tcp4Socket::completeHandshake_(smarter::shared_ptr<Tcp4Socket> child) {
+	assert(synQueueLength_);
+	--synQueueLength_;
+	acceptQueue_.push_back(std::move(child));
+
+	inSeq_ = ++currentSeq_;
+	inEvent_.raise();
+	pollEvent_.raise();
+}
+
+void Tcp4Socket::abortHandshake_() {
+	if(debugTcp)
+		std::cout << "netserver: Aborting TCP handshake" << std::endl;
+
+	if(connectState_ == ConnectState::sendSynAck) {
+		if(auto listener = listener_.lock(); listener) {
+			assert(listener->synQueueLength_);
+			--listener->synQueueLength_;
+		}
+	}
+
+	enterClosed_();
+}
+
+void Tcp4Socket::handleRst_(TcpPacket &packet) {
+	// Only accept resets that are exactly in sequence (RFC 5961);
+	// in SYN-SENT, the reset must acknowledge our SYN.
+	if(connectState_ == ConnectState::sendSyn) {
+		if(localSettledSn_ == localFlushedSn_
+				|| !(packet.header.flags.load() & TcpHeader::ackFlag)
+				|| packet.header.ackNumber.load() != localSettledSn_ + 1)
+			return;
+	}else if(packet.header.seqNumber.load() != remoteKnownSn_) {
+		if(debugTcp)
+			std::cout << "netserver: Ignoring out-of-sequence RST" << std::endl;
+		return;
+	}
+
+	if(debugTcp)
+		std::cout << "netserver: Connection reset by remote" << std::endl;
+
+	if(connectState_ == ConnectState::sendSynAck) {
+		abortHandshake_();
+		return;
+	}
+	remoteClosed_ = true;
+	enterClosed_();
+}
+
+void Tcp4Socket::close_() {
+	if(localClosed_)
+		return;
+	localClosed_ = true;
+
+	if(connectState_ == ConnectState::connected) {
+		// Send a FIN once the remaining data was sent.
+		closedFirst_ = !remoteClosed_;
+		finSn_ = localSettledSn_ + sendRing_.availableToDequeue();
+		flushEvent_.raise();
+		return;
+	}
+
+	// Connections that were not yet accepted will never be accepted.
+	if(connectState_ == ConnectState::listening) {
+		auto queue = std::move(acceptQueue_);
+		for(auto &child : queue)
+			child->close_();
+	}
+	if(connectState_ != ConnectState::closed)
+		enterClosed_();
+}
+
+void Tcp4Socket::handleFinAcked_() {
+	if(debugTcp)
+		std::cout << "netserver: TCP FIN was acknowledged" << std::endl;
+
+	// If the remote closed first, we are in LAST-ACK and the connection is done.
+	if(!closedFirst_) {
+		enterClosed_();
+		return;
+	}
+
+	// Otherwise, we are in FIN-WAIT-2 or TIME-WAIT. Keep the 4-tuple registered
+	// such that we can acknowledge retransmitted FINs of the remote.
+	async::detach(timeWait_());
+}
+
+async::result<void> Tcp4Socket::timeWait_() {
+	auto self = holder_.lock();
+	co_await helix::sleepFor(timeWaitDuration);
+	if(connectState_ != ConnectState::closed)
+		enterClosed_();
+}
+
+void Tcp4Socket::enterClosed_() {
+	// Our coroutines keep the socket alive until they observe the state change.
+	connectState_ = ConnectState::closed;
+	if(registered_) {
+		parent_->unregisterConnection(connectionKey_);
+		registered_ = false;
+	}
+	// Listening and actively opened sockets own their port.
+	if(bound_) {
+		parent_->unbind(localEp_);
+		bound_ = false;
+	}
+	rtoDeadline_ = 0;
+	flushEvent_.raise();
+	rtoEvent_.raise();
+
+	// Wake up users that wait for the connection.
+	hupSeq_ = ++currentSeq_;
+	inEvent_.raise();
+	settleEvent_.raise();
+	pollEvent_.raise();
+}
+
+void Tcp4Socket::handleAck_(TcpPacket &packet) {
+	size_t validWindow = localHighestSn_ - localSettledSn_;
+	size_t ackPointer = packet.header.ackNumber.load() - localSettledSn_;
+	if(ackPointer > validWindow) {
+		std::cout << "netserver: Rejecting ack-number outside of valid window"
+				<< std::endl;
+		return;
+	}
+
+	uint32_t newWindowSn = localSettledSn_ + ackPointer + packet.header.window.load();
+
+	if(!ackPointer) {
+		// Detect duplicate ACKs as in RFC 5681.
+		bool isDuplicate = localHighestSn_ != localSettledSn_
+				&& !packet.payload().size()
+				&& !(packet.header.flags.load() & TcpHeader::synFlag)
+				&& !(packet.header.flags.load() & TcpHeader::finFlag)
+				&& newWindowSn == localWindowSn_;
+		localWindowSn_ = newWindowSn;
+		if(!isDuplicate) {
+			flushEvent_.raise();
+			return;
+		}
+
+		stats_.dupAcks++;
+		if(inRecovery_) {
+			cc_->onRecoveryDupAck();
+		}else if(++dupAcks_ == dupAckThreshold
+				&& seqBefore(recoverSn_, localSettledSn_)) {
+			// Fast retransmit, then enter fast recovery (RFC 6582).
+			cc_->onEnterRecovery(localHighestSn_ - localSettledSn_);
+			inRecovery_ = true;
+			recoverSn_ = localHighestSn_;
+			retransmitFirst_ = true;
+			rttSampling_ = false;
+			stats_.fastRetransmits++;
+		}
+		flushEvent_.raise();
+		return;
+	}
+
+	localSettledSn_ += ackPointer;
+	localWindowSn_ = newWindowSn;
+	if(seqBefore(localFlushedSn_, localSettledSn_))
+		localFlushedSn_ = localSettledSn_;
+	// The ACK of our FIN does not correspond to data in sendRing_.
+	sendRing_.dequeueAdvance(std::min(size_t{ackPointer}, sendRing_.availableToDequeue()));
+	dupAcks_ = 0;
+	retransmitRetries_ = 0;
+
+	if(rttSampling_ && !seqBefore(localSettledSn_, rttSampleSn_)) {
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		updateRtt_(now - rttSampleTime_);
+		rttSampling_ = false;
+	}
+
+	if(inRecovery_) {
+		if(seqBefore(localSettledSn_, recoverSn_)) {
+			// Partial ACK: the next segment was lost as well.
+			cc_->onPartialAck(ackPointer);
+			retransmitFirst_ = true;
+		}else{
+			cc_->onExitRecovery(localHighestSn_ - localSettledSn_);
+			inRecovery_ = false;
+		}
+	}else{
+		cc_->onAck(ackPointer);
+	}
+
+	// Restart the timer for the remaining outstanding data (RFC 6298 5.3).
+	if(localHighestSn_ == localSettledSn_) {
+		rtoDeadline_ = 0;
+	}else{
+		armRetransmitTimer_();
+	}
+
+	outSeq_ = ++currentSeq_;
+	flushEvent_.raise();
+	settleEvent_.raise();
+	pollEvent_.raise();
+
+	if(localClosed_ && !finAcked_ && localSettledSn_ == finSn_ + 1) {
+		finAcked_ = true;
+		handleFinAcked_();
+	}
+}
+
+void Tcp4Socket::handleRetransmitTimeout_() {
+	if(localHighestSn_ == localSettledSn_)
+		return;
+
+	if(debugTcp)
+		std::cout << "netserver: TCP retransmission timeout" << std::endl;
+
+	stats_.timeouts++;
+	if(connectState_ == ConnectState::sendSynAck && ++synAckRetries_ > maxSynAckRetries) {
+		abortHandshake_();
+		return;
+	}
+	if(connectState_ != ConnectState::sendSynAck && ++retransmitRetries_ > maxRetransmitRetries) {
+		// The remote is unreachable; this also ends our coroutines.
+		if(debugTcp)
+			std::cout << "netserver: Dropping unresponsive TCP connection" << std::endl;
+		remoteClosed_ = true;
+		enterClosed_();
+		return;
+	}
+	rto_ = std::min(rto_ * 2, maxRto);
+	rttSampling_ = false;
+
+	if(connectState_ == ConnectState::connected) {
+		cc_->onRetransmitTimeout(localHighestSn_ - localSettledSn_);
+		inRecovery_ = false;
+		dupAcks_ = 0;
+		recoverSn_ = localHighestSn_;
+		retransmitFirst_ = false;
+	}
+
+	// Resend everything starting at the first unacknowledged byte.
+	localFlushedSn_ = localSettledSn_;
+	flushEvent_.raise();
+}
+
+void Tcp4Socket::armRetransmitTimer_() {
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	rtoDeadline_ = now + rto_;
+	rtoEvent_.raise();
+}
+
+void Tcp4Socket::updateRtt_(uint64_t sample) {
+	if(!haveRtt_) {
+		srtt_ = sample;
+		rttVar_ = sample / 2;
+		haveRtt_ = true;
+	}else{
+		uint64_t delta = srtt_ > sample ? srtt_ - sample : sample - srtt_;
+		rttVar_ = (3 * rttVar_ + delta) / 4;
+		srtt_ = (7 * srtt_ + sample) / 8;
+	}
+	rto_ = std::clamp(srtt_ + std::max(clockGranularity, 4 * rttVar_), minRto, maxRto);
+}
+
+async::result<void> Tcp4Socket::retransmitTimer_() {
+	// Keep the socket alive until it is closed.
+	auto self = holder_.lock();
+
+	while(true) {
+		if(connectState_ == ConnectState::closed)
+			co_return;
+
+		if(!rtoDeadline_) {
+			co_await rtoEvent_.async_wait();
+			continue;
 		}
+
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		if(now < rtoDeadline_) {
+			// Wait until the deadline passes or until the timer is re-armed.
+			async::cancellation_event cancelWait;
+			helix::TimeoutCancellation timer{rtoDeadline_ - now, cancelWait};
+			co_await rtoEvent_.async_wait(cancelWait);
+			co_await timer.retire();
+			continue;
+		}
+
+		rtoDeadline_ = 0;
+		handleRetransmitTimeout_();
 	}
 }
 
@@ -727,6 +1431,18 @@ void Tcp4::feedDatagram(smarter::shared_ptr<const Ip4Packet> packet) {
 		std::cout << "netserver: Received TCP packet at port " << tcp.header.destPort.load()
 				<< " (" << tcp.payload().size() << " bytes)" << std::endl;
 
+	// Fast path: segments of established (or half-open) connections.
+	TcpConnectionKey key{tcp.packet->header.destination, tcp.header.destPort.load(),
+			tcp.packet->header.source, tcp.header.srcPort.load()};
+	if(auto it = connections.find(key); it != connections.end()) {
+		// Closed connections unregister themselves before they are destructed.
+		auto socket = it->second.lock();
+		assert(socket);
+		socket->handleInPacket_(std::move(tcp));
+		return;
+	}
+
+	// Otherwise, deliver the segment to a listening or bound socket.
 	auto it = binds.lower_bound({ 0, tcp.header.destPort.load() });
 	for (; it != binds.end() && it->first.port == tcp.header.destPort.load(); it++) {
 		auto existingEp = it->first;
@@ -748,6 +1464,7 @@ bool Tcp4::tryBind(smarter::shared_ptr<Tcp4Socket> socket, TcpEndpoint wantedEp)
 		}
 	}
 	socket->localEp_ = wantedEp;
+	socket->bound_ = true;
 	binds.emplace(wantedEp, std::move(socket));
 	return true;
 }
@@ -756,9 +1473,17 @@ bool Tcp4::unbind(TcpEndpoint e) {
 	return binds.erase(e) != 0;
 }
 
+void Tcp4::registerConnection(TcpConnectionKey key, smarter::shared_ptr<Tcp4Socket> socket) {
+	if(!connections.emplace(key, smarter::weak_ptr<Tcp4Socket>{socket}).second)
+		std::cout << "netserver: TCP connection " << key.localPort << " -> "
+				<< key.remotePort << " is already registered" << std::endl;
+}
+
+bool Tcp4::unregisterConnection(TcpConnectionKey key) {
+	return connections.erase(key) != 0;
+}
+
 void Tcp4::serveSocket(int flags, helix::UniqueLane lane) {
-	using protocols::fs::servePassthrough;
 	auto sock = Tcp4Socket::makeSocket(this, flags & SOCK_NONBLOCK);
-	async::detach(servePassthrough(std::move(lane), std::move(sock),
-			&Tcp4Socket::ops));
+	Tcp4Socket::serve(std::move(lane), std::move(sock));
 }
@@ -3,6 +3,7 @@
 #include <helix/ipc.hpp>
 #include <smarter.hpp>
 #include <map>
+#include <unordered_map>
 
 class Ip4Packet;
 
@@ -15,14 +16,44 @@ struct TcpEndpoint {
 	uint16_t port = 0;
 };
 
+// Identifies a connection by its 4-tuple.
+struct TcpConnectionKey {
+	friend bool operator==(const TcpConnectionKey &l, const TcpConnectionKey &r) {
+		return l.localIp == r.localIp && l.localPort == r.localPort
+				&& l.remoteIp == r.remoteIp && l.remotePort == r.remotePort;
+	}
+
+	uint32_t localIp = 0;
+	uint16_t localPort = 0;
+	uint32_t remoteIp = 0;
+	uint16_t remotePort = 0;
+};
+
+struct TcpConnectionKeyHash {
+	size_t operator()(const TcpConnectionKey &k) const {
+		uint64_t ports = (uint64_t{k.localPort} << 16) | k.remotePort;
+		uint64_t ips = (uint64_t{k.localIp} << 32) | k.remoteIp;
+		// Mix both words (multipliers taken from splitmix64).
+		uint64_t h = (ips ^ (ports * 0x9E3779B97F4A7C15)) * 0xBF58476D1CE4E5B9;
+		return h ^ (h >> 31);
+	}
+};
+
 struct Tcp4Socket;
 
 struct Tcp4 {
 	void feedDatagram(smarter::shared_ptr<const Ip4Packet>);
 	bool tryBind(smarter::shared_ptr<Tcp4Socket> socket, TcpEndpoint ipAddress);
 	bool unbind(TcpEndpoint remote);
+	// Connections are registered once their 4-tuple is known and unregistered once they
+	// are closed. Incoming segments are matched against connections before bound sockets.
+	void registerConnection(TcpConnectionKey key, smarter::shared_ptr<Tcp4Socket> socket);
+	bool unregisterConnection(TcpConnectionKey key);
 	void serveSocket(int flags, helix::UniqueLane lane);
 
 private:
 	std::map<TcpEndpoint, smarter::shared_ptr<Tcp4Socket>> binds;
+	// Connections are kept alive by their users and by their own coroutines.
+	std::unordered_map<TcpConnectionKey, smarter::weak_ptr<Tcp4Socket>,
+			TcpConnectionKeyHash> connections;
 };
@@ -79,7 +79,7 @@ struct Udp {
 		if (payload.size() < header.len) {
 			return false;
 		}
-		if (header.chk != 0) {
+		if (header.chk != 0 && !packet->checksumVerified) {
 			PseudoHeader phdr;
 			phdr.src = packet->header.source;
 			phdr.dst = packet->header.destination;
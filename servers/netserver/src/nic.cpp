@@ -1,12 +1,37 @@
 #include <netserver/nic.hpp>
 
 #include <algorithm>
+#include <cassert>
 #include <cstring>
 #include <arch/bit.hpp>
+#include "ip/checksum.hpp"
 #include "ip/ip4.hpp"
 #include "ip/arp.hpp"
 
 namespace nic {
+BufferPool::BufferPool(arch::dma_pool *backing, size_t bufferSize)
+	: backing_(backing), bufferSize_(bufferSize) {}
+
+BufferPool::~BufferPool() {
+	for (auto buffer : freeBuffers_)
+		backing_->deallocate(buffer, bufferSize_, 1, 1);
+}
+
+void *BufferPool::allocate(size_t size, size_t count, size_t align) {
+	assert(size * count <= bufferSize_);
+	(void)align;
+	if (!freeBuffers_.empty()) {
+		auto buffer = freeBuffers_.back();
+		freeBuffers_.pop_back();
+		return buffer;
+	}
+	return backing_->allocate(bufferSize_, 1, 1);
+}
+
+void BufferPool::deallocate(void *pointer, size_t, size_t, size_t) {
+	freeBuffers_.push_back(pointer);
+}
+
 uint8_t &MacAddress::operator[](size_t idx) {
 	return mac_[idx];
 }
@@ -51,13 +76,117 @@ Link::AllocatedBuffer Link::allocateFrame(MacAddress to, EtherType type,
 	return buf;
 }
 
-async::detached runDevice(std::shared_ptr<nic::Link> dev) {
+namespace {
+
+uint16_t load16(const uint8_t *p) {
+	return p[0] << 8 | p[1];
+}
+
+uint32_t load32(const uint8_t *p) {
+	return uint32_t(load16(p)) << 16 | load16(p + 2);
+}
+
+void store16(uint8_t *p, uint16_t value) {
+	p[0] = value >> 8;
+	p[1] = value;
+}
+
+void store32(uint8_t *p, uint32_t value) {
+	store16(p, value >> 16);
+	store16(p + 2, value);
+}
+
+} // namespace
+
+async::result<void> Link::sendSegmented(const arch::dma_buffer_view frame,
+		ChecksumOffload checksum, SegmentationOffload segmentation) {
+	constexpr size_t ipOffset = 14;
+	constexpr uint8_t finFlag = 0x01;
+	constexpr uint8_t pshFlag = 0x08;
+
+	auto in = static_cast<const uint8_t *>(frame.data());
+	size_t headerSize = segmentation.headerSize;
+	size_t tcpOffset = checksum.start;
+	assert(tcpOffset + 20 <= headerSize && headerSize < frame.size());
+
+	auto ident = load16(in + ipOffset + 4);
+	auto seq = load32(in + tcpOffset + 4);
+
+	for (size_t offset = headerSize; offset < frame.size();
+			offset += segmentation.segmentSize) {
+		auto chunk = std::min(size_t{segmentation.segmentSize}, frame.size() - offset);
+		bool last = offset + chunk == frame.size();
+
+		arch::dma_buffer segment { dmaPool(), headerSize + chunk };
+		auto out = static_cast<uint8_t *>(segment.data());
+		std::memcpy(out, in, headerSize);
+		std::memcpy(out + headerSize, in + offset, chunk);
+
+		// Each segment is a separate IP packet.
+		store16(out + ipOffset + 2, headerSize - ipOffset + chunk);
+		store16(out + ipOffset + 4, ident++);
+		store16(out + ipOffset + 10, 0);
+		Checksum ipChecksum;
+		ipChecksum.update(out + ipOffset, tcpOffset - ipOffset);
+		store16(out + ipOffset + 10, ipChecksum.finalize());
+
+		// FIN and PSH only apply to the end of the super-segment.
+		store32(out + tcpOffset + 4, seq + (offset - headerSize));
+		if (!last)
+			out[tcpOffset + 13] &= ~(finFlag | pshFlag);
+
+		size_t tcpSize = headerSize - tcpOffset + chunk;
+		auto checksumField = out + tcpOffset + checksum.offset;
+		Checksum tcpChecksum;
+		tcpChecksum.update(out + ipOffset + 12, 8);
+		tcpChecksum.update(uint16_t{out[ipOffset + 9]});
+		tcpChecksum.update(static_cast<uint16_t>(tcpSize));
+		if (txChecksumOffload) {
+			store16(checksumField, tcpChecksum.partial());
+			co_await send(segment, checksum);
+		} else {
+			store16(checksumField, 0);
+			tcpChecksum.update(out + tcpOffset, tcpSize);
+			store16(checksumField, tcpChecksum.finalize());
+			co_await send(segment, std::nullopt);
+		}
+	}
+}
+
+uint32_t flowHash(arch::dma_buffer_view frame) {
+	constexpr size_t ipOffset = 14;
+	auto data = static_cast<const uint8_t *>(frame.data());
+	if (frame.size() < ipOffset + 20 || load16(data + 12) != ETHER_TYPE_IP4)
+		return 0;
+	auto ip = data + ipOffset;
+	auto proto = ip[9];
+	size_t l4Offset = ipOffset + (ip[0] & 0xF) * 4;
+	if ((proto != 6 && proto != 17) || frame.size() < l4Offset + 4)
+		return 0;
+
+	// FNV-1a over the 12 bytes that identify the flow.
+	uint32_t hash = 2166136261;
+	auto mix = [&] (const uint8_t *p, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			hash ^= p[i];
+			hash *= 16777619;
+		}
+	};
+	mix(ip + 12, 8);
+	mix(data + l4Offset, 4);
+	return hash;
+}
+
+namespace {
+
+async::detached runQueue(std::shared_ptr<nic::Link> dev, size_t queue) {
 	using namespace arch;
 	while(true) {
-		dma_buffer frameBuffer { dev->dmaPool(), 1514 };
-		co_await dev->receive(frameBuffer);
-		auto capsule = frameBuffer.subview(14);
-		auto data = reinterpret_cast<uint8_t*>(frameBuffer.data());
+		auto [frameBuffer, frame, checksumVerified] = co_await dev->receive(queue);
+		if (frame.size() < 14)
+			continue;
+		auto capsule = frame.subview(14);
+		auto data = reinterpret_cast<uint8_t*>(frame.data());
 		uint16_t ethertype = data[12] << 8 | data[13];
 		nic::MacAddress dstsrc[2];
 		std::memcpy(dstsrc, data, sizeof(dstsrc));
@@ -65,7 +194,7 @@ async::detached runDevice(std::shared_ptr<nic::Link> dev) {
 		switch (ethertype) {
 		case ETHER_TYPE_IP4:
 			ip4().feedPacket(dstsrc[0], dstsrc[1],
-				std::move(frameBuffer), capsule);
+				std::move(frameBuffer), capsule, checksumVerified);
 			break;
 		case ETHER_TYPE_ARP:
 			neigh4().feedArp(dstsrc[0], capsule);
@@ -75,4 +204,13 @@ async::detached runDevice(std::shared_ptr<nic::Link> dev) {
 		}
 	}
 }
+} // namespace
+
+void runDevice(std::shared_ptr<nic::Link> dev) {
+	// All receive loops run on the netserver's single dispatcher; this only avoids
+	// head-of-line blocking between the queues. The IPv4 and TCP state is not
+	// synchronized, so the queues cannot be processed in parallel yet.
+	for (size_t i = 0; i < dev->numQueues; i++)
+		runQueue(dev, i);
+}
 } // namespace nic
@@ -1,7 +1,12 @@
 #include <math.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
 
 #include <async/result.hpp>
 #include <async/algorithm.hpp>
+#include <async/oneshot-event.hpp>
+#include <helix/clock.hpp>
 #include <helix/ipc.hpp>
 
 namespace {
@@ -24,7 +29,8 @@ struct IterationsPerSecondBenchmark {
 		results_.push_back(iters);
 	}
 
-	void finalizeStatistics() {
+	// If bytesPerIteration is non-zero, the average throughput is reported, too.
+	void finalizeStatistics(size_t bytesPerIteration = 0) {
 		double avg = 0;
 		for(uint64_t n : results_)
 			avg += n;
@@ -37,6 +43,10 @@ struct IterationsPerSecondBenchmark {
 
 		std::cout << "    avg: " << static_cast<uint64_t>(avg)
 				<< ", std: " << static_cast<uint64_t>(sqrt(var)) << std::endl;
+		if(bytesPerIteration)
+			std::cout << "    throughput: "
+					<< static_cast<uint64_t>(avg * bytesPerIteration / (1024 * 1024))
+					<< " MiB/s" << std::endl;
 	}
 
 private:
@@ -81,6 +91,73 @@ async::result<void> doAsyncNopBenchmark() {
 	bench.finalizeStatistics();
 }
 
+async::result<void> doBatchedNopBenchmark(int batchSize) {
+	std::cout << "ipc completions (batch size = " << batchSize << ")" << std::endl;
+
+	auto nop = [] (int &pending, async::oneshot_event &allDone) -> async::result<void> {
+		auto result = co_await helix_ng::asyncNop();
+		HEL_CHECK(result.error());
+		if(!--pending)
+			allDone.raise();
+	};
+
+	IterationsPerSecondBenchmark bench;
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			for(int i = 0; i < 100; ++i) {
+				int pending = batchSize;
+				async::oneshot_event allDone;
+				for(int j = 0; j < batchSize; ++j)
+					async::detach(nop(pending, allDone));
+				co_await allDone.wait();
+				n += batchSize;
+			}
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+}
+
+void doGetClockBenchmark() {
+	std::cout << "clock reads (syscall)" << std::endl;
+
+	IterationsPerSecondBenchmark bench;
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			for(int i = 0; i < 100; ++i) {
+				uint64_t nanos;
+				HEL_CHECK(helGetClock(&nanos));
+				++n;
+			}
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+}
+
+void doClockPageBenchmark() {
+	std::cout << "clock reads (clock page)" << std::endl;
+
+	IterationsPerSecondBenchmark bench;
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			for(int i = 0; i < 100; ++i) {
+				auto nanos = helix::currentNanos();
+				asm volatile ("" : : "r"(nanos));
+				++n;
+			}
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+}
+
 void doFutexBenchmark() {
 	std::cout << "futex waits" << std::endl;
 
@@ -242,15 +319,93 @@ async::result<void> doSendRecvBufferBenchmark(size_t size) {
 		}
 		bench.announceIterations(n);
 	}
-	bench.finalizeStatistics();
+	bench.finalizeStatistics(size);
+}
+
+// Pager that completes writeback slowly, such that writers produce dirty pages faster
+// than they are cleaned.
+async::result<void> runSlowPager(HelHandle backing) {
+	while(true) {
+		helix::ManageMemory manage;
+		auto &&submit = helix::submitManageMemory(helix::BorrowedDescriptor(backing),
+				&manage, helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(manage.error());
+
+		if(manage.type() == kHelManageInitialize) {
+			HEL_CHECK(helUpdateMemory(backing, kHelManageInitialize,
+					manage.offset(), manage.length()));
+		}else{
+			assert(manage.type() == kHelManageWriteback);
+			usleep(1000);
+			HEL_CHECK(helUpdateMemory(backing, kHelManageWriteback,
+					manage.offset(), manage.length()));
+		}
+	}
+}
+
+// Dirties twice the hard limit of dirty memory (20% of RAM) through a mapping.
+// Write faults are throttled, thus the amount of dirty memory must stay below the limit
+// (plus the pages that were dirtied since the last fault).
+void doDirtyThrottleBenchmark() {
+	std::cout << "dirty page throttling" << std::endl;
+
+	constexpr size_t chunkSize = 1 << 20;
+
+	HelMemoryStats stats;
+	HEL_CHECK(helQueryMemoryStats(&stats));
+	size_t hardLimit = stats.totalMemory / 5;
+	size_t size = (2 * hardLimit + chunkSize - 1) & ~(chunkSize - 1);
+	uint64_t throttledBefore = stats.numThrottledWrites;
+
+	HelHandle backing, frontal;
+	HEL_CHECK(helCreateManagedMemory(size, 0, &backing, &frontal));
+
+	// The pager needs its own thread since the writer blocks in page faults.
+	// It is never joined; it keeps serving the memory until the process exits.
+	std::thread{[=] {
+		async::run(runSlowPager(backing), helix::currentDispatcher);
+	}}.detach();
+
+	auto start = std::chrono::high_resolution_clock::now();
+	size_t peakDirty = 0;
+	for(size_t offset = 0; offset < size; offset += chunkSize) {
+		void *window;
+		HEL_CHECK(helMapMemory(frontal, kHelNullHandle, nullptr, offset, chunkSize,
+				kHelMapProtRead | kHelMapProtWrite, &window));
+		auto p = reinterpret_cast<volatile std::byte *>(window);
+		for(size_t progress = 0; progress < chunkSize; progress += 0x1000)
+			p[progress] = static_cast<std::byte>(1);
+		// Unmapping accounts the pages as dirty.
+		HEL_CHECK(helUnmapMemory(kHelNullHandle, window, chunkSize));
+
+		HEL_CHECK(helQueryMemoryStats(&stats));
+		peakDirty = std::max(peakDirty, static_cast<size_t>(stats.dirtyMemory));
+	}
+	auto elapsed = duration_cast<std::chrono::milliseconds>(
+				std::chrono::high_resolution_clock::now() - start);
+
+	std::cout << "    wrote " << (size / (1024 * 1024)) << " MiB in "
+			<< elapsed.count() << " ms" << std::endl;
+	std::cout << "    peak dirty: " << (peakDirty / (1024 * 1024)) << " MiB"
+			<< ", limit: " << (hardLimit / (1024 * 1024)) << " MiB"
+			<< ", throttled writes: " << (stats.numThrottledWrites - throttledBefore)
+			<< std::endl;
+	assert(peakDirty <= hardLimit + chunkSize);
+
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, frontal));
 }
 
 } // anonymous namespace
 
 int main() {
 	doNopBenchmark();
+	doGetClockBenchmark();
+	doClockPageBenchmark();
 	doFutexBenchmark();
 	async::run(doAsyncNopBenchmark(), helix::currentDispatcher);
+	async::run(doBatchedNopBenchmark(16), helix::currentDispatcher);
+	async::run(doBatchedNopBenchmark(64), helix::currentDispatcher);
 	doAllocateBenchmark(1 << 20);
 	doMapBenchmark(1 << 20);
 	doMapPopulatedBenchmark(1 << 20);
@@ -262,4 +417,6 @@ int main() {
 	async::run(doSendRecvBufferBenchmark(16 * 1024), helix::currentDispatcher);
 	async::run(doSendRecvBufferBenchmark(64 * 1024), helix::currentDispatcher);
 	async::run(doSendRecvBufferBenchmark(1024 * 1024), helix::currentDispatcher);
+	async::run(doSendRecvBufferBenchmark(4 * 1024 * 1024), helix::currentDispatcher);
+	doDirtyThrottleBenchmark();
 }
@@ -49,3 +49,43 @@ DEFINE_TEST(unmapPartialPreserve, ([] {
 	HEL_CHECK(helUnmapMemory(kHelNullHandle, p, 0x1000));
 	HEL_CHECK(helUnmapMemory(kHelNullHandle, p + 0x2000, 0x1000));
 }))
+
+DEFINE_TEST(unmapPartialHugePage, ([] {
+	HelHandle handle;
+	HEL_CHECK(helAllocateMemory(0x400000, kHelAllocHugePages, nullptr, &handle));
+	void *window;
+	HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, 0x400000,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+
+	// Memory with huge page chunks cannot be resized in 4 KiB steps.
+	assert(helResizeMemory(handle, 0x401000) == kHelErrIllegalArgs);
+
+	HelMemoryStats statsBefore;
+	HEL_CHECK(helQueryMemoryStats(&statsBefore));
+
+	// Fault in the memory (this maps huge pages).
+	auto p = reinterpret_cast<std::byte *>(window);
+	for(size_t off = 0; off < 0x400000; off += 0x1000)
+		p[off] = static_cast<std::byte>(off >> 12);
+
+	HelMemoryStats statsAfter;
+	HEL_CHECK(helQueryMemoryStats(&statsAfter));
+	assert(statsAfter.numHugePageMappings >= statsBefore.numHugePageMappings + 2);
+
+	// Unmap a single page in the middle of each 2 MiB page to force a split.
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, p + 0x1000, 0x1000));
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, p + 0x201000, 0x1000));
+
+	// Check that the remaining pages are preserved.
+	for(size_t off = 0; off < 0x400000; off += 0x1000) {
+		if(off == 0x1000 || off == 0x201000)
+			continue;
+		assert(p[off] == static_cast<std::byte>(off >> 12));
+	}
+
+	// Clean up.
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, p, 0x1000));
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, p + 0x2000, 0x1FF000));
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, p + 0x202000, 0x1FE000));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+}))
@@ -1,9 +1,13 @@
 #include <cassert>
 #include <cstring>
 #include <errno.h>
+#include <iostream>
+#include <time.h>
 #include <unistd.h>
+#include <vector>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <sys/resource.h>
 
 #include "testsuite.hpp"
 
@@ -47,3 +51,172 @@ DEFINE_TEST(epoll_mod_active, ([] {
 	close(epfd);
 	close(fd);
 }))
+
+DEFINE_TEST(epoll_edge_triggered, ([] {
+	int e;
+	int pending;
+
+	int fd = eventfd(0, 0);
+	assert(fd >= 0);
+
+	int epfd = epoll_create1(0);
+	assert(epfd >= 0);
+
+	epoll_event evt;
+	memset(&evt, 0, sizeof(epoll_event));
+	evt.events = EPOLLIN | EPOLLET;
+	e = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &evt);
+	assert(!e);
+
+	uint64_t n = 1;
+	auto written = write(fd, &n, sizeof(uint64_t));
+	assert(written == sizeof(uint64_t));
+
+	memset(&evt, 0, sizeof(epoll_event));
+	pending = epoll_wait(epfd, &evt, 1, 0);
+	assert(pending == 1);
+	assert(evt.events & EPOLLIN);
+
+	// The FD is still readable but there was no new edge.
+	memset(&evt, 0, sizeof(epoll_event));
+	pending = epoll_wait(epfd, &evt, 1, 0);
+	assert(!pending);
+
+	written = write(fd, &n, sizeof(uint64_t));
+	assert(written == sizeof(uint64_t));
+
+	memset(&evt, 0, sizeof(epoll_event));
+	pending = epoll_wait(epfd, &evt, 1, 0);
+	assert(pending == 1);
+	assert(evt.events & EPOLLIN);
+
+	close(epfd);
+	close(fd);
+}))
+
+DEFINE_TEST(epoll_oneshot, ([] {
+	int e;
+	int pending;
+
+	int fd = eventfd(0, 0);
+	assert(fd >= 0);
+
+	int epfd = epoll_create1(0);
+	assert(epfd >= 0);
+
+	epoll_event evt;
+	memset(&evt, 0, sizeof(epoll_event));
+	evt.events = EPOLLIN | EPOLLONESHOT;
+	e = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &evt);
+	assert(!e);
+
+	uint64_t n = 1;
+	auto written = write(fd, &n, sizeof(uint64_t));
+	assert(written == sizeof(uint64_t));
+
+	memset(&evt, 0, sizeof(epoll_event));
+	pending = epoll_wait(epfd, &evt, 1, 0);
+	assert(pending == 1);
+
+	// The item is disabled after it was reported once.
+	written = write(fd, &n, sizeof(uint64_t));
+	assert(written == sizeof(uint64_t));
+	memset(&evt, 0, sizeof(epoll_event));
+	pending = epoll_wait(epfd, &evt, 1, 0);
+	assert(!pending);
+
+	// Re-arming the item reports it again.
+	memset(&evt, 0, sizeof(epoll_event));
+	evt.events = EPOLLIN | EPOLLONESHOT;
+	e = epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &evt);
+	assert(!e);
+	memset(&evt, 0, sizeof(epoll_event));
+	pending = epoll_wait(epfd, &evt, 1, 0);
+	assert(pending == 1);
+
+	close(epfd);
+	close(fd);
+}))
+
+namespace {
+	uint64_t elapsedMicros(const timespec &start, const timespec &end) {
+		return (end.tv_sec - start.tv_sec) * 1000000
+				+ (end.tv_nsec - start.tv_nsec) / 1000;
+	}
+}
+
+// Also acts as a benchmark: epoll_wait() should return all events in a single call
+// and its cost should not depend on the number of idle FDs.
+DEFINE_TEST(epoll_10k_fds, ([] {
+	constexpr int numFds = 10000;
+	int e;
+	int pending;
+
+	rlimit limit;
+	e = getrlimit(RLIMIT_NOFILE, &limit);
+	assert(!e);
+	if(limit.rlim_cur < numFds + 16) {
+		limit.rlim_cur = numFds + 16;
+		if(limit.rlim_max < limit.rlim_cur)
+			limit.rlim_max = limit.rlim_cur;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	int epfd = epoll_create1(0);
+	assert(epfd >= 0);
+
+	std::vector<int> fds;
+	for(int i = 0; i < numFds; i++) {
+		int fd = eventfd(0, 0);
+		assert(fd >= 0);
+
+		epoll_event evt;
+		memset(&evt, 0, sizeof(epoll_event));
+		evt.events = EPOLLIN | EPOLLET;
+		evt.data.u32 = i;
+		e = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &evt);
+		assert(!e);
+		fds.push_back(fd);
+	}
+
+	std::vector<epoll_event> events(numFds);
+	timespec start, end;
+
+	// All FDs are idle.
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pending = epoll_wait(epfd, events.data(), numFds, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	assert(!pending);
+	std::cout << "posix-tests: epoll_wait() on " << numFds << " idle FDs took "
+			<< elapsedMicros(start, end) << " us" << std::endl;
+
+	// A single FD becomes ready.
+	uint64_t n = 1;
+	auto written = write(fds[numFds / 2], &n, sizeof(uint64_t));
+	assert(written == sizeof(uint64_t));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pending = epoll_wait(epfd, events.data(), numFds, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	assert(pending == 1);
+	assert(events[0].data.u32 == numFds / 2);
+	std::cout << "posix-tests: epoll_wait() with 1 of " << numFds << " FDs ready took "
+			<< elapsedMicros(start, end) << " us" << std::endl;
+
+	// All FDs become ready.
+	for(int i = 0; i < numFds; i++) {
+		written = write(fds[i], &n, sizeof(uint64_t));
+		assert(written == sizeof(uint64_t));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pending = epoll_wait(epfd, events.data(), numFds, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	assert(pending == numFds);
+	std::cout << "posix-tests: epoll_wait() with " << numFds << " FDs ready took "
+			<< elapsedMicros(start, end) << " us" << std::endl;
+
+	for(int fd : fds)
+		close(fd);
+	close(epfd);
+}))
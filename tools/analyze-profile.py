@@ -12,80 +12,166 @@ parser.add_argument('--aggregate-by',
 	help="aggregate samples by source line of code or by symbol inside the binary")
 parser.add_argument('--line', action='store_true')
 parser.add_argument('--isn', action='store_true')
+parser.add_argument('--kernel-binary', type=str,
+	default='pkg-builds/managarm-kernel/kernel/thor/thor')
+parser.add_argument('--user-binary', type=str, action='append', default=[],
+	help="symbolize user samples against BINARY[@BASE]; PIE binaries default to BASE 0x200000")
+parser.add_argument('--folded', action='store_true',
+	help="print folded call stacks (suitable for flamegraph.pl) instead of a flat profile")
 
 args = parser.parse_args()
 
-profile = dict()
+class Binary:
+	def __init__(self, path, base):
+		self.path = path
+		self.base = base
 
-if args.aggregate_by == 'symbol':
-	nm = subprocess.check_output(
-		[
-			'nm', '-nC',
-			'pkg-builds/managarm-kernel/kernel/thor/thor'
-		],
-		encoding='ascii');
-
-	sym_table = []
-	for line in nm.splitlines():
-		start, attr, symbol = line.split(' ', 2)
-		sym_table.append((int(start, 16), symbol))
-	sym_index = [e[0] for e in sym_table]
-else:
-	addr2line = subprocess.Popen(
-		[
-			'addr2line', '-sfC',
-			'-e', 'pkg-builds/managarm-kernel/kernel/thor/thor'
-		],
-		encoding='ascii',
-		stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+		nm = subprocess.check_output(['nm', '-nC', '--defined-only', path],
+			encoding='ascii')
+		self.sym_table = []
+		for line in nm.splitlines():
+			parts = line.split(' ', 2)
+			if len(parts) != 3:
+				continue
+			start, attr, symbol = parts
+			if attr not in 'tTwW':
+				continue
+			self.sym_table.append((int(start, 16), symbol))
+		self.sym_index = [e[0] for e in self.sym_table]
 
-n_user = 0
-n_kernel = 0
-n_resolved = 0
+		self.addr2line = None
+
+	def contains(self, ip):
+		if not self.sym_index:
+			return False
+		return self.sym_index[0] <= ip - self.base <= self.sym_index[-1]
 
+	def symbolize(self, ip):
+		rel = ip - self.base
+		if args.aggregate_by == 'symbol':
+			idx = bisect.bisect_right(self.sym_index, rel)
+			if idx == 0:
+				return None
+			start, symbol = self.sym_table[idx - 1]
+			assert rel >= start
+			return symbol, 0
+
+		if self.addr2line is None:
+			self.addr2line = subprocess.Popen(
+				[
+					'addr2line', '-sfC',
+					'-e', self.path
+				],
+				encoding='ascii',
+				stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+		self.addr2line.stdin.write(hex(rel) + '\n')
+		self.addr2line.stdin.flush()
+		func = self.addr2line.stdout.readline().rstrip()
+		line = self.addr2line.stdout.readline().rstrip()
+		if args.line:
+			return (func, line)
+		elif args.isn:
+			return (func, line.split(':')[0] + ':' + hex(ip))
+		return (func, line.split(':')[0])
+
+def load_user_binary(spec):
+	path, _, base = spec.partition('@')
+	if base:
+		return Binary(path, int(base, 0))
+	# Position independent executables are loaded at a fixed address by posix.
+	with open(path, 'rb') as f:
+		e_type = struct.unpack('<H', f.read(18)[16:18])[0]
+	return Binary(path, 0x200000 if e_type == 3 else 0)
+
+kernel_binary = Binary(args.kernel_binary, 0)
+user_binaries = [load_user_binary(spec) for spec in args.user_binary]
+
+# Each record consists of a 16 byte header, followed by the kernel and then the user frames.
+samples = []
 with open(args.profile_path, 'rb') as f:
 	while True:
-		rec = f.read(8)
-		if not rec:
+		header = f.read(16)
+		if len(header) < 16:
 			break
-		ip = struct.unpack('Q', rec)[0]
-		if ip < (1 << 63):
-			n_user += 1
+		n_kernel_frames, n_user_frames, cpu, thread = struct.unpack('<HHIQ', header)
+		n_frames = n_kernel_frames + n_user_frames
+		frames = struct.unpack('<{}Q'.format(n_frames), f.read(8 * n_frames))
+		samples.append((thread, frames[:n_kernel_frames], frames[n_kernel_frames:]))
+
+# Multiple PIEs share the same load address, hence we cannot tell from an IP alone
+# which binary it belongs to. Pick the binary that covers the most IPs of each thread.
+thread_binary = dict()
+if user_binaries:
+	scores = dict()
+	for thread, kernel_frames, user_frames in samples:
+		for ip in user_frames:
+			for binary in user_binaries:
+				if binary.contains(ip):
+					key = (thread, binary.path)
+					scores[key] = scores.get(key, 0) + 1
+	for (thread, path), score in scores.items():
+		best = thread_binary.get(thread)
+		if best is None or scores[(thread, best.path)] < score:
+			thread_binary[thread] = next(b for b in user_binaries if b.path == path)
+
+def resolve(thread, ip):
+	if ip >= (1 << 63):
+		return kernel_binary.symbolize(ip)
+	binary = thread_binary.get(thread)
+	if binary is None or not binary.contains(ip):
+		return None
+	return binary.symbolize(ip)
+
+def describe(thread, ip):
+	loc = resolve(thread, ip)
+	if loc is None:
+		return hex(ip)
+	return loc[0]
+
+if args.folded:
+	stacks = dict()
+	for thread, kernel_frames, user_frames in samples:
+		# Folded stacks are ordered from the outermost to the innermost frame.
+		names = [describe(thread, ip) for ip in reversed(user_frames)]
+		names += [describe(thread, ip) for ip in reversed(kernel_frames)]
+		stack = ';'.join(name.replace(';', ':') for name in names)
+		stacks[stack] = stacks.get(stack, 0) + 1
+	for stack in sorted(stacks):
+		print("{} {}".format(stack, stacks[stack]))
+	raise SystemExit(0)
+
+profile = dict()
+
+n_user = 0
+n_kernel = 0
+n_resolved = 0
+
+for thread, kernel_frames, user_frames in samples:
+	if kernel_frames:
+		n_kernel += 1
+		leaf = kernel_frames[0]
+	else:
+		n_user += 1
+		if not user_binaries:
 			continue
-		else:
-			n_kernel += 1
+		leaf = user_frames[0]
 
-		if args.aggregate_by == 'symbol':
-			idx = bisect.bisect_left(sym_index, ip)
-			if idx == 0:
-				continue
-			start, symbol = sym_table[idx - 1];
-			assert ip >= start
-
-			loc = symbol, 0
-		else:
-			addr2line.stdin.write(hex(ip) + '\n')
-			addr2line.stdin.flush()
-			func = addr2line.stdout.readline().rstrip()
-			line = addr2line.stdout.readline().rstrip()
-			if args.line:
-				loc = (func, line)
-			elif args.isn:
-				loc = (func, line.split(':')[0] + ':' + hex(ip))
-			else:
-				loc = (func, line.split(':')[0])
-
-		if loc in profile:
-			profile[loc] += 1
-		else:
-			profile[loc] = 1
-		n_resolved += 1
+	loc = resolve(thread, leaf)
+	if loc is None:
+		continue
+
+	if loc in profile:
+		profile[loc] += 1
+	else:
+		profile[loc] = 1
+	n_resolved += 1
 
 n_all = n_user + n_kernel
+n_considered = n_all if user_binaries else n_kernel
 
 out = sorted(profile.keys(), key=lambda loc: profile[loc])
 for loc in out:
-	print("{:.2f}% ({} samples) in:".format(profile[loc]/n_kernel*100, profile[loc]))
+	print("{:.2f}% ({} samples) in:".format(profile[loc]/n_considered*100, profile[loc]))
 	print("    {} in {}".format(loc[0], loc[1]))
-print("{} (= {:.2f}% of all samples) in the kernel".format(n_kernel, n_kernel/(n_user + n_kernel)*100))
-print("{:.2f}% of all kernel samples could be resolved".format(n_resolved/n_kernel*100))
+print("{} (= {:.2f}% of all samples) in the kernel".format(n_kernel, n_kernel/n_all*100))
+print("{:.2f}% of all considered samples could be resolved".format(n_resolved/n_considered*100))
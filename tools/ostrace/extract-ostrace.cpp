@@ -3,6 +3,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
 
 #include <bragi/helpers-std.hpp>
@@ -64,8 +65,8 @@ int main(int argc, char **argv) {
 	uint64_t filteredEventId = 0;
 	uint64_t desiredItemId = 0;
 
-	std::vector<uint64_t> ts;
-	std::vector<uint64_t> value;
+	// Pairs of timestamps and values of matching records.
+	std::vector<std::pair<uint64_t, uint64_t>> matches;
 
 	auto extractRecord = [&] () -> bool {
 		auto preamble = bragi::read_preamble(buffer);
@@ -90,13 +91,12 @@ int main(int argc, char **argv) {
 
 			if(record.id() == filteredEventId) {
 				if(mode == ExtractMode::eventOnly) {
-					ts.push_back(record.ts());
+					matches.push_back({record.ts(), 0});
 				}else if(mode == ExtractMode::specificItem) {
 					for(size_t i = 0; i < record.ctrs_size(); ++i) {
 						if(record.ctrs(i).id() != desiredItemId)
 							continue;
-						ts.push_back(record.ts());
-						value.push_back(record.ctrs(i).value());
+						matches.push_back({record.ts(), record.ctrs(i).value()});
 					}
 				}
 			}
@@ -135,21 +135,27 @@ int main(int argc, char **argv) {
 		++nRecords;
 	}
 
+	// Records are emitted to per-CPU and per-thread rings that are only merged
+	// periodically. Hence, the log is not sorted by timestamp.
+	std::stable_sort(matches.begin(), matches.end(), [] (const auto &a, const auto &b) {
+		return a.first < b.first;
+	});
+
 	std::cout << "{\n";
 	std::cout << "\"ts\": [";
-	for(size_t i = 0; i < ts.size(); ++i)
-		std::cout << (i ? ", " : "") << ts[i];
+	for(size_t i = 0; i < matches.size(); ++i)
+		std::cout << (i ? ", " : "") << matches[i].first;
 	std::cout << "]\n";
 	if(mode == ExtractMode::specificItem) {
 		std::cout << ",\n";
 		std::cout << "\"value\": [";
-		for(size_t i = 0; i < value.size(); ++i)
-			std::cout << (i ? ", " : "") << value[i];
+		for(size_t i = 0; i < matches.size(); ++i)
+			std::cout << (i ? ", " : "") << matches[i].second;
 		std::cout << "]\n";
 	}
 	std::cout << "}" << std::endl;
 
 	std::cerr << "extracted " << nRecords << " records"
 			<< " (" << buffer.size() << " bytes remain)" << std::endl;
-	std::cerr << "found " << ts.size() << " matches" << std::endl;
+	std::cerr << "found " << matches.size() << " matches" << std::endl;
 }